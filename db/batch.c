@@ -0,0 +1,539 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <xfs/libxfs.h>
+#include "batch.h"
+#include "command.h"
+#include "type.h"
+#include "fprint.h"
+#include "faddr.h"
+#include "field.h"
+#include "inode.h"
+#include "input.h"
+#include "init.h"
+#include "io.h"
+#include "malloc.h"
+#include "output.h"
+#include "prefetch.h"
+#include "sig.h"
+
+/*
+ * Run a script of commands in an order that suits the disk rather than
+ * the order it was written in.
+ *
+ * The whole script is parsed and every command looked up once, up front.
+ * It is then cut into units, each starting with a command that moves to
+ * an absolute address ("inode 123", "fsblock 456", "agf 2"...) followed
+ * by commands that only look at or move relative to where that left us
+ * ("print core.size", "dblock 0"...).  Such units don't depend on one
+ * another, so a window of them is read ahead in disk order and run in
+ * disk order, letting neighbouring inodes share the cluster buffer
+ * already in the cache, with their output held back and printed in the
+ * order of the script.  Anything else (write, push, ring...) runs in
+ * place, between windows, just as it would have from "source".
+ */
+
+#define BATCH_WINDOW	4096	/* units run out of order at most */
+#define BATCH_RA_MAX	2048	/* longest readahead, in BBs */
+
+typedef struct bcmd {
+	const cmdinfo_t	*ct;		/* NULL if there's no such command */
+	char		*line;
+	char		**argv;
+	int		argc;
+} bcmd_t;
+
+typedef struct bunit {
+	xfs_daddr_t	daddr;		/* what the first command reads */
+	int		len;		/* in BBs, zero if it can't be moved */
+	int		first;		/* index of its first command */
+	int		ncmds;
+	int		setsino;	/* starts with an inode command */
+	int		setsagno;	/* ... or anything else choosing an AG */
+	long		outoff;		/* where its output was captured */
+	long		outlen;
+	xfs_ino_t	ino;		/* and the position it left behind */
+	xfs_ino_t	dirino;
+	__uint16_t	mode;
+	xfs_agnumber_t	agno;
+	iocur_t		*ring;		/* position ring entries it made */
+	int		nring;
+} bunit_t;
+
+static int	batch_f(int argc, char **argv);
+static void	batch_help(void);
+
+static const cmdinfo_t	batch_cmd =
+	{ "batch", NULL, batch_f, 1, 3, 0, N_("[-w window] script-file"),
+	  N_("run a script of commands in disk order"), batch_help };
+
+/* commands that go to an absolute address, given an argument */
+static const char	*batch_anchors[] = {
+	"agf", "agfl", "agi", "daddr", "fsblock", "inode", "sb", NULL
+};
+
+/* commands that only depend on the position left by the one before */
+static const char	*batch_followers[] = {
+	"convert", "echo", "hash", "print", "type", NULL
+};
+
+/* ... and those that also need it to have been an inode */
+static const char	*batch_inode_followers[] = {
+	"ablock", "bmap", "dblock", NULL
+};
+
+static void
+batch_help(void)
+{
+	dbprintf(_(
+"\n"
+" The 'batch' command runs the commands in script-file, like 'source', but\n"
+" reads and runs them in disk order rather than in the order they are\n"
+" written in, while printing their output in script order.  A command\n"
+" going to an absolute address (inode, fsblock, daddr, sb, agf, agi and\n"
+" agfl with an argument), together with the print, type, echo, hash and\n"
+" convert commands following it (and ablock, dblock and bmap following\n"
+" an inode), can be moved; any other command runs in its place in the\n"
+" script.\n"
+"\n"
+" Options:\n"
+"   -w -- move commands at most this many units apart (default 4096)\n"
+"\n"));
+}
+
+static int
+batch_listed(
+	const cmdinfo_t	*ct,
+	const char	**names)
+{
+	if (!ct)
+		return 0;
+	for (; *names; names++)
+		if (strcmp(ct->name, *names) == 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * Work out where an absolute move will read, without doing it.  Returns
+ * zero if it can't be told (no or a bad argument), in which case the
+ * command must run in place so that it complains in the right order.
+ */
+static int
+batch_anchor(
+	bcmd_t			*bc,
+	xfs_daddr_t		*daddr)
+{
+	const char		*name = bc->ct->name;
+	unsigned long long	n;
+	xfs_agnumber_t		agno;
+	xfs_agblock_t		agbno;
+	int			offset;
+	int			len;
+	char			*p;
+
+	if (bc->argc != 2)
+		return 0;
+	n = strtoull(bc->argv[1], &p, 0);
+	if (*p != '\0')
+		return 0;
+
+	if (strcmp(name, "inode") == 0) {
+		if (inode_cluster(n, daddr, &len, &offset))
+			return 0;
+		return len;
+	}
+	if (strcmp(name, "fsblock") == 0) {
+		agno = XFS_FSB_TO_AGNO(mp, n);
+		agbno = XFS_FSB_TO_AGBNO(mp, n);
+		if (agno >= mp->m_sb.sb_agcount ||
+		    agbno >= mp->m_sb.sb_agblocks)
+			return 0;
+		*daddr = XFS_AGB_TO_DADDR(mp, agno, agbno);
+		return blkbb;
+	}
+	if (strcmp(name, "daddr") == 0) {
+		if (n >= mp->m_sb.sb_dblocks <<
+				(mp->m_sb.sb_blocklog - BBSHIFT))
+			return 0;
+		*daddr = n;
+		return 1;
+	}
+
+	/* the per-AG headers */
+	if (n >= mp->m_sb.sb_agcount)
+		return 0;
+	if (strcmp(name, "sb") == 0)
+		*daddr = XFS_AG_DADDR(mp, n, XFS_SB_DADDR);
+	else if (strcmp(name, "agf") == 0)
+		*daddr = XFS_AG_DADDR(mp, n, XFS_AGF_DADDR(mp));
+	else if (strcmp(name, "agi") == 0)
+		*daddr = XFS_AG_DADDR(mp, n, XFS_AGI_DADDR(mp));
+	else
+		*daddr = XFS_AG_DADDR(mp, n, XFS_AGFL_DADDR(mp));
+	return XFS_FSS_TO_BB(mp, 1);
+}
+
+/*
+ * Read in and parse the whole script.
+ */
+static bcmd_t *
+batch_read(
+	FILE		*f,
+	int		*ncmdsp)
+{
+	bcmd_t		*cmds = NULL;
+	bcmd_t		*bc;
+	int		ncmds = 0;
+	int		maxcmds = 0;
+	char		buf[1024];
+	char		*line = NULL;
+	size_t		llen = 0;
+	size_t		len;
+
+	while (fgets(buf, sizeof(buf), f)) {
+		len = strlen(buf);
+		line = xrealloc(line, llen + len + 1);
+		memcpy(line + llen, buf, len + 1);
+		llen += len;
+		if (len && buf[len - 1] != '\n' && !feof(f))
+			continue;	/* longer than buf */
+		if (llen && line[llen - 1] == '\n')
+			line[--llen] = '\0';
+
+		if (ncmds == maxcmds) {
+			maxcmds = maxcmds ? maxcmds * 2 : 1024;
+			cmds = xrealloc(cmds, maxcmds * sizeof(*cmds));
+		}
+		bc = &cmds[ncmds];
+		bc->line = line;
+		bc->argv = breakline(line, &bc->argc);
+		line = NULL;
+		llen = 0;
+		if (!bc->argc) {
+			doneline(bc->line, bc->argv);
+			continue;
+		}
+		bc->ct = find_command(bc->argv[0]);
+		ncmds++;
+	}
+	xfree(line);
+	*ncmdsp = ncmds;
+	return cmds;
+}
+
+/*
+ * Cut the script into units.  A unit that can't be moved has len zero.
+ */
+static bunit_t *
+batch_plan(
+	bcmd_t		*cmds,
+	int		ncmds,
+	int		*nunitsp)
+{
+	bunit_t		*units = NULL;
+	bunit_t		*bu = NULL;
+	int		nunits = 0;
+	int		maxunits = 0;
+	xfs_daddr_t	daddr;
+	int		len;
+	int		i;
+
+	for (i = 0; i < ncmds; i++) {
+		len = 0;
+		if (batch_listed(cmds[i].ct, batch_anchors))
+			len = batch_anchor(&cmds[i], &daddr);
+		else if (bu && (batch_listed(cmds[i].ct, batch_followers) ||
+				(batch_listed(cmds[i].ct, batch_inode_followers) &&
+				 (bu->setsino || !bu->len)))) {
+			bu->ncmds++;
+			continue;
+		}
+		if (nunits == maxunits) {
+			maxunits = maxunits ? maxunits * 2 : 1024;
+			units = xrealloc(units, maxunits * sizeof(*units));
+		}
+		bu = &units[nunits++];
+		bu->daddr = len ? daddr : 0;
+		bu->len = len;
+		bu->first = i;
+		bu->ncmds = 1;
+		bu->ring = NULL;
+		bu->nring = 0;
+		bu->setsino = len && strcmp(cmds[i].ct->name, "inode") == 0;
+		bu->setsagno = len && strcmp(cmds[i].ct->name, "fsblock") != 0 &&
+				strcmp(cmds[i].ct->name, "daddr") != 0;
+	}
+	*nunitsp = nunits;
+	return units;
+}
+
+static int
+batch_run_unit(
+	bcmd_t		*cmds,
+	bunit_t		*bu)
+{
+	bcmd_t		*bc;
+	int		done = 0;
+
+	for (bc = &cmds[bu->first];
+	     !done && bc < &cmds[bu->first + bu->ncmds] && !seenint();
+	     bc++) {
+		if (!bc->ct) {
+			dbprintf(_("command %s not found\n"), bc->argv[0]);
+			continue;
+		}
+		done = run_command(bc->ct, bc->argc, bc->argv);
+	}
+	return done;
+}
+
+static bunit_t	*sort_units;
+
+static int
+batch_unit_cmp(
+	const void	*a,
+	const void	*b)
+{
+	const bunit_t	*ua = &sort_units[*(const int *)a];
+	const bunit_t	*ub = &sort_units[*(const int *)b];
+
+	if (ua->daddr != ub->daddr)
+		return ua->daddr < ub->daddr ? -1 : 1;
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * Hold on to the position ring entries of a unit run out of order.
+ */
+static void
+batch_ring_hold(
+	iocur_t		*ioc,
+	void		*arg)
+{
+	bunit_t		*bu = arg;
+
+	bu->ring = xrealloc(bu->ring, (bu->nring + 1) * sizeof(*bu->ring));
+	bu->ring[bu->nring++] = *ioc;
+}
+
+/*
+ * Moving to a new address keeps the current inode, so put back the
+ * inode and AG the units before the last one would have left, had they
+ * run in script order, before running that.  Their ring entries go in
+ * now too, in script order and carrying the inode each would have had.
+ */
+static void
+batch_restore(
+	bunit_t		*before,
+	bunit_t		*units,
+	int		nunits)
+{
+	xfs_ino_t	ino = before->ino;
+	xfs_ino_t	dirino = before->dirino;
+	__uint16_t	mode = before->mode;
+	xfs_agnumber_t	agno = before->agno;
+	bunit_t		*bu;
+	iocur_t		*ioc;
+
+	for (bu = units; bu < &units[nunits]; bu++) {
+		for (ioc = bu->ring; ioc < &bu->ring[bu->nring]; ioc++) {
+			if (!bu->setsino) {
+				ioc->ino = ino;
+				ioc->mode = mode;
+				ioc->dirino = dirino;
+			} else if ((bu->mode & S_IFMT) != S_IFDIR)
+				ioc->dirino = dirino;
+			ring_add_entry(ioc);
+		}
+		xfree(bu->ring);
+		bu->ring = NULL;
+		bu->nring = 0;
+		if (bu->setsino) {
+			ino = bu->ino;
+			mode = bu->mode;
+			if ((mode & S_IFMT) == S_IFDIR)
+				dirino = bu->dirino;
+		}
+		if (bu->setsagno)
+			agno = bu->agno;
+	}
+	iocur_top->ino = ino;
+	iocur_top->dirino = dirino;
+	iocur_top->mode = mode;
+	cur_agno = agno;
+}
+
+/*
+ * Read ahead everything a window of units is going to read, in disk
+ * order and merging neighbours, then run them in that order too.  The
+ * last unit still runs last, from the position the others would have
+ * left it, so that what follows the window sees what it would have.
+ */
+static void
+batch_run_window(
+	bcmd_t		*cmds,
+	bunit_t		*units,
+	int		nunits)
+{
+	xfs_daddr_t	start, end;
+	bunit_t		before;
+	bunit_t		*bu;
+	int		*order;
+	FILE		*out;
+	char		*buf = NULL;
+	size_t		buflen = 0;
+	int		i;
+
+	if (nunits == 1) {
+		batch_run_unit(cmds, units);
+		return;
+	}
+
+	order = xmalloc(nunits * sizeof(*order));
+	for (i = 0; i < nunits; i++)
+		order[i] = i;
+	sort_units = units;
+	qsort(order, nunits, sizeof(*order), batch_unit_cmp);
+
+	start = end = 0;
+	for (i = 0; i < nunits; i++) {
+		bu = &units[order[i]];
+		if (end && bu->daddr <= end &&
+		    bu->daddr + bu->len - start <= BATCH_RA_MAX) {
+			if (bu->daddr + bu->len > end)
+				end = bu->daddr + bu->len;
+			continue;
+		}
+		if (end)
+			readahead_blocks(start, end - start);
+		start = bu->daddr;
+		end = bu->daddr + bu->len;
+	}
+	readahead_blocks(start, end - start);
+
+	out = open_memstream(&buf, &buflen);
+	if (!out) {
+		for (i = 0; i < nunits; i++)
+			batch_run_unit(cmds, &units[i]);
+		xfree(order);
+		return;
+	}
+	before.ino = iocur_top->ino;
+	before.dirino = iocur_top->dirino;
+	before.mode = iocur_top->mode;
+	before.agno = cur_agno;
+	dbprintf_capture(out);
+	for (i = 0; i < nunits && !seenint(); i++) {
+		if (order[i] == nunits - 1)
+			continue;
+		bu = &units[order[i]];
+		bu->outoff = ftell(out);
+		ring_divert(batch_ring_hold, bu);
+		batch_run_unit(cmds, bu);
+		ring_divert(NULL, NULL);
+		bu->outlen = ftell(out) - bu->outoff;
+		bu->ino = iocur_top->ino;
+		bu->dirino = iocur_top->dirino;
+		bu->mode = iocur_top->mode;
+		bu->agno = cur_agno;
+	}
+	bu = &units[nunits - 1];
+	bu->outoff = ftell(out);
+	if (!seenint()) {
+		batch_restore(&before, units, nunits - 1);
+		batch_run_unit(cmds, bu);
+	} else
+		for (i = 0; i < nunits - 1; i++)
+			xfree(units[i].ring);
+	bu->outlen = ftell(out) - bu->outoff;
+	dbprintf_capture(NULL);
+	fclose(out);
+
+	for (i = 0; i < nunits && !seenint(); i++)
+		if (units[i].outlen)
+			dbprintf_lines(buf + units[i].outoff, units[i].outlen);
+	free(buf);
+	xfree(order);
+}
+
+static int
+batch_f(
+	int		argc,
+	char		**argv)
+{
+	bcmd_t		*cmds;
+	bunit_t		*units;
+	FILE		*f;
+	int		ncmds, nunits;
+	int		window = BATCH_WINDOW;
+	int		done = 0;
+	int		c, i, j;
+	char		*p;
+
+	while ((c = getopt(argc, argv, "w:")) != EOF) {
+		switch (c) {
+		case 'w':
+			window = (int)strtol(optarg, &p, 0);
+			if (*p != '\0' || window <= 0) {
+				dbprintf(_("bad window size %s\n"), optarg);
+				return 0;
+			}
+			break;
+		default:
+			dbprintf(_("bad option for batch command\n"));
+			return 0;
+		}
+	}
+	if (optind != argc - 1) {
+		dbprintf(_("batch needs a script file\n"));
+		return 0;
+	}
+	f = fopen(argv[optind], "r");
+	if (f == NULL) {
+		dbprintf(_("can't open %s\n"), argv[optind]);
+		return 0;
+	}
+	cmds = batch_read(f, &ncmds);
+	fclose(f);
+	units = batch_plan(cmds, ncmds, &nunits);
+
+	for (i = 0; !done && i < nunits && !seenint(); i = j) {
+		if (!units[i].len) {
+			done = batch_run_unit(cmds, &units[i]);
+			j = i + 1;
+			continue;
+		}
+		for (j = i + 1; j < nunits && j - i < window; j++)
+			if (!units[j].len)
+				break;
+		batch_run_window(cmds, &units[i], j - i);
+	}
+
+	for (i = 0; i < ncmds; i++)
+		doneline(cmds[i].line, cmds[i].argv);
+	xfree(cmds);
+	xfree(units);
+	return done;
+}
+
+void
+batch_init(void)
+{
+	add_command(&batch_cmd);
+}
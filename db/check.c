@@ -32,6 +32,8 @@
 #include "init.h"
 #include "malloc.h"
 #include "dir2.h"
+#include "prefetch.h"
+#include "rlemap.h"
 
 typedef enum {
 	IS_USER_QUOTA, IS_PROJECT_QUOTA, IS_GROUP_QUOTA,
@@ -50,19 +52,34 @@ typedef enum {
 
 typedef struct inodata {
 	struct inodata	*next;
-	nlink_t		link_set;
-	nlink_t		link_add;
+	struct inodata	*parent;
+	char		*name;
+	xfs_ino_t	ino;
+	__uint32_t	link_set;
+	__uint32_t	link_add;
 	char		isdir;
 	char		security;
 	char		ilist;
-	xfs_ino_t	ino;
-	struct inodata	*parent;
-	char		*name;
 } inodata_t;
 #define	MIN_INODATA_HASH_SIZE	256
 #define	MAX_INODATA_HASH_SIZE	65536
 #define	INODATA_AVG_HASH_LENGTH	8
 
+/*
+ * inodata_t records and the names hung off them are only ever freed all
+ * at once, so they are carved out of big arena blocks.
+ */
+#define	ARENA_BLOCK_SIZE	(1024 * 1024)
+typedef struct arena_blk {
+	struct arena_blk	*next;
+} arena_blk_t;
+
+typedef struct arena {
+	arena_blk_t	*blks;
+	char		*free;
+	size_t		left;
+} arena_t;
+
 typedef struct qinfo {
 	xfs_qcnt_t	bc;
 	xfs_qcnt_t	ic;
@@ -119,7 +136,7 @@ static xfs_agino_t	agicount;
 static xfs_agino_t	agifreecount;
 static xfs_fsblock_t	*blist;
 static int		blist_size;
-static char		**dbmap;	/* really dbm_t:8 */
+static rlemap_t		**dbmap;	/* dbm_t per block */
 static dirhash_t	**dirhash;
 static int		error;
 static __uint64_t	fdblocks;
@@ -127,9 +144,12 @@ static __uint64_t	frextents;
 static __uint64_t	icount;
 static __uint64_t	ifree;
 static inodata_t	***inodata;
+static arena_t		inodata_arena;
 static int		inodata_hash_size;
-static inodata_t	***inomap;
+static rlemap_t		**inomap;	/* inodata_t * per block */
+static arena_t		name_arena;
 static int		nflag;
+static int		nthreads;
 static int		pflag;
 static int		tflag;
 static qdata_t		**qpdata;
@@ -201,6 +221,9 @@ static void		add_ilist(xfs_ino_t ino);
 static void		addlink_inode(inodata_t *id);
 static void		addname_inode(inodata_t *id, char *name, int namelen);
 static void		addparent_inode(inodata_t *id, xfs_ino_t parent);
+static void		*arena_alloc(arena_t *arena, size_t size,
+				     size_t align);
+static void		arena_free(arena_t *arena);
 static void		blkent_append(blkent_t **entp, xfs_fsblock_t b,
 				      xfs_extlen_t c);
 static blkent_t		*blkent_new(xfs_fileoff_t o, xfs_fsblock_t b,
@@ -362,7 +385,7 @@ static const cmdinfo_t	blockfree_cmd =
 	  NULL, N_("free block usage information"), NULL };
 static const cmdinfo_t	blockget_cmd =
 	{ "blockget", "check", blockget_f, 0, -1, 0,
-	  N_("[-s|-v] [-n] [-t] [-b bno]... [-i ino] ..."),
+	  N_("[-s|-v] [-n] [-t] [-j threads] [-b bno]... [-i ino] ..."),
 	  N_("get block usage and check consistency"), NULL };
 static const cmdinfo_t	blocktrash_cmd =
 	{ "blocktrash", NULL, blocktrash_f, 0, -1, 0,
@@ -419,7 +442,7 @@ addname_inode(
 {
 	if (!nflag || id->name)
 		return;
-	id->name = xmalloc(namelen + 1);
+	id->name = arena_alloc(&name_arena, namelen + 1, 1);
 	memcpy(id->name, name, namelen);
 	id->name[namelen] = '\0';
 }
@@ -437,6 +460,47 @@ addparent_inode(
 		dbprintf(_("inode %lld parent %lld\n"), id->ino, parent);
 }
 
+static void *
+arena_alloc(
+	arena_t		*arena,
+	size_t		size,
+	size_t		align)
+{
+	arena_blk_t	*blk;
+	size_t		pad;
+	void		*p;
+
+	pad = (align - ((unsigned long)arena->free & (align - 1))) &
+		(align - 1);
+	if (arena->left < size + pad) {
+		blk = xmalloc(MAX(ARENA_BLOCK_SIZE, sizeof(*blk) + size));
+		blk->next = arena->blks;
+		arena->blks = blk;
+		arena->free = (char *)(blk + 1);
+		arena->left = MAX(ARENA_BLOCK_SIZE, sizeof(*blk) + size) -
+			sizeof(*blk);
+		pad = 0;
+	}
+	p = arena->free + pad;
+	arena->free += size + pad;
+	arena->left -= size + pad;
+	return p;
+}
+
+static void
+arena_free(
+	arena_t		*arena)
+{
+	arena_blk_t	*blk;
+
+	while ((blk = arena->blks)) {
+		arena->blks = blk->next;
+		xfree(blk);
+	}
+	arena->free = NULL;
+	arena->left = 0;
+}
+
 static void
 blkent_append(
 	blkent_t	**entp,
@@ -752,13 +816,15 @@ blockfree_f(
 	}
 	rt = mp->m_sb.sb_rextents != 0;
 	for (c = 0; c < mp->m_sb.sb_agcount; c++) {
-		xfree(dbmap[c]);
-		xfree(inomap[c]);
+		rlemap_free(dbmap[c]);
+		rlemap_free(inomap[c]);
 		free_inodata(c);
 	}
+	arena_free(&inodata_arena);
+	arena_free(&name_arena);
 	if (rt) {
-		xfree(dbmap[c]);
-		xfree(inomap[c]);
+		rlemap_free(dbmap[c]);
+		rlemap_free(inomap[c]);
 		xfree(sumcompute);
 		xfree(sumfile);
 		sumcompute = sumfile = NULL;
@@ -811,14 +877,17 @@ blockget_f(
 	}
 	oldprefix = dbprefix;
 	dbprefix |= pflag;
+	prefetch_start(PF_FREESP | PF_INODES | PF_BMAP | PF_DIRS, nthreads);
 	for (agno = 0, sbyell = 0; agno < mp->m_sb.sb_agcount; agno++) {
 		scan_ag(agno);
+		prefetch_ag_done(agno);
 		if (sbver_err > 4 && !sbyell && sbver_err >= agno) {
 			sbyell = 1;
 			dbprintf(_("WARNING: this may be a newer XFS "
 				 "filesystem.\n"));
 		}
 	}
+	prefetch_stop();
 	if (blist_size) {
 		xfree(blist);
 		blist = NULL;
@@ -1016,8 +1085,10 @@ blocktrash_f(
 	int		max;
 	int		min;
 	int		mode;
+	__uint64_t	n;
 	struct timeval	now;
 	char		*p;
+	dbm_t		t;
 	xfs_drfsbno_t	randb;
 	uint		seed;
 	int		sopt;
@@ -1127,11 +1198,10 @@ blocktrash_f(
 			lentab[lentablen - 1].max = i;
 	}
 	for (blocks = 0, agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
-		for (agbno = 0, p = dbmap[agno];
-		     agbno < mp->m_sb.sb_agblocks;
-		     agbno++, p++) {
-			if ((1 << *p) & tmask)
-				blocks++;
+		for (agbno = 0; agbno < mp->m_sb.sb_agblocks; agbno += n) {
+			t = (dbm_t)rlemap_get(dbmap[agno], agbno, &n);
+			if ((1 << t) & tmask)
+				blocks += n;
 		}
 	}
 	if (blocks == 0) {
@@ -1147,14 +1217,17 @@ blocktrash_f(
 		for (bi = 0, agno = 0, done = 0;
 		     !done && agno < mp->m_sb.sb_agcount;
 		     agno++) {
-			for (agbno = 0, p = dbmap[agno];
+			for (agbno = 0;
 			     agbno < mp->m_sb.sb_agblocks;
-			     agbno++, p++) {
-				if (!((1 << *p) & tmask))
+			     agbno += n) {
+				t = (dbm_t)rlemap_get(dbmap[agno], agbno, &n);
+				if (!((1 << t) & tmask))
 					continue;
-				if (bi++ < randb)
+				if (bi + n <= randb) {
+					bi += n;
 					continue;
-				blocktrash_b(agno, agbno, (dbm_t)*p,
+				}
+				blocktrash_b(agno, agbno + (randb - bi), t,
 					&lentab[random() % lentablen], mode);
 				done = 1;
 				break;
@@ -1214,11 +1287,12 @@ blockuse_f(
 		}
 	}
 	while (agbno <= end) {
-		p = &dbmap[agno][agbno];
-		i = inomap[agno][agbno];
+		i = (inodata_t *)(unsigned long)
+			rlemap_get(inomap[agno], agbno, NULL);
 		dbprintf(_("block %llu (%u/%u) type %s"),
 			(xfs_dfsbno_t)XFS_AGB_TO_FSB(mp, agno, agbno),
-			agno, agbno, typename[(dbm_t)*p]);
+			agno, agbno,
+			typename[rlemap_get(dbmap[agno], agbno, NULL)]);
 		if (i) {
 			dbprintf(_(" inode %lld"), i->ino);
 			if (shownames && (p = inode_name(i->ino, NULL))) {
@@ -1253,17 +1327,19 @@ check_dbmap(
 	dbm_t		type)
 {
 	xfs_extlen_t	i;
-	char		*p;
+	__uint64_t	n;
+	dbm_t		t;
 
-	for (i = 0, p = &dbmap[agno][agbno]; i < len; i++, p++) {
-		if ((dbm_t)*p != type) {
-			if (!sflag || CHECK_BLISTA(agno, agbno + i))
-				dbprintf(_("block %u/%u expected type %s got "
-					 "%s\n"),
-					agno, agbno + i, typename[type],
-					typename[(dbm_t)*p]);
-			error++;
+	for (i = 0; i < len; i++) {
+		t = (dbm_t)rlemap_get(dbmap[agno], agbno + i, &n);
+		if (t == type) {
+			i += MIN(n, len - i) - 1;
+			continue;
 		}
+		if (!sflag || CHECK_BLISTA(agno, agbno + i))
+			dbprintf(_("block %u/%u expected type %s got %s\n"),
+				agno, agbno + i, typename[type], typename[t]);
+		error++;
 	}
 }
 
@@ -1286,7 +1362,8 @@ check_inomap(
 	xfs_ino_t	c_ino)
 {
 	xfs_extlen_t	i;
-	inodata_t	**idp;
+	inodata_t	*id;
+	__uint64_t	n;
 	int		rval;
 
 	if (!check_range(agno, agbno, len))  {
@@ -1294,16 +1371,19 @@ check_inomap(
 			agno, agbno, agbno + len - 1, c_ino);
 		return 0;
 	}
-	for (i = 0, rval = 1, idp = &inomap[agno][agbno]; i < len; i++, idp++) {
-		if (*idp) {
-			if (!sflag || (*idp)->ilist ||
-			    CHECK_BLISTA(agno, agbno + i))
-				dbprintf(_("block %u/%u claimed by inode %lld, "
-					 "previous inum %lld\n"),
-					agno, agbno + i, c_ino, (*idp)->ino);
-			error++;
-			rval = 0;
+	for (i = 0, rval = 1; i < len; i++) {
+		id = (inodata_t *)(unsigned long)
+			rlemap_get(inomap[agno], agbno + i, &n);
+		if (!id) {
+			i += MIN(n, len - i) - 1;
+			continue;
 		}
+		if (!sflag || id->ilist || CHECK_BLISTA(agno, agbno + i))
+			dbprintf(_("block %u/%u claimed by inode %lld, "
+				 "previous inum %lld\n"),
+				agno, agbno + i, c_ino, id->ino);
+		error++;
+		rval = 0;
 	}
 	return rval;
 }
@@ -1419,17 +1499,19 @@ check_rdbmap(
 	dbm_t		type)
 {
 	xfs_extlen_t	i;
-	char		*p;
+	__uint64_t	n;
+	dbm_t		t;
 
-	for (i = 0, p = &dbmap[mp->m_sb.sb_agcount][bno]; i < len; i++, p++) {
-		if ((dbm_t)*p != type) {
-			if (!sflag || CHECK_BLIST(bno + i))
-				dbprintf(_("rtblock %llu expected type %s got "
-					 "%s\n"),
-					bno + i, typename[type],
-					typename[(dbm_t)*p]);
-			error++;
+	for (i = 0; i < len; i++) {
+		t = (dbm_t)rlemap_get(dbmap[mp->m_sb.sb_agcount], bno + i, &n);
+		if (t == type) {
+			i += MIN(n, len - i) - 1;
+			continue;
 		}
+		if (!sflag || CHECK_BLIST(bno + i))
+			dbprintf(_("rtblock %llu expected type %s got %s\n"),
+				bno + i, typename[type], typename[t]);
+		error++;
 	}
 }
 
@@ -1440,7 +1522,8 @@ check_rinomap(
 	xfs_ino_t	c_ino)
 {
 	xfs_extlen_t	i;
-	inodata_t	**idp;
+	inodata_t	*id;
+	__uint64_t	n;
 	int		rval;
 
 	if (!check_rrange(bno, len)) {
@@ -1448,17 +1531,19 @@ check_rinomap(
 			bno, bno + len - 1, c_ino);
 		return 0;
 	}
-	for (i = 0, rval = 1, idp = &inomap[mp->m_sb.sb_agcount][bno];
-	     i < len;
-	     i++, idp++) {
-		if (*idp) {
-			if (!sflag || (*idp)->ilist || CHECK_BLIST(bno + i))
-				dbprintf(_("rtblock %llu claimed by inode %lld, "
-					 "previous inum %lld\n"),
-					bno + i, c_ino, (*idp)->ino);
-			error++;
-			rval = 0;
+	for (i = 0, rval = 1; i < len; i++) {
+		id = (inodata_t *)(unsigned long)
+			rlemap_get(inomap[mp->m_sb.sb_agcount], bno + i, &n);
+		if (!id) {
+			i += MIN(n, len - i) - 1;
+			continue;
 		}
+		if (!sflag || id->ilist || CHECK_BLIST(bno + i))
+			dbprintf(_("rtblock %llu claimed by inode %lld, "
+				 "previous inum %lld\n"),
+				bno + i, c_ino, id->ino);
+		error++;
+		rval = 0;
 	}
 	return rval;
 }
@@ -1513,7 +1598,6 @@ check_set_dbmap(
 {
 	xfs_extlen_t	i;
 	int		mayprint;
-	char		*p;
 
 	if (!check_range(agno, agbno, len))  {
 		dbprintf(_("blocks %u/%u..%u claimed by block %u/%u\n"), agno,
@@ -1521,10 +1605,10 @@ check_set_dbmap(
 		return;
 	}
 	check_dbmap(agno, agbno, len, type1);
+	rlemap_set(dbmap[agno], agbno, len, type2);
 	mayprint = verbose | blist_size;
-	for (i = 0, p = &dbmap[agno][agbno]; i < len; i++, p++) {
-		*p = (char)type2;
-		if (mayprint && (verbose || CHECK_BLISTA(agno, agbno + i)))
+	for (i = 0; mayprint && i < len; i++) {
+		if (verbose || CHECK_BLISTA(agno, agbno + i))
 			dbprintf(_("setting block %u/%u to %s\n"), agno, agbno + i,
 				typename[type2]);
 	}
@@ -1539,15 +1623,14 @@ check_set_rdbmap(
 {
 	xfs_extlen_t	i;
 	int		mayprint;
-	char		*p;
 
 	if (!check_rrange(bno, len))
 		return;
 	check_rdbmap(bno, len, type1);
+	rlemap_set(dbmap[mp->m_sb.sb_agcount], bno, len, type2);
 	mayprint = verbose | blist_size;
-	for (i = 0, p = &dbmap[mp->m_sb.sb_agcount][bno]; i < len; i++, p++) {
-		*p = (char)type2;
-		if (mayprint && (verbose || CHECK_BLIST(bno + i)))
+	for (i = 0; mayprint && i < len; i++) {
+		if (verbose || CHECK_BLIST(bno + i))
 			dbprintf(_("setting rtblock %llu to %s\n"),
 				bno + i, typename[type2]);
 	}
@@ -1587,17 +1670,21 @@ checknot_dbmap(
 	int		typemask)
 {
 	xfs_extlen_t	i;
-	char		*p;
+	__uint64_t	n;
+	dbm_t		t;
 
 	if (!check_range(agno, agbno, len))
 		return;
-	for (i = 0, p = &dbmap[agno][agbno]; i < len; i++, p++) {
-		if ((1 << *p) & typemask) {
-			if (!sflag || CHECK_BLISTA(agno, agbno + i))
-				dbprintf(_("block %u/%u type %s not expected\n"),
-					agno, agbno + i, typename[(dbm_t)*p]);
-			error++;
+	for (i = 0; i < len; i++) {
+		t = (dbm_t)rlemap_get(dbmap[agno], agbno + i, &n);
+		if (!((1 << t) & typemask)) {
+			i += MIN(n, len - i) - 1;
+			continue;
 		}
+		if (!sflag || CHECK_BLISTA(agno, agbno + i))
+			dbprintf(_("block %u/%u type %s not expected\n"),
+				agno, agbno + i, typename[t]);
+		error++;
 	}
 }
 
@@ -1608,17 +1695,21 @@ checknot_rdbmap(
 	int		typemask)
 {
 	xfs_extlen_t	i;
-	char		*p;
+	__uint64_t	n;
+	dbm_t		t;
 
 	if (!check_rrange(bno, len))
 		return;
-	for (i = 0, p = &dbmap[mp->m_sb.sb_agcount][bno]; i < len; i++, p++) {
-		if ((1 << *p) & typemask) {
-			if (!sflag || CHECK_BLIST(bno + i))
-				dbprintf(_("rtblock %llu type %s not expected\n"),
-					bno + i, typename[(dbm_t)*p]);
-			error++;
+	for (i = 0; i < len; i++) {
+		t = (dbm_t)rlemap_get(dbmap[mp->m_sb.sb_agcount], bno + i, &n);
+		if (!((1 << t) & typemask)) {
+			i += MIN(n, len - i) - 1;
+			continue;
 		}
+		if (!sflag || CHECK_BLIST(bno + i))
+			dbprintf(_("rtblock %llu type %s not expected\n"),
+				bno + i, typename[t]);
+		error++;
 	}
 }
 
@@ -1729,7 +1820,8 @@ find_inode(
 	}
 	if (!add)
 		return NULL;
-	ent = xcalloc(1, sizeof(*ent));
+	ent = arena_alloc(&inodata_arena, sizeof(*ent), sizeof(void *));
+	memset(ent, 0, sizeof(*ent));
 	ent->ino = ino;
 	ent->next = htab[ih];
 	htab[ih] = ent;
@@ -1740,23 +1832,7 @@ static void
 free_inodata(
 	xfs_agnumber_t	agno)
 {
-	inodata_t	*hp;
-	inodata_t	**ht;
-	int		i;
-	inodata_t	*next;
-
-	ht = inodata[agno];
-	for (i = 0; i < inodata_hash_size; i++) {
-		hp = ht[i];
-		while (hp) {
-			next = hp->next;
-			if (hp->name)
-				xfree(hp->name);
-			xfree(hp);
-			hp = next;
-		}
-	}
-	xfree(ht);
+	xfree(inodata[agno]);
 }
 
 static int
@@ -1788,18 +1864,21 @@ init(
 			     MAX_INODATA_HASH_SIZE),
 			 MIN_INODATA_HASH_SIZE);
 	for (c = 0; c < mp->m_sb.sb_agcount; c++) {
-		dbmap[c] = xcalloc(mp->m_sb.sb_agblocks, sizeof(**dbmap));
-		inomap[c] = xcalloc(mp->m_sb.sb_agblocks, sizeof(**inomap));
+		dbmap[c] = rlemap_alloc(mp->m_sb.sb_agblocks, 1);
+		inomap[c] = rlemap_alloc(mp->m_sb.sb_agblocks,
+				sizeof(inodata_t *));
 		inodata[c] = xcalloc(inodata_hash_size, sizeof(**inodata));
 	}
 	if (rt) {
-		dbmap[c] = xcalloc(mp->m_sb.sb_rblocks, sizeof(**dbmap));
-		inomap[c] = xcalloc(mp->m_sb.sb_rblocks, sizeof(**inomap));
+		dbmap[c] = rlemap_alloc(mp->m_sb.sb_rblocks, 1);
+		inomap[c] = rlemap_alloc(mp->m_sb.sb_rblocks,
+				sizeof(inodata_t *));
 		sumfile = xcalloc(mp->m_rsumsize, 1);
 		sumcompute = xcalloc(mp->m_rsumsize, 1);
 	}
 	nflag = sflag = tflag = verbose = optind = 0;
-	while ((c = getopt(argc, argv, "b:i:npstv")) != EOF) {
+	nthreads = libxfs_nproc();
+	while ((c = getopt(argc, argv, "b:i:j:npstv")) != EOF) {
 		switch (c) {
 		case 'b':
 			bno = strtoll(optarg, NULL, 10);
@@ -1809,6 +1888,9 @@ init(
 			ino = strtoll(optarg, NULL, 10);
 			add_ilist(ino);
 			break;
+		case 'j':
+			nthreads = (int)strtol(optarg, NULL, 10);
+			break;
 		case 'n':
 			nflag = 1;
 			break;
@@ -4289,16 +4371,14 @@ set_inomap(
 	inodata_t	*id)
 {
 	xfs_extlen_t	i;
-	inodata_t	**idp;
 	int		mayprint;
 
 	if (!check_inomap(agno, agbno, len, id->ino))
 		return;
+	rlemap_set(inomap[agno], agbno, len, (unsigned long)id);
 	mayprint = verbose | id->ilist | blist_size;
-	for (i = 0, idp = &inomap[agno][agbno]; i < len; i++, idp++) {
-		*idp = id;
-		if (mayprint &&
-		    (verbose || id->ilist || CHECK_BLISTA(agno, agbno + i)))
+	for (i = 0; mayprint && i < len; i++) {
+		if (verbose || id->ilist || CHECK_BLISTA(agno, agbno + i))
 			dbprintf(_("setting inode to %lld for block %u/%u\n"),
 				id->ino, agno, agbno + i);
 	}
@@ -4320,17 +4400,14 @@ set_rinomap(
 	inodata_t	*id)
 {
 	xfs_extlen_t	i;
-	inodata_t	**idp;
 	int		mayprint;
 
 	if (!check_rinomap(bno, len, id->ino))
 		return;
+	rlemap_set(inomap[mp->m_sb.sb_agcount], bno, len, (unsigned long)id);
 	mayprint = verbose | id->ilist | blist_size;
-	for (i = 0, idp = &inomap[mp->m_sb.sb_agcount][bno];
-	     i < len;
-	     i++, idp++) {
-		*idp = id;
-		if (mayprint && (verbose || id->ilist || CHECK_BLIST(bno + i)))
+	for (i = 0; mayprint && i < len; i++) {
+		if (verbose || id->ilist || CHECK_BLIST(bno + i))
 			dbprintf(_("setting inode to %lld for rtblock %llu\n"),
 				id->ino, bno + i);
 	}
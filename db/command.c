@@ -19,6 +19,7 @@
 #include <xfs/libxfs.h>
 #include "addr.h"
 #include "attrset.h"
+#include "batch.h"
 #include "block.h"
 #include "bmap.h"
 #include "check.h"
@@ -73,15 +74,27 @@ command(
 	int		argc,
 	char		**argv)
 {
-	char		*cmd;
 	const cmdinfo_t	*ct;
 
-	cmd = argv[0];
-	ct = find_command(cmd);
+	ct = find_command(argv[0]);
 	if (ct == NULL) {
-		dbprintf(_("command %s not found\n"), cmd);
+		dbprintf(_("command %s not found\n"), argv[0]);
 		return 0;
 	}
+	return run_command(ct, argc, argv);
+}
+
+/*
+ * Run a command already looked up, for callers that keep the lookup.
+ */
+int
+run_command(
+	const cmdinfo_t	*ct,
+	int		argc,
+	char		**argv)
+{
+	char		*cmd = argv[0];
+
 	if (argc-1 < ct->argmin || (ct->argmax != -1 && argc-1 > ct->argmax)) {
 		dbprintf(_("bad argument count %d to %s, expected "), argc-1, cmd);
 		if (ct->argmax == -1)
@@ -119,6 +132,7 @@ init_commands(void)
 	agfl_init();
 	agi_init();
 	attrset_init();
+	batch_init();
 	block_init();
 	bmap_init();
 	check_init();
@@ -38,4 +38,6 @@ extern int		ncmds;
 extern void		add_command(const cmdinfo_t *ci);
 extern int		command(int argc, char **argv);
 extern const cmdinfo_t	*find_command(const char *cmd);
+extern int		run_command(const cmdinfo_t *ct, int argc,
+				    char **argv);
 extern void		init_commands(void);
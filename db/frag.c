@@ -26,6 +26,8 @@
 #include "type.h"
 #include "init.h"
 #include "malloc.h"
+#include "prefetch.h"
+#include "statsdb.h"
 
 typedef struct extent {
 	xfs_fileoff_t	startoff;
@@ -40,26 +42,72 @@ typedef	struct extmap {
 #define	EXTMAP_SIZE(n)	\
 	(offsetof(extmap_t, ents) + (sizeof(extent_t) * (n)))
 
+/*
+ * AGs are scanned in parallel, each into one of these, and the results
+ * are added up and printed in AG order once each scan is done.
+ */
+typedef struct agfrag {
+	xfs_agnumber_t	seqno;
+	__uint64_t	actual;
+	__uint64_t	ideal;
+	char		*chunk;		/* inode chunk buffer */
+	btwalk_t	*bmap;		/* bmap btree walk */
+	int		errors;		/* don't save to the stats file */
+	struct fragchunk *chunks;	/* every chunk, for the stats file */
+	__uint32_t	nchunks;
+	__uint32_t	maxchunks;
+	struct fraginode *inodes;	/* every inode, for the stats file */
+	__uint32_t	ninodes;
+	__uint32_t	maxinodes;
+	struct fragrec	*saved;		/* the AG's record in the stats file */
+	struct fragchunk **sorted;	/* its chunks by first inode */
+	__uint32_t	*first;		/* index of each chunk's inodes */
+	FILE		*fp;		/* output for this AG */
+	char		*out;
+	size_t		outlen;
+} agfrag_t;
+
+/*
+ * What the stats file holds for an AG: each inode chunk with a sum of
+ * its inodes, then the counts for the inodes of every chunk in turn.
+ * A chunk's counts are used again only if its sum hasn't changed.
+ */
+typedef struct fragrec {
+	__uint32_t	nchunks;
+	__uint32_t	ninodes;
+} fragrec_t;
+
+typedef struct fragchunk {
+	__uint32_t	startino;
+	__uint32_t	sum;
+	__uint32_t	ninodes;
+} fragchunk_t;
+
+typedef struct fraginode {
+	__uint32_t	agino;
+	__uint32_t	actual;
+	__uint32_t	ideal;
+} fraginode_t;
+
+typedef struct bmapwalk {
+	agfrag_t	*af;
+	extmap_t	**extmapp;
+} bmapwalk_t;
+
 static int		aflag;
 static int		dflag;
 static __uint64_t	extcount_actual;
 static __uint64_t	extcount_ideal;
 static int		fflag;
 static int		lflag;
+static int		nthreads;
 static int		qflag;
 static int		Rflag;
 static int		rflag;
+static statsdb_t	*statsdb;
+static char		*statsfile;
 static int		vflag;
 
-typedef void	(*scan_lbtree_f_t)(struct xfs_btree_block *block,
-				   int			level,
-				   extmap_t		**extmapp,
-				   typnm_t		btype);
-
-typedef void	(*scan_sbtree_f_t)(struct xfs_btree_block *block,
-				   int			level,
-				   xfs_agf_t		*agf);
-
 static extmap_t		*extmap_alloc(xfs_extnum_t nex);
 static xfs_extnum_t	extmap_ideal(extmap_t *extmap);
 static void		extmap_set_ext(extmap_t **extmapp, xfs_fileoff_t o,
@@ -68,28 +116,30 @@ static int		frag_f(int argc, char **argv);
 static int		init(int argc, char **argv);
 static void		process_bmbt_reclist(xfs_bmbt_rec_t *rp, int numrecs,
 					     extmap_t **extmapp);
-static void		process_btinode(xfs_dinode_t *dip, extmap_t **extmapp,
-					int whichfork);
+static void		process_btinode(agfrag_t *af, xfs_dinode_t *dip,
+					extmap_t **extmapp, int whichfork);
 static void		process_exinode(xfs_dinode_t *dip, extmap_t **extmapp,
 					int whichfork);
-static void		process_fork(xfs_dinode_t *dip, int whichfork);
-static void		process_inode(xfs_agf_t *agf, xfs_agino_t agino,
+static void		process_fork(agfrag_t *af, xfs_dinode_t *dip,
+				     int whichfork);
+static void		process_inode(agfrag_t *af, xfs_agino_t agino,
 				      xfs_dinode_t *dip);
-static void		scan_ag(xfs_agnumber_t agno);
-static void		scan_lbtree(xfs_fsblock_t root, int nlevels,
-				    scan_lbtree_f_t func, extmap_t **extmapp,
-				    typnm_t btype);
-static void		scan_sbtree(xfs_agf_t *agf, xfs_agblock_t root,
-				    int nlevels, scan_sbtree_f_t func,
-				    typnm_t btype);
-static void		scanfunc_bmap(struct xfs_btree_block *block, int level,
-				      extmap_t **extmapp, typnm_t btype);
-static void		scanfunc_ino(struct xfs_btree_block *block, int level,
-				     xfs_agf_t *agf);
+static void		scan_ag(xfs_agnumber_t agno, void *arg);
+static void		scan_ag_cached(agfrag_t *af, xfs_agnumber_t agno);
+static int		scan_chunk_cached(agfrag_t *af, xfs_agino_t agino,
+					  __uint32_t sum);
+static void		scan_ag_done(xfs_agnumber_t agno, void *arg);
+static void		scan_ag_save(agfrag_t *af, xfs_agnumber_t agno);
+static void		scanfunc_bmap(btwalk_t *bw, xfs_daddr_t daddr,
+				      int level, int btype, void *block,
+				      void *arg);
+static void		scanfunc_ino(btwalk_t *bw, xfs_daddr_t daddr,
+				     int level, int tag, void *block,
+				     void *arg);
 
 static const cmdinfo_t	frag_cmd =
 	{ "frag", NULL, frag_f, 0, -1, 0,
-	  "[-a] [-d] [-f] [-l] [-q] [-R] [-r] [-v]",
+	  "[-a] [-d] [-f] [-j threads] [-l] [-q] [-R] [-r] [-S statsfile] [-v]",
 	  "get file fragmentation data", NULL };
 
 static extmap_t *
@@ -158,13 +208,23 @@ frag_f(
 	int		argc,
 	char		**argv)
 {
-	xfs_agnumber_t	agno;
+	agfrag_t	*stats;
 	double		answer;
 
 	if (!init(argc, argv))
 		return 0;
-	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++)
-		scan_ag(agno);
+	if (statsfile) {
+		statsdb = statsdb_open(statsfile);
+		if (!statsdb)
+			return 0;
+	}
+	stats = xcalloc(mp->m_sb.sb_agcount, sizeof(agfrag_t));
+	agscan(nthreads, scan_ag, scan_ag_done, stats);
+	xfree(stats);
+	if (statsdb) {
+		statsdb_close(statsdb);
+		statsdb = NULL;
+	}
 	if (extcount_actual)
 		answer = (double)(extcount_actual - extcount_ideal) * 100.0 /
 			 (double)extcount_actual;
@@ -183,8 +243,10 @@ init(
 	int		c;
 
 	aflag = dflag = fflag = lflag = qflag = Rflag = rflag = vflag = 0;
+	statsfile = NULL;
+	nthreads = libxfs_nproc();
 	optind = 0;
-	while ((c = getopt(argc, argv, "adflqRrv")) != EOF) {
+	while ((c = getopt(argc, argv, "adfj:lqRrS:v")) != EOF) {
 		switch (c) {
 		case 'a':
 			aflag = 1;
@@ -195,6 +257,9 @@ init(
 		case 'f':
 			fflag = 1;
 			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
 		case 'l':
 			lflag = 1;
 			break;
@@ -207,6 +272,9 @@ init(
 		case 'r':
 			rflag = 1;
 			break;
+		case 'S':
+			statsfile = optarg;
+			break;
 		case 'v':
 			vflag = 1;
 			break;
@@ -217,10 +285,83 @@ init(
 	}
 	if (!aflag && !dflag && !fflag && !lflag && !qflag && !Rflag && !rflag)
 		aflag = dflag = fflag = lflag = qflag = Rflag = rflag = 1;
+	if (statsfile && !statsdb_usable())
+		statsfile = NULL;
 	extcount_actual = extcount_ideal = 0;
 	return 1;
 }
 
+static __uint32_t
+optflags(void)
+{
+	return aflag | dflag << 1 | fflag << 2 | lflag << 3 | qflag << 4 |
+	       Rflag << 5 | rflag << 6;
+}
+
+/*
+ * Sum of an inode chunk for the stats file: the free mask and every
+ * allocated inode, forks included, which covers the LSN and CRC of each
+ * inode's last change.
+ */
+static __uint32_t
+chunk_sum(
+	xfs_inobt_rec_t	*rp,
+	char		*chunk,
+	int		off)
+{
+	__uint32_t	crc;
+	int		j;
+
+	crc = crc32c(~0U, &rp->ir_free, sizeof(rp->ir_free));
+	for (j = 0; j < XFS_INODES_PER_CHUNK; j++) {
+		if (XFS_INOBT_IS_FREE_DISK(rp, j))
+			continue;
+		crc = crc32c(crc, chunk + ((off + j) << mp->m_sb.sb_inodelog),
+			mp->m_sb.sb_inodesize);
+	}
+	return crc;
+}
+
+static void
+frag_add_inode(
+	agfrag_t	*af,
+	xfs_agino_t	agino,
+	__uint64_t	actual,
+	__uint64_t	ideal)
+{
+	if (af->ninodes == af->maxinodes) {
+		af->maxinodes = af->maxinodes ? af->maxinodes * 2 : 64;
+		af->inodes = xrealloc(af->inodes,
+				af->maxinodes * sizeof(*af->inodes));
+	}
+	af->inodes[af->ninodes].agino = agino;
+	af->inodes[af->ninodes].actual = actual;
+	af->inodes[af->ninodes].ideal = ideal;
+	af->ninodes++;
+	af->chunks[af->nchunks - 1].ninodes++;
+}
+
+/*
+ * Start the stats file's record of an inode chunk; the inodes added
+ * after it belong to it.
+ */
+static void
+frag_add_chunk(
+	agfrag_t	*af,
+	xfs_agino_t	agino,
+	__uint32_t	sum)
+{
+	if (af->nchunks == af->maxchunks) {
+		af->maxchunks = af->maxchunks ? af->maxchunks * 2 : 16;
+		af->chunks = xrealloc(af->chunks,
+				af->maxchunks * sizeof(*af->chunks));
+	}
+	af->chunks[af->nchunks].startino = agino;
+	af->chunks[af->nchunks].sum = sum;
+	af->chunks[af->nchunks].ninodes = 0;
+	af->nchunks++;
+}
+
 static void
 process_bmbt_reclist(
 	xfs_bmbt_rec_t		*rp,
@@ -241,6 +382,7 @@ process_bmbt_reclist(
 
 static void
 process_btinode(
+	agfrag_t		*af,
 	xfs_dinode_t		*dip,
 	extmap_t		**extmapp,
 	int			whichfork)
@@ -248,6 +390,7 @@ process_btinode(
 	xfs_bmdr_block_t	*dib;
 	int			i;
 	xfs_bmbt_ptr_t		*pp;
+	bmapwalk_t		bmw;
 
 	dib = (xfs_bmdr_block_t *)XFS_DFORK_PTR(dip, whichfork);
 	if (be16_to_cpu(dib->bb_level) == 0) {
@@ -258,9 +401,12 @@ process_btinode(
 	pp = XFS_BMDR_PTR_ADDR(dib, 1,
 		xfs_bmdr_maxrecs(mp, XFS_DFORK_SIZE(dip, mp, whichfork), 0));
 	for (i = 0; i < be16_to_cpu(dib->bb_numrecs); i++)
-		scan_lbtree(be64_to_cpu(pp[i]), be16_to_cpu(dib->bb_level), 
-			scanfunc_bmap, extmapp,
+		btwalk_add(af->bmap, XFS_FSB_TO_DADDR(mp, be64_to_cpu(pp[i])),
+			be16_to_cpu(dib->bb_level) - 1,
 			whichfork == XFS_DATA_FORK ? TYP_BMAPBTD : TYP_BMAPBTA);
+	bmw.af = af;
+	bmw.extmapp = extmapp;
+	btwalk_run(af->bmap, scanfunc_bmap, &bmw);
 }
 
 static void
@@ -277,6 +423,7 @@ process_exinode(
 
 static void
 process_fork(
+	agfrag_t	*af,
 	xfs_dinode_t	*dip,
 	int		whichfork)
 {
@@ -292,17 +439,17 @@ process_fork(
 		process_exinode(dip, &extmap, whichfork);
 		break;
 	case XFS_DINODE_FMT_BTREE:
-		process_btinode(dip, &extmap, whichfork);
+		process_btinode(af, dip, &extmap, whichfork);
 		break;
 	}
-	extcount_actual += extmap->nents;
-	extcount_ideal += extmap_ideal(extmap);
+	af->actual += extmap->nents;
+	af->ideal += extmap_ideal(extmap);
 	xfree(extmap);
 }
 
 static void
 process_inode(
-	xfs_agf_t		*agf,
+	agfrag_t		*af,
 	xfs_agino_t		agino,
 	xfs_dinode_t		*dip)
 {
@@ -312,7 +459,7 @@ process_inode(
 	int			skipa;
 	int			skipd;
 
-	ino = XFS_AGINO_TO_INO(mp, be32_to_cpu(agf->agf_seqno), agino);
+	ino = XFS_AGINO_TO_INO(mp, af->seqno, agino);
 	switch (be16_to_cpu(dip->di_mode) & S_IFMT) {
 	case S_IFDIR:
 		skipd = !dflag;
@@ -339,171 +486,332 @@ process_inode(
 		skipd = 1;
 		break;
 	}
-	actual = extcount_actual;
-	ideal = extcount_ideal;
+	actual = af->actual;
+	ideal = af->ideal;
 	if (!skipd)
-		process_fork(dip, XFS_DATA_FORK);
+		process_fork(af, dip, XFS_DATA_FORK);
 	skipa = !aflag || !XFS_DFORK_Q(dip);
 	if (!skipa)
-		process_fork(dip, XFS_ATTR_FORK);
-	if (vflag && (!skipd || !skipa))
-		dbprintf(_("inode %lld actual %lld ideal %lld\n"),
-			ino, extcount_actual - actual, extcount_ideal - ideal);
+		process_fork(af, dip, XFS_ATTR_FORK);
+	if (skipd && skipa)
+		return;
+	if (vflag)
+		fprintf(af->fp, _("inode %lld actual %lld ideal %lld\n"),
+			(long long)ino, (long long)(af->actual - actual),
+			(long long)(af->ideal - ideal));
+	if (statsdb)
+		frag_add_inode(af, agino, af->actual - actual,
+			af->ideal - ideal);
 }
 
+/*
+ * Runs in a worker thread: everything is read with read_blocks and all
+ * output goes to the AG's own stream.
+ */
 static void
 scan_ag(
-	xfs_agnumber_t	agno)
+	xfs_agnumber_t	agno,
+	void		*arg)
 {
+	agfrag_t	*af = (agfrag_t *)arg + agno;
 	xfs_agf_t	*agf;
 	xfs_agi_t	*agi;
+	btwalk_t	*bw;
+
+	af->fp = open_memstream(&af->out, &af->outlen);
+	agf = xmalloc(mp->m_sb.sb_sectsize);
+	agi = xmalloc(mp->m_sb.sb_sectsize);
+	if (read_blocks(XFS_AG_DADDR(mp, agno, XFS_AGF_DADDR(mp)),
+			XFS_FSS_TO_BB(mp, 1), agf)) {
+		fprintf(af->fp, _("can't read agf block for ag %u\n"), agno);
+		goto out;
+	}
+	if (read_blocks(XFS_AG_DADDR(mp, agno, XFS_AGI_DADDR(mp)),
+			XFS_FSS_TO_BB(mp, 1), agi)) {
+		fprintf(af->fp, _("can't read agi block for ag %u\n"), agno);
+		goto out;
+	}
+	af->seqno = be32_to_cpu(agf->agf_seqno);
+	if (statsdb)
+		scan_ag_cached(af, agno);
+	af->chunk = xmalloc(XFS_FSB_TO_B(mp, XFS_IALLOC_BLOCKS(mp)));
+	af->bmap = btwalk_alloc(blkbb);
+	bw = btwalk_alloc(blkbb);
+	btwalk_add(bw, XFS_AGB_TO_DADDR(mp, af->seqno,
+			be32_to_cpu(agi->agi_root)),
+		be32_to_cpu(agi->agi_level) - 1, 0);
+	btwalk_run(bw, scanfunc_ino, af);
+	btwalk_free(bw);
+	btwalk_free(af->bmap);
+	xfree(af->chunk);
+	if (statsdb)
+		scan_ag_save(af, agno);
+out:
+	xfree(agi);
+	xfree(agf);
+	fclose(af->fp);
+}
+
+static int
+fragchunk_cmp(
+	const void	*a,
+	const void	*b)
+{
+	const fragchunk_t *ca = *(const fragchunk_t **)a;
+	const fragchunk_t *cb = *(const fragchunk_t **)b;
+
+	if (ca->startino < cb->startino)
+		return -1;
+	return ca->startino > cb->startino;
+}
 
-	push_cur();
-	set_cur(&typtab[TYP_AGF],
-		XFS_AG_DADDR(mp, agno, XFS_AGF_DADDR(mp)),
-		XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
-	if ((agf = iocur_top->data) == NULL) {
-		dbprintf(_("can't read agf block for ag %u\n"), agno);
-		pop_cur();
+/*
+ * Look up the stats file's record for the AG and index its chunks, so
+ * the inode btree walk can tell which chunks needn't be processed again.
+ */
+static void
+scan_ag_cached(
+	agfrag_t	*af,
+	xfs_agnumber_t	agno)
+{
+	fragrec_t	*fr;
+	fragchunk_t	*fc;
+	__uint64_t	key;
+	__uint32_t	flags;
+	size_t		len;
+	__uint32_t	i;
+	__uint32_t	n;
+
+	fr = statsdb_get(statsdb, STATS_FRAG, agno, &key, &flags, &len);
+	if (!fr || flags != optflags() || len < sizeof(*fr) ||
+	    len != sizeof(*fr) + (size_t)fr->nchunks * sizeof(fragchunk_t) +
+		   (size_t)fr->ninodes * sizeof(fraginode_t))
 		return;
+	fc = (fragchunk_t *)(fr + 1);
+	af->sorted = xmalloc((fr->nchunks + 1) * sizeof(*af->sorted));
+	af->first = xmalloc((fr->nchunks + 1) * sizeof(*af->first));
+	for (i = 0, n = 0; i < fr->nchunks; i++) {
+		af->sorted[i] = &fc[i];
+		af->first[i] = n;
+		n += fc[i].ninodes;
 	}
-	push_cur();
-	set_cur(&typtab[TYP_AGI],
-		XFS_AG_DADDR(mp, agno, XFS_AGI_DADDR(mp)),
-		XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
-	if ((agi = iocur_top->data) == NULL) {
-		dbprintf(_("can't read agi block for ag %u\n"), agno);
-		pop_cur();
-		pop_cur();
+	if (n != fr->ninodes) {
+		xfree(af->sorted);
+		xfree(af->first);
+		af->sorted = NULL;
+		af->first = NULL;
 		return;
 	}
-	scan_sbtree(agf, be32_to_cpu(agi->agi_root), 
-			be32_to_cpu(agi->agi_level), scanfunc_ino, TYP_INOBT);
-	pop_cur();
-	pop_cur();
+	qsort(af->sorted, fr->nchunks, sizeof(*af->sorted), fragchunk_cmp);
+	af->saved = fr;
+}
+
+/*
+ * Use the saved counts for an inode chunk if its sum still matches.
+ */
+static int
+scan_chunk_cached(
+	agfrag_t	*af,
+	xfs_agino_t	agino,
+	__uint32_t	sum)
+{
+	fragchunk_t	key;
+	fragchunk_t	*kp = &key;
+	fragchunk_t	**cpp;
+	fragchunk_t	*fc;
+	fraginode_t	*fi;
+	__uint32_t	i;
+
+	if (!af->saved)
+		return 0;
+	key.startino = agino;
+	cpp = bsearch(&kp, af->sorted, af->saved->nchunks,
+		sizeof(*af->sorted), fragchunk_cmp);
+	if (!cpp || (*cpp)->sum != sum)
+		return 0;
+	fc = (fragchunk_t *)(af->saved + 1);
+	fi = (fraginode_t *)(fc + af->saved->nchunks) + af->first[*cpp - fc];
+	for (i = 0; i < (*cpp)->ninodes; i++, fi++) {
+		af->actual += fi->actual;
+		af->ideal += fi->ideal;
+		if (vflag)
+			fprintf(af->fp,
+				_("inode %lld actual %lld ideal %lld\n"),
+				(long long)XFS_AGINO_TO_INO(mp, af->seqno,
+							    fi->agino),
+				(long long)fi->actual,
+				(long long)fi->ideal);
+		frag_add_inode(af, fi->agino, fi->actual, fi->ideal);
+	}
+	return 1;
 }
 
+/*
+ * Record the AG in the stats file, unless something went wrong
+ * reading it.
+ */
 static void
-scan_lbtree(
-	xfs_fsblock_t	root,
-	int		nlevels,
-	scan_lbtree_f_t	func,
-	extmap_t	**extmapp,
-	typnm_t		btype)
+scan_ag_save(
+	agfrag_t	*af,
+	xfs_agnumber_t	agno)
 {
-	push_cur();
-	set_cur(&typtab[btype], XFS_FSB_TO_DADDR(mp, root), blkbb, DB_RING_IGN,
-		NULL);
-	if (iocur_top->data == NULL) {
-		dbprintf(_("can't read btree block %u/%u\n"),
-			XFS_FSB_TO_AGNO(mp, root),
-			XFS_FSB_TO_AGBNO(mp, root));
-		return;
+	fragrec_t	*fr;
+	fragchunk_t	*fc;
+	size_t		len;
+
+	if (!af->errors) {
+		len = sizeof(*fr) + af->nchunks * sizeof(fragchunk_t) +
+		      af->ninodes * sizeof(fraginode_t);
+		fr = xmalloc(len);
+		fr->nchunks = af->nchunks;
+		fr->ninodes = af->ninodes;
+		fc = (fragchunk_t *)(fr + 1);
+		memcpy(fc, af->chunks, af->nchunks * sizeof(fragchunk_t));
+		memcpy(fc + af->nchunks, af->inodes,
+			af->ninodes * sizeof(fraginode_t));
+		statsdb_put(statsdb, STATS_FRAG, agno, 0, optflags(), fr, len);
 	}
-	(*func)(iocur_top->data, nlevels - 1, extmapp, btype);
-	pop_cur();
+	xfree(af->sorted);
+	xfree(af->first);
+	xfree(af->chunks);
+	xfree(af->inodes);
 }
 
+/*
+ * Back in the main thread, in AG order.
+ */
 static void
-scan_sbtree(
-	xfs_agf_t	*agf,
-	xfs_agblock_t	root,
-	int		nlevels,
-	scan_sbtree_f_t	func,
-	typnm_t		btype)
+scan_ag_done(
+	xfs_agnumber_t	agno,
+	void		*arg)
 {
-	xfs_agnumber_t	seqno = be32_to_cpu(agf->agf_seqno);
+	agfrag_t	*af = (agfrag_t *)arg + agno;
 
-	push_cur();
-	set_cur(&typtab[btype], XFS_AGB_TO_DADDR(mp, seqno, root),
-		blkbb, DB_RING_IGN, NULL);
-	if (iocur_top->data == NULL) {
-		dbprintf(_("can't read btree block %u/%u\n"), seqno, root);
-		return;
-	}
-	(*func)(iocur_top->data, nlevels - 1, agf);
-	pop_cur();
+	dbprintf_lines(af->out, af->outlen);
+	free(af->out);
+	extcount_actual += af->actual;
+	extcount_ideal += af->ideal;
 }
 
 static void
 scanfunc_bmap(
-	struct xfs_btree_block	*block,
+	btwalk_t		*bw,
+	xfs_daddr_t		daddr,
 	int			level,
-	extmap_t		**extmapp,
-	typnm_t			btype)
+	int			btype,
+	void			*buf,
+	void			*arg)
 {
+	bmapwalk_t		*bmw = arg;
+	struct xfs_btree_block	*block = buf;
 	int			i;
 	xfs_bmbt_ptr_t		*pp;
 	xfs_bmbt_rec_t		*rp;
 	int			nrecs;
 
+	if (block == NULL) {
+		fprintf(bmw->af->fp, _("can't read btree block %u/%u\n"),
+			xfs_daddr_to_agno(mp, daddr),
+			xfs_daddr_to_agbno(mp, daddr));
+		bmw->af->errors++;
+		return;
+	}
 	nrecs = be16_to_cpu(block->bb_numrecs);
 
 	if (level == 0) {
 		if (nrecs > mp->m_bmap_dmxr[0]) {
-			dbprintf(_("invalid numrecs (%u) in %s block\n"),
-				   nrecs, typtab[btype].name);
+			fprintf(bmw->af->fp,
+				_("invalid numrecs (%u) in %s block\n"),
+				nrecs, typtab[btype].name);
+			bmw->af->errors++;
 			return;
 		}
 		rp = XFS_BMBT_REC_ADDR(mp, block, 1);
-		process_bmbt_reclist(rp, nrecs, extmapp);
+		process_bmbt_reclist(rp, nrecs, bmw->extmapp);
 		return;
 	}
 
 	if (nrecs > mp->m_bmap_dmxr[1]) {
-		dbprintf(_("invalid numrecs (%u) in %s block\n"),
-			   nrecs, typtab[btype].name);
+		fprintf(bmw->af->fp, _("invalid numrecs (%u) in %s block\n"),
+			nrecs, typtab[btype].name);
+		bmw->af->errors++;
 		return;
 	}
 	pp = XFS_BMBT_PTR_ADDR(mp, block, 1, mp->m_bmap_dmxr[0]);
 	for (i = 0; i < nrecs; i++)
-		scan_lbtree(be64_to_cpu(pp[i]), level, scanfunc_bmap, extmapp, 
-									btype);
+		btwalk_add(bw, XFS_FSB_TO_DADDR(mp, be64_to_cpu(pp[i])),
+			level - 1, btype);
 }
 
 static void
 scanfunc_ino(
-	struct xfs_btree_block	*block,
+	btwalk_t		*bw,
+	xfs_daddr_t		daddr,
 	int			level,
-	xfs_agf_t		*agf)
+	int			tag,
+	void			*buf,
+	void			*arg)
 {
+	agfrag_t		*af = arg;
+	struct xfs_btree_block	*block = buf;
 	xfs_agino_t		agino;
-	xfs_agnumber_t		seqno = be32_to_cpu(agf->agf_seqno);
+	xfs_agnumber_t		seqno = af->seqno;
+	int			chunkbb;
 	int			i;
 	int			j;
+	int			nrecs;
 	int			off;
 	xfs_inobt_ptr_t		*pp;
 	xfs_inobt_rec_t		*rp;
+	__uint32_t		sum;
 
+	if (block == NULL) {
+		fprintf(af->fp, _("can't read btree block %u/%u\n"),
+			seqno, xfs_daddr_to_agbno(mp, daddr));
+		af->errors++;
+		return;
+	}
+	nrecs = be16_to_cpu(block->bb_numrecs);
 	if (level == 0) {
 		rp = XFS_INOBT_REC_ADDR(mp, block, 1);
-		for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++) {
+		nrecs = MIN(nrecs, mp->m_inobt_mxr[0]);
+		chunkbb = XFS_FSB_TO_BB(mp, XFS_IALLOC_BLOCKS(mp));
+		for (i = 0; i < nrecs; i++) {
+			agino = be32_to_cpu(rp[i].ir_startino);
+			readahead_blocks(XFS_AGB_TO_DADDR(mp, seqno,
+					XFS_AGINO_TO_AGBNO(mp, agino)),
+				chunkbb);
+		}
+		for (i = 0; i < nrecs; i++) {
 			agino = be32_to_cpu(rp[i].ir_startino);
 			off = XFS_INO_TO_OFFSET(mp, agino);
-			push_cur();
-			set_cur(&typtab[TYP_INODE],
-				XFS_AGB_TO_DADDR(mp, seqno,
-						 XFS_AGINO_TO_AGBNO(mp, agino)),
-				XFS_FSB_TO_BB(mp, XFS_IALLOC_BLOCKS(mp)),
-				DB_RING_IGN, NULL);
-			if (iocur_top->data == NULL) {
-				dbprintf(_("can't read inode block %u/%u\n"),
+			if (read_blocks(XFS_AGB_TO_DADDR(mp, seqno,
+						XFS_AGINO_TO_AGBNO(mp, agino)),
+					chunkbb, af->chunk)) {
+				fprintf(af->fp,
+					_("can't read inode block %u/%u\n"),
 					seqno, XFS_AGINO_TO_AGBNO(mp, agino));
+				af->errors++;
 				continue;
 			}
+			if (statsdb) {
+				sum = chunk_sum(&rp[i], af->chunk, off);
+				frag_add_chunk(af, agino, sum);
+				if (scan_chunk_cached(af, agino, sum))
+					continue;
+			}
 			for (j = 0; j < XFS_INODES_PER_CHUNK; j++) {
 				if (XFS_INOBT_IS_FREE_DISK(&rp[i], j))
 					continue;
-				process_inode(agf, agino + j, (xfs_dinode_t *)
-					((char *)iocur_top->data + 
+				process_inode(af, agino + j, (xfs_dinode_t *)
+					(af->chunk +
 					((off + j) << mp->m_sb.sb_inodelog)));
 			}
-			pop_cur();
 		}
 		return;
 	}
 	pp = XFS_INOBT_PTR_ADDR(mp, block, 1, mp->m_inobt_mxr[1]);
-	for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
-		scan_sbtree(agf, be32_to_cpu(pp[i]), level, scanfunc_ino, 
-								TYP_INOBT);
+	for (i = 0; i < MIN(nrecs, mp->m_inobt_mxr[1]); i++)
+		btwalk_add(bw, XFS_AGB_TO_DADDR(mp, seqno, be32_to_cpu(pp[i])),
+			level - 1, 0);
 }
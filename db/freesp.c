@@ -24,6 +24,8 @@
 #include "output.h"
 #include "init.h"
 #include "malloc.h"
+#include "prefetch.h"
+#include "statsdb.h"
 
 typedef struct histent
 {
@@ -33,23 +35,48 @@ typedef struct histent
 	long long	blocks;
 } histent_t;
 
+/*
+ * AGs are scanned in parallel, each into one of these, and the results
+ * are added up and printed in AG order once each scan is done.
+ */
+typedef struct agstat {
+	xfs_agnumber_t	seqno;
+	long long	*counts;	/* per histogram entry */
+	long long	*blocks;
+	long long	totblocks;
+	long long	totexts;
+	int		errors;		/* don't save to the stats file */
+	xfs_extlen_t	*lens;		/* every extent, for the stats file */
+	size_t		nlens;
+	size_t		maxlens;
+	FILE		*fp;		/* output for this AG */
+	char		*out;
+	size_t		outlen;
+} agstat_t;
+
+/* what the stats file holds for an AG: how many extents of each length */
+typedef struct freerec {
+	__uint32_t	len;
+	__uint32_t	count;
+} freerec_t;
+
 static void	addhistent(int h);
-static void	addtohist(xfs_agnumber_t agno, xfs_agblock_t agbno,
-			  xfs_extlen_t len);
+static void	addtohist(agstat_t *as, xfs_agnumber_t agno,
+			  xfs_agblock_t agbno, xfs_extlen_t len);
+static void	binext(agstat_t *as, xfs_extlen_t len, long long count);
 static int	freesp_f(int argc, char **argv);
 static void	histinit(int maxlen);
 static int	init(int argc, char **argv);
 static void	printhist(void);
-static void	scan_ag(xfs_agnumber_t agno);
-static void	scanfunc_bno(struct xfs_btree_block *block, typnm_t typ, int level,
-			     xfs_agf_t *agf);
-static void	scanfunc_cnt(struct xfs_btree_block *block, typnm_t typ, int level,
-			     xfs_agf_t *agf);
-static void	scan_freelist(xfs_agf_t *agf);
-static void	scan_sbtree(xfs_agf_t *agf, xfs_agblock_t root, typnm_t typ,
-			    int nlevels,
-			    void (*func)(struct xfs_btree_block *block, typnm_t typ,
-					 int level, xfs_agf_t *agf));
+static int	scan_ag_cached(agstat_t *as, xfs_agnumber_t agno,
+			       __uint64_t key);
+static void	scan_ag_save(agstat_t *as, xfs_agnumber_t agno,
+			     __uint64_t key);
+static void	scan_ag(xfs_agnumber_t agno, void *arg);
+static void	scan_ag_done(xfs_agnumber_t agno, void *arg);
+static void	scanfunc_alloc(btwalk_t *bw, xfs_daddr_t daddr, int level,
+			       int tag, void *block, void *arg);
+static void	scan_freelist(agstat_t *as, xfs_agf_t *agf);
 static int	usage(void);
 
 static int		agcount;
@@ -60,14 +87,18 @@ static int		equalsize;
 static histent_t	*hist;
 static int		histcount;
 static int		multsize;
+static int		nthreads;
 static int		seen1;
+static statsdb_t	*statsdb;
+static char		*statsfile;
 static int		summaryflag;
 static long long	totblocks;
 static long long	totexts;
 
 static const cmdinfo_t	freesp_cmd =
 	{ "freesp", NULL, freesp_f, 0, -1, 0,
-	  "[-bcdfs] [-a agno]... [-e binsize] [-h h1]... [-m binmult]",
+	  "[-bcdfs] [-a agno]... [-e binsize] [-h h1]... [-j threads] [-m binmult]"
+	  " [-S statsfile]",
 	  "summarize free space for filesystem", NULL };
 
 static int
@@ -92,17 +123,25 @@ freesp_f(
 	int		argc,
 	char		**argv)
 {
-	xfs_agnumber_t	agno;
+	agstat_t	*stats;
 
 	if (!init(argc, argv))
 		return 0;
+	if (statsfile) {
+		statsdb = statsdb_open(statsfile);
+		if (!statsdb)
+			goto out;
+	}
 
 	if (dumpflag)
 		dbprintf("%8s %8s %8s\n", "agno", "agbno", "len");
 
-	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++)  {
-		if (inaglist(agno))
-			scan_ag(agno);
+	stats = xcalloc(mp->m_sb.sb_agcount, sizeof(agstat_t));
+	agscan(nthreads, scan_ag, scan_ag_done, stats);
+	xfree(stats);
+	if (statsdb) {
+		statsdb_close(statsdb);
+		statsdb = NULL;
 	}
 	if (histcount)
 		printhist();
@@ -112,6 +151,7 @@ freesp_f(
 		dbprintf(_("average free extent size %g\n"),
 			(double)totblocks / (double)totexts);
 	}
+out:
 	if (aglist)
 		xfree(aglist);
 	if (hist)
@@ -147,7 +187,9 @@ init(
 	totblocks = totexts = 0;
 	aglist = NULL;
 	hist = NULL;
-	while ((c = getopt(argc, argv, "a:bcde:h:m:s")) != EOF) {
+	statsfile = NULL;
+	nthreads = libxfs_nproc();
+	while ((c = getopt(argc, argv, "a:bcde:h:j:m:sS:")) != EOF) {
 		switch (c) {
 		case 'a':
 			aglistadd(optarg);
@@ -176,6 +218,9 @@ init(
 			addhistent(atoi(optarg));
 			speced = 1;
 			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
 		case 'm':
 			if (speced)
 				return usage();
@@ -185,6 +230,9 @@ init(
 		case 's':
 			summaryflag = 1;
 			break;
+		case 'S':
+			statsfile = optarg;
+			break;
 		case '?':
 			return usage();
 		}
@@ -193,6 +241,8 @@ init(
 		return usage();
 	if (!speced)
 		multsize = 2;
+	if (statsfile && !statsdb_usable())
+		statsfile = NULL;
 	histinit((int)mp->m_sb.sb_agblocks);
 	return 1;
 }
@@ -201,34 +251,155 @@ static int
 usage(void)
 {
 	dbprintf(_("freesp arguments: [-bcds] [-a agno] [-e binsize] [-h h1]... "
-		 "[-m binmult]\n"));
+		 "[-j threads] [-m binmult] [-S statsfile]\n"));
 	return 0;
 }
 
+/*
+ * Runs in a worker thread: everything is read with read_blocks and all
+ * output goes to the AG's own stream.
+ */
 static void
 scan_ag(
-	xfs_agnumber_t	agno)
+	xfs_agnumber_t	agno,
+	void		*arg)
 {
+	agstat_t	*as = (agstat_t *)arg + agno;
 	xfs_agf_t	*agf;
+	btwalk_t	*bw;
+	__uint64_t	key = 0;
 
-	push_cur();
-	set_cur(&typtab[TYP_AGF], XFS_AG_DADDR(mp, agno, XFS_AGF_DADDR(mp)),
-				XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
-	agf = iocur_top->data;
-	scan_freelist(agf);
+	if (!inaglist(agno))
+		return;
+	as->counts = xcalloc(histcount, sizeof(*as->counts));
+	as->blocks = xcalloc(histcount, sizeof(*as->blocks));
+	as->fp = open_memstream(&as->out, &as->outlen);
+	agf = xmalloc(mp->m_sb.sb_sectsize);
+	if (read_blocks(XFS_AG_DADDR(mp, agno, XFS_AGF_DADDR(mp)),
+			XFS_FSS_TO_BB(mp, 1), agf)) {
+		fprintf(as->fp, _("can't read agf block for ag %u\n"), agno);
+		goto out;
+	}
+	as->seqno = be32_to_cpu(agf->agf_seqno);
+	if (statsdb) {
+		key = statsdb_sum(agf, mp->m_sb.sb_sectsize);
+		if (!dumpflag && scan_ag_cached(as, agno, key))
+			goto out;
+	}
+	scan_freelist(as, agf);
+	bw = btwalk_alloc(blkbb);
 	if (countflag)
-		scan_sbtree(agf, be32_to_cpu(agf->agf_roots[XFS_BTNUM_CNT]),
-			TYP_CNTBT, be32_to_cpu(agf->agf_levels[XFS_BTNUM_CNT]),
-			scanfunc_cnt);
+		btwalk_add(bw, XFS_AGB_TO_DADDR(mp, as->seqno,
+				be32_to_cpu(agf->agf_roots[XFS_BTNUM_CNT])),
+			be32_to_cpu(agf->agf_levels[XFS_BTNUM_CNT]) - 1, 0);
 	else
-		scan_sbtree(agf, be32_to_cpu(agf->agf_roots[XFS_BTNUM_BNO]),
-			TYP_BNOBT, be32_to_cpu(agf->agf_levels[XFS_BTNUM_BNO]),
-			scanfunc_bno);
-	pop_cur();
+		btwalk_add(bw, XFS_AGB_TO_DADDR(mp, as->seqno,
+				be32_to_cpu(agf->agf_roots[XFS_BTNUM_BNO])),
+			be32_to_cpu(agf->agf_levels[XFS_BTNUM_BNO]) - 1, 0);
+	btwalk_run(bw, scanfunc_alloc, as);
+	btwalk_free(bw);
+	if (statsdb)
+		scan_ag_save(as, agno, key);
+out:
+	xfree(agf);
+	fclose(as->fp);
+}
+
+/*
+ * Use the stats file's record for the AG if its AGF hasn't changed.
+ */
+static int
+scan_ag_cached(
+	agstat_t	*as,
+	xfs_agnumber_t	agno,
+	__uint64_t	key)
+{
+	freerec_t	*fr;
+	__uint64_t	okey;
+	__uint32_t	flags;
+	size_t		len;
+	size_t		i;
+
+	fr = statsdb_get(statsdb, STATS_FREESP, agno, &okey, &flags, &len);
+	if (!fr || okey != key || flags != countflag)
+		return 0;
+	for (i = 0; i < len / sizeof(*fr); i++)
+		binext(as, fr[i].len, fr[i].count);
+	return 1;
+}
+
+static int
+lencmp(
+	const void	*a,
+	const void	*b)
+{
+	xfs_extlen_t	la = *(xfs_extlen_t *)a;
+	xfs_extlen_t	lb = *(xfs_extlen_t *)b;
+
+	return la < lb ? -1 : la > lb;
+}
+
+/*
+ * Record the AG's extent lengths in the stats file, unless something
+ * went wrong reading it.
+ */
+static void
+scan_ag_save(
+	agstat_t	*as,
+	xfs_agnumber_t	agno,
+	__uint64_t	key)
+{
+	freerec_t	*fr;
+	size_t		i;
+	size_t		n = 0;
+
+	if (as->errors) {
+		xfree(as->lens);
+		return;
+	}
+	qsort(as->lens, as->nlens, sizeof(*as->lens), lencmp);
+	fr = xmalloc(as->nlens ? as->nlens * sizeof(*fr) : 1);
+	for (i = 0; i < as->nlens; i++) {
+		if (n && fr[n - 1].len == as->lens[i]) {
+			fr[n - 1].count++;
+			continue;
+		}
+		fr[n].len = as->lens[i];
+		fr[n++].count = 1;
+	}
+	xfree(as->lens);
+	statsdb_put(statsdb, STATS_FREESP, agno, key, countflag, fr,
+		n * sizeof(*fr));
+}
+
+/*
+ * Back in the main thread, in AG order.
+ */
+static void
+scan_ag_done(
+	xfs_agnumber_t	agno,
+	void		*arg)
+{
+	agstat_t	*as = (agstat_t *)arg + agno;
+	int		i;
+
+	if (!inaglist(agno))
+		return;
+	dbprintf_lines(as->out, as->outlen);
+	for (i = 0; i < histcount; i++) {
+		hist[i].count += as->counts[i];
+		hist[i].blocks += as->blocks[i];
+	}
+	totexts += as->totexts;
+	totblocks += as->totblocks;
+	free(as->out);
+	xfree(as->counts);
+	xfree(as->blocks);
 }
 
 static void
 scan_freelist(
+	agstat_t	*as,
 	xfs_agf_t	*agf)
 {
 	xfs_agnumber_t	seqno = be32_to_cpu(agf->agf_seqno);
@@ -239,10 +410,12 @@ scan_freelist(
 
 	if (be32_to_cpu(agf->agf_flcount) == 0)
 		return;
-	push_cur();
-	set_cur(&typtab[TYP_AGFL], XFS_AG_DADDR(mp, seqno, XFS_AGFL_DADDR(mp)),
-				XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
-	agfl = iocur_top->data;
+	agfl = xmalloc(mp->m_sb.sb_sectsize);
+	if (read_blocks(XFS_AG_DADDR(mp, seqno, XFS_AGFL_DADDR(mp)),
+			XFS_FSS_TO_BB(mp, 1), agfl)) {
+		as->errors++;
+		goto out;
+	}
 	i = be32_to_cpu(agf->agf_flfirst);
 
 	/* open coded XFS_BUF_TO_AGFL_BNO */
@@ -252,102 +425,68 @@ scan_freelist(
 	/* verify agf values before proceeding */
 	if (be32_to_cpu(agf->agf_flfirst) >= XFS_AGFL_SIZE(mp) ||
 	    be32_to_cpu(agf->agf_fllast) >= XFS_AGFL_SIZE(mp)) {
-		dbprintf(_("agf %d freelist blocks bad, skipping "
+		fprintf(as->fp, _("agf %d freelist blocks bad, skipping "
 			  "freelist scan\n"), i);
-		pop_cur();
-		return;
+		as->errors++;
+		goto out;
 	}
 
 	for (;;) {
 		bno = be32_to_cpu(agfl_bno[i]);
-		addtohist(seqno, bno, 1);
+		addtohist(as, seqno, bno, 1);
 		if (i == be32_to_cpu(agf->agf_fllast))
 			break;
 		if (++i == XFS_AGFL_SIZE(mp))
 			i = 0;
 	}
-	pop_cur();
+out:
+	xfree(agfl);
 }
 
 static void
-scan_sbtree(
-	xfs_agf_t	*agf,
-	xfs_agblock_t	root,
-	typnm_t		typ,
-	int		nlevels,
-	void		(*func)(struct xfs_btree_block	*block,
-				typnm_t			typ,
-				int			level,
-				xfs_agf_t		*agf))
-{
-	xfs_agnumber_t	seqno = be32_to_cpu(agf->agf_seqno);
-
-	push_cur();
-	set_cur(&typtab[typ], XFS_AGB_TO_DADDR(mp, seqno, root),
-		blkbb, DB_RING_IGN, NULL);
-	if (iocur_top->data == NULL) {
-		dbprintf(_("can't read btree block %u/%u\n"), seqno, root);
-		return;
-	}
-	(*func)(iocur_top->data, typ, nlevels - 1, agf);
-	pop_cur();
-}
-
-/*ARGSUSED*/
-static void
-scanfunc_bno(
-	struct xfs_btree_block	*block,
-	typnm_t			typ,
+scanfunc_alloc(
+	btwalk_t		*bw,
+	xfs_daddr_t		daddr,
 	int			level,
-	xfs_agf_t		*agf)
+	int			tag,
+	void			*buf,
+	void			*arg)
 {
+	agstat_t		*as = arg;
+	struct xfs_btree_block	*block = buf;
 	int			i;
+	int			nrecs;
 	xfs_alloc_ptr_t		*pp;
 	xfs_alloc_rec_t		*rp;
 
-	if (!(be32_to_cpu(block->bb_magic) == XFS_ABTB_MAGIC ||
-	      be32_to_cpu(block->bb_magic) == XFS_ABTB_CRC_MAGIC))
-		return;
-
-	if (level == 0) {
-		rp = XFS_ALLOC_REC_ADDR(mp, block, 1);
-		for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
-			addtohist(be32_to_cpu(agf->agf_seqno),
-					be32_to_cpu(rp[i].ar_startblock),
-					be32_to_cpu(rp[i].ar_blockcount));
+	if (block == NULL) {
+		fprintf(as->fp, _("can't read btree block %u/%u\n"),
+			as->seqno, xfs_daddr_to_agbno(mp, daddr));
+		as->errors++;
 		return;
 	}
-	pp = XFS_ALLOC_PTR_ADDR(mp, block, 1, mp->m_alloc_mxr[1]);
-	for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
-		scan_sbtree(agf, be32_to_cpu(pp[i]), typ, level, scanfunc_bno);
-}
-
-static void
-scanfunc_cnt(
-	struct xfs_btree_block	*block,
-	typnm_t			typ,
-	int			level,
-	xfs_agf_t		*agf)
-{
-	int			i;
-	xfs_alloc_ptr_t		*pp;
-	xfs_alloc_rec_t		*rp;
-
-	if (!(be32_to_cpu(block->bb_magic) == XFS_ABTC_MAGIC ||
-	      be32_to_cpu(block->bb_magic) == XFS_ABTC_CRC_MAGIC))
+	if (countflag ?
+	    !(be32_to_cpu(block->bb_magic) == XFS_ABTC_MAGIC ||
+	      be32_to_cpu(block->bb_magic) == XFS_ABTC_CRC_MAGIC) :
+	    !(be32_to_cpu(block->bb_magic) == XFS_ABTB_MAGIC ||
+	      be32_to_cpu(block->bb_magic) == XFS_ABTB_CRC_MAGIC)) {
+		as->errors++;
 		return;
+	}
 
+	nrecs = be16_to_cpu(block->bb_numrecs);
 	if (level == 0) {
 		rp = XFS_ALLOC_REC_ADDR(mp, block, 1);
-		for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
-			addtohist(be32_to_cpu(agf->agf_seqno),
+		for (i = 0; i < MIN(nrecs, mp->m_alloc_mxr[0]); i++)
+			addtohist(as, as->seqno,
 					be32_to_cpu(rp[i].ar_startblock),
 					be32_to_cpu(rp[i].ar_blockcount));
 		return;
 	}
 	pp = XFS_ALLOC_PTR_ADDR(mp, block, 1, mp->m_alloc_mxr[1]);
-	for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
-		scan_sbtree(agf, be32_to_cpu(pp[i]), typ, level, scanfunc_cnt);
+	for (i = 0; i < MIN(nrecs, mp->m_alloc_mxr[1]); i++)
+		btwalk_add(bw, XFS_AGB_TO_DADDR(mp, as->seqno,
+				be32_to_cpu(pp[i])), level - 1, 0);
 }
 
 static void
@@ -366,20 +505,38 @@ addhistent(
 
 static void
 addtohist(
+	agstat_t	*as,
 	xfs_agnumber_t	agno,
 	xfs_agblock_t	agbno,
 	xfs_extlen_t	len)
+{
+	if (dumpflag)
+		fprintf(as->fp, "%8d %8d %8d\n", agno, agbno, len);
+	if (statsdb) {
+		if (as->nlens == as->maxlens) {
+			as->maxlens = as->maxlens ? as->maxlens * 2 : 64;
+			as->lens = xrealloc(as->lens,
+					as->maxlens * sizeof(*as->lens));
+		}
+		as->lens[as->nlens++] = len;
+	}
+	binext(as, len, 1);
+}
+
+static void
+binext(
+	agstat_t	*as,
+	xfs_extlen_t	len,
+	long long	count)
 {
 	int		i;
 
-	if (dumpflag)
-		dbprintf("%8d %8d %8d\n", agno, agbno, len);
-	totexts++;
-	totblocks += len;
+	as->totexts += count;
+	as->totblocks += len * count;
 	for (i = 0; i < histcount; i++) {
 		if (hist[i].high >= len) {
-			hist[i].count++;
-			hist[i].blocks += len;
+			as->counts[i] += count;
+			as->blocks[i] += len * count;
 			break;
 		}
 	}
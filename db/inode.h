@@ -29,6 +29,8 @@ extern const struct field	timestamp_flds[];
 extern int	fp_dinode_fmt(void *obj, int bit, int count, char *fmtstr,
 			      int size, int arg, int base, int array);
 extern int	inode_a_size(void *obj, int startoff, int idx);
+extern int	inode_cluster(xfs_ino_t ino, xfs_daddr_t *daddr,
+			      int *numblks, int *offset);
 extern void	inode_init(void);
 extern typnm_t	inode_next_type(void);
 extern int	inode_size(void *obj, int startoff, int idx);
@@ -398,26 +398,51 @@ ring_help(void)
 		RING_ENTRIES);
 }
 
+/*
+ * While the batch command runs commands out of script order it takes
+ * the ring entries they make, to add them itself in script order.
+ */
+static void	(*ring_hook)(iocur_t *ioc, void *arg);
+static void	*ring_hook_arg;
+
+void
+ring_divert(
+	void	(*fn)(iocur_t *ioc, void *arg),
+	void	*arg)
+{
+	ring_hook = fn;
+	ring_hook_arg = arg;
+}
 
 void
 ring_add(void)
+{
+	if (ring_hook)
+		ring_hook(iocur_top, ring_hook_arg);
+	else
+		ring_add_entry(iocur_top);
+}
+
+void
+ring_add_entry(
+	iocur_t	*ioc)
 {
 	if (ring_head == -1) {
 		/* only get here right after startup */
 		ring_head = 0;
 		ring_tail = 0;
 		ring_current = 0;
-		iocur_ring[0] = *iocur_top;
+		iocur_ring[0] = *ioc;
 	} else {
 		if (ring_current == ring_head) {
 			ring_head = (ring_head+1)%RING_ENTRIES;
-			iocur_ring[ring_head] = *iocur_top;
+			iocur_ring[ring_head] = *ioc;
 			if (ring_head == ring_tail)
 				ring_tail = (ring_tail+1)%RING_ENTRIES;
 			ring_current = ring_head;
 		} else {
 			ring_current = (ring_current+1)%RING_ENTRIES;
-			iocur_ring[ring_current] = *iocur_top;
+			iocur_ring[ring_current] = *ioc;
 		}
 	}
 }
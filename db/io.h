@@ -61,6 +61,8 @@ extern void     write_cur(void);
 extern void	set_cur(const struct typ *t, __int64_t d, int c, int ring_add,
 			bbmap_t *bbmap);
 extern void     ring_add(void);
+extern void	ring_add_entry(iocur_t *ioc);
+extern void	ring_divert(void (*fn)(iocur_t *ioc, void *arg), void *arg);
 
 static inline bool
 iocur_crc_valid()
@@ -33,6 +33,7 @@ static const cmdinfo_t	log_cmd =
 int		dbprefix;
 static FILE	*log_file;
 static char	*log_file_name;
+static FILE	*capture_file;
 
 int
 dbprintf(const char *fmt, ...)
@@ -42,6 +43,12 @@ dbprintf(const char *fmt, ...)
 
 	if (seenint())
 		return 0;
+	if (capture_file) {
+		va_start(ap, fmt);
+		i = vfprintf(capture_file, fmt, ap);
+		va_end(ap);
+		return i;
+	}
 	va_start(ap, fmt);
 	blockint();
 	i = 0;
@@ -58,6 +65,38 @@ dbprintf(const char *fmt, ...)
 	return i;
 }
 
+/*
+ * Print text collected off to the side (say by a worker thread) one
+ * line at a time, exactly as if each line had gone through dbprintf.
+ */
+void
+dbprintf_lines(
+	const char	*buf,
+	size_t		len)
+{
+	const char	*end = buf + len;
+	const char	*nl;
+
+	while (buf < end) {
+		nl = memchr(buf, '\n', end - buf);
+		if (!nl)
+			nl = end - 1;
+		dbprintf("%.*s", (int)(nl - buf + 1), buf);
+		buf = nl + 1;
+	}
+}
+
+/*
+ * Send everything dbprintf'd to fp, unprefixed and unlogged, until called
+ * again with NULL; it can be passed to dbprintf_lines later on.
+ */
+void
+dbprintf_capture(
+	FILE		*fp)
+{
+	capture_file = fp;
+}
+
 static int
 log_f(
 	int		argc,
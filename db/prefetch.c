@@ -0,0 +1,754 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <xfs/libxfs.h>
+#include <pthread.h>
+#include "init.h"
+#include "malloc.h"
+#include "prefetch.h"
+
+/*
+ * Parallel, batched metadata reading for the commands that scan the
+ * whole filesystem.
+ *
+ * Everything here reads through the device fd into private buffers and
+ * never through the libxfs buffer cache or the iocur stack, so it can
+ * run from as many threads as we like.  Btrees are walked one level at
+ * a time so that all the I/O for a level is in flight at once rather
+ * than one block after another.
+ */
+
+typedef struct bw_blk {
+	xfs_daddr_t	daddr;
+	int		level;
+	int		tag;
+} bw_blk_t;
+
+typedef struct bw_list {
+	bw_blk_t	*blks;
+	int		nblks;
+	int		maxblks;
+} bw_list_t;
+
+struct btwalk {
+	int		len;		/* of every block, in BBs */
+	char		*buf;
+	bw_list_t	cur;		/* level being read */
+	bw_list_t	next;		/* level below it */
+	bw_list_t	sorted;		/* readahead order of cur */
+	int		abort;
+};
+
+static int
+dev_fd(void)
+{
+	return libxfs_device_to_fd(mp->m_ddev_targp->dev);
+}
+
+int
+read_blocks(
+	xfs_daddr_t	daddr,
+	int		len,
+	void		*buf)
+{
+	return pread64(dev_fd(), buf, BBTOB(len), BBTOB(daddr)) !=
+			BBTOB(len);
+}
+
+void
+readahead_blocks(
+	xfs_daddr_t	daddr,
+	int		len)
+{
+	platform_readahead(dev_fd(), BBTOB(daddr), BBTOB(len));
+}
+
+static void
+bw_list_add(
+	bw_list_t	*list,
+	bw_blk_t	*b)
+{
+	if (list->nblks == list->maxblks) {
+		list->maxblks = list->maxblks ? list->maxblks * 2 : 64;
+		list->blks = xrealloc(list->blks,
+				list->maxblks * sizeof(bw_blk_t));
+	}
+	list->blks[list->nblks++] = *b;
+}
+
+static int
+bw_blk_cmp(
+	const void	*a,
+	const void	*b)
+{
+	const bw_blk_t	*ba = a;
+	const bw_blk_t	*bb = b;
+
+	if (ba->daddr != bb->daddr)
+		return ba->daddr < bb->daddr ? -1 : 1;
+	return 0;
+}
+
+btwalk_t *
+btwalk_alloc(
+	int		len)
+{
+	btwalk_t	*bw;
+
+	bw = xcalloc(1, sizeof(*bw));
+	bw->len = len;
+	bw->buf = xmalloc(BBTOB(len));
+	return bw;
+}
+
+void
+btwalk_free(
+	btwalk_t	*bw)
+{
+	xfree(bw->buf);
+	xfree(bw->cur.blks);
+	xfree(bw->next.blks);
+	xfree(bw->sorted.blks);
+	xfree(bw);
+}
+
+void
+btwalk_add(
+	btwalk_t	*bw,
+	xfs_daddr_t	daddr,
+	int		level,
+	int		tag)
+{
+	bw_blk_t	b;
+
+	b.daddr = daddr;
+	b.level = level;
+	b.tag = tag;
+	bw_list_add(&bw->next, &b);
+}
+
+void
+btwalk_abort(
+	btwalk_t	*bw)
+{
+	bw->abort = 1;
+}
+
+/*
+ * Start readahead of a whole level, merging neighbouring blocks into
+ * one request.
+ */
+static void
+btwalk_readahead(
+	btwalk_t	*bw)
+{
+	bw_list_t	*s = &bw->sorted;
+	xfs_daddr_t	start;
+	xfs_daddr_t	end;
+	int		i;
+
+	if (bw->cur.nblks < 2) {
+		if (bw->cur.nblks)
+			readahead_blocks(bw->cur.blks[0].daddr, bw->len);
+		return;
+	}
+	if (s->maxblks < bw->cur.nblks) {
+		s->maxblks = bw->cur.maxblks;
+		s->blks = xrealloc(s->blks, s->maxblks * sizeof(bw_blk_t));
+	}
+	memcpy(s->blks, bw->cur.blks, bw->cur.nblks * sizeof(bw_blk_t));
+	s->nblks = bw->cur.nblks;
+	qsort(s->blks, s->nblks, sizeof(bw_blk_t), bw_blk_cmp);
+
+	start = s->blks[0].daddr;
+	end = start + bw->len;
+	for (i = 1; i < s->nblks; i++) {
+		if (s->blks[i].daddr <= end) {
+			end = MAX(end, s->blks[i].daddr + bw->len);
+			continue;
+		}
+		readahead_blocks(start, end - start);
+		start = s->blks[i].daddr;
+		end = start + bw->len;
+	}
+	readahead_blocks(start, end - start);
+}
+
+void
+btwalk_run(
+	btwalk_t	*bw,
+	btwalk_f_t	func,
+	void		*arg)
+{
+	bw_list_t	level;
+	bw_blk_t	*b;
+	int		i;
+
+	bw->abort = 0;
+	while (bw->next.nblks && !bw->abort) {
+		level = bw->cur;
+		bw->cur = bw->next;
+		bw->next = level;
+		bw->next.nblks = 0;
+
+		btwalk_readahead(bw);
+		for (i = 0; i < bw->cur.nblks && !bw->abort; i++) {
+			b = &bw->cur.blks[i];
+			if (read_blocks(b->daddr, bw->len, bw->buf))
+				func(bw, b->daddr, b->level, b->tag, NULL, arg);
+			else
+				func(bw, b->daddr, b->level, b->tag, bw->buf,
+					arg);
+		}
+	}
+	bw->cur.nblks = 0;
+	bw->next.nblks = 0;
+}
+
+/*
+ * Parallel per-AG driver.  Workers may run up to AGSCAN_AHEAD AGs per
+ * thread ahead of the one the caller is waiting to finish, which bounds
+ * how many per-AG results are held at once.
+ */
+#define	AGSCAN_AHEAD	2
+
+static struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	claim;		/* workers wait for an AG to scan */
+	pthread_cond_t	done;		/* caller waits for the next AG */
+	char		*finished;
+	xfs_agnumber_t	next_ag;
+	xfs_agnumber_t	limit;
+	agscan_f_t	scan;
+	void		*arg;
+} as;
+
+static void *
+agscan_thread(
+	void		*arg)
+{
+	xfs_agnumber_t	agno;
+
+	for (;;) {
+		pthread_mutex_lock(&as.lock);
+		while (as.next_ag < mp->m_sb.sb_agcount &&
+		       as.next_ag >= as.limit)
+			pthread_cond_wait(&as.claim, &as.lock);
+		if (as.next_ag >= mp->m_sb.sb_agcount) {
+			pthread_mutex_unlock(&as.lock);
+			return NULL;
+		}
+		agno = as.next_ag++;
+		pthread_mutex_unlock(&as.lock);
+
+		as.scan(agno, as.arg);
+
+		pthread_mutex_lock(&as.lock);
+		as.finished[agno] = 1;
+		pthread_cond_signal(&as.done);
+		pthread_mutex_unlock(&as.lock);
+	}
+}
+
+void
+agscan(
+	int		nthreads,
+	agscan_f_t	scan,
+	agscan_f_t	done,
+	void		*arg)
+{
+	pthread_t	*threads = NULL;
+	xfs_agnumber_t	agno;
+	int		started = 0;
+	int		i;
+
+	if (nthreads > mp->m_sb.sb_agcount)
+		nthreads = mp->m_sb.sb_agcount;
+	if (nthreads > 1) {
+		as.finished = xcalloc(mp->m_sb.sb_agcount, 1);
+		as.next_ag = 0;
+		as.limit = nthreads * AGSCAN_AHEAD;
+		as.scan = scan;
+		as.arg = arg;
+		pthread_mutex_init(&as.lock, NULL);
+		pthread_cond_init(&as.claim, NULL);
+		pthread_cond_init(&as.done, NULL);
+		threads = xmalloc(nthreads * sizeof(pthread_t));
+		for (i = 0; i < nthreads; i++) {
+			if (pthread_create(&threads[i], NULL, agscan_thread,
+					NULL))
+				break;
+			started++;
+		}
+	}
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		if (!started) {
+			scan(agno, arg);
+			done(agno, arg);
+			continue;
+		}
+		pthread_mutex_lock(&as.lock);
+		while (!as.finished[agno])
+			pthread_cond_wait(&as.done, &as.lock);
+		pthread_mutex_unlock(&as.lock);
+
+		done(agno, arg);
+
+		pthread_mutex_lock(&as.lock);
+		as.limit = agno + 1 + nthreads * AGSCAN_AHEAD;
+		pthread_cond_broadcast(&as.claim);
+		pthread_mutex_unlock(&as.lock);
+	}
+
+	if (threads) {
+		for (i = 0; i < started; i++)
+			pthread_join(threads[i], NULL);
+		xfree(threads);
+		xfree(as.finished);
+		pthread_cond_destroy(&as.done);
+		pthread_cond_destroy(&as.claim);
+		pthread_mutex_destroy(&as.lock);
+	}
+}
+
+/*
+ * Readahead for a serial scan of the whole filesystem.
+ *
+ * Worker threads each claim an AG a little ahead of the command's own
+ * scan and walk its free space and inode btrees, then its inode chunks,
+ * and then the bmap btrees and directory blocks of those inodes.  The
+ * command's scan is untouched apart from finding the page cache warm.
+ */
+
+#define	PF_AHEAD	2	/* AGs each thread may run ahead of the scan */
+
+static struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	wait;
+	pthread_t	*threads;
+	int		nthreads;
+	int		flags;
+	xfs_agnumber_t	next_ag;	/* next AG to be claimed */
+	xfs_agnumber_t	done_ag;	/* AGs the scan has finished with */
+	int		stop;
+} pf;
+
+typedef struct pf_ag {
+	xfs_agnumber_t	agno;
+	btwalk_t	*btree;		/* AG btree blocks */
+	btwalk_t	*chunks;	/* inode chunks */
+	btwalk_t	*bmap;		/* bmap btree blocks */
+	xfs_daddr_t	last_chunk;
+} pf_ag_t;
+
+static int
+pf_agbno_ok(
+	xfs_agblock_t	agbno)
+{
+	return agbno != 0 && agbno < mp->m_sb.sb_agblocks;
+}
+
+static int
+pf_fsbno_ok(
+	xfs_dfsbno_t	fsbno)
+{
+	return XFS_FSB_TO_AGNO(mp, fsbno) < mp->m_sb.sb_agcount &&
+	       pf_agbno_ok(XFS_FSB_TO_AGBNO(mp, fsbno));
+}
+
+/*
+ * Sanity check a short form btree block well enough to follow it;
+ * returns the number of records or -1.
+ */
+static int
+pf_sblock_nrecs(
+	struct xfs_btree_block	*block,
+	int			level,
+	uint			*mxr)
+{
+	int			nrecs = be16_to_cpu(block->bb_numrecs);
+
+	if (be16_to_cpu(block->bb_level) != level)
+		return -1;
+	if (nrecs > mxr[level != 0])
+		return -1;
+	return nrecs;
+}
+
+static void
+pf_sblock(
+	btwalk_t		*bw,
+	xfs_daddr_t		daddr,
+	int			level,
+	int			tag,
+	void			*buf,
+	void			*arg)
+{
+	pf_ag_t			*pa = arg;
+	struct xfs_btree_block	*block = buf;
+	__be32			*pp;
+	xfs_inobt_rec_t		*rp;
+	xfs_agblock_t		agbno;
+	xfs_daddr_t		chunk;
+	int			nrecs;
+	int			i;
+
+	if (pf.stop) {
+		btwalk_abort(bw);
+		return;
+	}
+	if (!block)
+		return;
+	switch (be32_to_cpu(block->bb_magic)) {
+	case XFS_ABTB_MAGIC:
+	case XFS_ABTB_CRC_MAGIC:
+	case XFS_ABTC_MAGIC:
+	case XFS_ABTC_CRC_MAGIC:
+		nrecs = pf_sblock_nrecs(block, level, mp->m_alloc_mxr);
+		if (nrecs <= 0 || level == 0)
+			return;
+		pp = XFS_ALLOC_PTR_ADDR(mp, block, 1, mp->m_alloc_mxr[1]);
+		break;
+	case XFS_IBT_MAGIC:
+	case XFS_IBT_CRC_MAGIC:
+		nrecs = pf_sblock_nrecs(block, level, mp->m_inobt_mxr);
+		if (nrecs <= 0)
+			return;
+		if (level) {
+			pp = XFS_INOBT_PTR_ADDR(mp, block, 1,
+					mp->m_inobt_mxr[1]);
+			break;
+		}
+		rp = XFS_INOBT_REC_ADDR(mp, block, 1);
+		for (i = 0; i < nrecs; i++) {
+			agbno = XFS_AGINO_TO_AGBNO(mp,
+					be32_to_cpu(rp[i].ir_startino));
+			if (!pf_agbno_ok(agbno))
+				continue;
+			chunk = XFS_AGB_TO_DADDR(mp, pa->agno, agbno);
+			if (chunk == pa->last_chunk)
+				continue;
+			btwalk_add(pa->chunks, chunk, 0, 0);
+			pa->last_chunk = chunk;
+		}
+		return;
+	default:
+		return;
+	}
+	for (i = 0; i < nrecs; i++) {
+		if (!pf_agbno_ok(be32_to_cpu(pp[i])))
+			continue;
+		btwalk_add(bw, XFS_AGB_TO_DADDR(mp, pa->agno,
+				be32_to_cpu(pp[i])), level - 1, 0);
+	}
+}
+
+/*
+ * Start readahead of the blocks a list of extent records maps.
+ */
+static void
+pf_extents(
+	xfs_bmbt_rec_t		*rp,
+	int			nrecs)
+{
+	xfs_bmbt_irec_t		irec;
+	int			i;
+
+	for (i = 0; i < nrecs; i++) {
+		libxfs_bmbt_disk_get_all(&rp[i], &irec);
+		if (!pf_fsbno_ok(irec.br_startblock) ||
+		    irec.br_blockcount > mp->m_sb.sb_agblocks)
+			continue;
+		readahead_blocks(XFS_FSB_TO_DADDR(mp, irec.br_startblock),
+			XFS_FSB_TO_BB(mp, irec.br_blockcount));
+	}
+}
+
+static void
+pf_bmap_block(
+	btwalk_t		*bw,
+	xfs_daddr_t		daddr,
+	int			level,
+	int			dir,
+	void			*buf,
+	void			*arg)
+{
+	struct xfs_btree_block	*block = buf;
+	xfs_bmbt_ptr_t		*pp;
+	__uint32_t		magic;
+	int			nrecs;
+	int			i;
+
+	if (pf.stop) {
+		btwalk_abort(bw);
+		return;
+	}
+	if (!block)
+		return;
+	magic = be32_to_cpu(block->bb_magic);
+	nrecs = be16_to_cpu(block->bb_numrecs);
+	if ((magic != XFS_BMAP_MAGIC && magic != XFS_BMAP_CRC_MAGIC) ||
+	    be16_to_cpu(block->bb_level) != level ||
+	    nrecs > mp->m_bmap_dmxr[level != 0])
+		return;
+	if (level == 0) {
+		if (dir && (pf.flags & PF_DIRS))
+			pf_extents(XFS_BMBT_REC_ADDR(mp, block, 1), nrecs);
+		return;
+	}
+	pp = XFS_BMBT_PTR_ADDR(mp, block, 1, mp->m_bmap_dmxr[1]);
+	for (i = 0; i < nrecs; i++) {
+		if (!pf_fsbno_ok(be64_to_cpu(pp[i])))
+			continue;
+		btwalk_add(bw, XFS_FSB_TO_DADDR(mp, be64_to_cpu(pp[i])),
+			level - 1, dir);
+	}
+}
+
+/*
+ * Queue the children of an inode fork's bmap btree root.
+ */
+static void
+pf_bmroot(
+	pf_ag_t			*pa,
+	xfs_bmdr_block_t	*dib,
+	int			size,
+	int			dir)
+{
+	int			level;
+	int			nrecs;
+	xfs_bmbt_ptr_t		*pp;
+	int			i;
+
+	if (size < sizeof(xfs_bmdr_block_t))
+		return;
+	level = be16_to_cpu(dib->bb_level);
+	nrecs = be16_to_cpu(dib->bb_numrecs);
+	if (level == 0 || level >= mp->m_bm_maxlevels[0] ||
+	    nrecs > xfs_bmdr_maxrecs(mp, size, 0))
+		return;
+	pp = XFS_BMDR_PTR_ADDR(dib, 1, xfs_bmdr_maxrecs(mp, size, 0));
+	for (i = 0; i < nrecs; i++) {
+		if (!pf_fsbno_ok(be64_to_cpu(pp[i])))
+			continue;
+		btwalk_add(pa->bmap, XFS_FSB_TO_DADDR(mp, be64_to_cpu(pp[i])),
+			level - 1, dir);
+	}
+}
+
+static void
+pf_chunk(
+	btwalk_t		*bw,
+	xfs_daddr_t		daddr,
+	int			level,
+	int			tag,
+	void			*buf,
+	void			*arg)
+{
+	pf_ag_t			*pa = arg;
+	xfs_dinode_t		*dip;
+	int			ninodes;
+	int			dir;
+	int			i;
+
+	if (pf.stop) {
+		btwalk_abort(bw);
+		return;
+	}
+	if (!buf)
+		return;
+	ninodes = XFS_IALLOC_BLOCKS(mp) << mp->m_sb.sb_inopblog;
+	for (i = 0; i < ninodes; i++) {
+		dip = (xfs_dinode_t *)((char *)buf +
+				(i << mp->m_sb.sb_inodelog));
+		if (be16_to_cpu(dip->di_magic) != XFS_DINODE_MAGIC ||
+		    !dip->di_mode)
+			continue;
+		/* nothing here is verified yet, so keep inside the inode */
+		if (XFS_DFORK_BOFF(dip) > XFS_LITINO(mp, dip->di_version))
+			continue;
+		dir = S_ISDIR(be16_to_cpu(dip->di_mode));
+		if (dip->di_format == XFS_DINODE_FMT_BTREE &&
+		    (pf.flags & PF_BMAP))
+			pf_bmroot(pa, (xfs_bmdr_block_t *)XFS_DFORK_DPTR(dip),
+				XFS_DFORK_DSIZE(dip, mp), dir);
+		else if (dip->di_format == XFS_DINODE_FMT_EXTENTS && dir &&
+			 (pf.flags & PF_DIRS) &&
+			 be32_to_cpu(dip->di_nextents) <=
+				XFS_DFORK_DSIZE(dip, mp) /
+					sizeof(xfs_bmbt_rec_t))
+			pf_extents((xfs_bmbt_rec_t *)XFS_DFORK_DPTR(dip),
+				be32_to_cpu(dip->di_nextents));
+		if (XFS_DFORK_Q(dip) &&
+		    dip->di_aformat == XFS_DINODE_FMT_BTREE &&
+		    (pf.flags & PF_BMAP))
+			pf_bmroot(pa, (xfs_bmdr_block_t *)XFS_DFORK_APTR(dip),
+				XFS_DFORK_ASIZE(dip, mp), 0);
+	}
+}
+
+static void
+pf_add_root(
+	pf_ag_t		*pa,
+	xfs_agblock_t	root,
+	int		levels)
+{
+	if (!pf_agbno_ok(root) || levels < 1 ||
+	    levels > MAX(mp->m_ag_maxlevels, mp->m_in_maxlevels))
+		return;
+	btwalk_add(pa->btree, XFS_AGB_TO_DADDR(mp, pa->agno, root),
+		levels - 1, 0);
+}
+
+static void
+pf_scan_ag(
+	pf_ag_t		*pa,
+	char		*sect)
+{
+	xfs_agf_t	*agf = (xfs_agf_t *)sect;
+	xfs_agi_t	*agi = (xfs_agi_t *)sect;
+	xfs_daddr_t	daddr;
+	int		sectbb = XFS_FSS_TO_BB(mp, 1);
+
+	/* superblock, AGF, AGI and AGFL are the first four sectors */
+	daddr = XFS_AGB_TO_DADDR(mp, pa->agno, 0);
+	readahead_blocks(daddr, sectbb * 4);
+
+	if ((pf.flags & PF_FREESP) &&
+	    !read_blocks(daddr + XFS_AGF_DADDR(mp), sectbb, sect) &&
+	    be32_to_cpu(agf->agf_magicnum) == XFS_AGF_MAGIC) {
+		pf_add_root(pa, be32_to_cpu(agf->agf_roots[XFS_BTNUM_BNO]),
+			be32_to_cpu(agf->agf_levels[XFS_BTNUM_BNO]));
+		pf_add_root(pa, be32_to_cpu(agf->agf_roots[XFS_BTNUM_CNT]),
+			be32_to_cpu(agf->agf_levels[XFS_BTNUM_CNT]));
+	}
+	if ((pf.flags & PF_INODES) &&
+	    !read_blocks(daddr + XFS_AGI_DADDR(mp), sectbb, sect) &&
+	    be32_to_cpu(agi->agi_magicnum) == XFS_AGI_MAGIC)
+		pf_add_root(pa, be32_to_cpu(agi->agi_root),
+			be32_to_cpu(agi->agi_level));
+
+	pa->last_chunk = 0;
+	btwalk_run(pa->btree, pf_sblock, pa);
+	btwalk_run(pa->chunks, pf_chunk, pa);
+	btwalk_run(pa->bmap, pf_bmap_block, pa);
+}
+
+static void *
+pf_thread(
+	void		*arg)
+{
+	pf_ag_t		pa = { 0 };
+	char		*sect;
+
+	sect = xmalloc(mp->m_sb.sb_sectsize);
+	pa.btree = btwalk_alloc(blkbb);
+	pa.chunks = btwalk_alloc(XFS_FSB_TO_BB(mp, XFS_IALLOC_BLOCKS(mp)));
+	pa.bmap = btwalk_alloc(blkbb);
+	for (;;) {
+		pthread_mutex_lock(&pf.lock);
+		while (!pf.stop && pf.next_ag < mp->m_sb.sb_agcount &&
+		       pf.next_ag >= pf.done_ag + pf.nthreads * PF_AHEAD)
+			pthread_cond_wait(&pf.wait, &pf.lock);
+		if (pf.stop || pf.next_ag >= mp->m_sb.sb_agcount) {
+			pthread_mutex_unlock(&pf.lock);
+			break;
+		}
+		pa.agno = pf.next_ag++;
+		pthread_mutex_unlock(&pf.lock);
+
+		pf_scan_ag(&pa, sect);
+	}
+	btwalk_free(pa.btree);
+	btwalk_free(pa.chunks);
+	btwalk_free(pa.bmap);
+	xfree(sect);
+	return NULL;
+}
+
+/*
+ * Start prefetching the metadata selected by flags with nthreads worker
+ * threads.  Returns 0 if prefetch isn't running, in which case the other
+ * calls are no-ops.
+ */
+int
+prefetch_start(
+	int		flags,
+	int		nthreads)
+{
+	int		i;
+
+	if (pf.threads || nthreads <= 0)
+		return 0;
+	if (nthreads > mp->m_sb.sb_agcount)
+		nthreads = mp->m_sb.sb_agcount;
+	pf.flags = flags;
+	pf.next_ag = 0;
+	pf.done_ag = 0;
+	pf.stop = 0;
+	pf.nthreads = 0;
+	pthread_mutex_init(&pf.lock, NULL);
+	pthread_cond_init(&pf.wait, NULL);
+	pf.threads = xmalloc(nthreads * sizeof(pthread_t));
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&pf.threads[i], NULL, pf_thread, NULL))
+			break;
+		pf.nthreads++;
+	}
+	if (!pf.nthreads) {
+		xfree(pf.threads);
+		pf.threads = NULL;
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * The scan is done with agno, let the workers move further ahead.
+ */
+void
+prefetch_ag_done(
+	xfs_agnumber_t	agno)
+{
+	if (!pf.threads)
+		return;
+	pthread_mutex_lock(&pf.lock);
+	pf.done_ag = agno + 1;
+	pthread_cond_broadcast(&pf.wait);
+	pthread_mutex_unlock(&pf.lock);
+}
+
+void
+prefetch_stop(void)
+{
+	int		i;
+
+	if (!pf.threads)
+		return;
+	pthread_mutex_lock(&pf.lock);
+	pf.stop = 1;
+	pthread_cond_broadcast(&pf.wait);
+	pthread_mutex_unlock(&pf.lock);
+	for (i = 0; i < pf.nthreads; i++)
+		pthread_join(pf.threads[i], NULL);
+	xfree(pf.threads);
+	pf.threads = NULL;
+	pthread_cond_destroy(&pf.wait);
+	pthread_mutex_destroy(&pf.lock);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Raw reads of the data device, bypassing the buffer cache and so safe
+ * to use from any thread.
+ */
+extern int	read_blocks(xfs_daddr_t daddr, int len, void *buf);
+extern void	readahead_blocks(xfs_daddr_t daddr, int len);
+
+/*
+ * Btree walk a level at a time: blocks added from a callback make up
+ * the next level, which is all submitted as readahead before any of it
+ * is read.  Blocks are passed to the callback in the order they were
+ * added, so a walk of a btree sees its blocks in key order; block is
+ * NULL if the read failed.
+ */
+typedef struct btwalk	btwalk_t;
+typedef void		(*btwalk_f_t)(btwalk_t *bw, xfs_daddr_t daddr,
+				      int level, int tag, void *block,
+				      void *arg);
+
+extern btwalk_t	*btwalk_alloc(int len);
+extern void	btwalk_free(btwalk_t *bw);
+extern void	btwalk_add(btwalk_t *bw, xfs_daddr_t daddr, int level,
+			   int tag);
+extern void	btwalk_run(btwalk_t *bw, btwalk_f_t func, void *arg);
+extern void	btwalk_abort(btwalk_t *bw);
+
+/*
+ * Run scan on every AG from nthreads threads, and done on each AG in
+ * AG order from the calling thread once its scan has finished.
+ */
+typedef void	(*agscan_f_t)(xfs_agnumber_t agno, void *arg);
+
+extern void	agscan(int nthreads, agscan_f_t scan, agscan_f_t done,
+		       void *arg);
+
+/*
+ * Metadata readahead ahead of a serial whole filesystem scan.
+ */
+#define	PF_FREESP	0x01	/* free space btrees */
+#define	PF_INODES	0x02	/* inode btree and inode chunks */
+#define	PF_BMAP		0x04	/* bmap btrees of btree format inodes */
+#define	PF_DIRS		0x08	/* directory blocks */
+
+extern int	prefetch_start(int flags, int nthreads);
+extern void	prefetch_ag_done(xfs_agnumber_t agno);
+extern void	prefetch_stop(void);
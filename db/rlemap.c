@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <xfs/libxfs.h>
+#include "malloc.h"
+#include "rlemap.h"
+
+/*
+ * Run length encoded per-block value map.
+ *
+ * The block range is cut into fixed size regions.  A region starts out
+ * as nothing at all (every block zero), becomes a sorted array of runs
+ * once something is set in it, and falls back to a plain array of
+ * values once the runs would take more room than that would.  Values
+ * are stored vsize bytes wide in the plain array, so a map of one byte
+ * types never costs more than a byte per block, and a typical
+ * filesystem made of long extents costs a few runs per region.
+ */
+
+#define	RLE_REGION_LOG	12
+#define	RLE_REGION_SIZE	(1 << RLE_REGION_LOG)
+#define	RLE_REGION_MASK	(RLE_REGION_SIZE - 1)
+
+typedef struct rle_run {
+	__uint32_t	start;		/* offset in the region */
+	__uint64_t	val;		/* up to the next run's start */
+} rle_run_t;
+
+typedef struct rle_region {
+	rle_run_t	*runs;
+	void		*dense;
+	__uint32_t	nruns;
+	__uint32_t	maxruns;
+} rle_region_t;
+
+struct rlemap {
+	rle_region_t	*regions;
+	__uint64_t	nblocks;
+	__uint64_t	nregions;
+	int		vsize;
+};
+
+rlemap_t *
+rlemap_alloc(
+	__uint64_t	nblocks,
+	int		vsize)
+{
+	rlemap_t	*map;
+
+	map = xmalloc(sizeof(*map));
+	map->nblocks = nblocks;
+	map->nregions = (nblocks + RLE_REGION_MASK) >> RLE_REGION_LOG;
+	map->vsize = vsize;
+	map->regions = xcalloc(map->nregions ? map->nregions : 1,
+			sizeof(rle_region_t));
+	return map;
+}
+
+void
+rlemap_free(
+	rlemap_t	*map)
+{
+	__uint64_t	r;
+
+	if (!map)
+		return;
+	for (r = 0; r < map->nregions; r++) {
+		xfree(map->regions[r].runs);
+		xfree(map->regions[r].dense);
+	}
+	xfree(map->regions);
+	xfree(map);
+}
+
+static __uint32_t
+rle_region_len(
+	rlemap_t	*map,
+	__uint64_t	r)
+{
+	if (r == map->nregions - 1 && (map->nblocks & RLE_REGION_MASK))
+		return map->nblocks & RLE_REGION_MASK;
+	return RLE_REGION_SIZE;
+}
+
+static __uint64_t
+rle_dense_get(
+	rlemap_t	*map,
+	rle_region_t	*rg,
+	__uint32_t	off)
+{
+	if (map->vsize == 1)
+		return ((__uint8_t *)rg->dense)[off];
+	return ((__uint64_t *)rg->dense)[off];
+}
+
+static void
+rle_dense_set(
+	rlemap_t	*map,
+	rle_region_t	*rg,
+	__uint32_t	start,
+	__uint32_t	end,
+	__uint64_t	val)
+{
+	__uint32_t	i;
+
+	if (map->vsize == 1) {
+		memset((__uint8_t *)rg->dense + start, (__uint8_t)val,
+			end - start);
+		return;
+	}
+	for (i = start; i < end; i++)
+		((__uint64_t *)rg->dense)[i] = val;
+}
+
+/* index of the run holding off */
+static __uint32_t
+rle_find(
+	rle_region_t	*rg,
+	__uint32_t	off)
+{
+	__uint32_t	lo = 0;
+	__uint32_t	hi = rg->nruns;
+	__uint32_t	mid;
+
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (rg->runs[mid].start <= off)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void
+rle_make_dense(
+	rlemap_t	*map,
+	rle_region_t	*rg,
+	__uint32_t	rlen)
+{
+	__uint32_t	i;
+	__uint32_t	end;
+
+	rg->dense = xmalloc((size_t)rlen * map->vsize);
+	for (i = 0; i < rg->nruns; i++) {
+		end = i + 1 < rg->nruns ? rg->runs[i + 1].start : rlen;
+		rle_dense_set(map, rg, rg->runs[i].start, end,
+			rg->runs[i].val);
+	}
+	xfree(rg->runs);
+	rg->runs = NULL;
+	rg->nruns = rg->maxruns = 0;
+}
+
+/*
+ * Set [start, end) of a region to val: the runs it covers are replaced
+ * by at most three (what's left of the first one, the new one, and
+ * what's left of the last one), then equal neighbours are merged.
+ */
+static void
+rle_region_set(
+	rlemap_t	*map,
+	rle_region_t	*rg,
+	__uint32_t	start,
+	__uint32_t	end,
+	__uint32_t	rlen,
+	__uint64_t	val)
+{
+	rle_run_t	new[3];
+	__uint32_t	first;
+	__uint32_t	last;
+	__uint32_t	last_end;
+	__uint32_t	n = 0;
+	__uint32_t	nruns;
+	__uint32_t	i;
+	__uint32_t	lim;
+
+	if (rg->dense) {
+		rle_dense_set(map, rg, start, end, val);
+		return;
+	}
+	if (!rg->runs) {
+		if (!val)
+			return;
+		rg->maxruns = 4;
+		rg->runs = xmalloc(rg->maxruns * sizeof(rle_run_t));
+		rg->runs[0].start = 0;
+		rg->runs[0].val = 0;
+		rg->nruns = 1;
+	}
+
+	first = rle_find(rg, start);
+	last = rle_find(rg, end - 1);
+	last_end = last + 1 < rg->nruns ? rg->runs[last + 1].start : rlen;
+	if (rg->runs[first].start < start)
+		new[n++] = rg->runs[first];
+	new[n].start = start;
+	new[n++].val = val;
+	if (end < last_end) {
+		new[n].start = end;
+		new[n++].val = rg->runs[last].val;
+	}
+
+	nruns = rg->nruns - (last - first + 1) + n;
+	if (nruns > rg->maxruns) {
+		while (rg->maxruns < nruns)
+			rg->maxruns *= 2;
+		rg->runs = xrealloc(rg->runs, rg->maxruns * sizeof(rle_run_t));
+	}
+	memmove(&rg->runs[first + n], &rg->runs[last + 1],
+		(rg->nruns - last - 1) * sizeof(rle_run_t));
+	memcpy(&rg->runs[first], new, n * sizeof(rle_run_t));
+	rg->nruns = nruns;
+
+	/* merge from the run before the new ones to the one after them */
+	i = first ? first : 1;
+	lim = first + n;
+	while (i <= lim && i < rg->nruns) {
+		if (rg->runs[i].val != rg->runs[i - 1].val) {
+			i++;
+			continue;
+		}
+		memmove(&rg->runs[i], &rg->runs[i + 1],
+			(rg->nruns - i - 1) * sizeof(rle_run_t));
+		rg->nruns--;
+		lim--;
+	}
+
+	if (rg->nruns == 1 && !rg->runs[0].val) {
+		xfree(rg->runs);
+		rg->runs = NULL;
+		rg->nruns = rg->maxruns = 0;
+	} else if ((size_t)rg->nruns * sizeof(rle_run_t) >
+		   (size_t)rlen * map->vsize)
+		rle_make_dense(map, rg, rlen);
+}
+
+/*
+ * Value of block bno.  If len isn't NULL it's set to the number of
+ * blocks from bno on, up to the end of the region, with the same value.
+ */
+__uint64_t
+rlemap_get(
+	rlemap_t	*map,
+	__uint64_t	bno,
+	__uint64_t	*len)
+{
+	rle_region_t	*rg = &map->regions[bno >> RLE_REGION_LOG];
+	__uint32_t	off = bno & RLE_REGION_MASK;
+	__uint32_t	rlen = rle_region_len(map, bno >> RLE_REGION_LOG);
+	__uint32_t	end;
+	__uint32_t	i;
+	__uint64_t	val;
+
+	if (rg->dense) {
+		val = rle_dense_get(map, rg, off);
+		if (len) {
+			for (end = off + 1;
+			     end < rlen && rle_dense_get(map, rg, end) == val;
+			     end++)
+				;
+			*len = end - off;
+		}
+		return val;
+	}
+	if (!rg->runs) {
+		if (len)
+			*len = rlen - off;
+		return 0;
+	}
+	i = rle_find(rg, off);
+	if (len) {
+		end = i + 1 < rg->nruns ? rg->runs[i + 1].start : rlen;
+		*len = end - off;
+	}
+	return rg->runs[i].val;
+}
+
+void
+rlemap_set(
+	rlemap_t	*map,
+	__uint64_t	bno,
+	__uint64_t	len,
+	__uint64_t	val)
+{
+	__uint64_t	r;
+	__uint32_t	off;
+	__uint32_t	rlen;
+	__uint32_t	n;
+
+	while (len) {
+		r = bno >> RLE_REGION_LOG;
+		off = bno & RLE_REGION_MASK;
+		rlen = rle_region_len(map, r);
+		n = MIN(len, rlen - off);
+		rle_region_set(map, &map->regions[r], off, off + n, rlen, val);
+		bno += n;
+		len -= n;
+	}
+}
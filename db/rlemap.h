@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+typedef struct rlemap	rlemap_t;
+
+extern rlemap_t		*rlemap_alloc(__uint64_t nblocks, int vsize);
+extern void		rlemap_free(rlemap_t *map);
+extern __uint64_t	rlemap_get(rlemap_t *map, __uint64_t bno,
+				   __uint64_t *len);
+extern void		rlemap_set(rlemap_t *map, __uint64_t bno,
+				   __uint64_t len, __uint64_t val);
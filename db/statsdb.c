@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <xfs/libxfs.h>
+#include "init.h"
+#include "malloc.h"
+#include "output.h"
+#include "statsdb.h"
+
+/*
+ * The file is a header followed by records, each a statsdb_rec_t and
+ * its data padded out to 8 bytes.  It's a local cache, so it's written
+ * in host byte order; one that doesn't belong to this filesystem (or
+ * this host) is ignored and rewritten, but anything that isn't a stats
+ * file at all is left alone.
+ */
+#define	STATSDB_MAGIC	"XFSDBSTS"
+#define	STATSDB_VERSION	2
+
+typedef struct statsdb_hdr {
+	char		magic[8];
+	__uint32_t	version;
+	__uint32_t	agcount;
+	uuid_t		uuid;
+} statsdb_hdr_t;
+
+typedef struct statsdb_rec {
+	__uint32_t	type;
+	__uint32_t	agno;
+	__uint64_t	key;
+	__uint32_t	flags;
+	__uint32_t	pad;
+	__uint64_t	len;
+} statsdb_rec_t;
+
+typedef struct statsdb_ent {
+	__uint64_t	key;
+	__uint32_t	flags;
+	size_t		len;
+	void		*data;		/* NULL if there's no record */
+} statsdb_ent_t;
+
+struct statsdb {
+	char		*path;
+	__uint32_t	agcount;
+	statsdb_ent_t	*ents[STATS_NTYPES];
+};
+
+#define	STATSDB_PAD(n)	(((n) + 7) & ~(size_t)7)
+
+static void
+statsdb_free(
+	statsdb_t	*db)
+{
+	int		i;
+	__uint32_t	agno;
+
+	for (i = 0; i < STATS_NTYPES; i++) {
+		for (agno = 0; agno < db->agcount; agno++)
+			xfree(db->ents[i][agno].data);
+		xfree(db->ents[i]);
+	}
+	xfree(db->path);
+	xfree(db);
+}
+
+static void
+statsdb_load(
+	statsdb_t	*db,
+	FILE		*fp)
+{
+	statsdb_rec_t	rec;
+	statsdb_ent_t	*ent;
+	void		*data;
+
+	while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+		if (rec.len > (1ULL << 40))
+			break;
+		data = xmalloc(STATSDB_PAD(rec.len) ? STATSDB_PAD(rec.len) : 1);
+		if (rec.len &&
+		    fread(data, STATSDB_PAD(rec.len), 1, fp) != 1) {
+			xfree(data);
+			break;
+		}
+		if (rec.type >= STATS_NTYPES || rec.agno >= db->agcount) {
+			xfree(data);
+			continue;
+		}
+		ent = &db->ents[rec.type][rec.agno];
+		xfree(ent->data);
+		ent->key = rec.key;
+		ent->flags = rec.flags;
+		ent->len = rec.len;
+		ent->data = data;
+	}
+}
+
+/*
+ * Records can only be checked against metadata that carries an LSN or
+ * CRC; without metadata CRCs btree blocks can change under an unchanged
+ * AG header or inode, so the stats file isn't used at all.
+ */
+int
+statsdb_usable(void)
+{
+	if (xfs_sb_version_hascrc(&mp->m_sb))
+		return 1;
+	dbprintf(_("filesystem has no metadata CRCs, "
+		   "not using statistics file\n"));
+	return 0;
+}
+
+/*
+ * Returns NULL if path exists and isn't a stats file.
+ */
+statsdb_t *
+statsdb_open(
+	const char	*path)
+{
+	statsdb_t	*db;
+	statsdb_hdr_t	hdr;
+	struct stat	st;
+	FILE		*fp;
+	int		i;
+
+	db = xcalloc(1, sizeof(*db));
+	db->path = xstrdup(path);
+	db->agcount = mp->m_sb.sb_agcount;
+	for (i = 0; i < STATS_NTYPES; i++)
+		db->ents[i] = xcalloc(db->agcount, sizeof(statsdb_ent_t));
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return db;
+	if (fstat(fileno(fp), &st) == 0 && st.st_size == 0) {
+		fclose(fp);
+		return db;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    memcmp(hdr.magic, STATSDB_MAGIC, sizeof(hdr.magic)) != 0) {
+		dbprintf(_("%s is not a statistics file\n"), path);
+		fclose(fp);
+		statsdb_free(db);
+		return NULL;
+	}
+	if (hdr.version == STATSDB_VERSION &&
+	    hdr.agcount == db->agcount &&
+	    !platform_uuid_compare(&hdr.uuid, &mp->m_sb.sb_uuid))
+		statsdb_load(db, fp);
+	fclose(fp);
+	return db;
+}
+
+static int
+statsdb_write(
+	statsdb_t	*db,
+	FILE		*fp)
+{
+	statsdb_hdr_t	hdr;
+	statsdb_rec_t	rec;
+	statsdb_ent_t	*ent;
+	static char	zero[8];
+	int		i;
+	__uint32_t	agno;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, STATSDB_MAGIC, sizeof(hdr.magic));
+	hdr.version = STATSDB_VERSION;
+	hdr.agcount = db->agcount;
+	platform_uuid_copy(&hdr.uuid, &mp->m_sb.sb_uuid);
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		return -1;
+	memset(&rec, 0, sizeof(rec));
+	for (i = 0; i < STATS_NTYPES; i++) {
+		for (agno = 0; agno < db->agcount; agno++) {
+			ent = &db->ents[i][agno];
+			if (!ent->data)
+				continue;
+			rec.type = i;
+			rec.agno = agno;
+			rec.key = ent->key;
+			rec.flags = ent->flags;
+			rec.len = ent->len;
+			if (fwrite(&rec, sizeof(rec), 1, fp) != 1)
+				return -1;
+			if (ent->len &&
+			    fwrite(ent->data, ent->len, 1, fp) != 1)
+				return -1;
+			if (STATSDB_PAD(ent->len) != ent->len &&
+			    fwrite(zero, STATSDB_PAD(ent->len) - ent->len, 1,
+				   fp) != 1)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Write the file back, replacing the old one only once the new one is
+ * complete, and free everything.
+ */
+int
+statsdb_close(
+	statsdb_t	*db)
+{
+	char		*tmp;
+	FILE		*fp;
+	int		error = 0;
+
+	tmp = xmalloc(strlen(db->path) + 5);
+	sprintf(tmp, "%s.tmp", db->path);
+	fp = fopen(tmp, "w");
+	if (!fp || statsdb_write(db, fp) || fclose(fp) ||
+	    rename(tmp, db->path)) {
+		dbprintf(_("can't write statistics file %s: %s\n"),
+			db->path, strerror(errno));
+		if (fp)
+			unlink(tmp);
+		error = 1;
+	}
+	xfree(tmp);
+	statsdb_free(db);
+	return error;
+}
+
+/*
+ * The record of a type for an AG, or NULL if there is none.
+ */
+void *
+statsdb_get(
+	statsdb_t	*db,
+	int		type,
+	xfs_agnumber_t	agno,
+	__uint64_t	*key,
+	__uint32_t	*flags,
+	size_t		*len)
+{
+	statsdb_ent_t	*ent = &db->ents[type][agno];
+
+	*key = ent->key;
+	*flags = ent->flags;
+	*len = ent->len;
+	return ent->data;
+}
+
+/*
+ * Replace the record of a type for an AG; data must be from xmalloc and
+ * belongs to the db from now on.
+ */
+void
+statsdb_put(
+	statsdb_t	*db,
+	int		type,
+	xfs_agnumber_t	agno,
+	__uint64_t	key,
+	__uint32_t	flags,
+	void		*data,
+	size_t		len)
+{
+	statsdb_ent_t	*ent = &db->ents[type][agno];
+
+	xfree(ent->data);
+	ent->key = key;
+	ent->flags = flags;
+	ent->len = len;
+	ent->data = data;
+}
+
+/*
+ * Sums of the metadata a record was made from, such as an AG header
+ * sector.  With metadata CRCs these cover the LSN of the last change.
+ */
+__uint32_t
+statsdb_sum(
+	const void	*buf,
+	size_t		len)
+{
+	return crc32c(~0U, buf, len);
+}
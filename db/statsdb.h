@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Per-AG results of the frag and freesp scans kept in a file between
+ * runs, so that what has not changed needn't be scanned again.  Each AG
+ * has one slot per type which only its own scan uses, so worker threads
+ * can get and put their AG's record without locking.
+ */
+#define	STATS_FRAG	0
+#define	STATS_FREESP	1
+#define	STATS_NTYPES	2
+
+typedef struct statsdb	statsdb_t;
+
+extern int		statsdb_usable(void);
+extern statsdb_t	*statsdb_open(const char *path);
+extern int		statsdb_close(statsdb_t *db);
+extern void		*statsdb_get(statsdb_t *db, int type,
+				     xfs_agnumber_t agno, __uint64_t *key,
+				     __uint32_t *flags, size_t *len);
+extern void		statsdb_put(statsdb_t *db, int type,
+				    xfs_agnumber_t agno, __uint64_t key,
+				    __uint32_t flags, void *data, size_t len);
+extern __uint32_t	statsdb_sum(const void *buf, size_t len);
@@ -125,4 +125,16 @@ platform_discard_blocks(int fd, uint64_t start, uint64_t len)
 	return 0;
 }
 
+static __inline__ int
+platform_zero_range(int fd, uint64_t start, uint64_t len)
+{
+	return EOPNOTSUPP;
+}
+
+static __inline__ int
+platform_readahead(int fd, uint64_t start, uint64_t len)
+{
+	return EOPNOTSUPP;
+}
+
 #endif	/* __XFS_KFREEBSD_H__ */
@@ -24,22 +24,38 @@
 #define KM_MAYFAIL	0x0008u
 #define KM_LARGE	0x0010u
 
+struct kmem_mag;
+
 typedef struct kmem_zone {
 	int	zone_unitsize;	/* Size in bytes of zone unit           */
 	char	*zone_name;	/* tag name                             */
 	int	allocated;	/* debug: How many currently allocated  */
+	int	highwater;	/* most ever allocated at once          */
+	unsigned long long allocs; /* allocations made, ever            */
+	void	(*zone_ctor)(void *); /* sets up newly carved objects   */
+	int	zone_objsize;	/* unit size, rounded up for alignment  */
+	int	zone_slabsize;	/* bytes carved into objects at a time  */
+	pthread_mutex_t	zone_lock;
+	pthread_key_t	zone_key; /* this thread's magazine             */
+	void	**zone_free;	/* free objects not in any magazine     */
+	int	zone_nfree;
+	int	zone_maxfree;
+	char	*zone_carve;	/* uncarved part of the newest slab     */
+	char	*zone_carve_end;
+	void	**zone_slabs;
+	int	zone_nslabs;
+	struct kmem_mag	*zone_mags; /* every thread's magazine          */
+	struct kmem_zone *zone_next; /* on the list of all zones        */
 } kmem_zone_t;
 
 extern kmem_zone_t *kmem_zone_init(int, char *);
+extern kmem_zone_t *kmem_zone_init_flags(int, char *, unsigned long,
+					 void (*)(void *));
+extern void	kmem_zone_destroy(kmem_zone_t *);
 extern void	*kmem_zone_alloc(kmem_zone_t *, int);
 extern void	*kmem_zone_zalloc(kmem_zone_t *, int);
-
-static inline void
-kmem_zone_free(kmem_zone_t *zone, void *ptr)
-{
-	zone->allocated--;
-	free(ptr);
-}
+extern void	kmem_zone_free(kmem_zone_t *, void *);
+extern void	kmem_zone_report(FILE *);
 
 extern void	*kmem_alloc(size_t, int);
 extern void	*kmem_zalloc(size_t, int);
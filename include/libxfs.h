@@ -134,16 +134,24 @@ struct xfs_buftarg {
 extern void	libxfs_buftarg_init(struct xfs_mount *mp, dev_t ddev,
 				    dev_t logdev, dev_t rtdev);
 
+/* progress callback for long running device operations, in bytes */
+typedef void (libxfs_progress_t)(void *, __uint64_t, __uint64_t);
+
 extern char	*progname;
 extern int	libxfs_init (libxfs_init_t *);
 extern void	libxfs_destroy (void);
 extern int	libxfs_device_to_fd (dev_t);
 extern dev_t	libxfs_device_open (char *, int, int, int);
 extern void	libxfs_device_zero(struct xfs_buftarg *, xfs_daddr_t, uint);
+extern void	libxfs_device_zero_range(struct xfs_buftarg *, xfs_daddr_t,
+				__uint64_t, libxfs_progress_t *, void *);
+extern void	libxfs_device_discard(dev_t, xfs_daddr_t, __uint64_t,
+				unsigned int, libxfs_progress_t *, void *);
 extern void	libxfs_device_close (dev_t);
 extern int	libxfs_device_alignment (void);
 extern void	libxfs_report(FILE *);
 extern void	platform_findsizes(char *path, int fd, long long *sz, int *bsz);
+extern unsigned int platform_discard_granularity(int fd);
 
 /* check or write log footer: specify device, log size in blocks & uuid */
 typedef xfs_caddr_t (libxfs_get_block_t)(xfs_caddr_t, int, void *);
@@ -267,6 +275,7 @@ typedef struct xfs_perag {
 #define LIBXFS_MOUNT_ATTR2		0x0010
 
 #define LIBXFS_BHASHSIZE(sbp) 		(1<<10)
+#define LIBXFS_IHASHSIZE(sbp) 		(1<<9)
 
 extern xfs_mount_t	*libxfs_mount (xfs_mount_t *, xfs_sb_t *,
 				dev_t, dev_t, dev_t, int);
@@ -608,6 +617,9 @@ typedef struct xfs_inode {
 	unsigned int		i_delayed_blks;	/* count of delay alloc blks */
 	xfs_icdinode_t		i_d;		/* most of ondisk inode */
 	xfs_fsize_t		i_size;		/* in-memory size */
+	struct libxfs_icluster	*i_cluster;	/* icache: owning cluster */
+	unsigned int		i_cgen;		/* icache: cluster generation */
+	unsigned int		i_cflags;	/* icache: state flags */
 } xfs_inode_t;
 
 #define LIBXFS_ATTR_ROOT	0x0002	/* use attrs in root namespace */
@@ -651,9 +663,15 @@ extern void	libxfs_trans_ichgtime(struct xfs_trans *,
 extern int	libxfs_iflush_int (xfs_inode_t *, xfs_buf_t *);
 
 /* Inode Cache Interfaces */
+extern struct cache	*libxfs_icache;
+extern struct cache_operations	libxfs_icache_operations;
+extern int	libxfs_ihash_size;
+
 extern int	libxfs_iget (xfs_mount_t *, xfs_trans_t *, xfs_ino_t,
 				uint, xfs_inode_t **, xfs_daddr_t);
 extern void	libxfs_iput (xfs_inode_t *, uint);
+extern void	libxfs_icache_purge(void);
+extern void	libxfs_icluster_invalidate(xfs_buf_t *);
 
 /* Shared utility routines */
 extern unsigned int	libxfs_log2_roundup(unsigned int i);
@@ -722,6 +740,7 @@ void xfs_bmbt_disk_get_all(xfs_bmbt_rec_t *r, xfs_bmbt_irec_t *s);
 /* xfs_da_btree.h */
 #define libxfs_da_brelse		xfs_da_brelse
 #define libxfs_da_hashname		xfs_da_hashname
+#define libxfs_da_hashname_batch	xfs_da_hashname_batch
 #define libxfs_da_shrink_inode		xfs_da_shrink_inode
 #define libxfs_da_read_buf		xfs_da_read_buf
 
@@ -118,6 +118,10 @@ static __inline__ void platform_uuid_copy(uuid_t *dst, uuid_t *src)
 #define BLKDISCARD	_IO(0x12,119)
 #endif
 
+#ifndef BLKZEROOUT
+#define BLKZEROOUT	_IO(0x12,127)
+#endif
+
 static __inline__ int
 platform_discard_blocks(int fd, uint64_t start, uint64_t len)
 {
@@ -128,6 +132,37 @@ platform_discard_blocks(int fd, uint64_t start, uint64_t len)
 	return 0;
 }
 
+/*
+ * Have the device zero a range for us without transferring any data.
+ * Returns an errno if neither offload is available, callers are expected
+ * to fall back to writing zeroes.
+ */
+static __inline__ int
+platform_zero_range(int fd, uint64_t start, uint64_t len)
+{
+#ifdef FALLOC_FL_ZERO_RANGE
+	if (fallocate(fd, FALLOC_FL_ZERO_RANGE, start, len) == 0)
+		return 0;
+#endif
+	{
+		__uint64_t range[2] = { start, len };
+
+		if (ioctl(fd, BLKZEROOUT, &range) == 0)
+			return 0;
+	}
+	return EOPNOTSUPP;
+}
+
+/*
+ * Start asynchronous reads of a range so that later synchronous reads
+ * of it find the data already in the page cache.
+ */
+static __inline__ int
+platform_readahead(int fd, uint64_t start, uint64_t len)
+{
+	return posix_fadvise(fd, start, len, POSIX_FADV_WILLNEED);
+}
+
 #if (__GLIBC__ < 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ <= 1))
 # define constpp	const char * const *
 #else
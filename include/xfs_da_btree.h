@@ -189,6 +189,8 @@ int	xfs_da_shrink_inode(xfs_da_args_t *args, xfs_dablk_t dead_blkno,
 					  struct xfs_buf *dead_buf);
 
 uint xfs_da_hashname(const __uint8_t *name_string, int name_length);
+void xfs_da_hashname_batch(const __uint8_t **names, const int *name_lengths,
+			   xfs_dahash_t *hashes, int count);
 enum xfs_dacmp xfs_da_compname(struct xfs_da_args *args,
 				const unsigned char *name, int len);
 
@@ -22,11 +22,15 @@
  * Macros, structures, prototypes for internal log manager use.
  */
 
-#define XLOG_RHASH_BITS  4
-#define XLOG_RHASH_SIZE	16
-#define XLOG_RHASH_SHIFT 2
+/*
+ * In-flight transactions are hashed by tid.  Logs from busy filesystems
+ * can have thousands of them open at once, and tids are not sequential,
+ * so use a large table and a multiplicative hash.
+ */
+#define XLOG_RHASH_BITS  10
+#define XLOG_RHASH_SIZE	(1 << XLOG_RHASH_BITS)
 #define XLOG_RHASH(tid)	\
-	((((__uint32_t)tid)>>XLOG_RHASH_SHIFT) & (XLOG_RHASH_SIZE-1))
+	((((__uint32_t)(tid)) * 0x9e370001U) >> (32 - XLOG_RHASH_BITS))
 
 #define XLOG_MAX_REGIONS_IN_ITEM   (XFS_MAX_BLOCKSIZE / XFS_BLF_CHUNK / 2 + 1)
 
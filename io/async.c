@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2003-2005 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <xfs/xfs.h>
+#include <xfs/command.h>
+#include "init.h"
+#include "io.h"
+#include "async.h"
+
+/*
+ * Asynchronous pread/pwrite: keeps up to depth I/Os of buffersize in
+ * flight over the same offsets the synchronous loops would use, through
+ * io_uring where the kernel has it and POSIX AIO otherwise.  Registered
+ * buffers and polled completions only mean something to io_uring.
+ */
+
+/*
+ * Next offset and length, the same sequence as the synchronous loops.
+ */
+int
+async_next(
+	async_ctx_t	*ctx,
+	async_req_t	*req)
+{
+	off64_t		*offset = &req->offset;
+	size_t		*len = &req->len;
+
+	if (ctx->stop || ctx->count <= 0)
+		return 0;
+	switch (ctx->direction) {
+	case IO_FORWARD:
+		*offset = ctx->offset;
+		*len = min(ctx->count, buffersize);
+		ctx->offset += *len;
+		break;
+	case IO_BACKWARD:
+		*len = ctx->offset % buffersize;
+		if (!*len)
+			*len = buffersize;
+		*len = min(ctx->count, *len);
+		ctx->offset -= *len;
+		*offset = ctx->offset;
+		break;
+	case IO_RANDOM:
+		*offset = ctx->range ?
+			((random() % ctx->range) / buffersize) * buffersize : 0;
+		*len = buffersize;
+		break;
+	}
+	ctx->count -= *len;
+	if (iolat_enabled)
+		req->start = iolat_now();
+	return 1;
+}
+
+void
+async_complete(
+	async_ctx_t	*ctx,
+	int		slot,
+	ssize_t		res)
+{
+	if (iolat_enabled)
+		iolat_record(&iolat, ctx->reqs[slot].start);
+	if (res < 0) {
+		if (!ctx->error)
+			ctx->error = -res;
+		ctx->stop = 1;
+	} else if (res > 0) {
+		ctx->ops++;
+		ctx->total += res;
+	}
+	if (res < (ssize_t)ctx->reqs[slot].len)
+		ctx->stop = 1;
+	ctx->free[ctx->nfree++] = slot;
+}
+
+
+static int
+posix_aio_run(
+	async_ctx_t		*ctx)
+{
+	const struct aiocb64	**list;
+	struct aiocb64		*cb;
+	int			inflight = 0;
+	int			slot;
+	int			i;
+	int			error;
+
+	list = calloc(ctx->depth, sizeof(*list));
+	if (!list) {
+		perror("calloc");
+		return -2;
+	}
+	for (;;) {
+		while (ctx->nfree) {
+			slot = ctx->free[ctx->nfree - 1];
+			if (!async_next(ctx, &ctx->reqs[slot]))
+				break;
+			cb = &ctx->reqs[slot].cb;
+			memset(cb, 0, sizeof(*cb));
+			cb->aio_fildes = ctx->fd;
+			cb->aio_buf = ctx->reqs[slot].buf;
+			cb->aio_nbytes = ctx->reqs[slot].len;
+			cb->aio_offset = ctx->reqs[slot].offset;
+			if ((ctx->flags & ASYNC_WRITE) ?
+			    aio_write64(cb) : aio_read64(cb)) {
+				async_complete(ctx, slot, -errno);
+				break;
+			}
+			ctx->nfree--;
+			list[slot] = cb;
+			inflight++;
+		}
+		if (!inflight)
+			break;
+
+		if (aio_suspend64(list, ctx->depth, NULL) < 0 &&
+		    errno != EINTR) {
+			perror("aio_suspend64");
+			free(list);
+			return -2;
+		}
+		for (i = 0; i < ctx->depth; i++) {
+			if (!list[i])
+				continue;
+			error = aio_error64(list[i]);
+			if (error == EINPROGRESS)
+				continue;
+			async_complete(ctx, i, error ? -error :
+					aio_return64((struct aiocb64 *)list[i]));
+			list[i] = NULL;
+			inflight--;
+		}
+	}
+	free(list);
+	return 0;
+}
+
+/*
+ * Run the I/O, returning the number of operations done, or -1 after
+ * reporting an error.  For IO_BACKWARD, offset is the end of the range;
+ * for IO_RANDOM, offsets are picked from random() in the range as the
+ * synchronous loop does.
+ */
+int
+async_io(
+	int		fd,
+	int		flags,
+	int		depth,
+	int		direction,
+	off64_t		offset,
+	long long	count,
+	long long	*total)
+{
+	async_ctx_t	ctx;
+	ssize_t		bytes;
+	int		ret;
+	int		i;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.fd = fd;
+	ctx.flags = flags;
+	ctx.depth = depth;
+	ctx.bsize = buffersize;
+	ctx.direction = direction;
+	ctx.offset = offset;
+	ctx.count = count;
+	if (direction == IO_RANDOM) {
+		if ((bytes = (count % buffersize)))
+			count += bytes;
+		ctx.count = max(buffersize, count);
+		ctx.range = ctx.count - buffersize;
+	}
+
+	ctx.reqs = calloc(depth, sizeof(async_req_t));
+	ctx.free = calloc(depth, sizeof(int));
+	if (!ctx.reqs || !ctx.free) {
+		perror("calloc");
+		ret = -2;
+		goto out;
+	}
+	for (i = 0; i < depth; i++) {
+		ctx.reqs[i].buf = memalign(pagesize, buffersize);
+		if (!ctx.reqs[i].buf) {
+			perror("memalign");
+			ret = -2;
+			goto out;
+		}
+		/* writes use the pattern alloc_buffer set up */
+		memcpy(ctx.reqs[i].buf, buffer, buffersize);
+		ctx.free[ctx.nfree++] = depth - 1 - i;
+	}
+
+	ret = uring_run(&ctx);
+	if (ret == -1)
+		ret = posix_aio_run(&ctx);
+out:
+	if (ctx.reqs)
+		for (i = 0; i < depth; i++)
+			free(ctx.reqs[i].buf);
+	free(ctx.reqs);
+	free(ctx.free);
+	if (ret < 0)
+		return -1;
+	if (ctx.error) {
+		fprintf(stderr, "%s: %s\n",
+			(flags & ASYNC_WRITE) ? "pwrite64" : "pread64",
+			strerror(ctx.error));
+		return -1;
+	}
+	*total = ctx.total;
+	return ctx.ops;
+}
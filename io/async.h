@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __XFS_IO_ASYNC_H__
+#define __XFS_IO_ASYNC_H__
+
+#include <aio.h>
+#include <stdint.h>
+
+/*
+ * Asynchronous pread/pwrite (-Q)
+ */
+#define ASYNC_WRITE	(1<<0)	/* write rather than read */
+#define ASYNC_FIXED	(1<<1)	/* registered buffers (io_uring) */
+#define ASYNC_POLL	(1<<2)	/* polled completions (io_uring) */
+
+extern int		async_io(int, int, int, int, off64_t, long long,
+					long long *);
+
+/*
+ * Shared by the I/O engines; io_uring lives apart from the XFS headers
+ * because <linux/io_uring.h> drags in <linux/fs.h>.
+ */
+typedef struct async_req {
+	void		*buf;
+	off64_t		offset;
+	size_t		len;
+	uint64_t	start;		/* for the latency histogram */
+	struct aiocb64	cb;		/* POSIX AIO only */
+} async_req_t;
+
+typedef struct async_ctx {
+	int		fd;
+	int		flags;
+	int		depth;
+	size_t		bsize;		/* buffersize */
+	async_req_t	*reqs;
+	int		*free;		/* stack of idle requests */
+	int		nfree;
+
+	/* the offsets still to do */
+	int		direction;
+	off64_t		offset;
+	long long	count;
+	off64_t		range;		/* IO_RANDOM only */
+
+	/* results */
+	int		stop;		/* error or short I/O, issue no more */
+	int		error;
+	int		ops;
+	long long	total;
+} async_ctx_t;
+
+extern int		async_next(async_ctx_t *, async_req_t *);
+extern void		async_complete(async_ctx_t *, int, ssize_t);
+
+#ifdef HAVE_IO_URING
+extern int		uring_run(async_ctx_t *);
+#else
+#define uring_run(ctx)	(-1)
+#endif
+
+#endif	/* __XFS_IO_ASYNC_H__ */
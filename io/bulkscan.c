@@ -0,0 +1,512 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <pthread.h>
+#include <xfs/xfs.h>
+#include <xfs/command.h>
+#include <xfs/input.h>
+#include <xfs/handle.h>
+#include <xfs/jdm.h>
+#include "init.h"
+#include "io.h"
+
+/*
+ * Bulkstat the whole filesystem of the open file, an AG at a time from
+ * a number of threads, and write out a record for each inode and
+ * optionally each of its extents.  Inode numbers are laid out by AG, so
+ * an AG is a disjoint range of them: a thread starts bulkstat at the
+ * first inode number of its AG and stops at the first one past it.
+ */
+
+static cmdinfo_t bulkscan_cmd;
+
+#define BSCAN_BSTATS	1024		/* inodes per bulkstat call */
+#define BSCAN_BMAPS	256		/* extents per getbmapx call */
+#define BSCAN_FLUSH	(64 * 1024)	/* output buffered per thread */
+
+/*
+ * Binary output: a header, then for each inode a bscan_inode_t followed
+ * by nextents bscan_extent_t if extents were asked for.  Everything is
+ * host endian, and extents are in 512 byte units as for bmap.
+ */
+#define BSCAN_MAGIC	"XFSBSCAN"
+#define BSCAN_VERSION	1
+#define BSCAN_EXTENTS	0x1		/* header flag: -e */
+
+typedef struct bscan_header {
+	char		magic[8];
+	__uint32_t	version;
+	__uint32_t	flags;
+} bscan_header_t;
+
+typedef struct bscan_inode {
+	__uint64_t	ino;
+	__int64_t	size;
+	__int64_t	blocks;		/* filesystem blocks */
+	__uint32_t	mode;
+	__uint32_t	nextents;
+} bscan_inode_t;
+
+typedef struct bscan_extent {
+	__int64_t	offset;
+	__int64_t	block;
+	__int64_t	length;
+	__uint32_t	flags;		/* BMV_OF_* */
+	__uint32_t	pad;
+} bscan_extent_t;
+
+typedef struct bscan {
+	pthread_mutex_t	lock;		/* next_ag, out, totals */
+	xfs_agnumber_t	next_ag;
+	xfs_agnumber_t	agcount;
+	int		agino_log;
+	FILE		*out;
+	jdm_fshandle_t	*fshandle;
+	int		binary;
+	int		extents;
+	int		regonly;
+	long long	minsize;
+	int		minextents;
+	__uint64_t	scanned;
+	__uint64_t	matched;
+	int		error;
+} bscan_t;
+
+typedef struct bscan_buf {
+	char		*data;
+	size_t		len;
+	size_t		size;
+} bscan_buf_t;
+
+static void
+bulkscan_help(void)
+{
+	printf(_(
+"\n"
+" writes out the size and extent count of every inode in the filesystem,\n"
+" and optionally its extent map\n"
+"\n"
+" Example:\n"
+" 'bulkscan -j 8 -e -R -x 100 -o /tmp/map.csv' - extent maps of the files\n"
+"                                              with 100 extents or more\n"
+"\n"
+" Bulkstats the filesystem of the current file, each AG's inodes in turn\n"
+" by one of a number of threads.  The default output is CSV, one line per\n"
+" inode: i,inode,mode,size,blocks,extents with the mode in octal and the\n"
+" blocks in filesystem blocks; and with -e one line per extent after it:\n"
+" e,inode,offset,block,length,flags in 512 byte units, as for bmap.\n"
+" Lines for different AGs may be interleaved in blocks.\n"
+" -j -- number of threads (default: the number of online CPUs)\n"
+" -e -- open each file and directory by handle and write its extent map\n"
+" -B -- write a compact binary format rather than CSV\n"
+" -o -- write to the given file rather than stdout\n"
+" -R -- regular files only\n"
+" -s -- only inodes of at least the given size\n"
+" -x -- only inodes with at least the given number of extents\n"
+"\n"));
+}
+
+static void
+bscan_put(
+	bscan_buf_t	*b,
+	const void	*data,
+	size_t		len)
+{
+	if (b->len + len > b->size) {
+		b->size = max(b->size * 2, b->len + len);
+		b->data = realloc(b->data, b->size);
+		if (!b->data) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+}
+
+static void
+bscan_printf(
+	bscan_buf_t	*b,
+	const char	*fmt,
+	...)
+{
+	char		line[256];
+	va_list		ap;
+	int		len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	bscan_put(b, line, min(len, (int)sizeof(line) - 1));
+}
+
+static void
+bscan_flush(
+	bscan_t		*bs,
+	bscan_buf_t	*b)
+{
+	if (!b->len)
+		return;
+	pthread_mutex_lock(&bs->lock);
+	if (fwrite(b->data, b->len, 1, bs->out) != 1 && !bs->error) {
+		perror("fwrite");
+		bs->error = 1;
+	}
+	pthread_mutex_unlock(&bs->lock);
+	b->len = 0;
+}
+
+/*
+ * The extent map of an inode, with holes left out.  Returns the number
+ * of extents found, or -1 if the file can't be opened (it may have been
+ * removed since it was bulkstat'd) or mapped.
+ */
+static int
+bscan_bmap(
+	bscan_t		*bs,
+	xfs_bstat_t	*bstat,
+	bscan_buf_t	*ext)
+{
+	struct getbmapx	map[BSCAN_BMAPS + 1];
+	bscan_extent_t	e;
+	int		nextents = 0;
+	int		fd;
+	int		i;
+
+	fd = jdm_open(bs->fshandle, bstat, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	memset(map, 0, sizeof(map));
+	map[0].bmv_length = -1;
+	map[0].bmv_count = BSCAN_BMAPS + 1;
+	map[0].bmv_iflags = BMV_IF_NO_DMAPI_READ | BMV_IF_PREALLOC |
+			    BMV_IF_NO_HOLES;
+	for (;;) {
+		if (ioctl(fd, XFS_IOC_GETBMAPX, map) < 0) {
+			close(fd);
+			return -1;
+		}
+		for (i = 1; i <= map[0].bmv_entries; i++) {
+			if (map[i].bmv_block == -1)
+				continue;
+			e.offset = map[i].bmv_offset;
+			e.block = map[i].bmv_block;
+			e.length = map[i].bmv_length;
+			e.flags = map[i].bmv_oflags;
+			e.pad = 0;
+			if (bs->binary)
+				bscan_put(ext, &e, sizeof(e));
+			else
+				bscan_printf(ext, "e,%llu,%lld,%lld,%lld,%u\n",
+					(unsigned long long)bstat->bs_ino,
+					(long long)e.offset,
+					(long long)e.block,
+					(long long)e.length, e.flags);
+			nextents++;
+		}
+		if (map[0].bmv_entries < BSCAN_BMAPS ||
+		    (map[map[0].bmv_entries].bmv_oflags & BMV_OF_LAST))
+			break;
+		/* carry on from the end of the last one */
+		i = map[0].bmv_entries;
+		map[0].bmv_offset = map[i].bmv_offset + map[i].bmv_length;
+		map[0].bmv_length = -1;
+	}
+	close(fd);
+	return nextents;
+}
+
+/* returns 1 if the inode was written out */
+static int
+bscan_inode(
+	bscan_t		*bs,
+	xfs_bstat_t	*bstat,
+	bscan_buf_t	*b,
+	bscan_buf_t	*ext)
+{
+	bscan_inode_t	rec;
+	int		type = bstat->bs_mode & S_IFMT;
+	int		nextents = bstat->bs_extents;
+
+	if (bs->regonly && type != S_IFREG)
+		return 0;
+	if (bstat->bs_size < bs->minsize || bstat->bs_extents < bs->minextents)
+		return 0;
+
+	ext->len = 0;
+	if (bs->extents && (type == S_IFREG || type == S_IFDIR)) {
+		nextents = bscan_bmap(bs, bstat, ext);
+		if (nextents < 0)
+			return 0;
+	} else if (bs->extents && bs->binary) {
+		nextents = 0;
+	}
+
+	if (bs->binary) {
+		rec.ino = bstat->bs_ino;
+		rec.size = bstat->bs_size;
+		rec.blocks = bstat->bs_blocks;
+		rec.mode = bstat->bs_mode;
+		rec.nextents = nextents;
+		bscan_put(b, &rec, sizeof(rec));
+	} else {
+		bscan_printf(b, "i,%llu,%o,%lld,%lld,%d\n",
+			(unsigned long long)bstat->bs_ino, bstat->bs_mode,
+			(long long)bstat->bs_size, (long long)bstat->bs_blocks,
+			nextents);
+	}
+	if (ext->len)
+		bscan_put(b, ext->data, ext->len);
+	if (b->len >= BSCAN_FLUSH)
+		bscan_flush(bs, b);
+	return 1;
+}
+
+static void *
+bscan_thread(
+	void		*arg)
+{
+	bscan_t		*bs = arg;
+	xfs_fsop_bulkreq_t bulkreq;
+	xfs_bstat_t	*bstats;
+	bscan_buf_t	b = { NULL, 0, 0 };
+	bscan_buf_t	ext = { NULL, 0, 0 };
+	xfs_agnumber_t	agno;
+	__u64		lastino;
+	__uint64_t	scanned = 0;
+	__uint64_t	matched = 0;
+	__s32		count;
+	int		i;
+
+	bstats = calloc(BSCAN_BSTATS, sizeof(xfs_bstat_t));
+	if (!bstats) {
+		perror("calloc");
+		pthread_mutex_lock(&bs->lock);
+		bs->error = 1;
+		pthread_mutex_unlock(&bs->lock);
+		return NULL;
+	}
+	bulkreq.lastip = &lastino;
+	bulkreq.icount = BSCAN_BSTATS;
+	bulkreq.ubuffer = bstats;
+	bulkreq.ocount = &count;
+
+	for (;;) {
+		pthread_mutex_lock(&bs->lock);
+		agno = bs->next_ag++;
+		pthread_mutex_unlock(&bs->lock);
+		if (agno >= bs->agcount)
+			break;
+
+		/* bulkstat returns the inodes after lastino */
+		lastino = agno ? ((__u64)agno << bs->agino_log) - 1 : 0;
+		for (;;) {
+			if (xfsctl(file->name, file->fd, XFS_IOC_FSBULKSTAT,
+					&bulkreq) < 0) {
+				pthread_mutex_lock(&bs->lock);
+				if (!bs->error)
+					perror("xfsctl(XFS_IOC_FSBULKSTAT)");
+				bs->error = 1;
+				pthread_mutex_unlock(&bs->lock);
+				goto out;
+			}
+			if (!count)
+				break;
+			for (i = 0; i < count; i++) {
+				if (bstats[i].bs_ino >> bs->agino_log != agno)
+					break;
+				scanned++;
+				matched += bscan_inode(bs, &bstats[i], &b, &ext);
+			}
+			if (i < count)
+				break;
+		}
+	}
+out:
+	bscan_flush(bs, &b);
+
+	pthread_mutex_lock(&bs->lock);
+	bs->scanned += scanned;
+	bs->matched += matched;
+	pthread_mutex_unlock(&bs->lock);
+	free(b.data);
+	free(ext.data);
+	free(bstats);
+	return NULL;
+}
+
+/* log2 rounded up, as the superblock's agblklog and inopblog are */
+static int
+bscan_log2(
+	__uint32_t	v)
+{
+	int		log = 0;
+
+	while ((1ULL << log) < v)
+		log++;
+	return log;
+}
+
+static int
+bulkscan_f(
+	int		argc,
+	char		**argv)
+{
+	bscan_t		bs;
+	bscan_header_t	hdr;
+	pthread_t	*threads;
+	struct timeval	t1, t2;
+	char		*outfile = NULL;
+	char		ts[64];
+	size_t		blocksize, sectsize;
+	int		nthreads = 0;
+	int		c, i;
+
+	memset(&bs, 0, sizeof(bs));
+	init_cvtnum(&blocksize, &sectsize);
+	while ((c = getopt(argc, argv, "Bej:o:Rs:x:")) != EOF) {
+		switch (c) {
+		case 'B':
+			bs.binary = 1;
+			break;
+		case 'e':
+			bs.extents = 1;
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			if (nthreads <= 0) {
+				printf(_("bad thread count -- %s\n"), optarg);
+				return 0;
+			}
+			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		case 'R':
+			bs.regonly = 1;
+			break;
+		case 's':
+			bs.minsize = cvtnum(blocksize, sectsize, optarg);
+			if (bs.minsize < 0) {
+				printf(_("non-numeric size -- %s\n"), optarg);
+				return 0;
+			}
+			break;
+		case 'x':
+			bs.minextents = atoi(optarg);
+			break;
+		default:
+			return command_usage(&bulkscan_cmd);
+		}
+	}
+	if (optind != argc)
+		return command_usage(&bulkscan_cmd);
+	if (!nthreads) {
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (nthreads <= 0)
+			nthreads = 1;
+	}
+
+	bs.agcount = file->geom.agcount;
+	bs.agino_log = bscan_log2(file->geom.agblocks) +
+		       bscan_log2(file->geom.blocksize / file->geom.inodesize);
+	nthreads = min(nthreads, (int)bs.agcount);
+
+	if (bs.extents) {
+		bs.fshandle = jdm_getfshandle(file->name);
+		if (!bs.fshandle) {
+			fprintf(stderr, _("unable to get a handle for %s: %s\n"),
+				file->name, strerror(errno));
+			exitcode = 1;
+			return 0;
+		}
+	}
+	if (!outfile)
+		bs.out = stdout;
+	else if (!(bs.out = fopen(outfile, "w"))) {
+		perror(outfile);
+		exitcode = 1;
+		return 0;
+	}
+	if (bs.binary) {
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, BSCAN_MAGIC, sizeof(hdr.magic));
+		hdr.version = BSCAN_VERSION;
+		hdr.flags = bs.extents ? BSCAN_EXTENTS : 0;
+		fwrite(&hdr, sizeof(hdr), 1, bs.out);
+	}
+
+	threads = calloc(nthreads, sizeof(pthread_t));
+	if (!threads) {
+		perror("calloc");
+		goto out;
+	}
+	pthread_mutex_init(&bs.lock, NULL);
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, bscan_thread, &bs)) {
+			perror("pthread_create");
+			break;
+		}
+	}
+	if (!i)
+		bscan_thread(&bs);
+	while (--i >= 0)
+		pthread_join(threads[i], NULL);
+	gettimeofday(&t2, NULL);
+	t2 = tsub(t2, t1);
+	pthread_mutex_destroy(&bs.lock);
+	free(threads);
+
+	if (bs.error)
+		exitcode = 1;
+	if (outfile) {
+		timestr(&t2, ts, sizeof(ts), 0);
+		printf(_("scanned %llu inodes, wrote %llu, in %s "
+			 "(%.4f inodes/sec)\n"),
+			(unsigned long long)bs.scanned,
+			(unsigned long long)bs.matched, ts,
+			tdiv((double)bs.scanned, t2));
+	}
+out:
+	if (outfile && fclose(bs.out)) {
+		perror(outfile);
+		exitcode = 1;
+	} else if (!outfile) {
+		fflush(stdout);
+	}
+	return 0;
+}
+
+void
+bulkscan_init(void)
+{
+	bulkscan_cmd.name = "bulkscan";
+	bulkscan_cmd.cfunc = bulkscan_f;
+	bulkscan_cmd.argmin = 0;
+	bulkscan_cmd.argmax = -1;
+	bulkscan_cmd.flags = CMD_NOMAP_OK;
+	bulkscan_cmd.args =
+		_("[-j threads] [-eBR] [-s size] [-x extents] [-o file]");
+	bulkscan_cmd.oneline =
+		_("write out the inodes and extent maps of the whole filesystem");
+	bulkscan_cmd.help = bulkscan_help;
+
+	add_command(&bulkscan_cmd);
+}
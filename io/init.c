@@ -56,6 +56,7 @@ init_commands(void)
 {
 	attr_init();
 	bmap_init();
+	bulkscan_init();
 	fadvise_init();
 	file_init();
 	freeze_init();
@@ -64,6 +65,7 @@ init_commands(void)
 	help_init();
 	imap_init();
 	inject_init();
+	job_init();
 	seek_init();
 	madvise_init();
 	mincore_init();
@@ -79,6 +81,7 @@ init_commands(void)
 	resblks_init();
 	sendfile_init();
 	shutdown_init();
+	splice_init();
 	truncate_init();
 	sync_range_init();
 }
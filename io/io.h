@@ -89,8 +89,38 @@ extern int		read_buffer(int, off64_t, long long, long long *,
 					int, int);
 extern void		dump_buffer(off64_t, ssize_t);
 
+/*
+ * Per operation latency recording for the I/O commands (-L, -H)
+ */
+#define IOLAT_SUB_BITS	5
+#define IOLAT_SUB	(1 << IOLAT_SUB_BITS)
+#define IOLAT_BUCKETS	((65 - IOLAT_SUB_BITS) * IOLAT_SUB)
+
+typedef struct iolat {
+	__uint64_t	count;
+	__uint64_t	sum;
+	__uint64_t	min;
+	__uint64_t	max;
+	__uint64_t	buckets[IOLAT_BUCKETS];
+} iolat_t;
+
+extern int		iolat_enabled;
+extern int		iolat_forced;	/* record even without -L */
+extern iolat_t		iolat;		/* of the running command */
+extern void		iolat_reset(iolat_t *);
+extern __uint64_t	iolat_now(void);
+extern void		iolat_record(iolat_t *, __uint64_t);
+extern void		iolat_merge(iolat_t *, iolat_t *);
+extern __uint64_t	iolat_percentile(iolat_t *, double);
+extern int		iolat_dump(iolat_t *, const char *);
+extern void		report_io_times(struct timeval *, long long, int, int);
+extern int		io_reported;
+extern long long	io_report_total;
+extern int		io_report_ops;
+
 extern void		attr_init(void);
 extern void		bmap_init(void);
+extern void		bulkscan_init(void);
 extern void		file_init(void);
 extern void		freeze_init(void);
 extern void		fsync_init(void);
@@ -98,6 +128,7 @@ extern void		getrusage_init(void);
 extern void		help_init(void);
 extern void		imap_init(void);
 extern void		inject_init(void);
+extern void		job_init(void);
 extern void		mmap_init(void);
 extern void		open_init(void);
 extern void		parent_init(void);
@@ -127,6 +158,12 @@ extern void		sendfile_init(void);
 #define sendfile_init()	do { } while (0)
 #endif
 
+#ifdef HAVE_SPLICE
+extern void		splice_init(void);
+#else
+#define splice_init()	do { } while (0)
+#endif
+
 #ifdef HAVE_MADVISE
 extern void		madvise_init(void);
 #else
@@ -0,0 +1,390 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <sys/wait.h>
+#include <xfs/xfs.h>
+#include <xfs/command.h>
+#include <xfs/input.h>
+#include "init.h"
+#include "io.h"
+
+/*
+ * Run copies of an I/O command concurrently and add up what they did.
+ *
+ * Each copy runs in a process of its own: the commands keep their state
+ * (the current file, the I/O buffer, getopt) in globals, so a forked
+ * copy of the whole of xfs_io is the only way to run them side by side
+ * unchanged.  The copies are all held at a pipe until every one of them
+ * is ready, and send back their totals and latency histogram when done.
+ */
+
+static cmdinfo_t job_cmd;
+
+typedef struct job_result {
+	long long	total;		/* bytes, from the command's report */
+	long long	ops;
+	int		reported;	/* zero if the command didn't report */
+	int		pad;
+	iolat_t		lat;
+} job_result_t;
+
+static void
+job_help(void)
+{
+	printf(_(
+"\n"
+" runs copies of an I/O command concurrently, and reports the combined\n"
+" throughput and latencies of all of them\n"
+"\n"
+" Example:\n"
+" 'job -n 4 -F pwrite -b 1m 0 64m' - four writers, to file.0 to file.3\n"
+" 'job -n 8 -r -L pread 0 1g' - eight readers, each 128m of the file\n"
+"\n"
+" Each copy runs in a process of its own, all of them starting together.\n"
+" Commands that report a throughput (pread, pwrite, sendfile) are added\n"
+" up op by op; any other command (fsync, falloc, fpunch...) counts as a\n"
+" single op lasting as long as the command did.\n"
+" -n -- number of copies to run (default: the number of online CPUs)\n"
+" -F -- run each copy on a file of its own, named after the current file\n"
+"       with the copy number appended, created if it doesn't exist\n"
+" -r -- split the range given by the command's last two arguments (offset\n"
+"       and length) into disjoint, block aligned pieces, one per copy\n"
+" -v -- show the output of each copy\n"
+" -C -- print the combined report in a parsable format\n"
+" -L -- include the combined latency percentiles in the report\n"
+" -H -- write the combined latency histogram to the given file as JSON\n"
+"\n"));
+}
+
+static int
+job_xfer(
+	int		fd,
+	void		*buf,
+	size_t		len,
+	int		out)
+{
+	char		*p = buf;
+	ssize_t		n;
+
+	while (len) {
+		n = out ? write(fd, p, len) : read(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Turn the command's trailing offset and length into this copy's share
+ * of them.  Every copy but the last gets the same block aligned piece,
+ * the last one gets whatever is left over.
+ */
+static int
+job_split(
+	int		argc,
+	char		**argv,
+	int		i,
+	int		nr,
+	char		*offbuf,
+	char		*lenbuf,
+	size_t		buflen)
+{
+	long long	offset, length, chunk;
+	size_t		blocksize, sectsize;
+
+	init_cvtnum(&blocksize, &sectsize);
+	offset = cvtnum(blocksize, sectsize, argv[argc - 2]);
+	if (offset < 0) {
+		printf(_("non-numeric offset argument -- %s\n"),
+			argv[argc - 2]);
+		return -1;
+	}
+	length = cvtnum(blocksize, sectsize, argv[argc - 1]);
+	if (length < 0) {
+		printf(_("non-numeric length argument -- %s\n"),
+			argv[argc - 1]);
+		return -1;
+	}
+	chunk = length / nr;
+	if (chunk >= blocksize)
+		chunk -= chunk % blocksize;
+	offset += i * chunk;
+	if (i == nr - 1)
+		chunk = length - i * chunk;
+	snprintf(offbuf, buflen, "%lld", offset);
+	snprintf(lenbuf, buflen, "%lld", chunk);
+	argv[argc - 2] = offbuf;
+	argv[argc - 1] = lenbuf;
+	return 0;
+}
+
+static void
+job_child(
+	const cmdinfo_t	*ct,
+	int		argc,
+	char		**argv,
+	int		i,
+	int		nr,
+	int		Fflag,
+	int		rflag,
+	int		vflag,
+	int		Lflag,
+	int		gofd,
+	int		resfd)
+{
+	job_result_t	r;
+	fileio_t	f;
+	char		name[PATH_MAX];
+	char		offbuf[32], lenbuf[32];
+	__uint64_t	start;
+	char		c;
+	int		fd;
+
+	if (!vflag) {
+		fd = open("/dev/null", O_WRONLY);
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			close(fd);
+		}
+	}
+
+	if (Fflag) {
+		f = *file;
+		snprintf(name, sizeof(name), "%s.%d", file->name, i);
+		f.name = name;
+		f.flags |= IO_CREAT;
+		f.fd = openfile(name, (f.flags & IO_FOREIGN) ? NULL : &f.geom,
+				f.flags, 0600);
+		if (f.fd < 0)
+			_exit(1);
+		file = &f;
+	}
+	if (rflag && job_split(argc, argv, i, nr, offbuf, lenbuf,
+				sizeof(offbuf)) < 0)
+		_exit(1);
+
+	/* wait for the parent to close its end, i.e. for the others */
+	while (read(gofd, &c, 1) < 0 && errno == EINTR)
+		;
+	close(gofd);
+
+	iolat_forced = Lflag;
+	io_reported = 0;
+	start = iolat_now();
+	command(ct, argc, argv);
+	fflush(stdout);
+
+	memset(&r, 0, sizeof(r));
+	if (io_reported) {
+		r.total = io_report_total;
+		r.ops = io_report_ops;
+		r.reported = 1;
+		if (Lflag)
+			r.lat = iolat;
+	} else {
+		r.ops = 1;
+		if (Lflag)
+			iolat_record(&r.lat, start);
+	}
+	if (job_xfer(resfd, &r, sizeof(r), 1) < 0)
+		_exit(1);
+	_exit(0);
+}
+
+static int
+job_f(
+	int		argc,
+	char		**argv)
+{
+	const cmdinfo_t	*ct;
+	struct timeval	t1, t2;
+	job_result_t	*r;
+	pid_t		*pids;
+	int		*resfds;
+	int		gofds[2];
+	int		resp[2];
+	long long	total = 0;
+	int		ops = 0;
+	int		nr = 0;
+	int		started = 0;
+	int		done = 0;
+	int		Fflag = 0, rflag = 0, vflag = 0;
+	int		Cflag = 0, Lflag = 0;
+	char		*hfile = NULL;
+	int		c, i;
+
+	/* stop at the command name, the rest of the line is its own */
+	while ((c = getopt(argc, argv, "+CFH:Ln:rv")) != EOF) {
+		switch (c) {
+		case 'C':
+			Cflag = 1;
+			break;
+		case 'F':
+			Fflag = 1;
+			break;
+		case 'H':
+			hfile = optarg;
+			break;
+		case 'L':
+			Lflag = 1;
+			break;
+		case 'n':
+			nr = atoi(optarg);
+			if (nr <= 0) {
+				printf(_("bad job count -- %s\n"), optarg);
+				return 0;
+			}
+			break;
+		case 'r':
+			rflag = 1;
+			break;
+		case 'v':
+			vflag = 1;
+			break;
+		default:
+			return command_usage(&job_cmd);
+		}
+	}
+	if (optind == argc)
+		return command_usage(&job_cmd);
+	argc -= optind;
+	argv += optind;
+
+	ct = find_command(argv[0]);
+	if (!ct) {
+		printf(_("command \"%s\" not found\n"), argv[0]);
+		return 0;
+	}
+	if (ct->cfunc == job_f) {
+		printf(_("jobs cannot run jobs\n"));
+		return 0;
+	}
+	if (rflag && argc < 3) {
+		printf(_("-r needs a command ending in an offset and length\n"));
+		return 0;
+	}
+	if (Fflag && !file) {
+		printf(_("-F needs an open file to name the job files after\n"));
+		return 0;
+	}
+	if (!nr) {
+		nr = sysconf(_SC_NPROCESSORS_ONLN);
+		if (nr <= 0)
+			nr = 1;
+	}
+	if (hfile)
+		Lflag = 1;
+
+	pids = calloc(nr, sizeof(pid_t));
+	resfds = calloc(nr, sizeof(int));
+	r = malloc(sizeof(*r));
+	if (!pids || !resfds || !r) {
+		perror("malloc");
+		goto out_free;
+	}
+	if (pipe(gofds) < 0) {
+		perror("pipe");
+		goto out_free;
+	}
+
+	/* don't let the copies inherit anything still buffered */
+	fflush(stdout);
+	fflush(stderr);
+	for (started = 0; started < nr; started++) {
+		if (pipe(resp) < 0) {
+			perror("pipe");
+			break;
+		}
+		pids[started] = fork();
+		if (pids[started] < 0) {
+			perror("fork");
+			close(resp[0]);
+			close(resp[1]);
+			break;
+		}
+		if (!pids[started]) {
+			close(gofds[1]);
+			close(resp[0]);
+			for (i = 0; i < started; i++)
+				close(resfds[i]);
+			job_child(ct, argc, argv, started, nr, Fflag, rflag,
+				vflag, Lflag, gofds[0], resp[1]);
+		}
+		close(resp[1]);
+		resfds[started] = resp[0];
+	}
+	close(gofds[0]);
+
+	/* off they go */
+	gettimeofday(&t1, NULL);
+	close(gofds[1]);
+
+	iolat_reset(&iolat);
+	for (i = 0; i < started; i++) {
+		if (job_xfer(resfds[i], r, sizeof(*r), 0) < 0) {
+			fprintf(stderr, _("job %d failed\n"), i);
+		} else {
+			total += r->total;
+			ops += r->ops;
+			iolat_merge(&iolat, &r->lat);
+			done++;
+		}
+		close(resfds[i]);
+	}
+	for (i = 0; i < started; i++)
+		while (waitpid(pids[i], NULL, 0) < 0 && errno == EINTR)
+			;
+	gettimeofday(&t2, NULL);
+	t2 = tsub(t2, t1);
+
+	if (!done)
+		goto out_free;
+	if (hfile)
+		iolat_dump(&iolat, hfile);
+	if (!Cflag)
+		printf(_("%d of %d jobs of \"%s\" done\n"), done, nr, argv[0]);
+	iolat_enabled = Lflag;
+	report_io_times(&t2, total, ops, Cflag);
+	iolat_enabled = 0;
+out_free:
+	free(pids);
+	free(resfds);
+	free(r);
+	return 0;
+}
+
+void
+job_init(void)
+{
+	job_cmd.name = "job";
+	job_cmd.cfunc = job_f;
+	job_cmd.argmin = 1;
+	job_cmd.argmax = -1;
+	job_cmd.flags = CMD_NOMAP_OK | CMD_FOREIGN_OK;
+	job_cmd.args =
+		_("[-n N] [-Fr] [-vCL] [-H file] command [args...]");
+	job_cmd.oneline =
+		_("run copies of an I/O command concurrently");
+	job_cmd.help = job_help;
+
+	add_command(&job_cmd);
+}
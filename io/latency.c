@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <time.h>
+#include <xfs/xfs.h>
+#include <xfs/command.h>
+#include <xfs/input.h>
+#include "init.h"
+#include "io.h"
+
+/*
+ * Per operation latencies of the I/O commands, kept in a log-linear
+ * histogram: values below 2 * IOLAT_SUB nanoseconds have a bucket each,
+ * and every power of two above that is split into IOLAT_SUB buckets,
+ * so a bucket is never more than 1/IOLAT_SUB of its value wide.
+ */
+
+int		iolat_enabled;
+int		iolat_forced;
+iolat_t		iolat;
+
+/* what the last report_io_times() was given, for job to pick up */
+int		io_reported;
+long long	io_report_total;
+int		io_report_ops;
+
+static int
+iolat_bucket(
+	__uint64_t	ns)
+{
+	int		shift;
+
+	if (ns < 2 * IOLAT_SUB)
+		return ns;
+	shift = 63 - __builtin_clzll(ns) - IOLAT_SUB_BITS;
+	return shift * IOLAT_SUB + (ns >> shift);
+}
+
+/* highest value that lands in a bucket */
+static __uint64_t
+iolat_bucket_high(
+	int		b)
+{
+	int		shift;
+
+	if (b < 2 * IOLAT_SUB)
+		return b;
+	shift = b / IOLAT_SUB - 1;
+	return (((__uint64_t)(b % IOLAT_SUB + IOLAT_SUB + 1)) << shift) - 1;
+}
+
+static __uint64_t
+iolat_bucket_low(
+	int		b)
+{
+	int		shift;
+
+	if (b < 2 * IOLAT_SUB)
+		return b;
+	shift = b / IOLAT_SUB - 1;
+	return ((__uint64_t)(b % IOLAT_SUB + IOLAT_SUB)) << shift;
+}
+
+void
+iolat_reset(
+	iolat_t		*lat)
+{
+	memset(lat, 0, sizeof(*lat));
+}
+
+__uint64_t
+iolat_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+iolat_record(
+	iolat_t		*lat,
+	__uint64_t	start)
+{
+	__uint64_t	ns = iolat_now() - start;
+
+	if (!lat->count || ns < lat->min)
+		lat->min = ns;
+	if (ns > lat->max)
+		lat->max = ns;
+	lat->count++;
+	lat->sum += ns;
+	lat->buckets[iolat_bucket(ns)]++;
+}
+
+void
+iolat_merge(
+	iolat_t		*to,
+	iolat_t		*from)
+{
+	int		b;
+
+	if (!from->count)
+		return;
+	if (!to->count || from->min < to->min)
+		to->min = from->min;
+	if (from->max > to->max)
+		to->max = from->max;
+	to->count += from->count;
+	to->sum += from->sum;
+	for (b = 0; b < IOLAT_BUCKETS; b++)
+		to->buckets[b] += from->buckets[b];
+}
+
+/*
+ * The value below which pct percent of the latencies fall, to within
+ * the width of its bucket.
+ */
+__uint64_t
+iolat_percentile(
+	iolat_t		*lat,
+	double		pct)
+{
+	__uint64_t	want;
+	__uint64_t	seen = 0;
+	int		b;
+
+	if (!lat->count)
+		return 0;
+	want = (__uint64_t)(pct / 100.0 * lat->count + 0.5);
+	if (want < 1)
+		want = 1;
+	for (b = 0; b < IOLAT_BUCKETS; b++) {
+		seen += lat->buckets[b];
+		if (seen >= want)
+			return min(iolat_bucket_high(b), lat->max);
+	}
+	return lat->max;
+}
+
+static const double	iolat_pcts[] = { 50.0, 99.0, 99.9 };
+#define IOLAT_NPCTS	(sizeof(iolat_pcts) / sizeof(iolat_pcts[0]))
+
+/*
+ * Write the histogram out as JSON, for plotting or comparing runs.
+ */
+int
+iolat_dump(
+	iolat_t		*lat,
+	const char	*path)
+{
+	FILE		*fp;
+	const char	*sep = "";
+	int		b;
+	int		i;
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+	fprintf(fp, "{\n  \"ops\": %llu,\n", (unsigned long long)lat->count);
+	fprintf(fp, "  \"min_ns\": %llu,\n  \"max_ns\": %llu,\n",
+		(unsigned long long)lat->min, (unsigned long long)lat->max);
+	fprintf(fp, "  \"mean_ns\": %.1f,\n",
+		lat->count ? (double)lat->sum / lat->count : 0.0);
+	fprintf(fp, "  \"percentiles_ns\": {");
+	for (i = 0; i < IOLAT_NPCTS; i++)
+		fprintf(fp, "%s\"%g\": %llu", i ? ", " : " ", iolat_pcts[i],
+			(unsigned long long)iolat_percentile(lat,
+							      iolat_pcts[i]));
+	fprintf(fp, " },\n  \"buckets\": [");
+	for (b = 0; b < IOLAT_BUCKETS; b++) {
+		if (!lat->buckets[b])
+			continue;
+		fprintf(fp, "%s\n    { \"low_ns\": %llu, \"high_ns\": %llu, "
+			"\"count\": %llu }", sep,
+			(unsigned long long)iolat_bucket_low(b),
+			(unsigned long long)iolat_bucket_high(b),
+			(unsigned long long)lat->buckets[b]);
+		sep = ",";
+	}
+	fprintf(fp, "\n  ]\n}\n");
+	if (fclose(fp)) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * The throughput report common to the I/O commands, followed by the
+ * latencies if they were recorded.  -C gives a parsable format.
+ */
+void
+report_io_times(
+	struct timeval	*t2,
+	long long	total,
+	int		ops,
+	int		compact)
+{
+	char		s1[64], s2[64], ts[64];
+	int		i;
+
+	io_reported = 1;
+	io_report_total = total;
+	io_report_ops = ops;
+	timestr(t2, ts, sizeof(ts), compact ? VERBOSE_FIXED_TIME : 0);
+	if (!compact) {
+		cvtstr((double)total, s1, sizeof(s1));
+		cvtstr(tdiv((double)total, *t2), s2, sizeof(s2));
+		printf(_("%s, %d ops; %s (%s/sec and %.4f ops/sec)\n"),
+			s1, ops, ts, s2, tdiv((double)ops, *t2));
+		if (!iolat_enabled)
+			return;
+		printf(_("latency (usec): min %.3f, avg %.3f"),
+			iolat.min / 1000.0,
+			iolat.count ? iolat.sum / 1000.0 / iolat.count : 0.0);
+		for (i = 0; i < IOLAT_NPCTS; i++)
+			printf(", p%g %.3f", iolat_pcts[i],
+				iolat_percentile(&iolat, iolat_pcts[i]) /
+				1000.0);
+		printf(_(", max %.3f\n"), iolat.max / 1000.0);
+	} else {/* bytes,ops,time,bytes/sec,ops/sec[,min,avg,p50,p99,p99.9,max] */
+		printf("%lld,%d,%s,%.3f,%.3f",
+			total, ops, ts,
+			tdiv((double)total, *t2), tdiv((double)ops, *t2));
+		if (iolat_enabled) {
+			printf(",%.3f,%.3f", iolat.min / 1000.0,
+				iolat.count ?
+					iolat.sum / 1000.0 / iolat.count : 0.0);
+			for (i = 0; i < IOLAT_NPCTS; i++)
+				printf(",%.3f",
+					iolat_percentile(&iolat, iolat_pcts[i]) /
+					1000.0);
+			printf(",%.3f", iolat.max / 1000.0);
+		}
+		printf("\n");
+	}
+}
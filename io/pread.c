@@ -23,6 +23,7 @@
 #include <ctype.h>
 #include "init.h"
 #include "io.h"
+#include "async.h"
 
 static cmdinfo_t pread_cmd;
 
@@ -50,6 +51,11 @@ pread_help(void)
 #ifdef HAVE_PREADV
 " -V N -- use vectored IO with N iovecs of blocksize each (preadv)\n"
 #endif
+" -Q N -- keep N reads in flight at once (asynchronous IO, not with -v or -V)\n"
+" -K   -- use registered buffers for asynchronous reads (io_uring)\n"
+" -P   -- poll for asynchronous read completions (io_uring, needs -d open)\n"
+" -L   -- report read latency percentiles\n"
+" -H F -- write the read latency histogram to file F as JSON\n"
 "\n"
 " When in \"random\" mode, the number of read operations will equal the\n"
 " number required to do a complete forward/backward scan of the range.\n"
@@ -214,10 +220,18 @@ do_pread(
 	ssize_t		count,
 	ssize_t		buffer_size)
 {
-	if (!vectors)
-		return pread64(fd, buffer, min(count, buffer_size), offset);
+	__uint64_t	start = 0;
+	ssize_t		bytes;
 
-	return do_preadv(fd, offset, count, buffer_size);
+	if (iolat_enabled)
+		start = iolat_now();
+	if (!vectors)
+		bytes = pread64(fd, buffer, min(count, buffer_size), offset);
+	else
+		bytes = do_preadv(fd, offset, count, buffer_size);
+	if (iolat_enabled)
+		iolat_record(&iolat, start);
+	return bytes;
 }
 
 static int
@@ -357,6 +371,48 @@ read_forward(
 	return ops;
 }
 
+/*
+ * Work out the range the synchronous loop for the direction would cover,
+ * then read it with depth reads in flight.
+ */
+static int
+read_async(
+	int		fd,
+	off64_t		*offset,
+	long long	*count,
+	long long	*total,
+	unsigned int	seed,
+	int		eof,
+	int		direction,
+	int		depth,
+	int		flags)
+{
+	off64_t		end, off = *offset;
+	long long	cnt = *count;
+	int		ops;
+
+	end = lseek64(fd, 0, SEEK_END);
+	switch (direction) {
+	case IO_RANDOM:
+		srandom(seed ? seed : time(NULL));
+		break;
+	case IO_FORWARD:
+		if (eof)
+			cnt = max(0, end - off);
+		break;
+	case IO_BACKWARD:
+		off = eof ? end : min(end, off);
+		cnt = min(cnt, off);
+		*offset = off;
+		*count = cnt;
+		break;
+	}
+	ops = async_io(fd, flags, depth, direction, off, cnt, total);
+	if (direction == IO_FORWARD && eof)
+		*count = *total;
+	return ops;
+}
+
 int
 read_buffer(
 	int		fd,
@@ -366,7 +422,14 @@ read_buffer(
 	int		verbose,
 	int		onlyone)
 {
-	return read_forward(fd, offset, count, total, verbose, onlyone, 0);
+	int		lat = iolat_enabled;
+	int		ops;
+
+	/* pwrite reading its input isn't what's being timed */
+	iolat_enabled = 0;
+	ops = read_forward(fd, offset, count, total, verbose, onlyone, 0);
+	iolat_enabled = lat;
+	return ops;
 }
 
 static int
@@ -380,17 +443,17 @@ pread_f(
 	long long	count, total, tmp;
 	size_t		fsblocksize, fssectsize;
 	struct timeval	t1, t2;
-	char		s1[64], s2[64], ts[64];
-	char		*sp;
-	int		Cflag, qflag, uflag, vflag;
+	char		*sp, *hfile = NULL;
+	int		Cflag, Lflag, qflag, uflag, vflag;
 	int		eof = 0, direction = IO_FORWARD;
+	int		depth = 0, aflags = 0;
 	int		c;
 
-	Cflag = qflag = uflag = vflag = 0;
+	Cflag = Lflag = qflag = uflag = vflag = 0;
 	init_cvtnum(&fsblocksize, &fssectsize);
 	bsize = fsblocksize;
 
-	while ((c = getopt(argc, argv, "b:BCFRquvV:Z:")) != EOF) {
+	while ((c = getopt(argc, argv, "b:BCFH:KLPQ:RquvV:Z:")) != EOF) {
 		switch (c) {
 		case 'b':
 			tmp = cvtnum(fsblocksize, fssectsize, optarg);
@@ -409,6 +472,26 @@ pread_f(
 		case 'B':
 			direction = IO_BACKWARD;
 			break;
+		case 'H':
+			hfile = optarg;
+			break;
+		case 'K':
+			aflags |= ASYNC_FIXED;
+			break;
+		case 'L':
+			Lflag = 1;
+			break;
+		case 'P':
+			aflags |= ASYNC_POLL;
+			break;
+		case 'Q':
+			depth = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg || depth <= 0) {
+				printf(_("non-numeric queue depth -- %s\n"),
+					optarg);
+				return 0;
+			}
+			break;
 		case 'R':
 			direction = IO_RANDOM;
 			break;
@@ -444,6 +527,8 @@ pread_f(
 	}
 	if (optind != argc - 2)
 		return command_usage(&pread_cmd);
+	if (depth && (vflag || vectors))
+		return command_usage(&pread_cmd);
 
 	offset = cvtnum(fsblocksize, fssectsize, argv[optind]);
 	if (offset < 0 && (direction & (IO_RANDOM|IO_BACKWARD))) {
@@ -464,7 +549,14 @@ pread_f(
 	if (alloc_buffer(bsize, uflag, 0xabababab) < 0)
 		return 0;
 
+	iolat_enabled = Lflag || hfile || iolat_forced;
+	iolat_reset(&iolat);
 	gettimeofday(&t1, NULL);
+	if (depth) {
+		c = read_async(file->fd, &offset, &count, &total, zeed, eof,
+				direction, depth, aflags);
+		goto report;
+	}
 	switch (direction) {
 	case IO_RANDOM:
 		if (!zeed)	/* srandom seed */
@@ -482,27 +574,23 @@ pread_f(
 	default:
 		ASSERT(0);
 	}
+report:
 	if (c < 0)
-		return 0;
-	if (qflag)
-		return 0;
+		goto done;
 	gettimeofday(&t2, NULL);
 	t2 = tsub(t2, t1);
+	if (hfile)
+		iolat_dump(&iolat, hfile);
+	if (qflag)
+		goto done;
 
 	/* Finally, report back -- -C gives a parsable format */
-	timestr(&t2, ts, sizeof(ts), Cflag ? VERBOSE_FIXED_TIME : 0);
-	if (!Cflag) {
-		cvtstr((double)total, s1, sizeof(s1));
-		cvtstr(tdiv((double)total, t2), s2, sizeof(s2));
+	if (!Cflag)
 		printf(_("read %lld/%lld bytes at offset %lld\n"),
 			total, count, (long long)offset);
-		printf(_("%s, %d ops; %s (%s/sec and %.4f ops/sec)\n"),
-			s1, c, ts, s2, tdiv((double)c, t2));
-	} else {/* bytes,ops,time,bytes/sec,ops/sec */
-		printf("%lld,%d,%s,%.3f,%.3f\n",
-			total, c, ts,
-			tdiv((double)total, t2), tdiv((double)c, t2));
-	}
+	report_io_times(&t2, total, c, Cflag);
+done:
+	iolat_enabled = 0;
 	return 0;
 }
 
@@ -515,7 +603,8 @@ pread_init(void)
 	pread_cmd.argmin = 2;
 	pread_cmd.argmax = -1;
 	pread_cmd.flags = CMD_NOMAP_OK | CMD_FOREIGN_OK;
-	pread_cmd.args = _("[-b bs] [-v] [-i N] [-FBR [-Z N]] off len");
+	pread_cmd.args =
+		_("[-b bs] [-v] [-i N] [-FBR [-Z N]] [-Q N [-KP]] [-L] [-H file] off len");
 	pread_cmd.oneline = _("reads a number of bytes at a specified offset");
 	pread_cmd.help = pread_help;
 
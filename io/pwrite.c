@@ -22,6 +22,7 @@
 #include <xfs/input.h>
 #include "init.h"
 #include "io.h"
+#include "async.h"
 
 static cmdinfo_t pwrite_cmd;
 
@@ -54,6 +55,11 @@ pwrite_help(void)
 #ifdef HAVE_PWRITEV
 " -V N -- use vectored IO with N iovecs of blocksize each (pwritev)\n"
 #endif
+" -Q N -- keep N writes in flight at once (asynchronous IO, not with -i or -V)\n"
+" -K   -- use registered buffers for asynchronous writes (io_uring)\n"
+" -P   -- poll for asynchronous write completions (io_uring, needs -d open)\n"
+" -L   -- report write latency percentiles\n"
+" -H F -- write the write latency histogram to file F as JSON\n"
 "\n"));
 }
 
@@ -101,10 +107,18 @@ do_pwrite(
 	ssize_t		count,
 	ssize_t		buffer_size)
 {
-	if (!vectors)
-		return pwrite64(fd, buffer, min(count, buffer_size), offset);
+	__uint64_t	start = 0;
+	ssize_t		bytes;
 
-	return do_pwritev(fd, offset, count, buffer_size);
+	if (iolat_enabled)
+		start = iolat_now();
+	if (!vectors)
+		bytes = pwrite64(fd, buffer, min(count, buffer_size), offset);
+	else
+		bytes = do_pwritev(fd, offset, count, buffer_size);
+	if (iolat_enabled)
+		iolat_record(&iolat, start);
+	return bytes;
 }
 
 static int
@@ -251,17 +265,17 @@ pwrite_f(
 	unsigned int	zeed = 0, seed = 0xcdcdcdcd;
 	size_t		fsblocksize, fssectsize;
 	struct timeval	t1, t2;
-	char		s1[64], s2[64], ts[64];
-	char		*sp, *infile = NULL;
-	int		Cflag, qflag, uflag, dflag, wflag, Wflag;
+	char		*sp, *infile = NULL, *hfile = NULL;
+	int		Cflag, Lflag, qflag, uflag, dflag, wflag, Wflag;
 	int		direction = IO_FORWARD;
+	int		depth = 0, aflags = ASYNC_WRITE;
 	int		c, fd = -1;
 
-	Cflag = qflag = uflag = dflag = wflag = Wflag = 0;
+	Cflag = Lflag = qflag = uflag = dflag = wflag = Wflag = 0;
 	init_cvtnum(&fsblocksize, &fssectsize);
 	bsize = fsblocksize;
 
-	while ((c = getopt(argc, argv, "b:Cdf:i:qs:S:uV:wWZ:")) != EOF) {
+	while ((c = getopt(argc, argv, "b:BCdFf:H:i:KLPQ:qRs:S:uV:wWZ:")) != EOF) {
 		switch (c) {
 		case 'b':
 			tmp = cvtnum(fsblocksize, fssectsize, optarg);
@@ -290,6 +304,26 @@ pwrite_f(
 		case 'i':
 			infile = optarg;
 			break;
+		case 'H':
+			hfile = optarg;
+			break;
+		case 'K':
+			aflags |= ASYNC_FIXED;
+			break;
+		case 'L':
+			Lflag = 1;
+			break;
+		case 'P':
+			aflags |= ASYNC_POLL;
+			break;
+		case 'Q':
+			depth = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg || depth <= 0) {
+				printf(_("non-numeric queue depth -- %s\n"),
+					optarg);
+				return 0;
+			}
+			break;
 		case 's':
 			skip = cvtnum(fsblocksize, fssectsize, optarg);
 			if (skip < 0) {
@@ -339,6 +373,8 @@ pwrite_f(
 		return command_usage(&pwrite_cmd);
 	if (infile && direction != IO_FORWARD)
 		return command_usage(&pwrite_cmd);
+	if (depth && (infile || vectors))
+		return command_usage(&pwrite_cmd);
 	offset = cvtnum(fsblocksize, fssectsize, argv[optind]);
 	if (offset < 0) {
 		printf(_("non-numeric offset argument -- %s\n"), argv[optind]);
@@ -358,7 +394,18 @@ pwrite_f(
 	if (infile && ((fd = openfile(infile, NULL, c, 0)) < 0))
 		return 0;
 
+	iolat_enabled = Lflag || hfile || iolat_forced;
+	iolat_reset(&iolat);
 	gettimeofday(&t1, NULL);
+	if (depth) {
+		if (direction == IO_RANDOM)
+			srandom(zeed ? zeed : time(NULL));
+		if (direction == IO_BACKWARD)
+			count = min(count, offset);
+		c = async_io(file->fd, aflags, depth, direction, offset,
+				count, &total);
+		goto report;
+	}
 	switch (direction) {
 	case IO_RANDOM:
 		if (!zeed)	/* srandom seed */
@@ -375,32 +422,27 @@ pwrite_f(
 		total = 0;
 		ASSERT(0);
 	}
+report:
 	if (c < 0)
 		goto done;
 	if (Wflag)
 		fsync(file->fd);
 	if (wflag)
 		fdatasync(file->fd);
-	if (qflag)
-		goto done;
 	gettimeofday(&t2, NULL);
 	t2 = tsub(t2, t1);
+	if (hfile)
+		iolat_dump(&iolat, hfile);
+	if (qflag)
+		goto done;
 
 	/* Finally, report back -- -C gives a parsable format */
-	timestr(&t2, ts, sizeof(ts), Cflag ? VERBOSE_FIXED_TIME : 0);
-	if (!Cflag) {
-		cvtstr((double)total, s1, sizeof(s1));
-		cvtstr(tdiv((double)total, t2), s2, sizeof(s2));
+	if (!Cflag)
 		printf(_("wrote %lld/%lld bytes at offset %lld\n"),
 			total, count, (long long)offset);
-		printf(_("%s, %d ops; %s (%s/sec and %.4f ops/sec)\n"),
-			s1, c, ts, s2, tdiv((double)c, t2));
-	} else {/* bytes,ops,time,bytes/sec,ops/sec */
-		printf("%lld,%d,%s,%.3f,%.3f\n",
-			total, c, ts,
-			tdiv((double)total, t2), tdiv((double)c, t2));
-	}
+	report_io_times(&t2, total, c, Cflag);
 done:
+	iolat_enabled = 0;
 	if (infile)
 		close(fd);
 	return 0;
@@ -416,7 +458,7 @@ pwrite_init(void)
 	pwrite_cmd.argmax = -1;
 	pwrite_cmd.flags = CMD_NOMAP_OK | CMD_FOREIGN_OK;
 	pwrite_cmd.args =
-_("[-i infile [-d] [-s skip]] [-b bs] [-S seed] [-wW] [-FBR [-Z N]] [-V N] off len");
+_("[-i infile [-d] [-s skip]] [-b bs] [-S seed] [-wW] [-FBR [-Z N]] [-V N] [-Q N [-KP]] [-L] [-H file] off len");
 	pwrite_cmd.oneline =
 		_("writes a number of bytes at a specified offset");
 	pwrite_cmd.help = pwrite_help;
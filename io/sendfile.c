@@ -40,6 +40,8 @@ sendfile_help(void)
 " from user space.\n"
 " -f -- specifies an input file from which to source data to write\n"
 " -i -- specifies an input file name from which to source data to write.\n"
+" -L -- report sendfile latency percentiles\n"
+" -H F -- write the sendfile latency histogram to file F as JSON\n"
 " An offset and length in the source file can be optionally specified.\n"
 "\n"));
 }
@@ -53,11 +55,16 @@ send_buffer(
 {
 	off64_t		off = offset;
 	ssize_t		bytes, bytes_remaining = count;
+	__uint64_t	start = 0;
 	int		ops = 0;
 
 	*total = 0;
 	while (count > 0) {
+		if (iolat_enabled)
+			start = iolat_now();
 		bytes = sendfile64(file->fd, fd, &off, bytes_remaining);
+		if (iolat_enabled)
+			iolat_record(&iolat, start);
 		if (bytes == 0)
 			break;
 		if (bytes < 0) {
@@ -82,18 +89,23 @@ sendfile_f(
 	long long	count, total;
 	size_t		blocksize, sectsize;
 	struct timeval	t1, t2;
-	char		s1[64], s2[64], ts[64];
-	char		*infile = NULL;
-	int		Cflag, qflag;
+	char		*infile = NULL, *hfile = NULL;
+	int		Cflag, Lflag, qflag;
 	int		c, fd = -1;
 
-	Cflag = qflag = 0;
+	Cflag = Lflag = qflag = 0;
 	init_cvtnum(&blocksize, &sectsize);
-	while ((c = getopt(argc, argv, "Cf:i:q")) != EOF) {
+	while ((c = getopt(argc, argv, "Cf:H:i:Lq")) != EOF) {
 		switch (c) {
 		case 'C':
 			Cflag = 1;
 			break;
+		case 'H':
+			hfile = optarg;
+			break;
+		case 'L':
+			Lflag = 1;
+			break;
 		case 'q':
 			qflag = 1;
 			break;
@@ -144,30 +156,26 @@ sendfile_f(
 		count = stat.st_size;
 	}
 
+	iolat_enabled = Lflag || hfile || iolat_forced;
+	iolat_reset(&iolat);
 	gettimeofday(&t1, NULL);
 	c = send_buffer(offset, count, fd, &total);
 	if (c < 0)
 		goto done;
-	if (qflag)
-		goto done;
 	gettimeofday(&t2, NULL);
 	t2 = tsub(t2, t1);
+	if (hfile)
+		iolat_dump(&iolat, hfile);
+	if (qflag)
+		goto done;
 
 	/* Finally, report back -- -C gives a parsable format */
-	timestr(&t2, ts, sizeof(ts), Cflag ? VERBOSE_FIXED_TIME : 0);
-	if (!Cflag) {
-		cvtstr((double)total, s1, sizeof(s1));
-		cvtstr(tdiv((double)total, t2), s2, sizeof(s2));
+	if (!Cflag)
 		printf(_("sent %lld/%lld bytes from offset %lld\n"),
 			total, count, (long long)offset);
-		printf(_("%s, %d ops; %s (%s/sec and %.4f ops/sec)\n"),
-			s1, c, ts, s2, tdiv((double)c, t2));
-	} else {/* bytes,ops,time,bytes/sec,ops/sec */
-		printf("%lld,%d,%s,%.3f,%.3f\n",
-			total, c, ts,
-			tdiv((double)total, t2), tdiv((double)c, t2));
-	}
+	report_io_times(&t2, total, c, Cflag);
 done:
+	iolat_enabled = 0;
 	if (infile)
 		close(fd);
 	return 0;
@@ -183,7 +191,7 @@ sendfile_init(void)
 	sendfile_cmd.argmax = -1;
 	sendfile_cmd.flags = CMD_NOMAP_OK | CMD_FOREIGN_OK;
 	sendfile_cmd.args =
-		_("-i infile | -f N [off len]");
+		_("[-L] [-H file] -i infile | -f N [off len]");
 	sendfile_cmd.oneline =
 		_("Transfer data directly between file descriptors");
 	sendfile_cmd.help = sendfile_help;
@@ -0,0 +1,520 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <xfs/xfs.h>
+#include <xfs/command.h>
+#include <xfs/input.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include "init.h"
+#include "io.h"
+
+/*
+ * The in-kernel copies other than sendfile: copy_file_range, splice
+ * through a pipe, and vmsplice of a mapping through a pipe.  Like
+ * sendfile they write to the open file, at its file position unless
+ * -o says where, and report like pwrite does.
+ */
+
+#ifdef HAVE_COPY_FILE_RANGE
+static cmdinfo_t copy_range_cmd;
+#endif
+static cmdinfo_t splice_cmd;
+static cmdinfo_t vmsplice_cmd;
+
+typedef struct xfer {
+	int		fd;		/* source file */
+	char		*infile;	/* opened by us, to be closed */
+	off64_t		offset;		/* in the source */
+	long long	count;
+	off64_t		dstoff;		/* in the open file */
+	off64_t		*dstp;		/* NULL: use the file position */
+	size_t		bsize;
+	char		*hfile;
+	int		Cflag;
+	int		Lflag;
+	int		qflag;
+} xfer_t;
+
+static void
+xfer_help(
+	const char	*what)
+{
+	printf(_(
+"\n"
+" -b -- the most to transfer in one call (default 4096 bytes)\n"
+" -o -- the offset to write to in the open file, instead of its file\n"
+"       position\n"
+" -C -- print the statistics in a parsable format\n"
+" -q -- don't print the statistics\n"
+" -L -- report %s latency percentiles\n"
+" -H F -- write the %s latency histogram to file F as JSON\n"
+"\n"), what, what);
+}
+
+#ifdef HAVE_COPY_FILE_RANGE
+static void
+copy_range_help(void)
+{
+	printf(_(
+"\n"
+" copies a range of bytes from another file into the open file\n"
+"\n"
+" Example:\n"
+" 'copy_range -i src -b 1m -o 0 0 64m' - copies the first 64m of src over\n"
+"                                        the start of the open file\n"
+"\n"
+" Copies data with copy_file_range(2), which never passes it through user\n"
+" space, and lets filesystems that support it share the source blocks\n"
+" rather than copy them.\n"
+" -f -- specifies an open file (by number) to copy from\n"
+" -i -- specifies the name of a file to copy from\n"
+" An offset and length in the source file can be optionally specified,\n"
+" by default all of it is copied.\n"));
+	xfer_help("copy_file_range");
+}
+#endif
+
+static void
+splice_help(void)
+{
+	printf(_(
+"\n"
+" moves a range of bytes from another file into the open file through a pipe\n"
+"\n"
+" Example:\n"
+" 'splice -f 1 -b 64k 0 1m' - copies the first 1m of open file 1 into the\n"
+"                             open file\n"
+"\n"
+" Splices each piece of data from the source file into a pipe, and then\n"
+" from the pipe into the open file.  The pipe is grown to the transfer\n"
+" size if the system allows.\n"
+" -f -- specifies an open file (by number) to copy from\n"
+" -i -- specifies the name of a file to copy from\n"
+" An offset and length in the source file can be optionally specified,\n"
+" by default all of it is copied.\n"));
+	xfer_help("splice");
+}
+
+static void
+vmsplice_help(void)
+{
+	printf(_(
+"\n"
+" moves a range of the current memory mapping into the open file through\n"
+" a pipe\n"
+"\n"
+" Example:\n"
+" 'vmsplice -b 64k -o 0 0 1m' - writes the first 1m of the mapping to the\n"
+"                               start of the open file\n"
+"\n"
+" Maps the pages of each piece of the mapping into a pipe with vmsplice(2),\n"
+" and then splices them from the pipe into the open file.  The range is\n"
+" given in file offsets, as for mread; the whole mapping by default.\n"));
+	xfer_help("vmsplice");
+}
+
+/*
+ * Options and arguments common to all of them.  vmsplice has no source
+ * file, its default range is all of the mapping.
+ */
+static int
+xfer_args(
+	cmdinfo_t	*ct,
+	int		argc,
+	char		**argv,
+	xfer_t		*x)
+{
+	size_t		blocksize, sectsize;
+	struct stat64	st;
+	int		c, fnum = -1;
+
+	memset(x, 0, sizeof(*x));
+	x->fd = -1;
+	x->bsize = 4096;
+	init_cvtnum(&blocksize, &sectsize);
+	while ((c = getopt(argc, argv,
+			ct == &vmsplice_cmd ? "b:CH:Lo:q" :
+					      "b:Cf:H:i:Lo:q")) != EOF) {
+		switch (c) {
+		case 'b':
+			x->bsize = cvtnum(blocksize, sectsize, optarg);
+			if ((long long)x->bsize <= 0) {
+				printf(_("non-numeric bsize -- %s\n"), optarg);
+				return -1;
+			}
+			break;
+		case 'C':
+			x->Cflag = 1;
+			break;
+		case 'f':
+			fnum = atoi(optarg);
+			if (fnum < 0 || fnum >= filecount) {
+				printf(_("value %d is out of range (0-%d)\n"),
+					fnum, filecount - 1);
+				return -1;
+			}
+			break;
+		case 'H':
+			x->hfile = optarg;
+			break;
+		case 'i':
+			x->infile = optarg;
+			break;
+		case 'L':
+			x->Lflag = 1;
+			break;
+		case 'o':
+			x->dstoff = cvtnum(blocksize, sectsize, optarg);
+			if (x->dstoff < 0) {
+				printf(_("non-numeric offset argument -- %s\n"),
+					optarg);
+				return -1;
+			}
+			x->dstp = &x->dstoff;
+			break;
+		case 'q':
+			x->qflag = 1;
+			break;
+		default:
+			command_usage(ct);
+			return -1;
+		}
+	}
+
+	if (ct != &vmsplice_cmd) {
+		if (!x->infile == (fnum == -1)) {
+			command_usage(ct);
+			return -1;
+		}
+		if (!x->infile)
+			x->fd = filetable[fnum].fd;
+		else if ((x->fd = openfile(x->infile, NULL, IO_READONLY, 0)) < 0)
+			return -1;
+	}
+
+	if (optind == argc - 2) {
+		x->offset = cvtnum(blocksize, sectsize, argv[optind]);
+		if (x->offset < 0) {
+			printf(_("non-numeric offset argument -- %s\n"),
+				argv[optind]);
+			goto out_close;
+		}
+		optind++;
+		x->count = cvtnum(blocksize, sectsize, argv[optind]);
+		if (x->count < 0) {
+			printf(_("non-numeric length argument -- %s\n"),
+				argv[optind]);
+			goto out_close;
+		}
+	} else if (optind != argc) {
+		command_usage(ct);
+		goto out_close;
+	} else if (ct == &vmsplice_cmd) {
+		x->offset = mapping->offset;
+		x->count = mapping->length;
+	} else {
+		if (fstat64(x->fd, &st) < 0) {
+			perror("fstat64");
+			goto out_close;
+		}
+		x->count = st.st_size;
+	}
+	return 0;
+
+out_close:
+	if (x->infile)
+		close(x->fd);
+	return -1;
+}
+
+static void
+xfer_report(
+	xfer_t		*x,
+	struct timeval	*t1,
+	long long	total,
+	int		ops)
+{
+	struct timeval	t2;
+
+	gettimeofday(&t2, NULL);
+	t2 = tsub(t2, *t1);
+	if (x->hfile)
+		iolat_dump(&iolat, x->hfile);
+	if (x->qflag)
+		return;
+
+	/* Finally, report back -- -C gives a parsable format */
+	if (!x->Cflag)
+		printf(_("copied %lld/%lld bytes from offset %lld\n"),
+			total, x->count, (long long)x->offset);
+	report_io_times(&t2, total, ops, x->Cflag);
+}
+
+static void
+xfer_done(
+	xfer_t		*x)
+{
+	iolat_enabled = 0;
+	if (x->infile)
+		close(x->fd);
+}
+
+#ifdef HAVE_COPY_FILE_RANGE
+static ssize_t
+copy_file_range64(
+	int		fd_in,
+	off64_t		*off_in,
+	int		fd_out,
+	off64_t		*off_out,
+	size_t		len,
+	unsigned int	flags)
+{
+	return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out,
+			len, flags);
+}
+
+static int
+copy_range_f(
+	int		argc,
+	char		**argv)
+{
+	xfer_t		x;
+	struct timeval	t1;
+	off64_t		off;
+	long long	total = 0;
+	ssize_t		bytes;
+	__uint64_t	start = 0;
+	int		ops = 0;
+
+	if (xfer_args(&copy_range_cmd, argc, argv, &x) < 0)
+		return 0;
+
+	iolat_enabled = x.Lflag || x.hfile || iolat_forced;
+	iolat_reset(&iolat);
+	gettimeofday(&t1, NULL);
+	off = x.offset;
+	while (total < x.count) {
+		if (iolat_enabled)
+			start = iolat_now();
+		bytes = copy_file_range64(x.fd, &off, file->fd, x.dstp,
+				min((long long)x.bsize, x.count - total), 0);
+		if (iolat_enabled)
+			iolat_record(&iolat, start);
+		if (bytes == 0)
+			break;
+		if (bytes < 0) {
+			perror("copy_file_range");
+			goto done;
+		}
+		ops++;
+		total += bytes;
+	}
+	xfer_report(&x, &t1, total, ops);
+done:
+	xfer_done(&x);
+	return 0;
+}
+#endif
+
+/* write out everything in the pipe */
+static ssize_t
+splice_drain(
+	int		pfd,
+	size_t		len,
+	xfer_t		*x)
+{
+	ssize_t		bytes;
+	size_t		done = 0;
+
+	while (done < len) {
+		bytes = splice(pfd, NULL, file->fd, x->dstp, len - done,
+				SPLICE_F_MOVE);
+		if (bytes <= 0) {
+			if (bytes < 0)
+				perror("splice");
+			else
+				fprintf(stderr, _("splice: short write\n"));
+			return -1;
+		}
+		done += bytes;
+	}
+	return done;
+}
+
+static int
+splice_pipe(
+	int		pfd[2],
+	size_t		bsize)
+{
+	if (pipe(pfd) < 0) {
+		perror("pipe");
+		return -1;
+	}
+#ifdef F_SETPIPE_SZ
+	/* best effort, a pipe smaller than bsize just takes more calls */
+	if (bsize > pagesize)
+		fcntl(pfd[1], F_SETPIPE_SZ, bsize);
+#endif
+	return 0;
+}
+
+static int
+splice_f(
+	int		argc,
+	char		**argv)
+{
+	xfer_t		x;
+	struct timeval	t1;
+	off64_t		off;
+	long long	total = 0;
+	ssize_t		bytes;
+	__uint64_t	start = 0;
+	int		pfd[2];
+	int		ops = 0;
+
+	if (xfer_args(&splice_cmd, argc, argv, &x) < 0)
+		return 0;
+	if (splice_pipe(pfd, x.bsize) < 0)
+		goto done;
+
+	iolat_enabled = x.Lflag || x.hfile || iolat_forced;
+	iolat_reset(&iolat);
+	gettimeofday(&t1, NULL);
+	off = x.offset;
+	while (total < x.count) {
+		if (iolat_enabled)
+			start = iolat_now();
+		bytes = splice(x.fd, &off, pfd[1], NULL,
+				min((long long)x.bsize, x.count - total),
+				SPLICE_F_MOVE);
+		if (bytes == 0)
+			break;
+		if (bytes < 0) {
+			perror("splice");
+			goto out_close;
+		}
+		if (splice_drain(pfd[0], bytes, &x) < 0)
+			goto out_close;
+		if (iolat_enabled)
+			iolat_record(&iolat, start);
+		ops++;
+		total += bytes;
+	}
+	xfer_report(&x, &t1, total, ops);
+out_close:
+	close(pfd[0]);
+	close(pfd[1]);
+done:
+	xfer_done(&x);
+	return 0;
+}
+
+static int
+vmsplice_f(
+	int		argc,
+	char		**argv)
+{
+	xfer_t		x;
+	struct timeval	t1;
+	struct iovec	iv;
+	long long	total = 0;
+	ssize_t		bytes;
+	__uint64_t	start = 0;
+	char		*addr;
+	int		pfd[2];
+	int		ops = 0;
+
+	if (xfer_args(&vmsplice_cmd, argc, argv, &x) < 0)
+		return 0;
+	addr = check_mapping_range(mapping, x.offset, x.count, 0);
+	if (!addr)
+		return 0;
+	if (splice_pipe(pfd, x.bsize) < 0)
+		return 0;
+
+	iolat_enabled = x.Lflag || x.hfile || iolat_forced;
+	iolat_reset(&iolat);
+	gettimeofday(&t1, NULL);
+	while (total < x.count) {
+		if (iolat_enabled)
+			start = iolat_now();
+		iv.iov_base = addr + total;
+		iv.iov_len = min((long long)x.bsize, x.count - total);
+		bytes = vmsplice(pfd[1], &iv, 1, 0);
+		if (bytes <= 0) {
+			if (bytes < 0)
+				perror("vmsplice");
+			goto out_close;
+		}
+		if (splice_drain(pfd[0], bytes, &x) < 0)
+			goto out_close;
+		if (iolat_enabled)
+			iolat_record(&iolat, start);
+		ops++;
+		total += bytes;
+	}
+	xfer_report(&x, &t1, total, ops);
+out_close:
+	close(pfd[0]);
+	close(pfd[1]);
+	xfer_done(&x);
+	return 0;
+}
+
+void
+splice_init(void)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+	copy_range_cmd.name = "copy_range";
+	copy_range_cmd.cfunc = copy_range_f;
+	copy_range_cmd.argmin = 2;
+	copy_range_cmd.argmax = -1;
+	copy_range_cmd.flags = CMD_NOMAP_OK | CMD_FOREIGN_OK;
+	copy_range_cmd.args =
+_("[-b bs] [-o dstoff] [-CLq] [-H file] -i infile | -f N [off len]");
+	copy_range_cmd.oneline =
+		_("copy data into the open file with copy_file_range");
+	copy_range_cmd.help = copy_range_help;
+	add_command(&copy_range_cmd);
+#endif
+
+	splice_cmd.name = "splice";
+	splice_cmd.cfunc = splice_f;
+	splice_cmd.argmin = 2;
+	splice_cmd.argmax = -1;
+	splice_cmd.flags = CMD_NOMAP_OK | CMD_FOREIGN_OK;
+	splice_cmd.args =
+_("[-b bs] [-o dstoff] [-CLq] [-H file] -i infile | -f N [off len]");
+	splice_cmd.oneline =
+		_("copy data into the open file by splicing through a pipe");
+	splice_cmd.help = splice_help;
+	add_command(&splice_cmd);
+
+	vmsplice_cmd.name = "vmsplice";
+	vmsplice_cmd.cfunc = vmsplice_f;
+	vmsplice_cmd.argmin = 0;
+	vmsplice_cmd.argmax = -1;
+	vmsplice_cmd.flags = CMD_FOREIGN_OK;
+	vmsplice_cmd.args =
+		_("[-b bs] [-o dstoff] [-CLq] [-H file] [off len]");
+	vmsplice_cmd.oneline =
+		_("write part of the current mapping to the open file via a pipe");
+	vmsplice_cmd.help = vmsplice_help;
+	add_command(&vmsplice_cmd);
+}
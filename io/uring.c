@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "async.h"
+
+/*
+ * io_uring engine for async_io, straight on top of the system calls.
+ * Returns -1 if there's no usable ring, so that the caller can fall
+ * back to POSIX AIO, or -2 after reporting an error.
+ */
+typedef struct uring {
+	int			fd;
+	unsigned		*sq_tail;
+	unsigned		*sq_mask;
+	unsigned		*sq_array;
+	unsigned		*cq_head;
+	unsigned		*cq_tail;
+	unsigned		*cq_mask;
+	struct io_uring_sqe	*sqes;
+	struct io_uring_cqe	*cqes;
+	void			*sq_ring;
+	size_t			sq_size;
+	void			*cq_ring;
+	size_t			cq_size;
+	size_t			sqes_size;
+	struct iovec		*iovs;
+} uring_t;
+
+static void
+uring_exit(
+	uring_t		*ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring)
+		munmap(ring->cq_ring, ring->cq_size);
+	if (ring->sq_ring)
+		munmap(ring->sq_ring, ring->sq_size);
+	free(ring->iovs);
+	close(ring->fd);
+}
+
+static int
+uring_init(
+	uring_t			*ring,
+	async_ctx_t		*ctx)
+{
+	struct io_uring_params	p;
+	int			i;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+	if (ctx->flags & ASYNC_POLL)
+		p.flags |= IORING_SETUP_IOPOLL;
+	ring->fd = syscall(__NR_io_uring_setup, ctx->depth, &p);
+	if (ring->fd < 0)
+		return -1;
+
+	ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_size = p.cq_off.cqes +
+			p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sq_ring = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_ring = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED ||
+	    ring->sqes == MAP_FAILED) {
+		if (ring->sq_ring == MAP_FAILED)
+			ring->sq_ring = NULL;
+		if (ring->cq_ring == MAP_FAILED)
+			ring->cq_ring = NULL;
+		if (ring->sqes == MAP_FAILED)
+			ring->sqes = NULL;
+		uring_exit(ring);
+		return -1;
+	}
+	ring->sq_tail = ring->sq_ring + p.sq_off.tail;
+	ring->sq_mask = ring->sq_ring + p.sq_off.ring_mask;
+	ring->sq_array = ring->sq_ring + p.sq_off.array;
+	ring->cq_head = ring->cq_ring + p.cq_off.head;
+	ring->cq_tail = ring->cq_ring + p.cq_off.tail;
+	ring->cq_mask = ring->cq_ring + p.cq_off.ring_mask;
+	ring->cqes = ring->cq_ring + p.cq_off.cqes;
+
+	ring->iovs = calloc(ctx->depth, sizeof(struct iovec));
+	if (!ring->iovs) {
+		uring_exit(ring);
+		return -1;
+	}
+	for (i = 0; i < ctx->depth; i++) {
+		ring->iovs[i].iov_base = ctx->reqs[i].buf;
+		ring->iovs[i].iov_len = ctx->bsize;
+	}
+	if ((ctx->flags & ASYNC_FIXED) &&
+	    syscall(__NR_io_uring_register, ring->fd,
+		    IORING_REGISTER_BUFFERS, ring->iovs, ctx->depth) < 0) {
+		perror("io_uring_register");
+		uring_exit(ring);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+uring_prep(
+	uring_t			*ring,
+	async_ctx_t		*ctx,
+	int			slot)
+{
+	async_req_t		*req = &ctx->reqs[slot];
+	struct io_uring_sqe	*sqe;
+	unsigned		tail;
+	unsigned		idx;
+	int			write = ctx->flags & ASYNC_WRITE;
+
+	tail = *ring->sq_tail;
+	idx = tail & *ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd = ctx->fd;
+	sqe->off = req->offset;
+	sqe->user_data = slot;
+	if (ctx->flags & ASYNC_FIXED) {
+		sqe->opcode = write ? IORING_OP_WRITE_FIXED :
+				      IORING_OP_READ_FIXED;
+		sqe->addr = (unsigned long)req->buf;
+		sqe->len = req->len;
+		sqe->buf_index = slot;
+	} else {
+		sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+		ring->iovs[slot].iov_len = req->len;
+		sqe->addr = (unsigned long)&ring->iovs[slot];
+		sqe->len = 1;
+	}
+	ring->sq_array[idx] = idx;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+int
+uring_run(
+	async_ctx_t	*ctx)
+{
+	uring_t		ring;
+	unsigned	head;
+	int		inflight = 0;
+	int		nsubmit = 0;
+	int		slot;
+	int		ret;
+
+	if (uring_init(&ring, ctx) < 0)
+		return -1;
+	for (;;) {
+		while (ctx->nfree) {
+			slot = ctx->free[ctx->nfree - 1];
+			if (!async_next(ctx, &ctx->reqs[slot]))
+				break;
+			ctx->nfree--;
+			uring_prep(&ring, ctx, slot);
+			nsubmit++;
+			inflight++;
+		}
+		if (!inflight)
+			break;
+
+		ret = syscall(__NR_io_uring_enter, ring.fd, nsubmit, 1,
+				IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("io_uring_enter");
+			uring_exit(&ring);
+			return -2;
+		}
+		nsubmit -= ret;
+
+		head = *ring.cq_head;
+		while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe *cqe;
+
+			cqe = &ring.cqes[head & *ring.cq_mask];
+			async_complete(ctx, cqe->user_data, cqe->res);
+			inflight--;
+			head++;
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+	uring_exit(&ring);
+	return 0;
+}
@@ -67,6 +67,12 @@ platform_findsizes(char *path, int fd, long long *sz, int *bsz)
 	*bsz = BBSIZE;
 }
 
+unsigned int
+platform_discard_granularity(int fd)
+{
+	return 0;
+}
+
 char *
 platform_findrawpath(char *path)
 {
@@ -6,10 +6,150 @@
  * Simple memory interface
  */
 
+/*
+ * Zones hand out fixed size objects carved from large slabs.  Each thread
+ * keeps a magazine of free objects for each zone it uses, so most
+ * allocations and frees never take the zone lock; a magazine is refilled
+ * from, and spilled back to, the zone's free list half at a time.  Objects
+ * are only set up by the zone's constructor when first carved out, and
+ * keep whatever state they are freed in, so a zone with a constructor
+ * should not be used with kmem_zone_zalloc.  Memory goes back to the
+ * system only when a zone is destroyed with nothing allocated from it.
+ */
+
+#define KMEM_SLAB_SIZE	(64 * 1024)	/* smallest slab, in bytes */
+#define KMEM_SLAB_OBJS	16		/* fewest objects in a slab */
+#define KMEM_MAG_SIZE	32		/* objects held per magazine */
+#define KMEM_ALIGN	sizeof(long long)
+
+typedef struct kmem_mag {
+	struct kmem_mag	*next;		/* on the zone's list */
+	kmem_zone_t	*zone;
+	int		nobjs;
+	int		allocated;	/* not yet added to the zone's count */
+	unsigned long long allocs;	/* ditto */
+	void		*objs[KMEM_MAG_SIZE];
+} kmem_mag_t;
+
+static kmem_zone_t	*kmem_zones;
+static pthread_mutex_t	kmem_zones_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+kmem_nomem(kmem_zone_t *zone, size_t size)
+{
+	fprintf(stderr, _("%s: zone alloc failed (%s, %d bytes): %s\n"),
+		progname, zone->zone_name, (int)size, strerror(errno));
+	exit(1);
+}
+
+/* called with the zone locked */
+static void
+kmem_mag_fold(kmem_zone_t *zone, kmem_mag_t *mag)
+{
+	zone->allocated += mag->allocated;
+	zone->allocs += mag->allocs;
+	mag->allocated = 0;
+	mag->allocs = 0;
+	if (zone->allocated > zone->highwater)
+		zone->highwater = zone->allocated;
+}
+
+/* called with the zone locked */
+static void
+kmem_mag_spill(kmem_zone_t *zone, kmem_mag_t *mag, int keep)
+{
+	int	n = mag->nobjs - keep;
+
+	if (zone->zone_nfree + n > zone->zone_maxfree) {
+		zone->zone_maxfree = max(zone->zone_maxfree * 2,
+					 zone->zone_nfree + n);
+		zone->zone_free = realloc(zone->zone_free,
+				zone->zone_maxfree * sizeof(void *));
+		if (!zone->zone_free)
+			kmem_nomem(zone, zone->zone_maxfree * sizeof(void *));
+	}
+	memcpy(&zone->zone_free[zone->zone_nfree], &mag->objs[keep],
+		n * sizeof(void *));
+	zone->zone_nfree += n;
+	mag->nobjs = keep;
+}
+
+/* called with the zone locked */
+static void *
+kmem_zone_carve(kmem_zone_t *zone)
+{
+	void	*ptr;
+	int	error;
+
+	if (zone->zone_carve == zone->zone_carve_end) {
+		zone->zone_slabs = realloc(zone->zone_slabs,
+				(zone->zone_nslabs + 1) * sizeof(void *));
+		if (!zone->zone_slabs)
+			kmem_nomem(zone, (zone->zone_nslabs + 1) *
+					 sizeof(void *));
+		error = posix_memalign(&ptr, getpagesize(),
+				zone->zone_slabsize);
+		if (error) {
+			errno = error;
+			kmem_nomem(zone, zone->zone_slabsize);
+		}
+		zone->zone_slabs[zone->zone_nslabs++] = ptr;
+		zone->zone_carve = ptr;
+		zone->zone_carve_end = zone->zone_carve +
+			(zone->zone_slabsize / zone->zone_objsize) *
+			zone->zone_objsize;
+	}
+	ptr = zone->zone_carve;
+	zone->zone_carve += zone->zone_objsize;
+	if (zone->zone_ctor)
+		zone->zone_ctor(ptr);
+	return ptr;
+}
+
+static void
+kmem_mag_release(void *arg)
+{
+	kmem_mag_t	*mag = arg;
+	kmem_zone_t	*zone = mag->zone;
+	kmem_mag_t	**mp;
+
+	pthread_mutex_lock(&zone->zone_lock);
+	kmem_mag_spill(zone, mag, 0);
+	kmem_mag_fold(zone, mag);
+	for (mp = &zone->zone_mags; *mp != mag; mp = &(*mp)->next)
+		;
+	*mp = mag->next;
+	pthread_mutex_unlock(&zone->zone_lock);
+	free(mag);
+}
+
+static kmem_mag_t *
+kmem_mag_get(kmem_zone_t *zone)
+{
+	kmem_mag_t	*mag = pthread_getspecific(zone->zone_key);
+
+	if (mag)
+		return mag;
+	mag = calloc(1, sizeof(*mag));
+	if (!mag)
+		kmem_nomem(zone, sizeof(*mag));
+	mag->zone = zone;
+	pthread_mutex_lock(&zone->zone_lock);
+	mag->next = zone->zone_mags;
+	zone->zone_mags = mag;
+	pthread_mutex_unlock(&zone->zone_lock);
+	pthread_setspecific(zone->zone_key, mag);
+	return mag;
+}
+
 kmem_zone_t *
-kmem_zone_init(int size, char *name)
+kmem_zone_init_flags(
+	int		size,
+	char		*name,
+	unsigned long	flags,
+	void		(*ctor)(void *))
 {
-	kmem_zone_t	*ptr = malloc(sizeof(kmem_zone_t));
+	kmem_zone_t	*ptr = calloc(1, sizeof(kmem_zone_t));
 
 	if (ptr == NULL) {
 		fprintf(stderr, _("%s: zone init failed (%s, %d bytes): %s\n"),
@@ -20,23 +160,91 @@ kmem_zone_init(int size, char *name)
 	ptr->zone_unitsize = size;
 	ptr->zone_name = name;
 	ptr->allocated = 0;
+	ptr->zone_ctor = ctor;
+	ptr->zone_objsize = (size + KMEM_ALIGN - 1) & ~(KMEM_ALIGN - 1);
+	ptr->zone_slabsize = max(KMEM_SLAB_SIZE,
+				 ptr->zone_objsize * KMEM_SLAB_OBJS);
+	pthread_mutex_init(&ptr->zone_lock, NULL);
+	pthread_key_create(&ptr->zone_key, kmem_mag_release);
+
+	pthread_mutex_lock(&kmem_zones_lock);
+	ptr->zone_next = kmem_zones;
+	kmem_zones = ptr;
+	pthread_mutex_unlock(&kmem_zones_lock);
 	return ptr;
 }
 
+kmem_zone_t *
+kmem_zone_init(int size, char *name)
+{
+	return kmem_zone_init_flags(size, name, 0, NULL);
+}
+
+/*
+ * Free a zone and its slabs, unless something is still allocated from it
+ * (buffers are never given back, for one), in which case it is left be.
+ */
+void
+kmem_zone_destroy(kmem_zone_t *zone)
+{
+	kmem_zone_t	**zp;
+	kmem_mag_t	*mag;
+	int		allocated;
+	int		i;
+
+	pthread_mutex_lock(&zone->zone_lock);
+	allocated = zone->allocated;
+	for (mag = zone->zone_mags; mag; mag = mag->next)
+		allocated += mag->allocated;
+	pthread_mutex_unlock(&zone->zone_lock);
+	if (allocated)
+		return;
+
+	pthread_mutex_lock(&kmem_zones_lock);
+	for (zp = &kmem_zones; *zp != zone; zp = &(*zp)->zone_next)
+		;
+	*zp = zone->zone_next;
+	pthread_mutex_unlock(&kmem_zones_lock);
+
+	pthread_key_delete(zone->zone_key);
+	while ((mag = zone->zone_mags) != NULL) {
+		zone->zone_mags = mag->next;
+		free(mag);
+	}
+	for (i = 0; i < zone->zone_nslabs; i++)
+		free(zone->zone_slabs[i]);
+	free(zone->zone_slabs);
+	free(zone->zone_free);
+	pthread_mutex_destroy(&zone->zone_lock);
+	free(zone);
+}
+
 void *
 kmem_zone_alloc(kmem_zone_t *zone, int flags)
 {
-	void	*ptr = malloc(zone->zone_unitsize);
+	kmem_mag_t	*mag = kmem_mag_get(zone);
 
-	if (ptr == NULL) {
-		fprintf(stderr, _("%s: zone alloc failed (%s, %d bytes): %s\n"),
-			progname, zone->zone_name, zone->zone_unitsize,
-			strerror(errno));
-		exit(1);
+	if (!mag->nobjs) {
+		pthread_mutex_lock(&zone->zone_lock);
+		while (mag->nobjs < KMEM_MAG_SIZE / 2) {
+			if (zone->zone_nfree)
+				mag->objs[mag->nobjs++] =
+					zone->zone_free[--zone->zone_nfree];
+			else
+				mag->objs[mag->nobjs++] =
+					kmem_zone_carve(zone);
+		}
+		mag->allocated++;
+		mag->allocs++;
+		kmem_mag_fold(zone, mag);
+		pthread_mutex_unlock(&zone->zone_lock);
+	} else {
+		mag->allocated++;
+		mag->allocs++;
 	}
-	zone->allocated++;
-	return ptr;
+	return mag->objs[--mag->nobjs];
 }
+
 void *
 kmem_zone_zalloc(kmem_zone_t *zone, int flags)
 {
@@ -46,6 +254,51 @@ kmem_zone_zalloc(kmem_zone_t *zone, int flags)
 	return ptr;
 }
 
+void
+kmem_zone_free(kmem_zone_t *zone, void *ptr)
+{
+	kmem_mag_t	*mag = kmem_mag_get(zone);
+
+	if (mag->nobjs == KMEM_MAG_SIZE) {
+		pthread_mutex_lock(&zone->zone_lock);
+		kmem_mag_spill(zone, mag, KMEM_MAG_SIZE / 2);
+		mag->allocated--;
+		kmem_mag_fold(zone, mag);
+		pthread_mutex_unlock(&zone->zone_lock);
+	} else
+		mag->allocated--;
+	mag->objs[mag->nobjs++] = ptr;
+}
+
+/*
+ * Usage of every zone; the counts can be a magazine's worth out for
+ * zones in use by other threads at the time.
+ */
+void
+kmem_zone_report(FILE *fp)
+{
+	kmem_zone_t	*zone;
+	kmem_mag_t	*mag;
+	int		allocated;
+
+	pthread_mutex_lock(&kmem_zones_lock);
+	for (zone = kmem_zones; zone; zone = zone->zone_next) {
+		pthread_mutex_lock(&zone->zone_lock);
+		allocated = zone->allocated;
+		for (mag = zone->zone_mags; mag; mag = mag->next)
+			allocated += mag->allocated;
+		if (zone->allocs || allocated)
+			fprintf(fp, "%s: %d byte objects, %d in use, "
+					"%d at most, %llu allocations, "
+					"%d slabs of %d KiB\n",
+				zone->zone_name, zone->zone_unitsize,
+				allocated, max(allocated, zone->highwater),
+				zone->allocs,
+				zone->zone_nslabs, zone->zone_slabsize >> 10);
+		pthread_mutex_unlock(&zone->zone_lock);
+	}
+	pthread_mutex_unlock(&kmem_zones_lock);
+}
 
 void *
 kmem_alloc(size_t size, int flags)
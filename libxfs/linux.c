@@ -175,6 +175,37 @@ platform_findsizes(char *path, int fd, long long *sz, int *bsz)
 		max_block_alignment = *bsz;
 }
 
+/*
+ * Discard granularity of a block device in bytes, or zero if the device
+ * does not say.  Partitions have no queue directory of their own, so
+ * fall back to the parent disk's.
+ */
+unsigned int
+platform_discard_granularity(int fd)
+{
+	struct stat64	st;
+	char		path[PATH_MAX];
+	unsigned int	granularity = 0;
+	FILE		*fp;
+
+	if (fstat64(fd, &st) < 0 || !S_ISBLK(st.st_mode))
+		return 0;
+	snprintf(path, sizeof(path),
+		"/sys/dev/block/%u:%u/queue/discard_granularity",
+		major(st.st_rdev), minor(st.st_rdev));
+	if ((fp = fopen(path, "r")) == NULL) {
+		snprintf(path, sizeof(path),
+			"/sys/dev/block/%u:%u/../queue/discard_granularity",
+			major(st.st_rdev), minor(st.st_rdev));
+		if ((fp = fopen(path, "r")) == NULL)
+			return 0;
+	}
+	if (fscanf(fp, "%u", &granularity) != 1)
+		granularity = 0;
+	fclose(fp);
+	return granularity;
+}
+
 char *
 platform_findrawpath(char *path)
 {
@@ -23,37 +23,47 @@
 
 #define IO_BCOMPARE_CHECK
 
-void
-libxfs_device_zero(struct xfs_buftarg *btp, xfs_daddr_t start, uint len)
-{
-	xfs_off_t	start_offset, end_offset, offset;
-	ssize_t		zsize, bytes;
-	char		*z;
-	int		fd;
-
-	zsize = min(BDSTRAT_SIZE, BBTOB(len));
-	if ((z = memalign(libxfs_device_alignment(), zsize)) == NULL) {
-		fprintf(stderr,
-			_("%s: %s can't memalign %d bytes: %s\n"),
-			progname, __FUNCTION__, (int)zsize, strerror(errno));
-		exit(1);
-	}
-	memset(z, 0, zsize);
-
-	fd = libxfs_device_to_fd(btp->dev);
-	start_offset = LIBXFS_BBTOOFF64(start);
+/*
+ * Zeroing and discarding of large device ranges.  The range is cut into
+ * chunks which are handed out to a handful of threads, so that several
+ * requests are outstanding at once rather than one after the other.
+ * Zeroing is offloaded to the device if it can do that for us, else
+ * zeroes are written.  Ranges that fit in a single chunk are done in
+ * the caller's context.
+ */
+#define DEVICE_IO_THREADS	8
+#define DEVICE_ZERO_CHUNK	(16ULL * 1024 * 1024)
+#define DEVICE_DISCARD_CHUNK	(1ULL * 1024 * 1024 * 1024)
+
+struct device_range {
+	pthread_mutex_t		lock;
+	int			fd;
+	int			discard;
+	int			nooffload;	/* zero range not supported */
+	int			stop;		/* discard failed */
+						/* (both set without the lock) */
+	char			*zbuf;
+	xfs_off_t		next;
+	xfs_off_t		end;
+	xfs_off_t		chunk;
+	__uint64_t		done;
+	__uint64_t		total;
+	libxfs_progress_t	*progress;
+	void			*arg;
+};
 
-	if ((lseek64(fd, start_offset, SEEK_SET)) < 0) {
-		fprintf(stderr, _("%s: %s seek to offset %llu failed: %s\n"),
-			progname, __FUNCTION__,
-			(unsigned long long)start_offset, strerror(errno));
-		exit(1);
-	}
+static void
+device_zero_write(
+	struct device_range	*dr,
+	xfs_off_t		offset,
+	xfs_off_t		len)
+{
+	ssize_t			bytes;
 
-	end_offset = LIBXFS_BBTOOFF64(start + len) - start_offset;
-	for (offset = 0; offset < end_offset; ) {
-		bytes = min((ssize_t)(end_offset - offset), zsize);
-		if ((bytes = write(fd, z, bytes)) < 0) {
+	while (len > 0) {
+		bytes = pwrite64(dr->fd, dr->zbuf,
+				 min(len, (xfs_off_t)BDSTRAT_SIZE), offset);
+		if (bytes < 0) {
 			fprintf(stderr, _("%s: %s write failed: %s\n"),
 				progname, __FUNCTION__, strerror(errno));
 			exit(1);
@@ -63,8 +73,145 @@ libxfs_device_zero(struct xfs_buftarg *btp, xfs_daddr_t start, uint len)
 			exit(1);
 		}
 		offset += bytes;
+		len -= bytes;
 	}
-	free(z);
+}
+
+static void
+device_range_chunk(
+	struct device_range	*dr,
+	xfs_off_t		offset,
+	xfs_off_t		len)
+{
+	if (dr->discard) {
+		/*
+		 * Errors are ignored, discard is only an optimisation, but
+		 * there is no point in asking again once the device refused.
+		 */
+		if (platform_discard_blocks(dr->fd, offset, len))
+			dr->stop = 1;
+		return;
+	}
+	if (!dr->nooffload && platform_zero_range(dr->fd, offset, len) == 0)
+		return;
+	dr->nooffload = 1;
+	device_zero_write(dr, offset, len);
+}
+
+static void *
+device_range_worker(
+	void			*arg)
+{
+	struct device_range	*dr = arg;
+	xfs_off_t		offset;
+	xfs_off_t		len;
+
+	pthread_mutex_lock(&dr->lock);
+	while (dr->next < dr->end && !dr->stop) {
+		offset = dr->next;
+		len = min(dr->end, (offset / dr->chunk + 1) * dr->chunk) -
+			offset;
+		dr->next += len;
+		pthread_mutex_unlock(&dr->lock);
+
+		device_range_chunk(dr, offset, len);
+
+		pthread_mutex_lock(&dr->lock);
+		dr->done += len;
+		if (dr->progress)
+			dr->progress(dr->arg, dr->done, dr->total);
+	}
+	pthread_mutex_unlock(&dr->lock);
+	return NULL;
+}
+
+static void
+device_range_run(
+	struct device_range	*dr)
+{
+	pthread_t		threads[DEVICE_IO_THREADS];
+	__uint64_t		nchunks;
+	int			nthreads;
+	int			i;
+
+	pthread_mutex_init(&dr->lock, NULL);
+	dr->total = dr->end - dr->next;
+	nchunks = howmany(dr->end - dr->next, dr->chunk);
+	nthreads = min(nchunks, (__uint64_t)DEVICE_IO_THREADS);
+	for (i = 1; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, device_range_worker, dr))
+			break;
+	}
+	nthreads = i;
+	device_range_worker(dr);
+	for (i = 1; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&dr->lock);
+}
+
+void
+libxfs_device_zero_range(
+	struct xfs_buftarg	*btp,
+	xfs_daddr_t		start,
+	__uint64_t		len,
+	libxfs_progress_t	*progress,
+	void			*arg)
+{
+	struct device_range	dr = { 0 };
+	ssize_t			zsize;
+
+	zsize = min((__uint64_t)BDSTRAT_SIZE, BBTOB(len));
+	if ((dr.zbuf = memalign(libxfs_device_alignment(), zsize)) == NULL) {
+		fprintf(stderr,
+			_("%s: %s can't memalign %d bytes: %s\n"),
+			progname, __FUNCTION__, (int)zsize, strerror(errno));
+		exit(1);
+	}
+	memset(dr.zbuf, 0, zsize);
+
+	dr.fd = libxfs_device_to_fd(btp->dev);
+	dr.next = LIBXFS_BBTOOFF64(start);
+	dr.end = LIBXFS_BBTOOFF64(start + len);
+	dr.chunk = DEVICE_ZERO_CHUNK;
+	dr.progress = progress;
+	dr.arg = arg;
+	device_range_run(&dr);
+	free(dr.zbuf);
+}
+
+void
+libxfs_device_zero(struct xfs_buftarg *btp, xfs_daddr_t start, uint len)
+{
+	libxfs_device_zero_range(btp, start, len, NULL, NULL);
+}
+
+/*
+ * Discard a device range.  Chunks are aligned to the discard granularity
+ * (in bytes) so that no request straddles a granule it cannot free.
+ */
+void
+libxfs_device_discard(
+	dev_t			dev,
+	xfs_daddr_t		start,
+	__uint64_t		len,
+	unsigned int		granularity,
+	libxfs_progress_t	*progress,
+	void			*arg)
+{
+	struct device_range	dr = { 0 };
+
+	dr.fd = libxfs_device_to_fd(dev);
+	if (dr.fd <= 0)
+		return;
+	dr.discard = 1;
+	dr.next = LIBXFS_BBTOOFF64(start);
+	dr.end = LIBXFS_BBTOOFF64(start + len);
+	dr.chunk = DEVICE_DISCARD_CHUNK;
+	if (granularity > 1)
+		dr.chunk = roundup(dr.chunk, granularity);
+	dr.progress = progress;
+	dr.arg = arg;
+	device_range_run(&dr);
 }
 
 static void unmount_record(void *p)
@@ -881,6 +1028,7 @@ libxfs_writebufr(xfs_buf_t *bp)
 			(long long)LIBXFS_BBTOOFF64(bp->b_bn),
 			(long long)bp->b_bn, bp);
 #endif
+	libxfs_icluster_invalidate(bp);
 	if (!error) {
 		bp->b_flags |= LIBXFS_B_UPTODATE;
 		bp->b_flags &= ~(LIBXFS_B_DIRTY | LIBXFS_B_EXIT);
@@ -892,6 +1040,7 @@ int
 libxfs_writebuf_int(xfs_buf_t *bp, int flags)
 {
 	bp->b_flags |= (LIBXFS_B_DIRTY | flags);
+	libxfs_icluster_invalidate(bp);
 	return 0;
 }
 
@@ -905,6 +1054,7 @@ libxfs_writebuf(xfs_buf_t *bp, int flags)
 			(long long)bp->b_bn);
 #endif
 	bp->b_flags |= (LIBXFS_B_DIRTY | flags);
+	libxfs_icluster_invalidate(bp);
 	libxfs_putbuf(bp);
 	return 0;
 }
@@ -1016,34 +1166,184 @@ struct cache_operations libxfs_bcache_operations = {
 
 
 /*
- * Inode cache stubs.
+ * Inode cache.
+ *
+ * In-core inodes are kept in a struct cache keyed by mount and inode
+ * number, so that repeated iget/iput cycles on the same inode do not
+ * re-read the cluster buffer and re-parse the forks each time.  A cached
+ * inode is handed out to one user at a time; a second concurrent iget
+ * of the same inode gets a private copy which is freed again on iput.
+ * Inodes that have been joined to a transaction are dropped from the
+ * cache when they are released, as their in-core state may be ahead of
+ * (or, for a cancelled transaction, different to) what is on disk.
+ *
+ * Each cached inode also holds a reference to a record for the cluster
+ * buffer it was read from.  Dirtying or writing any buffer that overlaps
+ * the cluster bumps the record's generation, which makes the inodes read
+ * from it stale; stale inodes miss in the cache and are purged.
  */
 
 extern kmem_zone_t	*xfs_ili_zone;
 extern kmem_zone_t	*xfs_inode_zone;
 
-int
-libxfs_iget(xfs_mount_t *mp, xfs_trans_t *tp, xfs_ino_t ino, uint lock_flags,
-		xfs_inode_t **ipp, xfs_daddr_t bno)
+#define LIBXFS_ICACHE_LOADED	0x1	/* inode was read from disk */
+#define LIBXFS_ICACHE_DOOMED	0x2	/* purge at the next iput */
+#define LIBXFS_ICACHE_PRIVATE	0x4	/* not in the cache */
+
+struct libxfs_icluster {
+	struct libxfs_icluster	*ic_next;	/* hash chain */
+	dev_t			ic_dev;
+	xfs_daddr_t		ic_blkno;	/* start of cluster */
+	int			ic_len;		/* length of cluster in BBs */
+	unsigned int		ic_gen;		/* bumped on overlapping write */
+	unsigned int		ic_refs;	/* cached inodes in cluster */
+};
+
+/*
+ * Cluster records are hashed by their start address in units of
+ * 1 << ICLUSTER_SHIFT basic blocks.  A write looks at every unit it
+ * covers, plus enough units before it to catch the longest cluster
+ * that starts ahead of the buffer.
+ */
+#define ICLUSTER_HASH_SIZE	1024
+#define ICLUSTER_SHIFT		4
+
+static struct libxfs_icluster	*icluster_hash[ICLUSTER_HASH_SIZE];
+static unsigned int		icluster_count;
+static int			icluster_maxlen;
+static pthread_mutex_t		icluster_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline unsigned int
+icluster_hashidx(xfs_daddr_t blkno)
 {
-	xfs_inode_t	*ip;
-	int		error = 0;
+	return (blkno >> ICLUSTER_SHIFT) % ICLUSTER_HASH_SIZE;
+}
 
-	ip = kmem_zone_zalloc(xfs_inode_zone, 0);
-	if (!ip)
-		return ENOMEM;
+/*
+ * Take a reference to the record for a cluster, creating it if need be,
+ * and return the current generation.  Called with icluster_lock held.
+ */
+static struct libxfs_icluster *
+icluster_get(
+	dev_t			dev,
+	xfs_daddr_t		blkno,
+	int			len)
+{
+	struct libxfs_icluster	**head;
+	struct libxfs_icluster	*ic;
 
-	ip->i_ino = ino;
-	ip->i_mount = mp;
-	error = xfs_iread(mp, tp, ip, bno);
-	if (error) {
-		kmem_zone_free(xfs_inode_zone, ip);
-		*ipp = NULL;
-		return error;
+	head = &icluster_hash[icluster_hashidx(blkno)];
+	for (ic = *head; ic; ic = ic->ic_next) {
+		if (ic->ic_dev == dev && ic->ic_blkno == blkno &&
+		    ic->ic_len == len)
+			break;
+	}
+	if (!ic) {
+		ic = malloc(sizeof(*ic));
+		if (!ic)
+			return NULL;
+		ic->ic_dev = dev;
+		ic->ic_blkno = blkno;
+		ic->ic_len = len;
+		ic->ic_gen = 0;
+		ic->ic_refs = 0;
+		ic->ic_next = *head;
+		*head = ic;
+		icluster_count++;
+		if (len > icluster_maxlen)
+			icluster_maxlen = len;
 	}
+	ic->ic_refs++;
+	return ic;
+}
 
-	*ipp = ip;
-	return 0;
+static void
+icluster_put(
+	struct libxfs_icluster	*ic)
+{
+	struct libxfs_icluster	**icp;
+
+	pthread_mutex_lock(&icluster_lock);
+	if (--ic->ic_refs == 0) {
+		for (icp = &icluster_hash[icluster_hashidx(ic->ic_blkno)];
+		     *icp != ic; icp = &(*icp)->ic_next)
+			;
+		*icp = ic->ic_next;
+		icluster_count--;
+		free(ic);
+	}
+	pthread_mutex_unlock(&icluster_lock);
+}
+
+static void
+icluster_invalidate_range(
+	dev_t			dev,
+	xfs_daddr_t		blkno,
+	int			len)
+{
+	struct libxfs_icluster	*ic;
+	xfs_daddr_t		first;
+	xfs_daddr_t		last;
+	xfs_daddr_t		unit;
+
+	first = (blkno - icluster_maxlen + 1) >> ICLUSTER_SHIFT;
+	if (first < 0)
+		first = 0;
+	last = (blkno + len - 1) >> ICLUSTER_SHIFT;
+	if (last - first >= ICLUSTER_HASH_SIZE)
+		last = first + ICLUSTER_HASH_SIZE - 1;
+
+	for (unit = first; unit <= last; unit++) {
+		ic = icluster_hash[unit % ICLUSTER_HASH_SIZE];
+		for (; ic; ic = ic->ic_next) {
+			if (ic->ic_dev != dev ||
+			    ic->ic_blkno >= blkno + len ||
+			    ic->ic_blkno + ic->ic_len <= blkno)
+				continue;
+			ic->ic_gen++;
+		}
+	}
+}
+
+/*
+ * Make any cached inodes read from the range of this buffer stale.
+ * Called whenever a buffer is dirtied, logged or written.
+ */
+void
+libxfs_icluster_invalidate(
+	xfs_buf_t		*bp)
+{
+	dev_t			dev = bp->b_target->dev;
+	int			i;
+
+	pthread_mutex_lock(&icluster_lock);
+	if (!icluster_count) {
+		pthread_mutex_unlock(&icluster_lock);
+		return;
+	}
+	if (!(bp->b_flags & LIBXFS_B_DISCONTIG)) {
+		icluster_invalidate_range(dev, bp->b_bn, BTOBB(bp->b_bcount));
+	} else {
+		for (i = 0; i < bp->b_nmaps; i++)
+			icluster_invalidate_range(dev, bp->b_map[i].bm_bn,
+						  bp->b_map[i].bm_len);
+	}
+	pthread_mutex_unlock(&icluster_lock);
+}
+
+static int
+libxfs_istale(
+	xfs_inode_t		*ip)
+{
+	int			stale;
+
+	if ((ip->i_cflags & (LIBXFS_ICACHE_LOADED | LIBXFS_ICACHE_DOOMED)) !=
+	    LIBXFS_ICACHE_LOADED)
+		return 1;
+	pthread_mutex_lock(&icluster_lock);
+	stale = ip->i_cgen != ip->i_cluster->ic_gen;
+	pthread_mutex_unlock(&icluster_lock);
+	return stale;
 }
 
 static void
@@ -1060,12 +1360,205 @@ libxfs_idestroy(xfs_inode_t *ip)
 		libxfs_idestroy_fork(ip, XFS_ATTR_FORK);
 }
 
-void
-libxfs_iput(xfs_inode_t *ip, uint lock_flags)
+static void
+libxfs_ifree(xfs_inode_t *ip)
 {
 	if (ip->i_itemp)
 		kmem_zone_free(xfs_ili_zone, ip->i_itemp);
 	ip->i_itemp = NULL;
-	libxfs_idestroy(ip);
+	if (ip->i_cflags & LIBXFS_ICACHE_LOADED)
+		libxfs_idestroy(ip);
+	if (ip->i_cluster)
+		icluster_put(ip->i_cluster);
 	kmem_zone_free(xfs_inode_zone, ip);
 }
+
+struct libxfs_ikey {
+	xfs_mount_t		*mp;
+	xfs_ino_t		ino;
+};
+
+static unsigned int
+libxfs_ihash(cache_key_t key, unsigned int hashsize)
+{
+	xfs_ino_t		ino = ((struct libxfs_ikey *)key)->ino;
+
+	return (unsigned int)(ino ^ (ino >> 32)) % hashsize;
+}
+
+static int
+libxfs_icompare(struct cache_node *node, cache_key_t key)
+{
+	xfs_inode_t		*ip = (xfs_inode_t *)node;
+	struct libxfs_ikey	*ikey = (struct libxfs_ikey *)key;
+
+	if (ip->i_ino != ikey->ino || ip->i_mount != ikey->mp)
+		return CACHE_MISS;
+	if (libxfs_istale(ip))
+		return CACHE_PURGE;
+	return CACHE_HIT;
+}
+
+static struct cache_node *
+libxfs_ialloc_node(cache_key_t key)
+{
+	struct libxfs_ikey	*ikey = (struct libxfs_ikey *)key;
+	xfs_inode_t		*ip;
+
+	ip = kmem_zone_zalloc(xfs_inode_zone, 0);
+	if (!ip)
+		return NULL;
+	ip->i_ino = ikey->ino;
+	ip->i_mount = ikey->mp;
+	return (struct cache_node *)ip;
+}
+
+static void
+libxfs_iflush_node(struct cache_node *node)
+{
+	/* cached inodes are never dirty, transactions write them back */
+}
+
+static void
+libxfs_irelse(struct cache_node *node)
+{
+	libxfs_ifree((xfs_inode_t *)node);
+}
+
+struct cache_operations libxfs_icache_operations = {
+	/* .hash */	libxfs_ihash,
+	/* .alloc */	libxfs_ialloc_node,
+	/* .flush */	libxfs_iflush_node,
+	/* .relse */	libxfs_irelse,
+	/* .compare */	libxfs_icompare,
+	/* .bulkrelse */NULL
+};
+
+void
+libxfs_icache_purge(void)
+{
+	if (libxfs_icache)
+		cache_purge(libxfs_icache);
+}
+
+/*
+ * Read an inode into a cache node.  The cluster record is taken before
+ * the inode buffer is read, so that a write to the cluster racing with
+ * the read leaves the inode stale rather than silently out of date.
+ */
+static int
+libxfs_iread_cached(
+	xfs_mount_t		*mp,
+	xfs_trans_t		*tp,
+	xfs_inode_t		*ip,
+	uint			flags)
+{
+	int			error;
+
+	error = xfs_imap(mp, tp, ip->i_ino, &ip->i_imap, flags);
+	if (error)
+		return error;
+
+	pthread_mutex_lock(&icluster_lock);
+	ip->i_cluster = icluster_get(mp->m_ddev_targp->dev,
+				ip->i_imap.im_blkno, ip->i_imap.im_len);
+	if (ip->i_cluster)
+		ip->i_cgen = ip->i_cluster->ic_gen;
+	pthread_mutex_unlock(&icluster_lock);
+	if (!ip->i_cluster)
+		return ENOMEM;
+
+	return xfs_iread(mp, tp, ip, flags);
+}
+
+int
+libxfs_iget(xfs_mount_t *mp, xfs_trans_t *tp, xfs_ino_t ino, uint lock_flags,
+		xfs_inode_t **ipp, xfs_daddr_t bno)
+{
+	struct cache_node	*node;
+	struct libxfs_ikey	key;
+	xfs_inode_t		*ip;
+	int			busy;
+	int			error = 0;
+
+	if (!libxfs_icache)
+		goto private;
+
+	key.mp = mp;
+	key.ino = ino;
+	if (cache_node_get(libxfs_icache, &key, &node)) {
+		ip = (xfs_inode_t *)node;
+		error = libxfs_iread_cached(mp, tp, ip, bno);
+		if (error) {
+			ip->i_cflags |= LIBXFS_ICACHE_DOOMED;
+			cache_node_put(libxfs_icache, node);
+			cache_node_purge(libxfs_icache, &key, node);
+			*ipp = NULL;
+			return error;
+		}
+		ip->i_cflags |= LIBXFS_ICACHE_LOADED;
+		*ipp = ip;
+		return 0;
+	}
+
+	/* a cached inode has a single user, anyone else gets a copy */
+	pthread_mutex_lock(&node->cn_mutex);
+	busy = node->cn_count > 1;
+	pthread_mutex_unlock(&node->cn_mutex);
+	if (!busy) {
+		*ipp = (xfs_inode_t *)node;
+		return 0;
+	}
+	cache_node_put(libxfs_icache, node);
+
+private:
+	ip = kmem_zone_zalloc(xfs_inode_zone, 0);
+	if (!ip)
+		return ENOMEM;
+
+	ip->i_ino = ino;
+	ip->i_mount = mp;
+	ip->i_cflags = LIBXFS_ICACHE_PRIVATE;
+	error = xfs_iread(mp, tp, ip, bno);
+	if (error) {
+		kmem_zone_free(xfs_inode_zone, ip);
+		*ipp = NULL;
+		return error;
+	}
+
+	ip->i_cflags |= LIBXFS_ICACHE_LOADED;
+	*ipp = ip;
+	return 0;
+}
+
+void
+libxfs_iput(xfs_inode_t *ip, uint lock_flags)
+{
+	struct libxfs_ikey	key;
+
+	if (ip->i_cflags & LIBXFS_ICACHE_PRIVATE) {
+		libxfs_ifree(ip);
+		return;
+	}
+
+	/*
+	 * An inode that has been part of a transaction may no longer match
+	 * the disk, so drop it.  Mark it first so that nobody can find it
+	 * between the put and the purge.
+	 */
+	if (ip->i_itemp) {
+		kmem_zone_free(xfs_ili_zone, ip->i_itemp);
+		ip->i_itemp = NULL;
+		ip->i_cflags |= LIBXFS_ICACHE_DOOMED;
+	}
+	if (!libxfs_istale(ip)) {
+		cache_node_put(libxfs_icache, &ip->i_node);
+		return;
+	}
+
+	key.mp = ip->i_mount;
+	key.ino = ip->i_ino;
+	ip->i_cflags |= LIBXFS_ICACHE_DOOMED;
+	cache_node_put(libxfs_icache, &ip->i_node);
+	cache_node_purge(libxfs_icache, &key, &ip->i_node);
+}
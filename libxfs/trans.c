@@ -402,6 +402,7 @@ libxfs_trans_log_buf(
 	tp->t_flags |= XFS_TRANS_DIRTY;
 	bip->bli_item.li_desc->lid_flags |= XFS_LID_DIRTY;
 	xfs_buf_item_log(bip, first, last);
+	libxfs_icluster_invalidate(bp);
 }
 
 void
@@ -1982,6 +1982,74 @@ xfs_da_hashname(const __uint8_t *name, int namelen)
 	}
 }
 
+/*
+ * Continue hashing a name from a partial hash value.  This must match
+ * xfs_da_hashname() exactly, which remains the reference.
+ */
+static inline xfs_dahash_t
+xfs_da_hashname_cont(xfs_dahash_t hash, const __uint8_t *name, int namelen)
+{
+	for (; namelen >= 4; namelen -= 4, name += 4)
+		hash = (name[0] << 21) ^ (name[1] << 14) ^ (name[2] << 7) ^
+		       (name[3] << 0) ^ rol32(hash, 7 * 4);
+
+	switch (namelen) {
+	case 3:
+		return (name[0] << 14) ^ (name[1] << 7) ^ (name[2] << 0) ^
+		       rol32(hash, 7 * 3);
+	case 2:
+		return (name[0] << 7) ^ (name[1] << 0) ^ rol32(hash, 7 * 2);
+	case 1:
+		return (name[0] << 0) ^ rol32(hash, 7 * 1);
+	default: /* case 0: */
+		return hash;
+	}
+}
+
+/*
+ * Hash a batch of names into hashes[].  Each step of the hash mixes one
+ * four byte word into the value, placing its bytes 7 bits apart.  Here
+ * the names are read eight bytes at a time and both words are spread
+ * out in one 64 bit register, two 32 bit lanes side by side, before
+ * being folded into the hash.  The rest of each name is finished off a
+ * word and then a byte at a time.
+ */
+#define XFS_DA_HASH_LANE0	0xff000000ff000000ULL
+#define XFS_DA_HASH_LANE1	0x00ff000000ff0000ULL
+#define XFS_DA_HASH_LANE2	0x0000ff000000ff00ULL
+#define XFS_DA_HASH_LANE3	0x000000ff000000ffULL
+
+void
+xfs_da_hashname_batch(
+	const __uint8_t		**names,
+	const int		*namelens,
+	xfs_dahash_t		*hashes,
+	int			count)
+{
+	const __uint8_t		*name;
+	xfs_dahash_t		hash;
+	__uint64_t		x;
+	int			namelen;
+	int			i;
+
+	for (i = 0; i < count; i++) {
+		name = names[i];
+		namelen = namelens[i];
+		for (hash = 0; namelen >= 8; namelen -= 8, name += 8) {
+			x = get_unaligned_be64((void *)name);
+			x = ((x & XFS_DA_HASH_LANE0) >> 3) ^
+			    ((x & XFS_DA_HASH_LANE1) >> 2) ^
+			    ((x & XFS_DA_HASH_LANE2) >> 1) ^
+			    (x & XFS_DA_HASH_LANE3);
+			/* two word steps rotate by 7 * 8 = 24 mod 32 */
+			hash = rol32(hash, 24) ^
+			       rol32((__uint32_t)(x >> 32), 7 * 4) ^
+			       (__uint32_t)x;
+		}
+		hashes[i] = xfs_da_hashname_cont(hash, name, namelen);
+	}
+}
+
 enum xfs_dacmp
 xfs_da_compname(
 	struct xfs_da_args *args,
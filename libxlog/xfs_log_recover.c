@@ -1007,6 +1007,42 @@ xlog_recover_find_tid(
 	return NULL;
 }
 
+/*
+ * Transaction and item structures are recycled through free lists
+ * instead of going back to the heap each time a transaction commits.
+ * Only the thread running the recovery pass touches them.
+ */
+static struct hlist_head	xlog_trans_pool;
+static struct list_head		xlog_item_pool = { &xlog_item_pool,
+						   &xlog_item_pool };
+
+STATIC xlog_recover_t *
+xlog_recover_trans_get(void)
+{
+	xlog_recover_t		*trans;
+	struct hlist_node	*n = xlog_trans_pool.first;
+
+	if (!n)
+		return kmem_zalloc(sizeof(xlog_recover_t), KM_SLEEP);
+	hlist_del(n);
+	trans = hlist_entry(n, xlog_recover_t, r_list);
+	memset(trans, 0, sizeof(*trans));
+	return trans;
+}
+
+STATIC xlog_recover_item_t *
+xlog_recover_item_get(void)
+{
+	xlog_recover_item_t	*item;
+
+	if (list_empty(&xlog_item_pool))
+		return kmem_zalloc(sizeof(xlog_recover_item_t), KM_SLEEP);
+	item = list_entry(xlog_item_pool.next, xlog_recover_item_t, ri_list);
+	list_del(&item->ri_list);
+	memset(item, 0, sizeof(*item));
+	return item;
+}
+
 STATIC void
 xlog_recover_new_tid(
 	struct hlist_head	*head,
@@ -1015,7 +1051,7 @@ xlog_recover_new_tid(
 {
 	xlog_recover_t		*trans;
 
-	trans = kmem_zalloc(sizeof(xlog_recover_t), KM_SLEEP);
+	trans = xlog_recover_trans_get();
 	trans->r_log_tid   = tid;
 	trans->r_lsn	   = lsn;
 	INIT_LIST_HEAD(&trans->r_itemq);
@@ -1030,7 +1066,7 @@ xlog_recover_add_item(
 {
 	xlog_recover_item_t	*item;
 
-	item = kmem_zalloc(sizeof(xlog_recover_item_t), KM_SLEEP);
+	item = xlog_recover_item_get();
 	INIT_LIST_HEAD(&item->ri_list);
 	list_add_tail(&item->ri_list, head);
 }
@@ -1165,12 +1201,12 @@ xlog_recover_free_trans(
 		list_del(&item->ri_list);
 		for (i = 0; i < item->ri_cnt; i++)
 			kmem_free(item->ri_buf[i].i_addr);
-		/* Free the item itself */
+		/* Return the item itself to the pool */
 		kmem_free(item->ri_buf);
-		kmem_free(item);
+		list_add(&item->ri_list, &xlog_item_pool);
 	}
-	/* Free the transaction recover structure */
-	kmem_free(trans);
+	/* Return the transaction recover structure to the pool */
+	hlist_add_head(&trans->r_list, &xlog_trans_pool);
 }
 
 /*
@@ -1305,19 +1341,47 @@ xlog_recover_process_data(
 }
 
 /*
- * Upack the log buffer data and crc check it. If the check fails, issue a
- * warning if and only if the CRC in the header is non-zero. This makes the
- * check an advisory warning, and the zero CRC check will prevent failure
- * warnings from being emitted when upgrading the kernel from one that does not
- * add CRCs by default.
+ * The CRC covers the record header with h_crc zeroed, the extended headers
+ * of a v2 log and the payload as it sits on disk, before the cycle data
+ * is unpacked into it.
+ */
+STATIC __le32
+xlog_cksum(
+	struct xlog		*log,
+	struct xlog_rec_header	*rhead,
+	xfs_caddr_t		dp,
+	int			size)
+{
+	__uint32_t		crc;
+	int			heads, i;
+
+	crc = xfs_start_cksum((char *)rhead, sizeof(struct xlog_rec_header),
+			      offsetof(struct xlog_rec_header, h_crc));
+
+	if (xfs_sb_version_haslogv2(&log->l_mp->m_sb)) {
+		xlog_in_core_2_t *xhdr = (xlog_in_core_2_t *)rhead;
+
+		/* the extended headers cover the payload, not the buffer */
+		heads = howmany(size, XLOG_HEADER_CYCLE_SIZE);
+		for (i = 1; i < heads; i++)
+			crc = crc32c(crc, &xhdr[i].hic_xheader,
+				     sizeof(struct xlog_rec_ext_header));
+	}
+
+	crc = crc32c(crc, dp, size);
+	return xfs_end_cksum(crc);
+}
+
+/*
+ * CRC check the log buffer data before it is unpacked. If the check fails,
+ * issue a warning if and only if the CRC in the header is non-zero. This
+ * makes the check an advisory warning, and the zero CRC check will prevent
+ * failure warnings from being emitted when upgrading the kernel from one that
+ * does not add CRCs by default.
  *
  * When filesystems are CRC enabled, this CRC mismatch becomes a fatal log
  * corruption failure
- *
- * XXX: we do not calculate the CRC here yet. It's not clear what we should do
- * with CRC errors here in userspace, so we'll address that problem later on.
  */
-#define xlog_cksum(l,r,dp,len)	((r)->h_crc)
 STATIC int
 xlog_unpack_data_crc(
 	struct xlog_rec_header	*rhead,
@@ -1355,11 +1419,6 @@ xlog_unpack_data(
 	struct xlog		*log)
 {
 	int			i, j, k;
-	int			error;
-
-	error = xlog_unpack_data_crc(rhead, dp, log);
-	if (error)
-		return error;
 
 	for (i = 0; i < BTOBB(be32_to_cpu(rhead->h_len)) &&
 		  i < (XLOG_HEADER_CYCLE_SIZE / BBSIZE); i++) {
@@ -1417,12 +1476,270 @@ xlog_valid_rec_header(
 }
 
 /*
- * Read the log from tail to head and process the log records found.
- * Handle the two cases where the tail and head are in the same cycle
- * and where the active portion of the log wraps around the end of
- * the physical log separately.  The pass parameter is passed through
- * to the routines called to process the data and is not looked at
- * here.
+ * Read the log record at *blk_no into hbp and dbp, handling a header or
+ * data section that wraps around the physical end of the log, and move
+ * *blk_no on to the next record.  *blk_no is not wrapped back into the
+ * log, so the caller can tell when it passed the physical end.
+ */
+STATIC int
+xlog_recover_read_record(
+	struct xlog		*log,
+	xfs_daddr_t		*blk_no,
+	int			hblks,
+	struct xfs_buf		*hbp,
+	struct xfs_buf		*dbp,
+	xlog_rec_header_t	**rheadp,
+	xfs_caddr_t		*dp)
+{
+	xlog_rec_header_t	*rhead;
+	xfs_daddr_t		blk = *blk_no;
+	xfs_caddr_t		offset;
+	int			bblks, split_bblks;
+	int			split_hblks, wrapped_hblks;
+	int			error;
+
+	/*
+	 * Check for header wrapping around physical end-of-log
+	 */
+	offset = hbp->b_addr;
+	split_hblks = 0;
+	wrapped_hblks = 0;
+	if (blk + hblks <= log->l_logBBsize) {
+		/* Read header in one read */
+		error = xlog_bread(log, blk, hblks, hbp, &offset);
+		if (error)
+			return error;
+	} else {
+		/* This LR is split across physical log end */
+		if (blk != log->l_logBBsize) {
+			/* some data before physical log end */
+			ASSERT(blk <= INT_MAX);
+			split_hblks = log->l_logBBsize - (int)blk;
+			ASSERT(split_hblks > 0);
+			error = xlog_bread(log, blk, split_hblks, hbp,
+					   &offset);
+			if (error)
+				return error;
+		}
+
+		/*
+		 * Note: this black magic still works with
+		 * large sector sizes (non-512) only because:
+		 * - we increased the buffer size originally
+		 *   by 1 sector giving us enough extra space
+		 *   for the second read;
+		 * - the log start is guaranteed to be sector
+		 *   aligned;
+		 * - we read the log end (LR header start)
+		 *   _first_, then the log start (LR header end)
+		 *   - order is important.
+		 */
+		wrapped_hblks = hblks - split_hblks;
+		error = xlog_bread_offset(log, 0, wrapped_hblks, hbp,
+					  offset + BBTOB(split_hblks));
+		if (error)
+			return error;
+	}
+	rhead = (xlog_rec_header_t *)offset;
+	error = xlog_valid_rec_header(log, rhead, blk);
+	if (error)
+		return error;
+
+	bblks = (int)BTOBB(be32_to_cpu(rhead->h_len));
+	blk += hblks;
+	if (blk >= log->l_logBBsize)
+		blk -= log->l_logBBsize;
+
+	/* Read in data for log record */
+	if (blk + bblks <= log->l_logBBsize) {
+		error = xlog_bread(log, blk, bblks, dbp, &offset);
+		if (error)
+			return error;
+	} else {
+		/* This log record is split across the physical end of log */
+		offset = dbp->b_addr;
+		split_bblks = 0;
+		if (blk != log->l_logBBsize) {
+			/* some data is before the physical end of log */
+			ASSERT(!wrapped_hblks);
+			ASSERT(blk <= INT_MAX);
+			split_bblks = log->l_logBBsize - (int)blk;
+			ASSERT(split_bblks > 0);
+			error = xlog_bread(log, blk, split_bblks, dbp,
+					   &offset);
+			if (error)
+				return error;
+		}
+
+		/* same black magic as for the header above */
+		error = xlog_bread_offset(log, 0, bblks - split_bblks, dbp,
+					  offset + BBTOB(split_bblks));
+		if (error)
+			return error;
+	}
+
+	*rheadp = rhead;
+	*dp = offset;
+	*blk_no += hblks + bblks;
+	return 0;
+}
+
+/*
+ * Log record readahead.
+ *
+ * A reader thread reads records from the tail towards the head into a
+ * ring of record buffers while earlier records are being processed, and
+ * a few more threads CRC check the records that have been read.  The
+ * records are still unpacked and processed one at a time, in log order,
+ * by the thread running the recovery pass.
+ */
+#define XLOG_RA_RECORDS		16
+#define XLOG_RA_CRC_THREADS	4
+
+#define XLOG_RA_FREE		0	/* slot available to the reader */
+#define XLOG_RA_READ		1	/* read, waiting for CRC check */
+#define XLOG_RA_CHECK		2	/* being CRC checked */
+#define XLOG_RA_DONE		3	/* ready to process */
+
+struct xlog_ra_rec {
+	struct xfs_buf		*hbp;
+	struct xfs_buf		*dbp;
+	xlog_rec_header_t	*rhead;
+	xfs_caddr_t		dp;
+	int			state;
+	int			error;
+};
+
+struct xlog_ra {
+	struct xlog		*log;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	struct xlog_ra_rec	recs[XLOG_RA_RECORDS];
+	int			hblks;
+	xfs_daddr_t		blk_no;		/* next record to read */
+	xfs_daddr_t		head_blk;
+	int			wrapped;	/* blk_no is past the wrap */
+	unsigned long		nread;		/* records read */
+	unsigned long		nchecked;	/* records handed out to check */
+	unsigned long		nused;		/* records processed */
+	int			eof;		/* nothing more to read */
+	int			stop;
+	int			ncrc;
+	pthread_t		reader;
+	pthread_t		crc[XLOG_RA_CRC_THREADS];
+};
+
+static int
+xlog_ra_more(
+	struct xlog_ra		*ra)
+{
+	if (ra->wrapped)
+		return ra->blk_no < ra->head_blk;
+	return 1;
+}
+
+static void *
+xlog_ra_reader(
+	void			*arg)
+{
+	struct xlog_ra		*ra = arg;
+	struct xlog_ra_rec	*rec;
+	xfs_daddr_t		blk_no;
+	int			error;
+
+	pthread_mutex_lock(&ra->lock);
+	while (!ra->stop && xlog_ra_more(ra)) {
+		if (ra->nread - ra->nused == XLOG_RA_RECORDS) {
+			pthread_cond_wait(&ra->cond, &ra->lock);
+			continue;
+		}
+		rec = &ra->recs[ra->nread % XLOG_RA_RECORDS];
+		blk_no = ra->blk_no;
+		pthread_mutex_unlock(&ra->lock);
+
+		error = xlog_recover_read_record(ra->log, &blk_no, ra->hblks,
+				rec->hbp, rec->dbp, &rec->rhead, &rec->dp);
+		if (!error && !ra->ncrc)
+			error = xlog_unpack_data_crc(rec->rhead, rec->dp,
+						     ra->log);
+
+		pthread_mutex_lock(&ra->lock);
+		rec->error = error;
+		rec->state = (error || !ra->ncrc) ? XLOG_RA_DONE :
+						    XLOG_RA_READ;
+		ra->nread++;
+		if (error) {
+			ra->eof = 1;
+			break;
+		}
+		if (blk_no >= ra->log->l_logBBsize) {
+			blk_no -= ra->log->l_logBBsize;
+			ra->wrapped = 1;
+		}
+		ra->blk_no = blk_no;
+		pthread_cond_broadcast(&ra->cond);
+	}
+	ra->eof = 1;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->lock);
+	return NULL;
+}
+
+static void *
+xlog_ra_checker(
+	void			*arg)
+{
+	struct xlog_ra		*ra = arg;
+	struct xlog_ra_rec	*rec;
+	int			error;
+
+	pthread_mutex_lock(&ra->lock);
+	for (;;) {
+		if (ra->stop || (ra->eof && ra->nchecked == ra->nread))
+			break;
+		if (ra->nchecked == ra->nread) {
+			pthread_cond_wait(&ra->cond, &ra->lock);
+			continue;
+		}
+		rec = &ra->recs[ra->nchecked++ % XLOG_RA_RECORDS];
+		if (rec->state != XLOG_RA_READ)
+			continue;
+		rec->state = XLOG_RA_CHECK;
+		pthread_mutex_unlock(&ra->lock);
+
+		error = xlog_unpack_data_crc(rec->rhead, rec->dp, ra->log);
+
+		pthread_mutex_lock(&ra->lock);
+		rec->error = error;
+		rec->state = XLOG_RA_DONE;
+		pthread_cond_broadcast(&ra->cond);
+	}
+	pthread_mutex_unlock(&ra->lock);
+	return NULL;
+}
+
+static void
+xlog_ra_free(
+	struct xlog_ra		*ra)
+{
+	int			i;
+
+	for (i = 0; i < XLOG_RA_RECORDS; i++) {
+		if (ra->recs[i].hbp)
+			xlog_put_bp(ra->recs[i].hbp);
+		if (ra->recs[i].dbp)
+			xlog_put_bp(ra->recs[i].dbp);
+	}
+	pthread_mutex_destroy(&ra->lock);
+	pthread_cond_destroy(&ra->cond);
+	free(ra);
+}
+
+/*
+ * Read the log from tail to head and process the log records found,
+ * wrapping around the end of the physical log if the tail and head are
+ * in different cycles.  The pass parameter is passed through to the
+ * routines called to process the data and is not looked at here.
  */
 int
 xlog_do_recovery_pass(
@@ -1432,12 +1749,12 @@ xlog_do_recovery_pass(
 	int			pass)
 {
 	xlog_rec_header_t	*rhead;
-	xfs_daddr_t		blk_no;
 	xfs_caddr_t		offset;
-	xfs_buf_t		*hbp, *dbp;
+	xfs_buf_t		*hbp;
+	struct xlog_ra		*ra;
+	struct xlog_ra_rec	*rec;
 	int			error = 0, h_size;
-	int			bblks, split_bblks;
-	int			hblks, split_hblks, wrapped_hblks;
+	int			hblks, i;
 	struct hlist_head	rhash[XLOG_RHASH_SIZE];
 
 	ASSERT(head_blk != tail_blk);
@@ -1449,229 +1766,109 @@ xlog_do_recovery_pass(
 	if (xfs_sb_version_haslogv2(&log->l_mp->m_sb)) {
 		/*
 		 * When using variable length iclogs, read first sector of
-		 * iclog header and extract the header size from it.  Get a
-		 * new hbp that is the correct size.
+		 * iclog header and extract the header size from it.
 		 */
 		hbp = xlog_get_bp(log, 1);
 		if (!hbp)
 			return ENOMEM;
 
 		error = xlog_bread(log, tail_blk, 1, hbp, &offset);
-		if (error)
-			goto bread_err1;
-
-		rhead = (xlog_rec_header_t *)offset;
-		error = xlog_valid_rec_header(log, rhead, tail_blk);
-		if (error)
-			goto bread_err1;
+		if (!error) {
+			rhead = (xlog_rec_header_t *)offset;
+			error = xlog_valid_rec_header(log, rhead, tail_blk);
+		}
+		if (error) {
+			xlog_put_bp(hbp);
+			return error;
+		}
 		h_size = be32_to_cpu(rhead->h_size);
 		if ((be32_to_cpu(rhead->h_version) & XLOG_VERSION_2) &&
 		    (h_size > XLOG_HEADER_CYCLE_SIZE)) {
 			hblks = h_size / XLOG_HEADER_CYCLE_SIZE;
 			if (h_size % XLOG_HEADER_CYCLE_SIZE)
 				hblks++;
-			xlog_put_bp(hbp);
-			hbp = xlog_get_bp(log, hblks);
 		} else {
 			hblks = 1;
 		}
+		xlog_put_bp(hbp);
 	} else {
 		ASSERT(log->l_sectBBsize == 1);
 		hblks = 1;
-		hbp = xlog_get_bp(log, 1);
 		h_size = XLOG_BIG_RECORD_BSIZE;
 	}
 
-	if (!hbp)
-		return ENOMEM;
-	dbp = xlog_get_bp(log, BTOBB(h_size));
-	if (!dbp) {
-		xlog_put_bp(hbp);
+	ra = calloc(1, sizeof(*ra));
+	if (!ra)
 		return ENOMEM;
+	pthread_mutex_init(&ra->lock, NULL);
+	pthread_cond_init(&ra->cond, NULL);
+	ra->log = log;
+	ra->hblks = hblks;
+	ra->blk_no = tail_blk;
+	ra->head_blk = head_blk;
+	ra->wrapped = tail_blk <= head_blk;
+	for (i = 0; i < XLOG_RA_RECORDS; i++) {
+		ra->recs[i].hbp = xlog_get_bp(log, hblks);
+		ra->recs[i].dbp = xlog_get_bp(log, BTOBB(h_size));
+		if (!ra->recs[i].hbp || !ra->recs[i].dbp) {
+			xlog_ra_free(ra);
+			return ENOMEM;
+		}
 	}
 
-	memset(rhash, 0, sizeof(rhash));
-	if (tail_blk <= head_blk) {
-		for (blk_no = tail_blk; blk_no < head_blk; ) {
-			error = xlog_bread(log, blk_no, hblks, hbp, &offset);
-			if (error)
-				goto bread_err2;
-
-			rhead = (xlog_rec_header_t *)offset;
-			error = xlog_valid_rec_header(log, rhead, blk_no);
-			if (error)
-				goto bread_err2;
-
-			/* blocks in data section */
-			bblks = (int)BTOBB(be32_to_cpu(rhead->h_len));
-			error = xlog_bread(log, blk_no + hblks, bblks, dbp,
-					   &offset);
-			if (error)
-				goto bread_err2;
-
-			error = xlog_unpack_data(rhead, offset, log);
-			if (error)
-				goto bread_err2;
+	for (i = 0; i < XLOG_RA_CRC_THREADS; i++) {
+		if (pthread_create(&ra->crc[i], NULL, xlog_ra_checker, ra))
+			break;
+	}
+	ra->ncrc = i;
+	if (pthread_create(&ra->reader, NULL, xlog_ra_reader, ra)) {
+		error = EAGAIN;
+		pthread_mutex_lock(&ra->lock);
+		ra->stop = 1;
+		pthread_cond_broadcast(&ra->cond);
+		pthread_mutex_unlock(&ra->lock);
+		goto out_join;
+	}
 
-			error = xlog_recover_process_data(log,
-						rhash, rhead, offset, pass);
-			if (error)
-				goto bread_err2;
-			blk_no += bblks + hblks;
+	memset(rhash, 0, sizeof(rhash));
+	pthread_mutex_lock(&ra->lock);
+	for (;;) {
+		rec = &ra->recs[ra->nused % XLOG_RA_RECORDS];
+		if (ra->nused == ra->nread) {
+			if (ra->eof)
+				break;
+			pthread_cond_wait(&ra->cond, &ra->lock);
+			continue;
 		}
-	} else {
-		/*
-		 * Perform recovery around the end of the physical log.
-		 * When the head is not on the same cycle number as the tail,
-		 * we can't do a sequential recovery as above.
-		 */
-		blk_no = tail_blk;
-		while (blk_no < log->l_logBBsize) {
-			/*
-			 * Check for header wrapping around physical end-of-log
-			 */
-			offset = hbp->b_addr;
-			split_hblks = 0;
-			wrapped_hblks = 0;
-			if (blk_no + hblks <= log->l_logBBsize) {
-				/* Read header in one read */
-				error = xlog_bread(log, blk_no, hblks, hbp,
-						   &offset);
-				if (error)
-					goto bread_err2;
-			} else {
-				/* This LR is split across physical log end */
-				if (blk_no != log->l_logBBsize) {
-					/* some data before physical log end */
-					ASSERT(blk_no <= INT_MAX);
-					split_hblks = log->l_logBBsize - (int)blk_no;
-					ASSERT(split_hblks > 0);
-					error = xlog_bread(log, blk_no,
-							   split_hblks, hbp,
-							   &offset);
-					if (error)
-						goto bread_err2;
-				}
-
-				/*
-				 * Note: this black magic still works with
-				 * large sector sizes (non-512) only because:
-				 * - we increased the buffer size originally
-				 *   by 1 sector giving us enough extra space
-				 *   for the second read;
-				 * - the log start is guaranteed to be sector
-				 *   aligned;
-				 * - we read the log end (LR header start)
-				 *   _first_, then the log start (LR header end)
-				 *   - order is important.
-				 */
-				wrapped_hblks = hblks - split_hblks;
-				error = xlog_bread_offset(log, 0,
-						wrapped_hblks, hbp,
-						offset + BBTOB(split_hblks));
-				if (error)
-					goto bread_err2;
-			}
-			rhead = (xlog_rec_header_t *)offset;
-			error = xlog_valid_rec_header(log, rhead,
-						split_hblks ? blk_no : 0);
-			if (error)
-				goto bread_err2;
-
-			bblks = (int)BTOBB(be32_to_cpu(rhead->h_len));
-			blk_no += hblks;
-
-			/* Read in data for log record */
-			if (blk_no + bblks <= log->l_logBBsize) {
-				error = xlog_bread(log, blk_no, bblks, dbp,
-						   &offset);
-				if (error)
-					goto bread_err2;
-			} else {
-				/* This log record is split across the
-				 * physical end of log */
-				offset = dbp->b_addr;
-				split_bblks = 0;
-				if (blk_no != log->l_logBBsize) {
-					/* some data is before the physical
-					 * end of log */
-					ASSERT(!wrapped_hblks);
-					ASSERT(blk_no <= INT_MAX);
-					split_bblks =
-						log->l_logBBsize - (int)blk_no;
-					ASSERT(split_bblks > 0);
-					error = xlog_bread(log, blk_no,
-							split_bblks, dbp,
-							&offset);
-					if (error)
-						goto bread_err2;
-				}
-
-				/*
-				 * Note: this black magic still works with
-				 * large sector sizes (non-512) only because:
-				 * - we increased the buffer size originally
-				 *   by 1 sector giving us enough extra space
-				 *   for the second read;
-				 * - the log start is guaranteed to be sector
-				 *   aligned;
-				 * - we read the log end (LR header start)
-				 *   _first_, then the log start (LR header end)
-				 *   - order is important.
-				 */
-				error = xlog_bread_offset(log, 0,
-						bblks - split_bblks, dbp,
-						offset + BBTOB(split_bblks));
-				if (error)
-					goto bread_err2;
-			}
-
-			error = xlog_unpack_data(rhead, offset, log);
-			if (error)
-				goto bread_err2;
-
-			error = xlog_recover_process_data(log, rhash,
-							rhead, offset, pass);
-			if (error)
-				goto bread_err2;
-			blk_no += bblks;
+		if (rec->state != XLOG_RA_DONE) {
+			pthread_cond_wait(&ra->cond, &ra->lock);
+			continue;
 		}
+		pthread_mutex_unlock(&ra->lock);
 
-		ASSERT(blk_no >= log->l_logBBsize);
-		blk_no -= log->l_logBBsize;
-
-		/* read first part of physical log */
-		while (blk_no < head_blk) {
-			error = xlog_bread(log, blk_no, hblks, hbp, &offset);
-			if (error)
-				goto bread_err2;
-
-			rhead = (xlog_rec_header_t *)offset;
-			error = xlog_valid_rec_header(log, rhead, blk_no);
-			if (error)
-				goto bread_err2;
-
-			bblks = (int)BTOBB(be32_to_cpu(rhead->h_len));
-			error = xlog_bread(log, blk_no+hblks, bblks, dbp,
-					   &offset);
-			if (error)
-				goto bread_err2;
-
-			error = xlog_unpack_data(rhead, offset, log);
-			if (error)
-				goto bread_err2;
-
+		error = rec->error;
+		if (!error)
+			error = xlog_unpack_data(rec->rhead, rec->dp, log);
+		if (!error)
 			error = xlog_recover_process_data(log, rhash,
-							rhead, offset, pass);
-			if (error)
-				goto bread_err2;
-			blk_no += bblks + hblks;
+						rec->rhead, rec->dp, pass);
+
+		pthread_mutex_lock(&ra->lock);
+		rec->state = XLOG_RA_FREE;
+		ra->nused++;
+		if (error) {
+			ra->stop = 1;
+			pthread_cond_broadcast(&ra->cond);
+			break;
 		}
+		pthread_cond_broadcast(&ra->cond);
 	}
+	pthread_mutex_unlock(&ra->lock);
 
- bread_err2:
-	xlog_put_bp(dbp);
- bread_err1:
-	xlog_put_bp(hbp);
+	pthread_join(ra->reader, NULL);
+out_join:
+	for (i = 0; i < ra->ncrc; i++)
+		pthread_join(ra->crc[i], NULL);
+	xlog_ra_free(ra);
 	return error;
 }
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "logprint.h"
+
+/*
+ * Log record index.
+ *
+ * One pass over the log reading only the first sector of each record
+ * header, starting at the oldest record and following h_len from one
+ * header to the next until the LSNs stop increasing.  The index is in
+ * LSN order, so an LSN range can be turned into the block range of the
+ * records covering it without decoding anything in between.
+ */
+
+static int
+xlog_lsn_cmp(
+	xfs_lsn_t	lsn1,
+	xfs_lsn_t	lsn2)
+{
+	if (CYCLE_LSN(lsn1) != CYCLE_LSN(lsn2))
+		return CYCLE_LSN(lsn1) < CYCLE_LSN(lsn2) ? -1 : 1;
+	if (BLOCK_LSN(lsn1) != BLOCK_LSN(lsn2))
+		return BLOCK_LSN(lsn1) < BLOCK_LSN(lsn2) ? -1 : 1;
+	return 0;
+}
+
+static int
+xlog_index_add(
+	xlog_index_t	*idx,
+	xfs_daddr_t	blkno,
+	xlog_rec_header_t *head)
+{
+	xlog_index_rec_t *rec;
+
+	if (idx->nrecs == idx->maxrecs) {
+		idx->maxrecs = idx->maxrecs ? idx->maxrecs * 2 : 1024;
+		idx->recs = realloc(idx->recs,
+				idx->maxrecs * sizeof(xlog_index_rec_t));
+		if (!idx->recs) {
+			fprintf(stderr, _("%s: %s: malloc failed\n"),
+				progname, __FUNCTION__);
+			exit(1);
+		}
+	}
+	rec = &idx->recs[idx->nrecs++];
+	rec->blkno = blkno;
+	rec->lsn = be64_to_cpu(head->h_lsn);
+	rec->len = be32_to_cpu(head->h_len);
+	rec->num_ops = be32_to_cpu(head->h_num_logops);
+	rec->hblks = 1;
+	if ((be32_to_cpu(head->h_version) & XLOG_VERSION_2) &&
+	    be32_to_cpu(head->h_size) > XLOG_HEADER_CYCLE_SIZE)
+		rec->hblks = howmany(be32_to_cpu(head->h_size),
+				     XLOG_HEADER_CYCLE_SIZE);
+	return 0;
+}
+
+int
+xlog_index_build(
+	struct xlog	*log,
+	xlog_index_t	*idx)
+{
+	xfs_buf_t	*bp;
+	xfs_caddr_t	offset;
+	xlog_rec_header_t *head;
+	xfs_daddr_t	blkno = 0;
+	xfs_daddr_t	walked = 0;
+	xfs_lsn_t	last_lsn = 0;
+	int		error;
+
+	memset(idx, 0, sizeof(*idx));
+	if ((error = xlog_print_find_oldest(log, &blkno)))
+		return error;
+	if ((bp = xlog_get_bp(log, 1)) == NULL)
+		return ENOMEM;
+
+	while (walked < log->l_logBBsize) {
+		if ((error = xlog_bread(log, blkno, 1, bp, &offset)))
+			break;
+		head = (xlog_rec_header_t *)offset;
+		if (be32_to_cpu(head->h_magicno) != XLOG_HEADER_MAGIC_NUM ||
+		    !head->h_len ||
+		    xlog_lsn_cmp(be64_to_cpu(head->h_lsn), last_lsn) <= 0) {
+			/*
+			 * On a wrapped log the oldest block is usually in
+			 * the middle of a record, so skip forward to the
+			 * first header like xfs_log_print does.
+			 */
+			if (idx->nrecs)
+				break;
+			walked++;
+			blkno = (blkno + 1) % log->l_logBBsize;
+			continue;
+		}
+		if (idx->nrecs &&
+		    xlog_get_cycle(offset) != CYCLE_LSN(last_lsn))
+			idx->cycle_start = idx->nrecs;
+		xlog_index_add(idx, blkno, head);
+		last_lsn = be64_to_cpu(head->h_lsn);
+
+		walked += idx->recs[idx->nrecs - 1].hblks +
+			  BTOBB(idx->recs[idx->nrecs - 1].len);
+		blkno = (blkno + idx->recs[idx->nrecs - 1].hblks +
+			 BTOBB(idx->recs[idx->nrecs - 1].len)) %
+			log->l_logBBsize;
+	}
+	xlog_put_bp(bp);
+	return 0;
+}
+
+void
+xlog_index_free(
+	xlog_index_t	*idx)
+{
+	free(idx->recs);
+	memset(idx, 0, sizeof(*idx));
+}
+
+/*
+ * Index of the first record with an LSN at or after lsn, or nrecs.
+ */
+int
+xlog_index_find(
+	xlog_index_t	*idx,
+	xfs_lsn_t	lsn)
+{
+	int		lo = 0;
+	int		hi = idx->nrecs;
+	int		mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (xlog_lsn_cmp(idx->recs[mid].lsn, lsn) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Turn an LSN range into the physical blocks of the first record in it
+ * and of the first block past its last record.  Returns non-zero if no
+ * record falls in the range.
+ */
+int
+xlog_index_range(
+	struct xlog	*log,
+	xlog_index_t	*idx,
+	xfs_lsn_t	start_lsn,
+	xfs_lsn_t	end_lsn,
+	xfs_daddr_t	*start_blk,
+	xfs_daddr_t	*end_blk)
+{
+	xlog_index_rec_t *rec;
+	int		first;
+	int		last;
+
+	first = xlog_index_find(idx, start_lsn);
+	if (end_lsn == NULLCOMMITLSN)
+		last = idx->nrecs;
+	else
+		last = xlog_index_find(idx, end_lsn + 1);
+	if (first >= last)
+		return 1;
+	rec = &idx->recs[last - 1];
+	*start_blk = idx->recs[first].blkno;
+
+	/*
+	 * A record ending at the physical end of the log stops there rather
+	 * than at block 0, which xfs_log_print would take as a wrapped range.
+	 */
+	*end_blk = rec->blkno + rec->hblks + BTOBB(rec->len);
+	if (*end_blk > log->l_logBBsize)
+		*end_blk -= log->l_logBBsize;
+	return 0;
+}
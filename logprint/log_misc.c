@@ -74,13 +74,19 @@ char *trans_type[] = {
 };
 
 typedef struct xlog_split_item {
-	struct xlog_split_item	*si_next;
-	struct xlog_split_item	*si_prev;
+	struct hlist_node	si_hash;
 	xlog_tid_t		si_tid;
 	int			si_skip;
 } xlog_split_item_t;
 
-xlog_split_item_t *split_list = NULL;
+/*
+ * Transactions with an operation split across log records, hashed by
+ * tid the same way recovery hashes in-flight transactions.  Finished
+ * entries are kept on a free list for reuse.
+ */
+static struct hlist_head split_hash[XLOG_RHASH_SIZE];
+static struct hlist_head split_free;
+static int		split_count;
 
 void
 print_xlog_op_line(void)
@@ -160,47 +166,47 @@ xlog_print_add_to_trans(xlog_tid_t	tid,
 {
     xlog_split_item_t *item;
 
-    item	  = (xlog_split_item_t *)calloc(sizeof(xlog_split_item_t), 1);
+    if (split_free.first) {
+	item = hlist_entry(split_free.first, xlog_split_item_t, si_hash);
+	hlist_del(&item->si_hash);
+    } else {
+	item = (xlog_split_item_t *)calloc(sizeof(xlog_split_item_t), 1);
+	if (!item) {
+	    fprintf(stderr, _("%s: %s: malloc failed\n"),
+		    progname, __FUNCTION__);
+	    exit(1);
+	}
+    }
     item->si_tid  = tid;
     item->si_skip = skip;
-    item->si_next = split_list;
-    item->si_prev = NULL;
-    if (split_list)
-	split_list->si_prev = item;
-    split_list	  = item;
+    hlist_add_head(&item->si_hash, &split_hash[XLOG_RHASH(tid)]);
+    split_count++;
 }	/* xlog_print_add_to_trans */
 
 
 int
 xlog_print_find_tid(xlog_tid_t tid, uint was_cont)
 {
-    xlog_split_item_t *listp = split_list;
+    xlog_split_item_t *item;
+    struct hlist_node *n;
 
-    if (!split_list) {
+    if (!split_count) {
 	if (was_cont != 0)	/* Not first time we have used this tid */
 	    return 1;
 	else
 	    return 0;
     }
-    while (listp) {
-	if (listp->si_tid == tid)
+    hlist_for_each_entry(item, n, &split_hash[XLOG_RHASH(tid)], si_hash) {
+	if (item->si_tid == tid)
 	    break;
-	listp = listp->si_next;
     }
-    if (!listp)  {
+    if (!n)  {
 	return 0;
     }
-    if (--listp->si_skip == 0) {
-	if (listp == split_list) {		/* delete at head */
-	    split_list = listp->si_next;
-	    if (split_list)
-		split_list->si_prev = NULL;
-	} else {
-	    if (listp->si_next)
-		listp->si_next->si_prev = listp->si_prev;
-	    listp->si_prev->si_next = listp->si_next;
-	}
-	free(listp);
+    if (--item->si_skip == 0) {
+	hlist_del(&item->si_hash);
+	hlist_add_head(&item->si_hash, &split_free);
+	split_count--;
     }
     return 1;
 }	/* xlog_print_find_tid */
@@ -1310,7 +1316,8 @@ xlog_print_extended_headers(
  */
 void xfs_log_print(struct xlog  *log,
 		   int          fd,
-		   int		print_block_start)
+		   int		print_block_start,
+		   int		print_block_end)
 {
     char			hbuf[XLOG_HEADER_SIZE];
     xlog_rec_header_t		*hdr = (xlog_rec_header_t *)&hbuf[0];
@@ -1339,6 +1346,8 @@ void xfs_log_print(struct xlog  *log,
 	block_start = block_end;
     else
 	block_start = print_block_start;
+    if (print_block_end != -1)
+	block_end = print_block_end;
     xlog_print_lseek(log, fd, block_start, SEEK_SET);
     blkno = block_start;
 
@@ -1401,6 +1410,7 @@ void xfs_log_print(struct xlog  *log,
 	    case 0: {
 		blkno += BTOBB(len);
 		if (print_block_start != -1 &&
+		    (print_block_end == -1 || block_end > block_start) &&
 		    blkno >= block_end)		/* If start specified, we */
 			goto end;		/* end early */
 		break;
@@ -1408,6 +1418,7 @@ void xfs_log_print(struct xlog  *log,
 	    case -1: {
 		print_xlog_bad_data(blkno-1);
 		if (print_block_start != -1 &&
+		    (print_block_end == -1 || block_end > block_start) &&
 		    blkno >= block_end)		/* If start specified, */
 			goto end;		/* we end early */
 		xlog_print_lseek(log, fd, blkno, SEEK_SET);
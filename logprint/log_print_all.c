@@ -17,6 +17,36 @@
  */
 
 #include "logprint.h"
+#include <pthread.h>
+
+/*
+ * Items of large transactions are formatted in parallel, each into its
+ * own memory stream, and written out in item order once all are done.
+ * Everything printed from this file goes through the calling thread's
+ * stream, or stdout when it has none.
+ */
+#define PRINT_MIN_ITEMS		16
+
+static pthread_key_t	print_stream_key;
+static pthread_once_t	print_stream_once = PTHREAD_ONCE_INIT;
+
+static void
+print_stream_init(void)
+{
+	pthread_key_create(&print_stream_key, NULL);
+}
+
+static FILE *
+print_stream(void)
+{
+	FILE	*fp;
+
+	pthread_once(&print_stream_once, print_stream_init);
+	fp = pthread_getspecific(print_stream_key);
+	return fp ? fp : stdout;
+}
+
+#define printf(fmt...)	fprintf(print_stream(), fmt)
 
 /*
  * Start is defined to be the block pointing to the oldest valid log record.
@@ -525,6 +555,145 @@ xlog_recover_print_item(
 	xlog_recover_print_logitem(item);
 }
 
+struct print_slot {
+	xlog_recover_item_t	*item;
+	char			*buf;
+	size_t			len;
+};
+
+static struct {
+	pthread_mutex_t		lock;
+	pthread_cond_t		work;
+	pthread_cond_t		done;
+	pthread_t		*threads;
+	int			nthreads;
+	struct print_slot	*slots;
+	int			maxslots;
+	int			nslots;
+	int			next;
+	int			finished;
+	unsigned long		gen;
+} print_pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+/*
+ * Format queued items until none are left.  Called with the pool lock
+ * held, returns with it held.
+ */
+static void
+print_pool_run(void)
+{
+	struct print_slot	*slot;
+	FILE			*fp;
+
+	while (print_pool.next < print_pool.nslots) {
+		slot = &print_pool.slots[print_pool.next++];
+		pthread_mutex_unlock(&print_pool.lock);
+
+		fp = open_memstream(&slot->buf, &slot->len);
+		if (!fp) {
+			fprintf(stderr, _("%s: %s: malloc failed\n"),
+				progname, __FUNCTION__);
+			exit(1);
+		}
+		pthread_setspecific(print_stream_key, fp);
+		xlog_recover_print_item(slot->item);
+		pthread_setspecific(print_stream_key, NULL);
+		fclose(fp);
+
+		pthread_mutex_lock(&print_pool.lock);
+		if (++print_pool.finished == print_pool.nslots)
+			pthread_cond_signal(&print_pool.done);
+	}
+}
+
+static void *
+print_pool_worker(
+	void		*arg)
+{
+	unsigned long	gen = 0;
+
+	pthread_mutex_lock(&print_pool.lock);
+	for (;;) {
+		while (gen == print_pool.gen)
+			pthread_cond_wait(&print_pool.work, &print_pool.lock);
+		gen = print_pool.gen;
+		print_pool_run();
+	}
+	return NULL;
+}
+
+static void
+print_pool_start(void)
+{
+	int		i;
+
+	pthread_once(&print_stream_once, print_stream_init);
+	print_pool.threads = calloc(print_threads - 1, sizeof(pthread_t));
+	if (!print_pool.threads) {
+		fprintf(stderr, _("%s: %s: malloc failed\n"),
+			progname, __FUNCTION__);
+		exit(1);
+	}
+	for (i = 0; i < print_threads - 1; i++) {
+		if (pthread_create(&print_pool.threads[i], NULL,
+				   print_pool_worker, NULL))
+			break;
+	}
+	print_pool.nthreads = i;
+}
+
+static void
+print_items_parallel(
+	struct list_head	*itemq)
+{
+	xlog_recover_item_t	*item;
+	int			i;
+
+	if (!print_pool.threads)
+		print_pool_start();
+
+	pthread_mutex_lock(&print_pool.lock);
+	print_pool.nslots = 0;
+	list_for_each_entry(item, itemq, ri_list) {
+		if (print_pool.nslots == print_pool.maxslots) {
+			print_pool.maxslots = print_pool.maxslots ?
+					print_pool.maxslots * 2 : 64;
+			print_pool.slots = realloc(print_pool.slots,
+					print_pool.maxslots *
+					sizeof(struct print_slot));
+			if (!print_pool.slots) {
+				fprintf(stderr, _("%s: %s: malloc failed\n"),
+					progname, __FUNCTION__);
+				exit(1);
+			}
+		}
+		print_pool.slots[print_pool.nslots].item = item;
+		print_pool.slots[print_pool.nslots].buf = NULL;
+		print_pool.slots[print_pool.nslots].len = 0;
+		print_pool.nslots++;
+	}
+	print_pool.next = 0;
+	print_pool.finished = 0;
+	print_pool.gen++;
+	pthread_cond_broadcast(&print_pool.work);
+
+	/* the calling thread formats its share too */
+	print_pool_run();
+	while (print_pool.finished < print_pool.nslots)
+		pthread_cond_wait(&print_pool.done, &print_pool.lock);
+	pthread_mutex_unlock(&print_pool.lock);
+
+	for (i = 0; i < print_pool.nslots; i++) {
+		fwrite(print_pool.slots[i].buf, 1, print_pool.slots[i].len,
+		       stdout);
+		free(print_pool.slots[i].buf);
+	}
+}
+
 void
 xlog_recover_print_trans(
 	xlog_recover_t		*trans,
@@ -538,6 +707,11 @@ xlog_recover_print_trans(
 
 	print_xlog_record_line();
 	xlog_recover_print_trans_head(trans);
+	if (print_threads > 1 &&
+	    trans->r_theader.th_num_items >= PRINT_MIN_ITEMS) {
+		print_items_parallel(itemq);
+		return;
+	}
 	list_for_each_entry(item, itemq, ri_list)
 		xlog_recover_print_item(item);
 }
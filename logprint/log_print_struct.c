@@ -0,0 +1,483 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "logprint.h"
+
+/*
+ * Transaction filters and structured (JSON lines or binary) output for
+ * the transactional view.  Items are decoded into an xlog_item_info
+ * once; filters are evaluated on that before anything is formatted.
+ */
+
+#define FILTER_INO	(1 << 0)
+#define FILTER_BLK	(1 << 1)
+#define FILTER_TID	(1 << 2)
+#define FILTER_TYPE	(1 << 3)
+
+static struct {
+	int		flags;
+	xfs_ino_t	ino;
+	xfs_daddr_t	blk_start;
+	xfs_daddr_t	blk_end;	/* inclusive */
+	xlog_tid_t	tid;
+	int		ntypes;
+	ushort		types[8];
+} filter;
+
+static struct {
+	char		*name;
+	ushort		type;
+} item_types[] = {
+	{ "buf",	XFS_LI_BUF },
+	{ "icreate",	XFS_LI_ICREATE },
+	{ "inode",	XFS_LI_INODE },
+	{ "efd",	XFS_LI_EFD },
+	{ "efi",	XFS_LI_EFI },
+	{ "dquot",	XFS_LI_DQUOT },
+	{ "qoff",	XFS_LI_QUOTAOFF },
+	{ NULL,		0 }
+};
+
+struct xlog_item_info {
+	ushort		type;		/* XFS_LI_* */
+	__uint64_t	ino;		/* inode number, dquot or EFI id */
+	xfs_daddr_t	blkno;		/* first disk block, -1 if none */
+	__uint32_t	len;		/* basic blocks */
+	__uint32_t	flags;
+	__uint32_t	count;		/* regions, extents or inodes */
+	xfs_efi_log_format_t *efi;	/* converted EFI extents */
+};
+
+static char *
+item_type_name(
+	ushort		type)
+{
+	int		i;
+
+	for (i = 0; item_types[i].name; i++)
+		if (item_types[i].type == type)
+			return item_types[i].name;
+	return "unknown";
+}
+
+/*
+ * Parse one -F filter, "key=value".  Different keys must all match;
+ * type may be given more than once to select several item types.
+ */
+int
+xlog_filter_add(
+	char		*arg)
+{
+	char		*val;
+	char		*end;
+	int		i;
+
+	if ((val = strchr(arg, '=')) == NULL)
+		return EINVAL;
+	*val++ = '\0';
+
+	if (!strcmp(arg, "ino")) {
+		filter.ino = strtoull(val, &end, 0);
+		filter.flags |= FILTER_INO;
+	} else if (!strcmp(arg, "blk")) {
+		filter.blk_start = strtoll(val, &end, 0);
+		filter.blk_end = filter.blk_start;
+		if (*end == ':')
+			filter.blk_end = strtoll(end + 1, &end, 0);
+		if (filter.blk_end < filter.blk_start)
+			return EINVAL;
+		filter.flags |= FILTER_BLK;
+	} else if (!strcmp(arg, "tid")) {
+		filter.tid = strtoul(val, &end, 16);
+		filter.flags |= FILTER_TID;
+	} else if (!strcmp(arg, "type")) {
+		for (i = 0; item_types[i].name; i++)
+			if (!strcmp(val, item_types[i].name))
+				break;
+		if (!item_types[i].name ||
+		    filter.ntypes == ARRAY_SIZE(filter.types))
+			return EINVAL;
+		filter.types[filter.ntypes++] = item_types[i].type;
+		filter.flags |= FILTER_TYPE;
+		return 0;
+	} else
+		return EINVAL;
+
+	return (*val && !*end) ? 0 : EINVAL;
+}
+
+/*
+ * Filesystem block to disk address, if we know the geometry.  A log
+ * file given with -f comes without a superblock.
+ */
+static xfs_daddr_t
+xlog_fsb_to_daddr(
+	xfs_mount_t	*mp,
+	xfs_fsblock_t	fsb)
+{
+	if (!mp->m_sb.sb_blocklog)
+		return -1;
+	return XFS_FSB_TO_DADDR(mp, fsb);
+}
+
+static void
+xlog_item_decode(
+	xfs_mount_t		*mp,
+	xlog_recover_item_t	*item,
+	struct xlog_item_info	*info)
+{
+	xfs_buf_log_format_t	*blf;
+	xfs_inode_log_format_t	ilf_buf, *ilf;
+	xfs_dq_logformat_t	*qlf;
+	xfs_efi_log_format_t	*efi;
+	xfs_efd_log_format_t	*efd;
+	xfs_qoff_logformat_t	*qoff;
+	struct xfs_icreate_log	*icl;
+	xfs_agnumber_t		agno;
+	xfs_agblock_t		agbno;
+
+	memset(info, 0, sizeof(*info));
+	info->type = ITEM_TYPE(item);
+	info->blkno = -1;
+
+	switch (info->type) {
+	case XFS_LI_BUF:
+		blf = (xfs_buf_log_format_t *)item->ri_buf[0].i_addr;
+		info->blkno = blf->blf_blkno;
+		info->len = blf->blf_len;
+		info->flags = blf->blf_flags;
+		info->count = blf->blf_size;
+		break;
+	case XFS_LI_INODE:
+		ilf = xfs_inode_item_format_convert(item->ri_buf[0].i_addr,
+				item->ri_buf[0].i_len, &ilf_buf);
+		info->ino = ilf->ilf_ino;
+		info->blkno = ilf->ilf_blkno;
+		info->len = ilf->ilf_len;
+		info->flags = ilf->ilf_fields;
+		info->count = ilf->ilf_size;
+		break;
+	case XFS_LI_DQUOT:
+		qlf = (xfs_dq_logformat_t *)item->ri_buf[0].i_addr;
+		info->ino = qlf->qlf_id;
+		info->blkno = qlf->qlf_blkno;
+		info->len = qlf->qlf_len;
+		info->count = qlf->qlf_size;
+		break;
+	case XFS_LI_EFI:
+		efi = (xfs_efi_log_format_t *)item->ri_buf[0].i_addr;
+		info->efi = malloc(sizeof(xfs_efi_log_format_t) +
+			(efi->efi_nextents - 1) * sizeof(xfs_extent_t));
+		if (!info->efi) {
+			fprintf(stderr, _("%s: %s: malloc failed\n"),
+				progname, __FUNCTION__);
+			exit(1);
+		}
+		if (xfs_efi_copy_format((char *)efi, item->ri_buf[0].i_len,
+					info->efi)) {
+			free(info->efi);
+			info->efi = NULL;
+			break;
+		}
+		info->ino = info->efi->efi_id;
+		info->count = info->efi->efi_nextents;
+		break;
+	case XFS_LI_EFD:
+		efd = (xfs_efd_log_format_t *)item->ri_buf[0].i_addr;
+		info->ino = efd->efd_efi_id;
+		info->count = efd->efd_nextents;
+		break;
+	case XFS_LI_ICREATE:
+		icl = (struct xfs_icreate_log *)item->ri_buf[0].i_addr;
+		agno = be32_to_cpu(icl->icl_ag);
+		agbno = be32_to_cpu(icl->icl_agbno);
+		info->count = be32_to_cpu(icl->icl_count);
+		if (!mp->m_sb.sb_blocklog)
+			break;
+		info->blkno = XFS_AGB_TO_DADDR(mp, agno, agbno);
+		info->len = XFS_FSB_TO_BB(mp, be32_to_cpu(icl->icl_length));
+		info->ino = ((xfs_ino_t)agno << (mp->m_sb.sb_inopblog +
+						 mp->m_sb.sb_agblklog)) |
+			    ((xfs_agino_t)agbno << mp->m_sb.sb_inopblog);
+		break;
+	case XFS_LI_QUOTAOFF:
+		qoff = (xfs_qoff_logformat_t *)item->ri_buf[0].i_addr;
+		info->flags = qoff->qf_flags;
+		info->count = qoff->qf_size;
+		break;
+	}
+}
+
+static int
+xlog_filter_blk(
+	xfs_mount_t		*mp,
+	struct xlog_item_info	*info)
+{
+	xfs_daddr_t		start;
+	int			i;
+
+	if (info->type == XFS_LI_EFI) {
+		if (!info->efi)
+			return 0;
+		for (i = 0; i < info->efi->efi_nextents; i++) {
+			start = xlog_fsb_to_daddr(mp,
+					info->efi->efi_extents[i].ext_start);
+			if (start == -1)
+				return 0;
+			if (start <= filter.blk_end &&
+			    start + XFS_FSB_TO_BB(mp,
+				info->efi->efi_extents[i].ext_len) >
+			    filter.blk_start)
+				return 1;
+		}
+		return 0;
+	}
+	if (info->blkno == -1)
+		return 0;
+	return info->blkno <= filter.blk_end &&
+	       info->blkno + (info->len ? info->len : 1) > filter.blk_start;
+}
+
+static int
+xlog_filter_item(
+	xfs_mount_t		*mp,
+	struct xlog_item_info	*info)
+{
+	int			i;
+
+	if (filter.flags & FILTER_TYPE) {
+		for (i = 0; i < filter.ntypes; i++)
+			if (filter.types[i] == info->type)
+				break;
+		if (i == filter.ntypes)
+			return 0;
+	}
+	if (filter.flags & FILTER_INO) {
+		if (info->type == XFS_LI_INODE) {
+			if (info->ino != filter.ino)
+				return 0;
+		} else if (info->type == XFS_LI_ICREATE && info->len) {
+			if (filter.ino < info->ino ||
+			    filter.ino >= info->ino + info->count)
+				return 0;
+		} else
+			return 0;
+	}
+	if ((filter.flags & FILTER_BLK) && !xlog_filter_blk(mp, info))
+		return 0;
+	return 1;
+}
+
+/*
+ * Move the items of a transaction that don't pass the filters onto the
+ * rejected list, so only the rest are formatted.  Returns the number of
+ * items left.  The caller splices them back before recovery frees the
+ * transaction.
+ */
+int
+xlog_filter_trans(
+	struct xlog		*log,
+	xlog_recover_t		*trans,
+	struct list_head	*rejected)
+{
+	xlog_recover_item_t	*item, *n;
+	struct xlog_item_info	info;
+	int			count = 0;
+
+	if ((filter.flags & FILTER_TID) && trans->r_log_tid != filter.tid) {
+		list_splice_init(&trans->r_itemq, rejected);
+		return 0;
+	}
+	if (!(filter.flags & ~FILTER_TID)) {
+		list_for_each_entry(item, &trans->r_itemq, ri_list)
+			count++;
+		return count;
+	}
+	list_for_each_entry_safe(item, n, &trans->r_itemq, ri_list) {
+		xlog_item_decode(log->l_mp, item, &info);
+		if (xlog_filter_item(log->l_mp, &info))
+			count++;
+		else
+			list_move_tail(&item->ri_list, rejected);
+		free(info.efi);
+	}
+	return count;
+}
+
+/*
+ * JSON lines: one object per transaction, followed by one per item.
+ */
+static void
+xlog_json_trans(
+	xlog_recover_t		*trans,
+	int			count)
+{
+	FILE			*fp = print_struct_out;
+
+	fprintf(fp, "{\"trans\":{\"tid\":\"0x%x\",\"type\":\"%s\","
+		    "\"lsn\":\"%u,%u\",\"items\":%d}}\n",
+		trans->r_log_tid, trans_type[trans->r_theader.th_type],
+		CYCLE_LSN(trans->r_lsn), BLOCK_LSN(trans->r_lsn), count);
+}
+
+static void
+xlog_json_item(
+	xlog_recover_t		*trans,
+	struct xlog_item_info	*info)
+{
+	FILE			*fp = print_struct_out;
+	int			i;
+
+	fprintf(fp, "{\"item\":{\"tid\":\"0x%x\",\"type\":\"%s\","
+		    "\"count\":%u",
+		trans->r_log_tid, item_type_name(info->type), info->count);
+
+	switch (info->type) {
+	case XFS_LI_BUF:
+		fprintf(fp, ",\"blkno\":%lld,\"len\":%u,\"flags\":%u",
+			(long long)info->blkno, info->len, info->flags);
+		break;
+	case XFS_LI_INODE:
+		fprintf(fp, ",\"ino\":%llu,\"blkno\":%lld,\"len\":%u,"
+			    "\"fields\":%u",
+			(unsigned long long)info->ino,
+			(long long)info->blkno, info->len, info->flags);
+		break;
+	case XFS_LI_DQUOT:
+		fprintf(fp, ",\"id\":%llu,\"blkno\":%lld,\"len\":%u",
+			(unsigned long long)info->ino,
+			(long long)info->blkno, info->len);
+		break;
+	case XFS_LI_EFI:
+		fprintf(fp, ",\"id\":\"0x%llx\",\"extents\":[",
+			(unsigned long long)info->ino);
+		for (i = 0; info->efi && i < info->efi->efi_nextents; i++)
+			fprintf(fp, "%s[%llu,%u]", i ? "," : "",
+				(unsigned long long)
+					info->efi->efi_extents[i].ext_start,
+				info->efi->efi_extents[i].ext_len);
+		fprintf(fp, "]");
+		break;
+	case XFS_LI_EFD:
+		fprintf(fp, ",\"id\":\"0x%llx\"",
+			(unsigned long long)info->ino);
+		break;
+	case XFS_LI_ICREATE:
+		if (info->len)
+			fprintf(fp, ",\"ino\":%llu,\"blkno\":%lld,\"len\":%u",
+				(unsigned long long)info->ino,
+				(long long)info->blkno, info->len);
+		break;
+	case XFS_LI_QUOTAOFF:
+		fprintf(fp, ",\"flags\":%u", info->flags);
+		break;
+	}
+	fprintf(fp, "}}\n");
+}
+
+/*
+ * Binary stream: an 8 byte magic, then fixed size big-endian records.
+ * A transaction record is followed by its item records; an EFI record
+ * is followed by one extent record per extent.
+ */
+#define XLOG_BIN_MAGIC		"XFSLOGB1"
+#define XLOG_BIN_TRANS		0
+#define XLOG_BIN_EXTENT		1
+
+struct xlog_bin_rec {
+	__be16		br_kind;	/* XLOG_BIN_* or an XFS_LI_* type */
+	__be16		br_ttype;	/* transaction type */
+	__be32		br_tid;
+	__be64		br_lsn;
+	__be64		br_ino;		/* inode number, dquot or EFI id */
+	__be64		br_blkno;	/* disk or fs block, ~0 if none */
+	__be32		br_len;
+	__be32		br_flags;
+	__be32		br_count;
+	__be32		br_pad;
+};
+
+static void
+xlog_bin_write(
+	xlog_recover_t		*trans,
+	int			kind,
+	__uint64_t		ino,
+	__uint64_t		blkno,
+	__uint32_t		len,
+	__uint32_t		flags,
+	__uint32_t		count)
+{
+	static int		header_done;
+	struct xlog_bin_rec	rec;
+	FILE			*fp = print_struct_out;
+
+	if (!header_done) {
+		fwrite(XLOG_BIN_MAGIC, 1, 8, fp);
+		header_done = 1;
+	}
+	rec.br_kind = cpu_to_be16(kind);
+	rec.br_ttype = cpu_to_be16(trans->r_theader.th_type);
+	rec.br_tid = cpu_to_be32(trans->r_log_tid);
+	rec.br_lsn = cpu_to_be64(trans->r_lsn);
+	rec.br_ino = cpu_to_be64(ino);
+	rec.br_blkno = cpu_to_be64(blkno);
+	rec.br_len = cpu_to_be32(len);
+	rec.br_flags = cpu_to_be32(flags);
+	rec.br_count = cpu_to_be32(count);
+	rec.br_pad = 0;
+	fwrite(&rec, sizeof(rec), 1, fp);
+}
+
+static void
+xlog_bin_item(
+	xlog_recover_t		*trans,
+	struct xlog_item_info	*info)
+{
+	int			i;
+
+	xlog_bin_write(trans, info->type, info->ino, info->blkno,
+			info->len, info->flags, info->count);
+	for (i = 0; info->efi && i < info->efi->efi_nextents; i++)
+		xlog_bin_write(trans, XLOG_BIN_EXTENT, info->ino,
+			info->efi->efi_extents[i].ext_start,
+			info->efi->efi_extents[i].ext_len, 0, 0);
+}
+
+void
+xlog_print_trans_struct(
+	struct xlog		*log,
+	xlog_recover_t		*trans,
+	int			count)
+{
+	xlog_recover_item_t	*item;
+	struct xlog_item_info	info;
+
+	if (print_format == PRINT_FORMAT_JSON)
+		xlog_json_trans(trans, count);
+	else
+		xlog_bin_write(trans, XLOG_BIN_TRANS, 0, -1, 0, 0, count);
+
+	list_for_each_entry(item, &trans->r_itemq, ri_list) {
+		xlog_item_decode(log->l_mp, item, &info);
+		if (print_format == PRINT_FORMAT_JSON)
+			xlog_json_item(trans, &info);
+		else
+			xlog_bin_item(trans, &info);
+		free(info.efi);
+	}
+}
@@ -34,14 +34,26 @@ xlog_recover_do_trans(
 	xlog_recover_t	*trans,
 	int		pass)
 {
-	xlog_recover_print_trans(trans, &trans->r_itemq, 3);
+	struct list_head	rejected;
+	int			count;
+
+	INIT_LIST_HEAD(&rejected);
+	count = xlog_filter_trans(log, trans, &rejected);
+	if (count || list_empty(&rejected)) {
+		if (print_format == PRINT_FORMAT_TEXT)
+			xlog_recover_print_trans(trans, &trans->r_itemq, 3);
+		else
+			xlog_print_trans_struct(log, trans, count);
+	}
+	list_splice(&rejected, &trans->r_itemq);
 	return 0;
 }
 
 void
 xfs_log_print_trans(
 	struct xlog	*log,
-	int		print_block_start)
+	int		print_block_start,
+	int		print_block_end)
 {
 	xfs_daddr_t	head_blk, tail_blk;
 	int		error;
@@ -62,6 +74,10 @@ xfs_log_print_trans(
 		printf(_("    override tail: %d\n"), print_block_start);
 		tail_blk = print_block_start;
 	}
+	if (print_block_end != -1) {
+		printf(_("    override head: %d\n"), print_block_end);
+		head_blk = print_block_end;
+	}
 	printf("\n");
 
 	print_record_header = 1;
@@ -34,6 +34,9 @@ int	print_overwrite;
 int     print_no_data;
 int     print_no_print;
 int     print_exit = 1; /* -e is now default. specify -c to override */
+int	print_threads;
+int	print_format = PRINT_FORMAT_TEXT;
+FILE	*print_struct_out;
 int	print_operation = OP_PRINT;
 
 void
@@ -46,9 +49,14 @@ Options:\n\
     -d	            dump the log in log-record format\n\
     -e	            exit when an error is found in the log\n\
     -f	            specified device is actually a file\n\
+    -F <key>=<val>  in transactional view, only items matching a filter\n\
+                    (ino=<n>, blk=<start>[:<end>], tid=<hex>, type=<name>)\n\
+    -j <threads>    threads used to format the transactional view\n\
+    -L <lsn>[:<lsn>] print only records in an LSN range (cycle,block)\n\
     -l <device>     filename of external log\n\
     -n	            don't try and interpret log data\n\
     -o	            print buffer data in hex\n\
+    -O json|binary  transactional view as JSON lines or binary records\n\
     -s <start blk>  block # to start printing\n\
     -v              print \"overwrite\" data\n\
     -t	            print out transactional view\n\
@@ -127,10 +135,67 @@ logstat(xfs_mount_t *mp)
 	return 0;
 }
 
+static int
+parse_lsn(
+	char		*str,
+	xfs_lsn_t	*lsn)
+{
+	unsigned int	cycle, block;
+	int		n = 0;
+
+	if (sscanf(str, "%u,%u%n", &cycle, &block, &n) != 2 || str[n])
+		return 1;
+	*lsn = xlog_assign_lsn(cycle, block);
+	return 0;
+}
+
+/*
+ * Index the record headers and map the requested LSN range onto the
+ * blocks to start and stop printing at.
+ */
+static void
+lsn_range(
+	struct xlog	*log,
+	char		*range,
+	int		*start_blk,
+	int		*end_blk)
+{
+	xlog_index_t	idx;
+	xfs_lsn_t	start_lsn, end_lsn = NULLCOMMITLSN;
+	xfs_daddr_t	start, end;
+	char		*p;
+
+	if ((p = strchr(range, ':')) != NULL)
+		*p++ = '\0';
+	if (parse_lsn(range, &start_lsn) || (p && parse_lsn(p, &end_lsn))) {
+		fprintf(stderr, _("%s: bad LSN range\n"), progname);
+		usage();
+	}
+	if (xlog_index_build(log, &idx)) {
+		fprintf(stderr, _("%s: problem indexing log records\n"),
+			progname);
+		exit(1);
+	}
+	if (xlog_index_range(log, &idx, start_lsn, end_lsn, &start, &end)) {
+		fprintf(stderr, _("%s: no log records in LSN range\n"),
+			progname);
+		exit(1);
+	}
+	printf(_("    indexed %d records, head cycle starts at record %d\n"),
+		idx.nrecs, idx.cycle_start);
+	printf(_("    LSN range blocks: %lld - %lld\n\n"),
+		(long long)start, (long long)end);
+	xlog_index_free(&idx);
+	*start_blk = start;
+	*end_blk = end;
+}
+
 int
 main(int argc, char **argv)
 {
 	int		print_start = -1;
+	int		print_end = -1;
+	char		*range = NULL;
 	int		c;
 	int             logfd;
 	char		*copy_file = NULL;
@@ -143,7 +208,7 @@ main(int argc, char **argv)
 	memset(&mount, 0, sizeof(mount));
 
 	progname = basename(argv[0]);
-	while ((c = getopt(argc, argv, "bC:cdefl:iqnors:tDVv")) != EOF) {
+	while ((c = getopt(argc, argv, "bC:cdefF:j:l:iL:qnoO:rs:tDVv")) != EOF) {
 		switch (c) {
 			case 'D':
 				print_only_data++;
@@ -174,6 +239,22 @@ main(int argc, char **argv)
 				print_skip_uuid++;
 				x.disfile = 1;
 				break;
+			case 'F':
+				if (xlog_filter_add(optarg)) {
+					fprintf(stderr,
+						_("%s: bad filter \"%s\"\n"),
+						progname, optarg);
+					usage();
+				}
+				break;
+			case 'j':
+				print_threads = atoi(optarg);
+				if (print_threads <= 0)
+					usage();
+				break;
+			case 'L':
+				range = optarg;
+				break;
 			case 'l':
 				x.logname = optarg;
 				x.lisfile = 1;
@@ -190,6 +271,14 @@ main(int argc, char **argv)
 			case 'o':
 				print_data++;
 				break;
+			case 'O':
+				if (!strcmp(optarg, "json"))
+					print_format = PRINT_FORMAT_JSON;
+				else if (!strcmp(optarg, "binary"))
+					print_format = PRINT_FORMAT_BINARY;
+				else
+					usage();
+				break;
 			case 's':
 				print_start = atoi(optarg);
 				break;
@@ -215,6 +304,25 @@ main(int argc, char **argv)
 	if (x.dname == NULL)
 		usage();
 
+	/*
+	 * Structured output implies the transactional view.  It keeps the
+	 * real stdout to itself; everything else printed goes to stderr.
+	 */
+	if (print_format != PRINT_FORMAT_TEXT) {
+		if (print_operation != OP_PRINT &&
+		    print_operation != OP_PRINT_TRANS)
+			usage();
+		print_operation = OP_PRINT_TRANS;
+		fflush(stdout);
+		if ((c = dup(STDOUT_FILENO)) < 0 ||
+		    (print_struct_out = fdopen(c, "w")) == NULL ||
+		    dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+			fprintf(stderr, _("%s: cannot set up output: %s\n"),
+				progname, strerror(errno));
+			exit(1);
+		}
+	}
+
 	x.isreadonly = LIBXFS_ISINACTIVE;
 	printf(_("xfs_logprint:\n"));
 	if (!libxfs_init(&x))
@@ -245,12 +353,21 @@ main(int argc, char **argv)
 	log.l_sectBBsize  = BTOBB(x.lbsize);
 	log.l_mp          = &mount;
 
+	if (!print_threads)
+		print_threads = libxfs_nproc();
+	if (range) {
+		if (print_operation != OP_PRINT &&
+		    print_operation != OP_PRINT_TRANS)
+			usage();
+		lsn_range(&log, range, &print_start, &print_end);
+	}
+
 	switch (print_operation) {
 	case OP_PRINT:
-		xfs_log_print(&log, logfd, print_start);
+		xfs_log_print(&log, logfd, print_start, print_end);
 		break;
 	case OP_PRINT_TRANS:
-		xfs_log_print_trans(&log, print_start);
+		xfs_log_print_trans(&log, print_start, print_end);
 		break;
 	case OP_DUMP:
 		xfs_log_dump(&log, logfd, print_start);
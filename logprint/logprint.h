@@ -30,6 +30,13 @@ extern int	print_transactions;
 extern int	print_overwrite;
 extern int	print_no_data;
 extern int	print_no_print;
+extern int	print_threads;
+extern int	print_format;
+extern FILE	*print_struct_out;
+
+#define PRINT_FORMAT_TEXT	0
+#define PRINT_FORMAT_JSON	1
+#define PRINT_FORMAT_BINARY	2
 
 /* exports */
 extern char *trans_type[];
@@ -38,13 +45,43 @@ extern void xlog_print_lseek(struct xlog *, int, xfs_daddr_t, int);
 
 extern void xfs_log_copy(struct xlog *, int, char *);
 extern void xfs_log_dump(struct xlog *, int, int);
-extern void xfs_log_print(struct xlog *, int, int);
-extern void xfs_log_print_trans(struct xlog *, int);
+extern void xfs_log_print(struct xlog *, int, int, int);
+extern void xfs_log_print_trans(struct xlog *, int, int);
 
 extern void print_xlog_record_line(void);
 extern void print_xlog_op_line(void);
 extern void print_stars(void);
 
+/*
+ * Index of log record headers in LSN order, from the oldest record up to
+ * the head.  cycle_start is the first record written in the head cycle.
+ */
+typedef struct xlog_index_rec {
+	xfs_daddr_t	blkno;		/* block of the record header */
+	xfs_lsn_t	lsn;
+	int		len;		/* bytes of data after the header */
+	int		num_ops;
+	int		hblks;		/* header blocks */
+} xlog_index_rec_t;
+
+typedef struct xlog_index {
+	xlog_index_rec_t *recs;
+	int		nrecs;
+	int		maxrecs;
+	int		cycle_start;
+} xlog_index_t;
+
+extern int xlog_index_build(struct xlog *, xlog_index_t *);
+extern void xlog_index_free(xlog_index_t *);
+extern int xlog_index_find(xlog_index_t *, xfs_lsn_t);
+extern int xlog_index_range(struct xlog *, xlog_index_t *, xfs_lsn_t,
+		xfs_lsn_t, xfs_daddr_t *, xfs_daddr_t *);
+
+extern int xlog_filter_add(char *);
+extern int xlog_filter_trans(struct xlog *, xlog_recover_t *,
+		struct list_head *);
+extern void xlog_print_trans_struct(struct xlog *, xlog_recover_t *, int);
+
 extern xfs_inode_log_format_t *
 	xfs_inode_item_format_convert(char *, uint, xfs_inode_log_format_t *);
 extern int xfs_efi_copy_format(char *, uint, xfs_efi_log_format_t *);
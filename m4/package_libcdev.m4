@@ -185,3 +185,57 @@ AC_DEFUN([AC_HAVE_READDIR],
     AC_SUBST(have_readdir)
   ])
 
+#
+# Check if we have splice and vmsplice libc calls (Linux)
+#
+AC_DEFUN([AC_HAVE_SPLICE],
+  [ AC_MSG_CHECKING([for splice])
+    AC_TRY_LINK([
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <fcntl.h>
+#include <sys/uio.h>
+    ], [
+         splice(0, 0, 0, 0, 0, SPLICE_F_MOVE);
+         vmsplice(0, 0, 0, 0);
+    ], have_splice=yes
+       AC_MSG_RESULT(yes),
+       AC_MSG_RESULT(no))
+    AC_SUBST(have_splice)
+  ])
+
+#
+# Check if we have the copy_file_range syscall (Linux)
+#
+AC_DEFUN([AC_HAVE_COPY_FILE_RANGE],
+  [ AC_MSG_CHECKING([for copy_file_range])
+    AC_TRY_COMPILE([
+#include <unistd.h>
+#include <sys/syscall.h>
+    ], [
+         syscall(__NR_copy_file_range, 0, 0, 0, 0, 0, 0);
+    ], have_copy_file_range=yes
+       AC_MSG_RESULT(yes),
+       AC_MSG_RESULT(no))
+    AC_SUBST(have_copy_file_range)
+  ])
+
+#
+# Check if we have the io_uring syscalls and header (Linux)
+#
+AC_DEFUN([AC_HAVE_IO_URING],
+  [ AC_MSG_CHECKING([for io_uring])
+    AC_TRY_COMPILE([
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+    ], [
+         struct io_uring_params p;
+         syscall(__NR_io_uring_setup, 1, &p);
+         syscall(__NR_io_uring_enter, 0, 0, 0, IORING_ENTER_GETEVENTS, 0, 0);
+         syscall(__NR_io_uring_register, 0, IORING_REGISTER_BUFFERS, 0, 0);
+    ], have_io_uring=yes
+       AC_MSG_RESULT(yes),
+       AC_MSG_RESULT(no))
+    AC_SUBST(have_io_uring)
+  ])
@@ -18,6 +18,7 @@
 
 #include <xfs/libxfs.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include "xfs_mkfs.h"
 
 /*
@@ -33,6 +34,9 @@ static int newfile(xfs_trans_t *tp, xfs_inode_t *ip, xfs_bmap_free_t *flist,
 static char *newregfile(char **pp, int *len);
 static void rtinit(xfs_mount_t *mp);
 static long filesize(int fd);
+static mode_t filemode(int fd);
+static void srcdir_scan_start(char *dirname);
+static void srcdir_populate(xfs_mount_t *mp, struct fsxattr *fsxp);
 
 /*
  * Use this for block reservations needed for mkfs's conditions
@@ -61,6 +65,16 @@ setup_proto(
 			progname, fname, strerror(errno));
 		exit(1);
 	}
+	/*
+	 * A directory is used as the source tree itself.  Start scanning
+	 * it now so the walk overlaps with laying down the AG headers;
+	 * parse_proto will pick up the result.
+	 */
+	if (S_ISDIR(filemode(fd))) {
+		close(fd);
+		srcdir_scan_start(fname);
+		return NULL;
+	}
 	buf = malloc(size + 1);
 	if (read(fd, buf, size) < size) {
 		fprintf(stderr, _("%s: read failed on %s: %s\n"),
@@ -592,7 +606,665 @@ parse_proto(
 	struct fsxattr	*fsx,
 	char		**pp)
 {
-	parseproto(mp, NULL, fsx, pp, NULL);
+	if (*pp == NULL)
+		srcdir_populate(mp, fsx);
+	else
+		parseproto(mp, NULL, fsx, pp, NULL);
+}
+
+/*
+ * Populate the filesystem from a directory tree on the host.
+ *
+ * The tree is walked by a pool of scanner threads, started from
+ * setup_proto so that the readdir/stat traffic overlaps with the rest of
+ * mkfs.  Each directory is read in full by one thread, its entries are
+ * sorted by name and any subdirectories are queued for the next idle
+ * thread.  The result is an in-memory copy of the tree which is then
+ * written out by srcdir_populate in a single pass.
+ *
+ * Placement follows the allocator: all the non-directory entries of a
+ * directory are created first, so their inodes and data land in the
+ * directory's AG, and only then are the subdirectories created, which
+ * xfs_dialloc spreads across the AGs.  Entries are created in batches of
+ * up to SRCDIR_BATCH inodes per transaction rather than one transaction
+ * per entry as for a proto file.
+ */
+#define SRCDIR_MAX_THREADS	16
+#define SRCDIR_BATCH		64		/* inodes per transaction */
+#define SRCDIR_BATCH_BLOCKS	4096		/* data blocks per transaction */
+#define SRCDIR_IOSIZE		(1024 * 1024)	/* file data copy size */
+#define SRCDIR_LINK_HASH	4096
+
+typedef struct srcent {
+	char		*name;
+	struct stat64	st;
+	char		*target;	/* symlink contents */
+	char		*path;		/* directories only */
+	struct srcent	*ents;		/* directory entries, sorted */
+	int		nents;
+	struct srcent	*qnext;		/* scan queue */
+} srcent_t;
+
+typedef struct srclink {
+	dev_t		dev;
+	ino_t		ino;
+	xfs_ino_t	xino;
+	struct srclink	*next;
+} srclink_t;
+
+static struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	wait;
+	srcent_t	*qhead;
+	srcent_t	*qtail;
+	int		busy;		/* threads scanning a directory */
+	int		nthreads;
+	pthread_t	*threads;
+	srcent_t	root;
+	char		*iobuf;
+	srclink_t	*links[SRCDIR_LINK_HASH];
+} srcdir;
+
+static int
+srcent_cmp(
+	const void	*a,
+	const void	*b)
+{
+	return strcmp(((srcent_t *)a)->name, ((srcent_t *)b)->name);
+}
+
+static char *
+srcdir_path(
+	char		*dir,
+	char		*name)
+{
+	char		*path;
+
+	path = malloc(strlen(dir) + strlen(name) + 2);
+	if (!path)
+		fail(_("cannot allocate source path"), errno);
+	sprintf(path, "%s/%s", dir, name);
+	return path;
+}
+
+/*
+ * Read one directory and stat everything in it.
+ */
+static void
+srcdir_scan_dir(
+	srcent_t	*dir)
+{
+	DIR		*d;
+	struct dirent	*dp;
+	srcent_t	*ent;
+	int		max = 0;
+	ssize_t		len;
+
+	if ((d = opendir(dir->path)) == NULL) {
+		fprintf(stderr, _("%s: cannot open directory %s: %s\n"),
+			progname, dir->path, strerror(errno));
+		exit(1);
+	}
+	while ((dp = readdir(d)) != NULL) {
+		if (strcmp(dp->d_name, ".") == 0 ||
+		    strcmp(dp->d_name, "..") == 0)
+			continue;
+		if (dir->nents == max) {
+			max = max ? max * 2 : 16;
+			dir->ents = realloc(dir->ents, max * sizeof(srcent_t));
+			if (!dir->ents)
+				fail(_("cannot allocate directory entries"),
+					errno);
+		}
+		ent = &dir->ents[dir->nents];
+		memset(ent, 0, sizeof(*ent));
+		if (fstatat64(dirfd(d), dp->d_name, &ent->st,
+				AT_SYMLINK_NOFOLLOW) < 0) {
+			fprintf(stderr, _("%s: cannot stat %s/%s: %s\n"),
+				progname, dir->path, dp->d_name,
+				strerror(errno));
+			exit(1);
+		}
+		ent->name = strdup(dp->d_name);
+		if (!ent->name)
+			fail(_("cannot allocate directory entries"), errno);
+		if (S_ISLNK(ent->st.st_mode)) {
+			ent->target = malloc(ent->st.st_size + 1);
+			len = readlinkat(dirfd(d), dp->d_name, ent->target,
+					ent->st.st_size + 1);
+			if (len < 0 || len > ent->st.st_size) {
+				fprintf(stderr,
+					_("%s: cannot read link %s/%s: %s\n"),
+					progname, dir->path, dp->d_name,
+					len < 0 ? strerror(errno) :
+						  _("link changed"));
+				exit(1);
+			}
+			ent->target[len] = '\0';
+		}
+		dir->nents++;
+	}
+	closedir(d);
+
+	qsort(dir->ents, dir->nents, sizeof(srcent_t), srcent_cmp);
+	for (ent = dir->ents; ent < dir->ents + dir->nents; ent++)
+		if (S_ISDIR(ent->st.st_mode))
+			ent->path = srcdir_path(dir->path, ent->name);
+}
+
+static void *
+srcdir_scan_thread(
+	void		*arg)
+{
+	srcent_t	*dir;
+	srcent_t	*ent;
+
+	pthread_mutex_lock(&srcdir.lock);
+	for (;;) {
+		while (!srcdir.qhead && srcdir.busy)
+			pthread_cond_wait(&srcdir.wait, &srcdir.lock);
+		if (!srcdir.qhead)
+			break;
+		dir = srcdir.qhead;
+		srcdir.qhead = dir->qnext;
+		srcdir.busy++;
+		pthread_mutex_unlock(&srcdir.lock);
+
+		srcdir_scan_dir(dir);
+
+		pthread_mutex_lock(&srcdir.lock);
+		for (ent = dir->ents; ent < dir->ents + dir->nents; ent++) {
+			if (!S_ISDIR(ent->st.st_mode))
+				continue;
+			if (srcdir.qhead)
+				srcdir.qtail->qnext = ent;
+			else
+				srcdir.qhead = ent;
+			srcdir.qtail = ent;
+		}
+		srcdir.busy--;
+		pthread_cond_broadcast(&srcdir.wait);
+	}
+	pthread_mutex_unlock(&srcdir.lock);
+	return NULL;
+}
+
+static void
+srcdir_scan_start(
+	char		*dirname)
+{
+	long		ncpus;
+	int		i;
+	int		err;
+
+	if (stat64(dirname, &srcdir.root.st) < 0)
+		fail(_("cannot stat source directory"), errno);
+	srcdir.root.path = strdup(dirname);
+	srcdir.qhead = srcdir.qtail = &srcdir.root;
+	pthread_mutex_init(&srcdir.lock, NULL);
+	pthread_cond_init(&srcdir.wait, NULL);
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	srcdir.nthreads = ncpus < 1 ? 1 : MIN(ncpus, SRCDIR_MAX_THREADS);
+	srcdir.threads = malloc(srcdir.nthreads * sizeof(pthread_t));
+	if (!srcdir.threads)
+		fail(_("cannot allocate scanner threads"), errno);
+	for (i = 0; i < srcdir.nthreads; i++) {
+		err = pthread_create(&srcdir.threads[i], NULL,
+				srcdir_scan_thread, NULL);
+		if (err)
+			fail(_("cannot create scanner thread"), err);
+	}
+}
+
+static void
+srcdir_scan_wait(void)
+{
+	int		i;
+
+	for (i = 0; i < srcdir.nthreads; i++)
+		pthread_join(srcdir.threads[i], NULL);
+	free(srcdir.threads);
+	srcdir.threads = NULL;
+}
+
+/*
+ * Blocks needed outside the inode itself for one entry.
+ */
+static xfs_filblks_t
+srcent_blocks(
+	xfs_mount_t	*mp,
+	srcent_t	*ent)
+{
+	if (S_ISREG(ent->st.st_mode) || S_ISLNK(ent->st.st_mode))
+		return XFS_B_TO_FSB(mp, ent->st.st_size);
+	return 0;
+}
+
+static void
+srcdir_plan(
+	xfs_mount_t	*mp,
+	srcent_t	*dir,
+	__uint64_t	*blocks)
+{
+	srcent_t	*ent;
+
+	for (ent = dir->ents; ent < dir->ents + dir->nents; ent++) {
+		if (S_ISDIR(ent->st.st_mode))
+			srcdir_plan(mp, ent, blocks);
+		else	/* share hard linked data between its names */
+			*blocks += howmany(srcent_blocks(mp, ent),
+					   ent->st.st_nlink);
+	}
+}
+
+static srclink_t **
+srcdir_link_bucket(
+	srcent_t	*ent)
+{
+	return &srcdir.links[(ent->st.st_ino ^ ent->st.st_dev) %
+			     SRCDIR_LINK_HASH];
+}
+
+static xfs_ino_t
+srcdir_link_find(
+	srcent_t	*ent)
+{
+	srclink_t	*l;
+
+	for (l = *srcdir_link_bucket(ent); l; l = l->next)
+		if (l->ino == ent->st.st_ino && l->dev == ent->st.st_dev)
+			return l->xino;
+	return NULLFSINO;
+}
+
+static void
+srcdir_link_add(
+	srcent_t	*ent,
+	xfs_ino_t	xino)
+{
+	srclink_t	**bucket = srcdir_link_bucket(ent);
+	srclink_t	*l;
+
+	l = malloc(sizeof(*l));
+	if (!l)
+		fail(_("cannot allocate hard link table"), errno);
+	l->dev = ent->st.st_dev;
+	l->ino = ent->st.st_ino;
+	l->xino = xino;
+	l->next = *bucket;
+	*bucket = l;
+}
+
+static int
+srcent_is_link(
+	srcent_t	*ent)
+{
+	return !S_ISDIR(ent->st.st_mode) && ent->st.st_nlink > 1;
+}
+
+static void
+srcdir_settimes(
+	xfs_inode_t	*ip,
+	struct stat64	*st)
+{
+	ip->i_d.di_atime.t_sec = (__int32_t)st->st_atime;
+	ip->i_d.di_atime.t_nsec = (__int32_t)st->st_atim.tv_nsec;
+	ip->i_d.di_mtime.t_sec = (__int32_t)st->st_mtime;
+	ip->i_d.di_mtime.t_nsec = (__int32_t)st->st_mtim.tv_nsec;
+	ip->i_d.di_ctime.t_sec = (__int32_t)st->st_ctime;
+	ip->i_d.di_ctime.t_nsec = (__int32_t)st->st_ctim.tv_nsec;
+	if (ip->i_d.di_version == 3)
+		ip->i_d.di_crtime = ip->i_d.di_mtime;
+}
+
+/*
+ * Copy a regular file's contents into newly allocated blocks.  The data
+ * goes straight to the device, it is never read back through the cache.
+ */
+static void
+srcdir_newfile(
+	xfs_trans_t	*tp,
+	xfs_inode_t	*ip,
+	xfs_bmap_free_t	*flist,
+	xfs_fsblock_t	*first,
+	char		*path,
+	srcent_t	*ent)
+{
+	xfs_mount_t	*mp = ip->i_mount;
+	xfs_bmbt_irec_t	map[XFS_BMAP_MAX_NMAP];
+	xfs_fileoff_t	bno = 0;
+	xfs_filblks_t	nb;
+	xfs_daddr_t	daddr;
+	off64_t		off;
+	size_t		len;
+	ssize_t		n;
+	int		devfd;
+	int		error;
+	int		fd;
+	int		nmap;
+	int		i;
+
+	nb = XFS_B_TO_FSB(mp, ent->st.st_size);
+	if (nb == 0) {
+		ip->i_d.di_size = 0;
+		return;
+	}
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		fprintf(stderr, _("%s: cannot open %s: %s\n"),
+			progname, path, strerror(errno));
+		exit(1);
+	}
+	devfd = libxfs_device_to_fd(mp->m_ddev_targp->dev);
+	while (bno < nb) {
+		nmap = XFS_BMAP_MAX_NMAP;
+		error = libxfs_bmapi_write(tp, ip, bno, nb - bno, 0, first,
+				nb - bno, map, &nmap, flist);
+		if (error)
+			fail(_("error allocating space for a file"), error);
+		if (nmap == 0)
+			fail(_("error allocating space for a file"), ENOSPC);
+		for (i = 0; i < nmap; i++) {
+			off = XFS_FSB_TO_B(mp, map[i].br_startoff);
+			daddr = XFS_FSB_TO_DADDR(mp, map[i].br_startblock);
+			len = XFS_FSB_TO_B(mp, map[i].br_blockcount);
+			while (len > 0) {
+				size_t	count = MIN(len, SRCDIR_IOSIZE);
+
+				n = pread64(fd, srcdir.iobuf, count, off);
+				if (n < 0) {
+					fprintf(stderr,
+						_("%s: read failed on %s: %s\n"),
+						progname, path,
+						strerror(errno));
+					exit(1);
+				}
+				memset(srcdir.iobuf + n, 0, count - n);
+				if (pwrite64(devfd, srcdir.iobuf, count,
+						BBTOB(daddr)) != (ssize_t)count)
+					fail(_("error writing file data"),
+						errno);
+				off += count;
+				daddr += BTOBB(count);
+				len -= count;
+			}
+			bno += map[i].br_blockcount;
+		}
+	}
+	close(fd);
+	ip->i_d.di_size = ent->st.st_size;
+}
+
+/*
+ * Create one non-directory entry in dp.  If inode allocation has to roll
+ * the transaction dp is rejoined to the new one.
+ */
+static void
+srcdir_newent(
+	xfs_mount_t	*mp,
+	xfs_trans_t	**tpp,
+	xfs_inode_t	*dp,
+	struct fsxattr	*fsxp,
+	srcent_t	*dir,
+	srcent_t	*ent,
+	xfs_bmap_free_t	*flist,
+	xfs_fsblock_t	*first)
+{
+	cred_t		creds;
+	int		error;
+	int		flags = XFS_ILOG_CORE;
+	xfs_inode_t	*ip;
+	xfs_ino_t	ino;
+	mode_t		mode = ent->st.st_mode;
+	char		*path;
+	xfs_dev_t	rdev = 0;
+	xfs_trans_t	*otp = *tpp;
+	struct xfs_name	xname;
+
+	xname.name = (uchar_t *)ent->name;
+	xname.len = strlen(ent->name);
+
+	if (srcent_is_link(ent) &&
+	    (ino = srcdir_link_find(ent)) != NULLFSINO) {
+		error = libxfs_trans_iget(mp, *tpp, ino, 0, 0, &ip);
+		if (error)
+			fail(_("cannot read hard linked inode"), error);
+		ip->i_d.di_nlink++;
+		libxfs_trans_ichgtime(*tpp, ip, XFS_ICHGTIME_CHG);
+		libxfs_trans_log_inode(*tpp, ip, XFS_ILOG_CORE);
+		newdirent(mp, *tpp, dp, &xname, ino, first, flist);
+		return;
+	}
+
+	if (S_ISCHR(mode) || S_ISBLK(mode))
+		rdev = IRIX_MKDEV(major(ent->st.st_rdev),
+				  minor(ent->st.st_rdev));
+	memset(&creds, 0, sizeof(creds));
+	creds.cr_uid = ent->st.st_uid;
+	creds.cr_gid = ent->st.st_gid;
+	error = libxfs_inode_alloc(tpp, dp, mode, 1, rdev,
+				   &creds, fsxp, &ip);
+	if (error)
+		fail(_("Inode allocation failed"), error);
+	if (*tpp != otp) {
+		/* the old transaction took dp and the earlier entries */
+		libxfs_trans_ijoin(*tpp, dp, 0);
+		libxfs_trans_ihold(*tpp, dp);
+		*first = NULLFSBLOCK;
+	}
+
+	switch (mode & S_IFMT) {
+	case S_IFREG:
+		path = srcdir_path(dir->path, ent->name);
+		srcdir_newfile(*tpp, ip, flist, first, path, ent);
+		free(path);
+		break;
+	case S_IFLNK:
+		flags |= newfile(*tpp, ip, flist, first, 1, 1, ent->target,
+				(int)strlen(ent->target));
+		break;
+	case S_IFCHR:
+	case S_IFBLK:
+		flags |= XFS_ILOG_DEV;
+		break;
+	}
+	/* ialloc may have inherited the setgid group from dp */
+	ip->i_d.di_gid = ent->st.st_gid;
+	srcdir_settimes(ip, &ent->st);
+	libxfs_trans_log_inode(*tpp, ip, flags);
+	newdirent(mp, *tpp, dp, &xname, ip->i_ino, first, flist);
+	if (srcent_is_link(ent))
+		srcdir_link_add(ent, ip->i_ino);
+}
+
+static void srcdir_fill(xfs_mount_t *mp, xfs_inode_t *dp,
+	struct fsxattr *fsxp, srcent_t *dir);
+
+/*
+ * Create a directory inode for ent.  A NULL pdp makes it the root.
+ */
+static xfs_inode_t *
+srcdir_newdir(
+	xfs_mount_t	*mp,
+	xfs_inode_t	*pdp,
+	struct fsxattr	*fsxp,
+	srcent_t	*ent)
+{
+	cred_t		creds;
+	int		committed;
+	int		error;
+	xfs_fsblock_t	first;
+	xfs_bmap_free_t	flist;
+	xfs_inode_t	*ip;
+	xfs_trans_t	*tp;
+	struct xfs_name	xname;
+
+	memset(&creds, 0, sizeof(creds));
+	creds.cr_uid = ent->st.st_uid;
+	creds.cr_gid = ent->st.st_gid;
+	tp = libxfs_trans_alloc(mp, 0);
+	getres(tp, 0);
+	xfs_bmap_init(&flist, &first);
+	error = libxfs_inode_alloc(&tp, pdp, ent->st.st_mode, 1, 0,
+				   &creds, fsxp, &ip);
+	if (error)
+		fail(_("Inode allocation failed"), error);
+	ip->i_d.di_nlink++;		/* account for . */
+	if (!pdp) {
+		mp->m_sb.sb_rootino = ip->i_ino;
+		libxfs_mod_sb(tp, XFS_SB_ROOTINO);
+	} else {
+		xname.name = (uchar_t *)ent->name;
+		xname.len = strlen(ent->name);
+		libxfs_trans_ijoin(tp, pdp, 0);
+		newdirent(mp, tp, pdp, &xname, ip->i_ino, &first, &flist);
+		pdp->i_d.di_nlink++;
+		libxfs_trans_ihold(tp, pdp);
+		libxfs_trans_log_inode(tp, pdp, XFS_ILOG_CORE);
+	}
+	/* ialloc may have inherited the setgid group from pdp */
+	ip->i_d.di_gid = ent->st.st_gid;
+	newdirectory(mp, tp, ip, pdp ? pdp : ip);
+	libxfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
+	error = libxfs_bmap_finish(&tp, &flist, &committed);
+	if (error)
+		fail(_("Directory creation failed"), error);
+	libxfs_trans_ihold(tp, ip);
+	libxfs_trans_commit(tp, 0);
+	return ip;
+}
+
+/*
+ * Fill dp with the contents of dir: first the files, in batched
+ * transactions, then each subdirectory in turn.
+ */
+static void
+srcdir_fill(
+	xfs_mount_t	*mp,
+	xfs_inode_t	*dp,
+	struct fsxattr	*fsxp,
+	srcent_t	*dir)
+{
+	int		committed;
+	int		error;
+	xfs_fsblock_t	first;
+	xfs_bmap_free_t	flist;
+	xfs_inode_t	*ip;
+	xfs_trans_t	*tp;
+	srcent_t	*end = dir->ents + dir->nents;
+	srcent_t	*ent = dir->ents;
+	srcent_t	*last;
+	xfs_filblks_t	blocks;
+	xfs_filblks_t	b;
+	uint		rsv;
+	int		n;
+
+	while (ent < end) {
+		/*
+		 * Size the next batch.  Hard linked files go in a
+		 * transaction of their own so that a later link never
+		 * finds its inode still joined to the current one.
+		 * Besides the file data, reserve room for each entry in
+		 * dp and for one inode chunk allocation.
+		 */
+		blocks = 0;
+		rsv = XFS_IALLOC_SPACE_RES(mp);
+		for (last = ent, n = 0; last < end && n < SRCDIR_BATCH;
+		     last++) {
+			if (S_ISDIR(last->st.st_mode))
+				continue;
+			b = srcent_blocks(mp, last);
+			if (n && (blocks + b > SRCDIR_BATCH_BLOCKS ||
+				  srcent_is_link(last)))
+				break;
+			blocks += b;
+			rsv += XFS_DIRENTER_SPACE_RES(mp, strlen(last->name));
+			n++;
+			if (srcent_is_link(last)) {
+				last++;
+				break;
+			}
+		}
+		if (n == 0)
+			break;
+
+		tp = libxfs_trans_alloc(mp, 0);
+		getres(tp, blocks + rsv);
+		xfs_bmap_init(&flist, &first);
+		libxfs_trans_ijoin(tp, dp, 0);
+		libxfs_trans_ihold(tp, dp);
+		for (; ent < last; ent++) {
+			if (S_ISDIR(ent->st.st_mode))
+				continue;
+			srcdir_newent(mp, &tp, dp, fsxp, dir, ent,
+				      &flist, &first);
+		}
+		libxfs_trans_log_inode(tp, dp, XFS_ILOG_CORE);
+		error = libxfs_bmap_finish(&tp, &flist, &committed);
+		if (error)
+			fail(_("Error encountered populating directory"),
+				error);
+		libxfs_trans_commit(tp, 0);
+	}
+
+	for (ent = dir->ents; ent < end; ent++) {
+		if (!S_ISDIR(ent->st.st_mode))
+			continue;
+		ip = srcdir_newdir(mp, dp, fsxp, ent);
+		srcdir_fill(mp, ip, fsxp, ent);
+		libxfs_iput(ip, 0);
+	}
+
+	/* directory timestamps last, adding entries updated them */
+	tp = libxfs_trans_alloc(mp, 0);
+	libxfs_trans_ijoin(tp, dp, 0);
+	libxfs_trans_ihold(tp, dp);
+	srcdir_settimes(dp, &dir->st);
+	libxfs_trans_log_inode(tp, dp, XFS_ILOG_CORE);
+	libxfs_trans_commit(tp, 0);
+
+	for (ent = dir->ents; ent < end; ent++) {
+		free(ent->name);
+		free(ent->target);
+		free(ent->path);
+	}
+	free(dir->ents);
+	dir->ents = NULL;
+	dir->nents = 0;
+}
+
+static void
+srcdir_populate(
+	xfs_mount_t	*mp,
+	struct fsxattr	*fsxp)
+{
+	__uint64_t	blocks = 0;
+	xfs_inode_t	*ip;
+
+	srcdir_scan_wait();
+
+	srcdir_plan(mp, &srcdir.root, &blocks);
+	if (blocks > mp->m_sb.sb_fdblocks) {
+		fprintf(stderr,
+	_("%s: source directory %s needs %llu blocks, only %llu available\n"),
+			progname, srcdir.root.path,
+			(unsigned long long)blocks,
+			(unsigned long long)mp->m_sb.sb_fdblocks);
+		exit(1);
+	}
+	srcdir.iobuf = memalign(libxfs_device_alignment(), SRCDIR_IOSIZE);
+	if (!srcdir.iobuf)
+		fail(_("cannot allocate file data buffer"), errno);
+
+	ip = srcdir_newdir(mp, NULL, fsxp, &srcdir.root);
+	/*
+	 * RT initialization.  Do this here to ensure that
+	 * the RT inodes get placed after the root inode.
+	 */
+	rtinit(mp);
+	srcdir_fill(mp, ip, fsxp, &srcdir.root);
+	libxfs_iput(ip, 0);
+	free(srcdir.iobuf);
 }
 
 /*
@@ -770,3 +1442,14 @@ filesize(
 		return -1;
 	return (long)stb.st_size;
 }
+
+static mode_t
+filemode(
+	int		fd)
+{
+	struct stat64	stb;
+
+	if (fstat64(fd, &stb) < 0)
+		return 0;
+	return stb.st_mode;
+}
@@ -847,17 +847,43 @@ done:
 }
 
 static void
-discard_blocks(dev_t dev, __uint64_t nsectors)
+discard_progress(
+	void		*arg,
+	__uint64_t	done,
+	__uint64_t	total)
 {
-	int fd;
+	int		*lastpct = arg;
+	int		pct = (int)(done * 100 / total);
+
+	if (pct == *lastpct)
+		return;
+	*lastpct = pct;
+	printf(_("\rDiscarding blocks... %d%%"), pct);
+	fflush(stdout);
+}
+
+static void
+discard_blocks(dev_t dev, __uint64_t nsectors, int quiet)
+{
+	int		fd;
+	int		lastpct = -1;
+	int		verbose;
 
 	/*
 	 * We intentionally ignore errors from the discard ioctl.  It is
 	 * not necessary for the mkfs functionality but just an optimization.
+	 * Large devices are discarded in granularity aligned chunks from
+	 * several threads, with progress shown if anyone is watching.
 	 */
 	fd = libxfs_device_to_fd(dev);
-	if (fd > 0)
-		platform_discard_blocks(fd, 0, nsectors << 9);
+	if (fd <= 0)
+		return;
+	verbose = !quiet && isatty(STDOUT_FILENO);
+	libxfs_device_discard(dev, 0, nsectors,
+			platform_discard_granularity(fd),
+			verbose ? discard_progress : NULL, &lastpct);
+	if (verbose && lastpct >= 0)
+		printf(_("\rDiscarding blocks...Done.\n"));
 }
 
 int
@@ -2059,11 +2085,11 @@ _("32 bit Project IDs always enabled on CRC enabled filesytems\n"));
 	}
 
 	if (discard && !Nflag) {
-		discard_blocks(xi.ddev, xi.dsize);
+		discard_blocks(xi.ddev, xi.dsize, qflag);
 		if (xi.rtdev)
-			discard_blocks(xi.rtdev, xi.rtsize);
+			discard_blocks(xi.rtdev, xi.rtsize, qflag);
 		if (xi.logdev && xi.logdev != xi.ddev)
-			discard_blocks(xi.logdev, xi.logBBsize);
+			discard_blocks(xi.logdev, xi.logBBsize, qflag);
 	}
 
 	if (!liflag && !ldflag)
@@ -2889,7 +2915,8 @@ _("size %s specified for log subvolume is too large, maximum is %lld blocks\n"),
 	}
 
 	/*
-	 * Allocate the root inode and anything else in the proto file.
+	 * Allocate the root inode and anything else in the proto file
+	 * or source directory.
 	 */
 	parse_proto(mp, &fsx, &protostring);
 
@@ -3095,7 +3122,7 @@ usage( void )
 /* label */		[-L label (maximum 12 characters)]\n\
 /* naming */		[-n log=n|size=num,version=2|ci,ftype=0|1]\n\
 /* no-op info only */	[-N]\n\
-/* prototype file */	[-p fname]\n\
+/* prototype file */	[-p fname|dir]\n\
 /* quiet */		[-q]\n\
 /* realtime subvol */	[-r extsize=num,size=num,rtdev=xxx]\n\
 /* sectorsize */	[-s log=n|size=num]\n\
@@ -18,29 +18,64 @@
 
 #include <xfs/command.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <grp.h>
 #include "init.h"
 #include "quota.h"
 
 typedef struct du {
-	struct du	*next;
 	__uint64_t	blocks;
 	__uint64_t	blocks30;
 	__uint64_t	blocks60;
 	__uint64_t	blocks90;
-	__uint64_t	nfiles;
+	__uint64_t	nfiles;		/* zero: free slot in a dutab */
 	__uint32_t	id;
 } du_t;
 
+/*
+ * Per-id usage, hashed by id with open addressing and doubled as it
+ * fills up, so there is no limit on the number of ids.
+ */
+typedef struct dutab {
+	du_t		*slots;
+	__uint32_t	size;		/* a power of two */
+	__uint32_t	used;
+} dutab_t;
+
 #define	TSIZE		500
+
+/*
+ * What one bulkstat thread has seen: each thread keeps its own tables
+ * and they are merged once all of them are done.
+ */
+typedef struct quot_acct {
+	dutab_t		du[3];		/* usr/grp/prj */
+	__uint64_t	sizes[TSIZE];
+	__uint64_t	overflow;
+} quot_acct_t;
+
+typedef struct quot_scan {
+	pthread_mutex_t	lock;		/* next_ag, error */
+	char		*fsdir;
+	int		fsfd;
+	uint		flags;
+	xfs_agnumber_t	next_ag;
+	xfs_agnumber_t	agcount;
+	int		agino_log;	/* zero: one scan of everything */
+	int		error;
+} quot_scan_t;
+
+typedef struct quot_thread {
+	quot_scan_t	*scan;
+	quot_acct_t	acct;
+	pthread_t	tid;
+} quot_thread_t;
+
 static __uint64_t	sizes[TSIZE];
 static __uint64_t	overflow;
 
-#define	NDU		60000
-#define	DUHASH		8209
-static du_t		du[3][NDU];
-static du_t		*duhash[3][DUHASH];
+static du_t		*du[3];	/* sorted for the report */
 static int		ndu[3];	/* #usr/grp/prj */
 
 #define NBSTAT 		4069
@@ -76,13 +111,79 @@ quot_help(void)
 "\n"));
 }
 
+/* the slot holding id, or the free one it would go in */
+static du_t *
+dutab_slot(
+	dutab_t		*t,
+	__uint32_t	id)
+{
+	__uint32_t	h;
+	du_t		*dp;
+
+	h = id * 2654435761U;
+	for (h ^= h >> 16; ; h++) {
+		dp = &t->slots[h & (t->size - 1)];
+		if (!dp->nfiles || dp->id == id)
+			return dp;
+	}
+}
+
+static void
+dutab_grow(
+	dutab_t		*t)
+{
+	dutab_t		old = *t;
+	__uint32_t	i;
+
+	t->size = old.size ? old.size * 2 : 64;
+	t->slots = calloc(t->size, sizeof(du_t));
+	if (!t->slots) {
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0; i < old.size; i++)
+		if (old.slots[i].nfiles)
+			*dutab_slot(t, old.slots[i].id) = old.slots[i];
+	free(old.slots);
+}
+
+/*
+ * Find the entry for id, adding an empty one if there isn't one yet.
+ * The caller must count a file against a new entry before the next
+ * lookup, as a slot with no files is a free one.
+ */
+static du_t *
+dutab_lookup(
+	dutab_t		*t,
+	__uint32_t	id)
+{
+	du_t		*dp;
+
+	if ((t->used + 1) * 4 > t->size * 3)
+		dutab_grow(t);
+	dp = dutab_slot(t, id);
+	if (!dp->nfiles) {
+		dp->id = id;
+		t->used++;
+	}
+	return dp;
+}
+
+static void
+dutab_free(
+	dutab_t		*t)
+{
+	free(t->slots);
+	memset(t, 0, sizeof(*t));
+}
+
 static void
 quot_bulkstat_add(
+	quot_acct_t	*acct,
 	xfs_bstat_t	*p,
 	uint		flags)
 {
 	du_t		*dp;
-	du_t		**hp;
 	__uint64_t	size;
 	__uint32_t	i, id;
 
@@ -94,32 +195,16 @@ quot_bulkstat_add(
 		if (!(S_ISDIR(p->bs_mode) || S_ISREG(p->bs_mode)))
 			return;
 		if (size >= TSIZE) {
-			overflow += size;
+			acct->overflow += size;
 			size = TSIZE - 1;
 		}
-		sizes[(int)size]++;
+		acct->sizes[(int)size]++;
 		return;
 	}
 	for (i = 0; i < 3; i++) {
 		id = (i == 0) ? p->bs_uid : ((i == 1) ?
 			p->bs_gid : bstat_get_projid(p));
-		hp = &duhash[i][id % DUHASH];
-		for (dp = *hp; dp; dp = dp->next)
-			if (dp->id == id)
-				break;
-		if (dp == NULL) {
-			if (ndu[i] >= NDU)
-				return;
-			dp = &du[i][(ndu[i]++)];
-			dp->next = *hp;
-			*hp = dp;
-			dp->id = id;
-			dp->nfiles = 0;
-			dp->blocks = 0;
-			dp->blocks30 = 0;
-			dp->blocks60 = 0;
-			dp->blocks90 = 0;
-		}
+		dp = dutab_lookup(&acct->du[i], id);
 		dp->blocks += size;
 
 		if (now - p->bs_atime.tv_sec > 30 * (60*60*24))
@@ -133,39 +218,54 @@ quot_bulkstat_add(
 }
 
 static void
-quot_bulkstat_mount(
-	char			*fsdir,
-	uint			flags)
+quot_acct_merge(
+	quot_acct_t	*to,
+	quot_acct_t	*from)
+{
+	du_t		*src, *dp;
+	__uint32_t	i, j;
+
+	for (i = 0; i < TSIZE; i++)
+		to->sizes[i] += from->sizes[i];
+	to->overflow += from->overflow;
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < from->du[i].size; j++) {
+			src = &from->du[i].slots[j];
+			if (!src->nfiles)
+				continue;
+			dp = dutab_lookup(&to->du[i], src->id);
+			dp->blocks += src->blocks;
+			dp->blocks30 += src->blocks30;
+			dp->blocks60 += src->blocks60;
+			dp->blocks90 += src->blocks90;
+			dp->nfiles += src->nfiles;
+		}
+		dutab_free(&from->du[i]);
+	}
+}
+
+/*
+ * Bulkstat an AG at a time until there are none left.  Inode numbers
+ * start with the AG number, so an AG's inodes are the ones from its
+ * first possible inode number up to the first one of the next AG.
+ */
+static void *
+quot_bulkstat_thread(
+	void			*arg)
 {
+	quot_thread_t		*qt = arg;
+	quot_scan_t		*qs = qt->scan;
 	xfs_fsop_bulkreq_t	bulkreq;
 	xfs_bstat_t		*buf;
-	__u64			last = 0;
+	xfs_agnumber_t		agno;
+	__u64			last;
 	__s32			count;
-	int			i, sts, fsfd;
-	du_t			**dp;
-
-	/*
-	 * Initialize tables between checks; because of the qsort
-	 * in report() the hash tables must be rebuilt each time.
-	 */
-	for (sts = 0; sts < TSIZE; sts++)
-		sizes[sts] = 0;
-	overflow = 0;
-	for (i = 0; i < 3; i++)
-		for (dp = duhash[i]; dp < &duhash[i][DUHASH]; dp++)
-			*dp = NULL;
-	ndu[0] = ndu[1] = ndu[2] = 0;
-
-	fsfd = open(fsdir, O_RDONLY);
-	if (fsfd < 0) {
-		perror(fsdir);
-		return;
-	}
+	int			i;
 
 	buf = (xfs_bstat_t *)calloc(NBSTAT, sizeof(xfs_bstat_t));
 	if (!buf) {
 		perror("calloc");
-		return;
+		goto out_error;
 	}
 
 	bulkreq.lastip = &last;
@@ -173,16 +273,143 @@ quot_bulkstat_mount(
 	bulkreq.ubuffer = buf;
 	bulkreq.ocount = &count;
 
-	while ((sts = xfsctl(fsdir, fsfd, XFS_IOC_FSBULKSTAT, &bulkreq)) == 0) {
-		if (count == 0)
+	for (;;) {
+		pthread_mutex_lock(&qs->lock);
+		agno = qs->next_ag++;
+		pthread_mutex_unlock(&qs->lock);
+		if (agno >= qs->agcount)
 			break;
-		for (i = 0; i < count; i++)
-			quot_bulkstat_add(&buf[i], flags);
+
+		last = agno ? ((__u64)agno << qs->agino_log) - 1 : 0;
+		for (;;) {
+			if (xfsctl(qs->fsdir, qs->fsfd, XFS_IOC_FSBULKSTAT,
+					&bulkreq) < 0) {
+				perror("XFS_IOC_FSBULKSTAT");
+				free(buf);
+				goto out_error;
+			}
+			if (count == 0)
+				break;
+			for (i = 0; i < count; i++) {
+				if (qs->agino_log &&
+				    buf[i].bs_ino >> qs->agino_log != agno)
+					break;
+				quot_bulkstat_add(&qt->acct, &buf[i],
+						qs->flags);
+			}
+			if (i < count)
+				break;
+		}
 	}
-	if (sts < 0)
-		perror("XFS_IOC_FSBULKSTAT"),
 	free(buf);
-	close(fsfd);
+	return NULL;
+
+out_error:
+	pthread_mutex_lock(&qs->lock);
+	qs->error = 1;
+	pthread_mutex_unlock(&qs->lock);
+	return NULL;
+}
+
+/* log2 rounded up, as the superblock's agblklog and inopblog are */
+static int
+quot_log2(
+	__uint32_t	v)
+{
+	int		log = 0;
+
+	while ((1ULL << log) < v)
+		log++;
+	return log;
+}
+
+static void
+quot_bulkstat_mount(
+	char			*fsdir,
+	uint			flags)
+{
+	xfs_fsop_geom_t		geom;
+	quot_scan_t		qs;
+	quot_thread_t		*threads;
+	quot_acct_t		*total;
+	int			nthreads;
+	int			started;
+	int			i, j;
+
+	/*
+	 * Initialize tables between checks; because of the qsort
+	 * in report() the tables must be rebuilt each time.
+	 */
+	memset(sizes, 0, sizeof(sizes));
+	overflow = 0;
+	for (i = 0; i < 3; i++) {
+		free(du[i]);
+		du[i] = NULL;
+		ndu[i] = 0;
+	}
+
+	memset(&qs, 0, sizeof(qs));
+	qs.fsdir = fsdir;
+	qs.flags = flags;
+	qs.fsfd = open(fsdir, O_RDONLY);
+	if (qs.fsfd < 0) {
+		perror(fsdir);
+		return;
+	}
+
+	/* one thread over everything if the AG layout can't be had */
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (xfsctl(fsdir, qs.fsfd, XFS_IOC_FSGEOMETRY, &geom) == 0) {
+		qs.agcount = geom.agcount;
+		qs.agino_log = quot_log2(geom.agblocks) +
+			       quot_log2(geom.blocksize / geom.inodesize);
+	} else {
+		qs.agcount = 1;
+	}
+	nthreads = max(1, min(nthreads, (int)qs.agcount));
+
+	threads = calloc(nthreads, sizeof(quot_thread_t));
+	total = calloc(1, sizeof(quot_acct_t));
+	if (!threads || !total) {
+		perror("calloc");
+		goto out;
+	}
+	pthread_mutex_init(&qs.lock, NULL);
+	for (i = 0; i < nthreads; i++)
+		threads[i].scan = &qs;
+	for (started = 0; started < nthreads; started++) {
+		if (pthread_create(&threads[started].tid, NULL,
+				quot_bulkstat_thread, &threads[started])) {
+			perror("pthread_create");
+			break;
+		}
+	}
+	if (!started)
+		quot_bulkstat_thread(&threads[0]);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i].tid, NULL);
+	for (i = 0; i < max(started, 1); i++)
+		quot_acct_merge(total, &threads[i].acct);
+	pthread_mutex_destroy(&qs.lock);
+
+	/* pack the merged tables into arrays for the report */
+	memcpy(sizes, total->sizes, sizeof(sizes));
+	overflow = total->overflow;
+	for (i = 0; i < 3; i++) {
+		du[i] = malloc(max(total->du[i].used, 1U) * sizeof(du_t));
+		if (!du[i]) {
+			perror("malloc");
+			break;
+		}
+		for (j = 0; j < total->du[i].size; j++)
+			if (total->du[i].slots[j].nfiles)
+				du[i][ndu[i]++] = total->du[i].slots[j];
+		dutab_free(&total->du[i]);
+	}
+out:
+	free(total);
+	free(threads);
+	close(qs.fsfd);
 }
 
 static int
@@ -214,13 +441,14 @@ quot_report_mount_any_type(
 	fs_path_t	*mount,
 	uint		flags)
 {
+	du_t		*end;
 	char		*cp;
 
 	fprintf(fp, _("%s (%s) %s:\n"),
 		mount->fs_name, mount->fs_dir, type_to_string(type));
 	qsort(dp, count, sizeof(dp[0]),
 		(int (*)(const void *, const void *))qcompare);
-	for (; dp < &dp[count]; dp++) {
+	for (end = dp + count; dp < end; dp++) {
 		if (dp->blocks == 0)
 			return;
 		fprintf(fp, "%8llu    ", (unsigned long long) dp->blocks);
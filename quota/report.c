@@ -73,19 +73,14 @@ report_help(void)
 }
 
 static void
-dump_file(
+dump_quota(
 	FILE		*fp,
-	uint		id,
-	uint		type,
+	__uint32_t	id,
+	fs_disk_quota_t	*dp,
 	char		*dev)
 {
-	fs_disk_quota_t	d;
+	fs_disk_quota_t	d = *dp;
 
-	if (xfsquotactl(XFS_GETQUOTA, dev, type, id, (void *)&d) < 0) {
-		if (errno != ENOENT && errno != ENOSYS && errno != ESRCH)
-			perror("XFS_GETQUOTA");
-		return;
-	}
 	if (!d.d_blk_softlimit && !d.d_blk_hardlimit &&
 	    !d.d_ino_softlimit && !d.d_ino_hardlimit &&
 	    !d.d_rtb_softlimit && !d.d_rtb_hardlimit)
@@ -108,6 +103,59 @@ dump_file(
 			(unsigned long long)d.d_ino_hardlimit);
 }
 
+static void
+dump_file(
+	FILE		*fp,
+	uint		id,
+	uint		type,
+	char		*dev)
+{
+	fs_disk_quota_t	d;
+
+	if (xfsquotactl(XFS_GETQUOTA, dev, type, id, (void *)&d) < 0) {
+		if (errno != ENOENT && errno != ENOSYS && errno != ESRCH)
+			perror("XFS_GETQUOTA");
+		return;
+	}
+	dump_quota(fp, id, &d, dev);
+}
+
+/*
+ * Ask for each dquot in turn from lower up to upper (or the last one)
+ * rather than trying every id.  Returns zero if the kernel can't, so
+ * the caller can fall back to going through the ids itself.
+ */
+static int
+dump_next_limits(
+	FILE		*fp,
+	uint		type,
+	char		*dev,
+	uint		lower,
+	uint		upper)
+{
+	fs_disk_quota_t	d;
+	__uint32_t	id = lower;
+	int		first = 1;
+
+	for (;;) {
+		if (xfsquotactl(XFS_GETNEXTQUOTA, dev, type, id,
+				(void *)&d) < 0) {
+			if (first && (errno == EINVAL || errno == ENOSYS))
+				return 0;
+			if (errno != ENOENT && errno != ESRCH)
+				perror("XFS_GETNEXTQUOTA");
+			return 1;
+		}
+		first = 0;
+		if (upper && d.d_id > upper)
+			return 1;
+		dump_quota(fp, d.d_id, &d, dev);
+		if (d.d_id == UINT_MAX)
+			return 1;
+		id = d.d_id + 1;
+	}
+}
+
 static void
 dump_limits_any_type(
 	FILE		*fp,
@@ -126,6 +174,9 @@ dump_limits_any_type(
 		return;
 	}
 
+	if (dump_next_limits(fp, type, mount->fs_name, lower, upper))
+		return;
+
 	if (upper) {
 		for (id = lower; id <= upper; id++)
 			dump_file(fp, id, type, mount->fs_name);
@@ -286,27 +337,20 @@ report_header(
 }
 
 static int
-report_mount(
+report_quota(
 	FILE		*fp,
-	__uint32_t	id,
+	fs_disk_quota_t	*dp,
 	char		*name,
 	uint		form,
 	uint		type,
 	fs_path_t	*mount,
 	uint		flags)
 {
-	fs_disk_quota_t	d;
-	char		*dev = mount->fs_name;
+	fs_disk_quota_t	d = *dp;
 	char		c[8], h[8], s[8];
 	uint		qflags;
 	int		count;
 
-	if (xfsquotactl(XFS_GETQUOTA, dev, type, id, (void *)&d) < 0) {
-		if (errno != ENOENT && errno != ENOSYS && errno != ESRCH)
-			perror("XFS_GETQUOTA");
-		return 0;
-	}
-
 	if (flags & TERSE_FLAG) {
 		count = 0;
 		if ((form & XFS_BLOCK_QUOTA) && d.d_bcount)
@@ -390,6 +434,77 @@ report_mount(
 	return 1;
 }
 
+static int
+report_mount(
+	FILE		*fp,
+	__uint32_t	id,
+	char		*name,
+	uint		form,
+	uint		type,
+	fs_path_t	*mount,
+	uint		flags)
+{
+	fs_disk_quota_t	d;
+	char		*dev = mount->fs_name;
+
+	if (xfsquotactl(XFS_GETQUOTA, dev, type, id, (void *)&d) < 0) {
+		if (errno != ENOENT && errno != ENOSYS && errno != ESRCH)
+			perror("XFS_GETQUOTA");
+		return 0;
+	}
+	return report_quota(fp, &d, name, form, type, mount, flags);
+}
+
+/*
+ * Report each dquot in turn from lower up to upper (or the last one),
+ * asking the kernel for the next one that exists rather than trying
+ * every id, and naming it through the id cache unless asked not to or
+ * given a range.  Returns zero if the kernel can't, so the caller can
+ * fall back to going through the ids itself.
+ */
+static int
+report_next_mount(
+	FILE		*fp,
+	uint		form,
+	uint		type,
+	fs_path_t	*mount,
+	uint		lower,
+	uint		upper,
+	uint		*flags,
+	char		*(*names)(__uint32_t))
+{
+	fs_disk_quota_t	d;
+	char		n[NMAX];
+	char		*name;
+	__uint32_t	id = lower;
+	int		first = 1;
+
+	for (;;) {
+		if (xfsquotactl(XFS_GETNEXTQUOTA, mount->fs_name, type, id,
+				(void *)&d) < 0) {
+			if (first && (errno == EINVAL || errno == ENOSYS))
+				return 0;
+			if (errno != ENOENT && errno != ESRCH)
+				perror("XFS_GETNEXTQUOTA");
+			return 1;
+		}
+		first = 0;
+		if (upper && d.d_id > upper)
+			return 1;
+		if (!upper && !(*flags & NO_LOOKUP_FLAG) &&
+		    (name = names(d.d_id)) != NULL)
+			strncpy(n, name, sizeof(n)-1);
+		else
+			snprintf(n, sizeof(n)-1, "#%u", d.d_id);
+		n[sizeof(n)-1] = '\0';
+		if (report_quota(fp, &d, n, form, type, mount, *flags))
+			*flags |= NO_HEADER_FLAG;
+		if (d.d_id == UINT_MAX)
+			return 1;
+		id = d.d_id + 1;
+	}
+}
+
 static void
 report_user_mount(
 	FILE		*fp,
@@ -403,6 +518,10 @@ report_user_mount(
 	char		n[NMAX];
 	uint		id;
 
+	if (report_next_mount(fp, form, XFS_USER_QUOTA, mount,
+				lower, upper, &flags, uid_to_name))
+		goto out;
+
 	if (upper) {	/* identifier range specified */
 		for (id = lower; id <= upper; id++) {
 			snprintf(n, sizeof(n)-1, "#%u", id);
@@ -424,6 +543,7 @@ report_user_mount(
 		endpwent();
 	}
 
+out:
 	if (flags & NO_HEADER_FLAG)
 		fputc('\n', fp);
 }
@@ -441,6 +561,10 @@ report_group_mount(
 	char		n[NMAX];
 	uint		id;
 
+	if (report_next_mount(fp, form, XFS_GROUP_QUOTA, mount,
+				lower, upper, &flags, gid_to_name))
+		goto out;
+
 	if (upper) {	/* identifier range specified */
 		for (id = lower; id <= upper; id++) {
 			snprintf(n, sizeof(n)-1, "#%u", id);
@@ -459,10 +583,12 @@ report_group_mount(
 					form, XFS_GROUP_QUOTA, mount, flags))
 				flags |= NO_HEADER_FLAG;
 		}
+		endgrent();
 	}
+
+out:
 	if (flags & NO_HEADER_FLAG)
 		fputc('\n', fp);
-	endgrent();
 }
 
 static void
@@ -478,6 +604,10 @@ report_project_mount(
 	char		n[NMAX];
 	uint		id;
 
+	if (report_next_mount(fp, form, XFS_PROJ_QUOTA, mount,
+				lower, upper, &flags, prid_to_name))
+		goto out;
+
 	if (upper) {	/* identifier range specified */
 		for (id = lower; id <= upper; id++) {
 			snprintf(n, sizeof(n)-1, "#%u", id);
@@ -500,6 +630,7 @@ report_project_mount(
 		endprent();
 	}
 
+out:
 	if (flags & NO_HEADER_FLAG)
 		fputc('\n', fp);
 }
@@ -220,30 +220,42 @@ type_to_string(
 
 /*
  * Identifier caches - user/group/project names/IDs
+ *
+ * The first lookup of a type reads its whole database into a hash table
+ * keyed by id, so a report over many ids costs one pass over it rather
+ * than a lookup per id.  Ids the database can't be asked to list are
+ * looked up by id the first time, and remembered whether or not they
+ * turn out to have a name.
  */
 
-#define NID		4096
-#define IDMASK		(NID-1)
-
 typedef struct {
 	__uint32_t	id;
 	char		name[NMAX+1];
-} idcache_t;
+} idname_t;
 
-static idcache_t	uidnc[NID];
-static idcache_t	gidnc[NID];
-static idcache_t	pidnc[NID];
-static int		uentriesleft = NID;
-static int		gentriesleft = NID;
-static int		pentriesleft = NID;
+typedef struct {
+	__uint32_t	id;
+	__uint32_t	used;
+	char		*name;		/* NULL if the id has none */
+} ident_t;
 
-static idcache_t *
+typedef struct {
+	ident_t		*ents;
+	__uint32_t	size;		/* a power of two */
+	__uint32_t	count;
+	int		loaded;
+	void		(*setent)(void);
+	idname_t	*(*getent)(__uint32_t id, int byid);
+	void		(*endent)(void);
+} idcache_t;
+
+static idname_t *
 getnextpwent(
 	__uint32_t	id,
 	int		byid)
 {
 	struct passwd	*pw;
-	static idcache_t idc;
+	static idname_t idc;
 
 	/* /etc/passwd */
 	if ((pw = byid? getpwuid(id) : getpwent()) == NULL)
@@ -253,13 +265,13 @@ getnextpwent(
 	return &idc;
 }
 
-static idcache_t *
+static idname_t *
 getnextgrent(
 	__uint32_t	id,
 	int		byid)
 {
 	struct group	*gr;
-	static idcache_t idc;
+	static idname_t idc;
 
 	if ((gr = byid? getgrgid(id) : getgrent()) == NULL)
 		return NULL;
@@ -268,13 +280,13 @@ getnextgrent(
 	return &idc;
 }
 
-static idcache_t *
+static idname_t *
 getnextprent(
 	__uint32_t	id,
 	int		byid)
 {
 	fs_project_t	*pr;
-	static idcache_t idc;
+	static idname_t idc;
 
 	if ((pr = byid? getprprid(id) : getprent()) == NULL)
 		return NULL;
@@ -283,115 +295,109 @@ getnextprent(
 	return &idc;
 }
 
-char *
-uid_to_name(
+static idcache_t	uidnc = { .setent = setpwent, .getent = getnextpwent,
+				  .endent = endpwent };
+static idcache_t	gidnc = { .setent = setgrent, .getent = getnextgrent,
+				  .endent = endgrent };
+static idcache_t	pidnc = { .setent = setprent, .getent = getnextprent,
+				  .endent = endprent };
+
+/* the entry for id, or the free one it would go in */
+static ident_t *
+idcache_slot(
+	idcache_t	*ic,
 	__uint32_t	id)
 {
-	idcache_t	*ncp, *idp;
-
-	/* Check cache for name first */
-	ncp = &uidnc[id & IDMASK];
-	if (ncp->id == id && ncp->name[0])
-		return ncp->name;
-	if (uentriesleft) {
-		/*
-		 * Fill this cache while seaching for a name.
-		 * This lets us run through the file serially.
-		 */
-		if (uentriesleft == NID)
-			setpwent();
-		while (((idp = getnextpwent(id, 0)) != NULL) && uentriesleft) {
-			uentriesleft--;
-			ncp = &uidnc[idp->id & IDMASK];
-			if (ncp->name[0] == '\0' || idp->id == id)
-				memcpy(ncp, idp, sizeof(idcache_t));
-			if (idp->id == id)
-				return ncp->name;
+	__uint32_t	h;
+	ident_t		*ent;
+
+	h = id * 2654435761U;
+	for (h ^= h >> 16; ; h++) {
+		ent = &ic->ents[h & (ic->size - 1)];
+		if (!ent->used || ent->id == id)
+			return ent;
+	}
+}
+
+/* the first name seen for an id wins, as it does for getpwuid */
+static ident_t *
+idcache_add(
+	idcache_t	*ic,
+	__uint32_t	id,
+	char		*name)
+{
+	ident_t		*old = ic->ents;
+	ident_t		*ent;
+	__uint32_t	oldsize = ic->size;
+	__uint32_t	i;
+
+	if ((ic->count + 1) * 4 > ic->size * 3) {
+		ic->size = oldsize ? oldsize * 2 : 256;
+		ic->ents = calloc(ic->size, sizeof(ident_t));
+		if (!ic->ents) {
+			perror("calloc");
+			exit(1);
 		}
-		endpwent();
-		uentriesleft = 0;
-		ncp = &uidnc[id & IDMASK];
+		for (i = 0; i < oldsize; i++)
+			if (old[i].used)
+				*idcache_slot(ic, old[i].id) = old[i];
+		free(old);
 	}
+	ent = idcache_slot(ic, id);
+	if (ent->used)
+		return ent;
+	ent->id = id;
+	ent->used = 1;
+	ent->name = name ? strdup(name) : NULL;
+	ic->count++;
+	return ent;
+}
 
-	/* Not cached - do it the slow way & insert into cache */
-	if ((idp = getnextpwent(id, 1)) == NULL)
-		return NULL;
-	memcpy(ncp, idp, sizeof(idcache_t));
-	return ncp->name;
+static char *
+id_to_name(
+	idcache_t	*ic,
+	__uint32_t	id)
+{
+	idname_t	*idp;
+	ident_t		*ent;
+
+	if (!ic->loaded) {
+		ic->loaded = 1;
+		ic->setent();
+		while ((idp = ic->getent(0, 0)) != NULL)
+			idcache_add(ic, idp->id, idp->name);
+		ic->endent();
+	}
+	if (ic->size) {
+		ent = idcache_slot(ic, id);
+		if (ent->used)
+			return ent->name;
+	}
+
+	/* Not listed - do it the slow way & insert into cache */
+	idp = ic->getent(id, 1);
+	return idcache_add(ic, id, idp ? idp->name : NULL)->name;
 }
 
 char *
-gid_to_name(
+uid_to_name(
 	__uint32_t	id)
 {
-	idcache_t	*ncp, *idp;
-
-	/* Check cache for name first */
-	ncp = &gidnc[id & IDMASK];
-	if (ncp->id == id && ncp->name[0])
-		return ncp->name;
-	if (gentriesleft) {
-		/*
-		 * Fill this cache while seaching for a name.
-		 * This lets us run through the file serially.
-		 */
-		if (gentriesleft == NID)
-			setgrent();
-		while (((idp = getnextgrent(id, 0)) != NULL) && gentriesleft) {
-			gentriesleft--;
-			ncp = &gidnc[idp->id & IDMASK];
-			if (ncp->name[0] == '\0' || idp->id == id)
-				memcpy(ncp, idp, sizeof(idcache_t));
-			if (idp->id == id)
-				return ncp->name;
-		}
-		endgrent();
-		gentriesleft = 0;
-		ncp = &gidnc[id & IDMASK];
-	}
+	return id_to_name(&uidnc, id);
+}
 
-	/* Not cached - do it the slow way & insert into cache */
-	if ((idp = getnextgrent(id, 1)) == NULL)
-		return NULL;
-	memcpy(ncp, idp, sizeof(idcache_t));
-	return ncp->name;
+char *
+gid_to_name(
+	__uint32_t	id)
+{
+	return id_to_name(&gidnc, id);
 }
 
 char *
 prid_to_name(
 	__uint32_t	id)
 {
-	idcache_t	*ncp, *idp;
-
-	/* Check cache for name first */
-	ncp = &pidnc[id & IDMASK];
-	if (ncp->id == id && ncp->name[0])
-		return ncp->name;
-	if (pentriesleft) {
-		/*
-		 * Fill this cache while seaching for a name.
-		 * This lets us run through the file serially.
-		 */
-		if (pentriesleft == NID)
-			setprent();
-		while (((idp = getnextprent(id, 0)) != NULL) && pentriesleft) {
-			pentriesleft--;
-			ncp = &pidnc[idp->id & IDMASK];
-			if (ncp->name[0] == '\0' || idp->id == id)
-				memcpy(ncp, idp, sizeof(idcache_t));
-			if (idp->id == id)
-				return ncp->name;
-		}
-		endprent();
-		pentriesleft = 0;
-		ncp = &pidnc[id & IDMASK];
-	}
-
-	/* Not cached - do it the slow way & insert into cache */
-	if ((idp = getnextprent(id, 1)) == NULL)
-		return NULL;
-	memcpy(ncp, idp, sizeof(idcache_t));
-	return ncp->name;
+	return id_to_name(&pidnc, id);
 }
 
 
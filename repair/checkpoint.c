@@ -0,0 +1,469 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <libxfs.h>
+#include <sys/mman.h>
+#include "globals.h"
+#include "incore.h"
+#include "err_protos.h"
+#include "checkpoint.h"
+
+struct xr_ckpt  {
+	/* writing */
+	FILE			*fp;
+	__uint32_t		crc;
+	__uint64_t		pos;
+	__uint64_t		sect_left;
+	int			error;
+
+	/* reading */
+	char			*base;
+	__uint64_t		size;
+	__uint64_t		off;
+	__uint64_t		sect_end;
+};
+
+/*
+ * the scalar repair state that phases 5-7 depend on
+ */
+typedef struct xr_ckpt_globals  {
+	__int32_t		fs_is_dirty;
+	__int32_t		primary_sb_modified;
+	__int32_t		bad_ino_btree;
+	__int32_t		clear_sunit;
+	__int32_t		need_root_inode;
+	__int32_t		need_root_dotdot;
+	__int32_t		need_rbmino;
+	__int32_t		need_rsumino;
+	__int32_t		lost_quotas;
+	__int32_t		have_uquotino;
+	__int32_t		have_gquotino;
+	__int32_t		have_pquotino;
+	__int32_t		lost_uquotino;
+	__int32_t		lost_gquotino;
+	__int32_t		lost_pquotino;
+	__int32_t		pad;
+	__uint64_t		sb_icount;
+	__uint64_t		sb_ifree;
+	__uint64_t		sb_fdblocks;
+	__uint64_t		sb_frextents;
+	xfs_sb_t		sb;		/* in-core superblock */
+} xr_ckpt_globals_t;
+
+static const char	ckpt_zero[8];
+
+#define	CKPT_PAD(x)	(((x) + 7) & ~(__uint64_t)7)
+
+/*
+ * writer side
+ */
+
+void
+ckpt_write(
+	xr_ckpt_t		*ck,
+	const void		*buf,
+	size_t			len)
+{
+	ASSERT(len <= ck->sect_left);
+	if (fwrite(buf, 1, len, ck->fp) != len)
+		ck->error = errno;
+	ck->crc = crc32c(ck->crc, buf, len);
+	ck->pos += len;
+	ck->sect_left -= len;
+}
+
+void
+ckpt_sect_begin(
+	xr_ckpt_t		*ck,
+	int			type,
+	__uint32_t		count,
+	__uint64_t		len)
+{
+	xr_ckpt_sect_t		sect;
+
+	ASSERT(ck->sect_left == 0);
+	memset(&sect, 0, sizeof(sect));
+	sect.cs_type = type;
+	sect.cs_count = count;
+	sect.cs_len = len;
+	ck->sect_left = sizeof(sect);
+	ckpt_write(ck, &sect, sizeof(sect));
+	ck->sect_left = len;
+}
+
+void
+ckpt_sect_end(
+	xr_ckpt_t		*ck)
+{
+	size_t			pad = CKPT_PAD(ck->pos) - ck->pos;
+
+	ASSERT(ck->sect_left == 0);
+	ck->sect_left = pad;
+	ckpt_write(ck, ckpt_zero, pad);
+}
+
+/*
+ * reader side.  the whole file has been checksummed before any section
+ * is looked at, so a malformed section means a bug, not a bad disk.
+ */
+
+const xr_ckpt_sect_t *
+ckpt_sect_next(
+	xr_ckpt_t		*ck,
+	int			type)
+{
+	const xr_ckpt_sect_t	*sect;
+
+	ck->off = CKPT_PAD(ck->off);
+	if (ck->off + sizeof(*sect) > ck->size)
+		do_error(_("checkpoint file %s is truncated\n"),
+			checkpoint_name);
+	sect = (const xr_ckpt_sect_t *)(ck->base + ck->off);
+	if (sect->cs_type != type)
+		do_error(
+	_("checkpoint file %s: expected section %d, found %u\n"),
+			checkpoint_name, type, sect->cs_type);
+	ck->off += sizeof(*sect);
+	if (sect->cs_len > ck->size - ck->off)
+		do_error(_("checkpoint file %s is truncated\n"),
+			checkpoint_name);
+	ck->sect_end = ck->off + sect->cs_len;
+	return sect;
+}
+
+const void *
+ckpt_read(
+	xr_ckpt_t		*ck,
+	size_t			len)
+{
+	const void		*p;
+
+	if (len > ck->sect_end - ck->off)
+		do_error(_("checkpoint file %s: section overrun\n"),
+			checkpoint_name);
+	p = ck->base + ck->off;
+	ck->off += len;
+	return p;
+}
+
+void
+ckpt_sect_done(
+	xr_ckpt_t		*ck)
+{
+	if (ck->off != ck->sect_end)
+		do_error(_("checkpoint file %s: section underrun\n"),
+			checkpoint_name);
+}
+
+/*
+ * The device generation is a checksum of the primary superblock and of
+ * the first log sector.  Repair zeroes the log in phase 2, so any mount
+ * after that writes to the start of the log.
+ */
+static __uint32_t
+ckpt_sector_crc(
+	struct xfs_buftarg	*btp,
+	xfs_daddr_t		daddr,
+	int			bblen)
+{
+	xfs_buf_t		*bp;
+	__uint32_t		crc = 0;
+
+	bp = libxfs_getbufr(btp, daddr, bblen);
+	if (!bp)
+		return 0;
+	if (!libxfs_readbufr(btp, daddr, bp, bblen, 0))
+		crc = crc32c(~0U, XFS_BUF_PTR(bp), BBTOB(bblen));
+	libxfs_putbufr(bp);
+	return crc;
+}
+
+static void
+ckpt_generation(
+	xfs_mount_t		*mp,
+	__uint32_t		*sb_crc,
+	__uint32_t		*log_crc)
+{
+	int			log_bbs = 1;
+
+	if (xfs_sb_version_hassector(&mp->m_sb))
+		log_bbs <<= mp->m_sb.sb_logsectlog - BBSHIFT;
+
+	*sb_crc = ckpt_sector_crc(mp->m_ddev_targp, XFS_SB_DADDR,
+				XFS_FSS_TO_BB(mp, 1));
+	*log_crc = ckpt_sector_crc(mp->m_logdev_targp,
+				XFS_FSB_TO_DADDR(mp, mp->m_sb.sb_logstart),
+				log_bbs);
+}
+
+static void
+save_globals(
+	xfs_mount_t		*mp,
+	xr_ckpt_t		*ck)
+{
+	xr_ckpt_globals_t	g;
+
+	memset(&g, 0, sizeof(g));
+	g.fs_is_dirty = fs_is_dirty;
+	g.primary_sb_modified = primary_sb_modified;
+	g.bad_ino_btree = bad_ino_btree;
+	g.clear_sunit = clear_sunit;
+	g.need_root_inode = need_root_inode;
+	g.need_root_dotdot = need_root_dotdot;
+	g.need_rbmino = need_rbmino;
+	g.need_rsumino = need_rsumino;
+	g.lost_quotas = lost_quotas;
+	g.have_uquotino = have_uquotino;
+	g.have_gquotino = have_gquotino;
+	g.have_pquotino = have_pquotino;
+	g.lost_uquotino = lost_uquotino;
+	g.lost_gquotino = lost_gquotino;
+	g.lost_pquotino = lost_pquotino;
+	g.sb_icount = sb_icount;
+	g.sb_ifree = sb_ifree;
+	g.sb_fdblocks = sb_fdblocks;
+	g.sb_frextents = sb_frextents;
+	g.sb = mp->m_sb;
+
+	ckpt_sect_begin(ck, XR_CKPT_GLOBALS, 1, sizeof(g));
+	ckpt_write(ck, &g, sizeof(g));
+	ckpt_sect_end(ck);
+}
+
+static void
+restore_globals(
+	xfs_mount_t		*mp,
+	xr_ckpt_t		*ck)
+{
+	const xr_ckpt_globals_t	*g;
+
+	ckpt_sect_next(ck, XR_CKPT_GLOBALS);
+	g = ckpt_read(ck, sizeof(*g));
+	ckpt_sect_done(ck);
+
+	fs_is_dirty = g->fs_is_dirty;
+	primary_sb_modified = g->primary_sb_modified;
+	bad_ino_btree = g->bad_ino_btree;
+	clear_sunit = g->clear_sunit;
+	need_root_inode = g->need_root_inode;
+	need_root_dotdot = g->need_root_dotdot;
+	need_rbmino = g->need_rbmino;
+	need_rsumino = g->need_rsumino;
+	lost_quotas = g->lost_quotas;
+	have_uquotino = g->have_uquotino;
+	have_gquotino = g->have_gquotino;
+	have_pquotino = g->have_pquotino;
+	lost_uquotino = g->lost_uquotino;
+	lost_gquotino = g->lost_gquotino;
+	lost_pquotino = g->lost_pquotino;
+	sb_icount = g->sb_icount;
+	sb_ifree = g->sb_ifree;
+	sb_fdblocks = g->sb_fdblocks;
+	sb_frextents = g->sb_frextents;
+	mp->m_sb = g->sb;
+}
+
+/*
+ * Write the in-core state at the end of the given phase.  The file is
+ * built under a temporary name and renamed over the old checkpoint once
+ * it is on stable storage, so an interruption here leaves the previous
+ * checkpoint intact.  Failing to write one is not fatal.
+ */
+void
+checkpoint_save(
+	xfs_mount_t		*mp,
+	int			phase)
+{
+	xr_ckpt_t		ck;
+	xr_ckpt_head_t		head;
+	char			*tmpname;
+	int			fd;
+
+	if (!checkpoint_name)
+		return;
+
+	/*
+	 * everything phases 1-4 changed must be on disk before the device
+	 * generation is sampled.  Purge rather than flush so the rest of this
+	 * run sees the same thing a resumed run would: directory blocks that
+	 * still carry BADFSINO tags fail their write verifier and are dropped
+	 * here just as they would be on cache eviction.
+	 */
+	libxfs_bcache_purge();
+
+	tmpname = malloc(strlen(checkpoint_name) + 5);
+	if (!tmpname)
+		do_error(_("couldn't allocate checkpoint file name\n"));
+	sprintf(tmpname, "%s.new", checkpoint_name);
+
+	memset(&ck, 0, sizeof(ck));
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0 || (ck.fp = fdopen(fd, "w")) == NULL) {
+		do_log(_("        - couldn't create checkpoint file %s: %s\n"),
+			tmpname, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		free(tmpname);
+		return;
+	}
+
+	memset(&head, 0, sizeof(head));
+	if (fwrite(&head, 1, sizeof(head), ck.fp) != sizeof(head))
+		ck.error = errno;
+	ck.crc = ~0U;
+
+	save_globals(mp, &ck);
+	save_bmaps(mp, &ck);
+	save_inode_trees(mp, &ck);
+	save_dir2_badlist(&ck);
+	ckpt_sect_begin(&ck, XR_CKPT_END, 0, 0);
+	ckpt_sect_end(&ck);
+
+	head.ch_magic = XR_CKPT_MAGIC;
+	head.ch_version = XR_CKPT_VERSION;
+	head.ch_phase = phase;
+	head.ch_flags = no_modify ? XR_CKPT_NO_MODIFY : 0;
+	platform_uuid_copy(&head.ch_uuid, &mp->m_sb.sb_uuid);
+	ckpt_generation(mp, &head.ch_sb_crc, &head.ch_log_crc);
+	head.ch_dblocks = mp->m_sb.sb_dblocks;
+	head.ch_agcount = mp->m_sb.sb_agcount;
+	head.ch_sbsize = sizeof(xfs_sb_t);
+	head.ch_size = sizeof(head) + ck.pos;
+	head.ch_crc = ck.crc;
+
+	if (fseek(ck.fp, 0, SEEK_SET) < 0 ||
+	    fwrite(&head, 1, sizeof(head), ck.fp) != sizeof(head))
+		ck.error = errno;
+	if (fflush(ck.fp) || fsync(fd) < 0)
+		ck.error = errno;
+	if (fclose(ck.fp))
+		ck.error = errno;
+
+	if (!ck.error && rename(tmpname, checkpoint_name) < 0)
+		ck.error = errno;
+	if (ck.error) {
+		do_log(_("        - couldn't write checkpoint file %s: %s\n"),
+			checkpoint_name, strerror(ck.error));
+		unlink(tmpname);
+	} else
+		do_log(_("        - saved state after phase %d to %s\n"),
+			phase, checkpoint_name);
+	free(tmpname);
+}
+
+/*
+ * Look for a checkpoint from an earlier run on this filesystem and load
+ * it into the freshly initialised in-core structures.  Returns the phase
+ * it was taken after, or 0 if there is nothing usable to resume from.
+ */
+int
+checkpoint_load(
+	xfs_mount_t		*mp)
+{
+	xr_ckpt_t		ck;
+	const xr_ckpt_head_t	*head;
+	struct stat64		st;
+	__uint32_t		sb_crc;
+	__uint32_t		log_crc;
+	char			*reason = NULL;
+	int			phase;
+	int			fd;
+
+	if (!checkpoint_name)
+		return 0;
+
+	fd = open(checkpoint_name, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			do_log(_("        - couldn't open checkpoint %s: %s\n"),
+				checkpoint_name, strerror(errno));
+		return 0;
+	}
+	if (fstat64(fd, &st) < 0 || st.st_size < sizeof(*head)) {
+		close(fd);
+		do_log(_("        - ignoring checkpoint %s: %s\n"),
+			checkpoint_name, _("file too short"));
+		return 0;
+	}
+
+	memset(&ck, 0, sizeof(ck));
+	ck.size = st.st_size;
+	ck.base = mmap(NULL, ck.size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ck.base == MAP_FAILED) {
+		do_log(_("        - couldn't map checkpoint %s: %s\n"),
+			checkpoint_name, strerror(errno));
+		return 0;
+	}
+	head = (const xr_ckpt_head_t *)ck.base;
+
+	if (head->ch_magic != XR_CKPT_MAGIC ||
+	    head->ch_version != XR_CKPT_VERSION ||
+	    head->ch_sbsize != sizeof(xfs_sb_t))
+		reason = _("unknown format");
+	else if (head->ch_size != ck.size ||
+		 crc32c(~0U, ck.base + sizeof(*head),
+			ck.size - sizeof(*head)) != head->ch_crc)
+		reason = _("bad checksum");
+	else if (platform_uuid_compare((uuid_t *)&head->ch_uuid,
+				       &mp->m_sb.sb_uuid) ||
+		 head->ch_dblocks != mp->m_sb.sb_dblocks ||
+		 head->ch_agcount != mp->m_sb.sb_agcount)
+		reason = _("different filesystem");
+	else if (!!(head->ch_flags & XR_CKPT_NO_MODIFY) != !!no_modify)
+		reason = no_modify ? _("written in modify mode") :
+				     _("written in no modify mode");
+	else if (head->ch_phase != 3 && head->ch_phase != 4)
+		reason = _("unknown phase");
+	else {
+		ckpt_generation(mp, &sb_crc, &log_crc);
+		if (sb_crc != head->ch_sb_crc || log_crc != head->ch_log_crc)
+			reason = _("filesystem changed since it was written");
+	}
+	if (reason) {
+		do_log(_("        - ignoring checkpoint %s: %s\n"),
+			checkpoint_name, reason);
+		munmap(ck.base, ck.size);
+		return 0;
+	}
+
+	phase = head->ch_phase;
+	ck.off = sizeof(*head);
+	restore_globals(mp, &ck);
+	restore_bmaps(mp, &ck);
+	restore_inode_trees(mp, &ck);
+	restore_dir2_badlist(&ck);
+	ckpt_sect_next(&ck, XR_CKPT_END);
+	ckpt_sect_done(&ck);
+	munmap(ck.base, ck.size);
+
+	do_log(_("        - resuming after phase %d from checkpoint %s\n"),
+		phase, checkpoint_name);
+	return phase;
+}
+
+/*
+ * the run completed, so the checkpoint no longer describes anything
+ */
+void
+checkpoint_remove(void)
+{
+	if (checkpoint_name && unlink(checkpoint_name) < 0 && errno != ENOENT)
+		do_log(_("couldn't remove checkpoint %s: %s\n"),
+			checkpoint_name, strerror(errno));
+}
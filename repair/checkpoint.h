@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _XFS_REPAIR_CHECKPOINT_H
+#define	_XFS_REPAIR_CHECKPOINT_H
+
+/*
+ * Checkpoint files hold the in-core state of a repair run at the end of
+ * phase 3 or 4, so that an interrupted run can pick up at the next phase.
+ *
+ * The file is a header followed by a sequence of sections, each a
+ * section header and a payload padded to 8 bytes.  Everything is in host
+ * byte order and laid out to be walked directly from an mmap of the file.
+ * The header ties the file to the filesystem UUID and to a generation
+ * made from checksums of the primary superblock and the head of the log,
+ * either of which changes if the filesystem is mounted in between.
+ */
+#define	XR_CKPT_MAGIC		0x58524350	/* XRCP */
+#define	XR_CKPT_VERSION		1
+
+#define	XR_CKPT_NO_MODIFY	0x1		/* written by a -n run */
+
+typedef struct xr_ckpt_head  {
+	__uint32_t		ch_magic;
+	__uint32_t		ch_version;
+	__uint32_t		ch_phase;	/* last completed phase */
+	__uint32_t		ch_flags;
+	uuid_t			ch_uuid;	/* filesystem uuid */
+	__uint32_t		ch_sb_crc;	/* device generation */
+	__uint32_t		ch_log_crc;
+	__uint64_t		ch_dblocks;
+	__uint32_t		ch_agcount;
+	__uint32_t		ch_sbsize;	/* sizeof(xfs_sb_t) */
+	__uint64_t		ch_size;	/* file size */
+	__uint32_t		ch_crc;		/* crc of everything after us */
+	__uint32_t		ch_pad;
+} xr_ckpt_head_t;
+
+#define	XR_CKPT_GLOBALS		1
+#define	XR_CKPT_BMAP		2
+#define	XR_CKPT_RTBMAP		3
+#define	XR_CKPT_INODES		4
+#define	XR_CKPT_BADDIRS		5
+#define	XR_CKPT_END		6
+
+typedef struct xr_ckpt_sect  {
+	__uint32_t		cs_type;
+	__uint32_t		cs_count;	/* number of records */
+	__uint64_t		cs_len;		/* payload bytes, unpadded */
+} xr_ckpt_sect_t;
+
+typedef struct xr_ckpt	xr_ckpt_t;
+
+/*
+ * writing a section: begin with the record count and payload length,
+ * then write exactly that many bytes.
+ */
+void		ckpt_sect_begin(xr_ckpt_t *ck, int type, __uint32_t count,
+				__uint64_t len);
+void		ckpt_write(xr_ckpt_t *ck, const void *buf, size_t len);
+void		ckpt_sect_end(xr_ckpt_t *ck);
+
+/*
+ * reading a section: returns the section header and leaves the cursor on
+ * the payload.  ckpt_read() returns a pointer into the mapped file.
+ */
+const xr_ckpt_sect_t *ckpt_sect_next(xr_ckpt_t *ck, int type);
+const void	*ckpt_read(xr_ckpt_t *ck, size_t len);
+void		ckpt_sect_done(xr_ckpt_t *ck);
+
+/*
+ * per-module state savers and loaders
+ */
+void		save_bmaps(xfs_mount_t *mp, xr_ckpt_t *ck);
+void		restore_bmaps(xfs_mount_t *mp, xr_ckpt_t *ck);
+void		save_inode_trees(xfs_mount_t *mp, xr_ckpt_t *ck);
+void		restore_inode_trees(xfs_mount_t *mp, xr_ckpt_t *ck);
+void		save_dir2_badlist(xr_ckpt_t *ck);
+void		restore_dir2_badlist(xr_ckpt_t *ck);
+
+int		checkpoint_load(xfs_mount_t *mp);
+void		checkpoint_save(xfs_mount_t *mp, int phase);
+void		checkpoint_remove(void);
+
+#endif /* _XFS_REPAIR_CHECKPOINT_H */
@@ -515,6 +515,52 @@ _("illegal state %d in rt block map %" PRIu64 "\n"),
 	return 0;
 }
 
+/*
+ * Phase 4 checks every extent of every inode against the duplicate extent
+ * trees.  Rather than searching for each record in turn, check the whole
+ * list in one sorted pass and return the index of the first record that
+ * claims a duplicate extent, or -1.  Collection stops at the first record
+ * with an invalid block range, as the caller never gets past it.
+ */
+static int
+find_dup_bmbt_rec(
+	xfs_mount_t		*mp,
+	xfs_bmbt_rec_t		*rp,
+	int			numrecs)
+{
+	xfs_bmbt_irec_t		irec;
+	dup_query_t		*queries;
+	dup_query_t		*q;
+	int			nqueries = 0;
+	int			dup;
+	int			i;
+
+	if (numrecs <= 0)
+		return -1;
+
+	queries = malloc(numrecs * sizeof(dup_query_t));
+	if (!queries)
+		do_error(_("couldn't allocate duplicate extent query list\n"));
+
+	for (i = 0; i < numrecs; i++) {
+		libxfs_bmbt_disk_get_all(rp + i, &irec);
+		if (irec.br_blockcount == 0 ||
+		    verify_dfsbno_range(mp, irec.br_startblock,
+				irec.br_blockcount) != XR_DFSBNORANGE_VALID)
+			break;
+
+		q = &queries[nqueries++];
+		q->dq_agno = XFS_FSB_TO_AGNO(mp, irec.br_startblock);
+		q->dq_start = XFS_FSB_TO_AGBNO(mp, irec.br_startblock);
+		q->dq_end = q->dq_start + irec.br_blockcount;
+		q->dq_index = i;
+	}
+
+	dup = search_dup_extents(queries, nqueries);
+	free(queries);
+	return dup;
+}
+
 /*
  * return 1 if inode should be cleared, 0 otherwise
  * if check_dups should be set to 1, that implies that
@@ -550,6 +596,7 @@ process_bmbt_reclist_int(
 	xfs_agblock_t		ebno;
 	xfs_extlen_t		blen;
 	xfs_agnumber_t		locked_agno = -1;
+	int			dup_rec = -1;
 	int			error = 1;
 
 	if (whichfork == XFS_DATA_FORK)
@@ -562,6 +609,10 @@ process_bmbt_reclist_int(
 	else
 		ftype = _("regular");
 
+	if (check_dups &&
+	    !(type == XR_INO_RTDATA && whichfork == XFS_DATA_FORK))
+		dup_rec = find_dup_bmbt_rec(mp, rp, *numrecs);
+
 	for (i = 0; i < *numrecs; i++) {
 		libxfs_bmbt_disk_get_all(rp + i, &irec);
 		if (i == 0)
@@ -691,9 +742,10 @@ _("Fatal error: inode %" PRIu64 " - blkmap_set_ext(): %s\n"
 			 * if we're just checking the bmap for dups,
 			 * return if we find one, otherwise, continue
 			 * checking each entry without setting the
-			 * block bitmap
+			 * block bitmap.  the lookups were all done up
+			 * front by find_dup_bmbt_rec().
 			 */
-			if (search_dup_extent(agno, agbno, ebno)) {
+			if (i == dup_rec) {
 				do_warn(
 _("%s fork in ino %" PRIu64 " claims dup extent, "
   "off - %" PRIu64 ", start - %" PRIu64 ", cnt %" PRIu64 "\n"),
@@ -26,6 +26,7 @@
 #include "bmap.h"
 #include "prefetch.h"
 #include "progress.h"
+#include "checkpoint.h"
 
 /*
  * Tag bad directory entries with this.
@@ -74,6 +75,39 @@ dir2_is_badino(
 	return 0;
 }
 
+void
+save_dir2_badlist(
+	xr_ckpt_t	*ck)
+{
+	dir2_bad_t	*l;
+	__uint32_t	cnt = 0;
+
+	for (l = dir2_bad_list; l; l = l->next)
+		cnt++;
+
+	ckpt_sect_begin(ck, XR_CKPT_BADDIRS, cnt, cnt * sizeof(xfs_ino_t));
+	for (l = dir2_bad_list; l; l = l->next)
+		ckpt_write(ck, &l->ino, sizeof(xfs_ino_t));
+	ckpt_sect_end(ck);
+}
+
+void
+restore_dir2_badlist(
+	xr_ckpt_t		*ck)
+{
+	const xr_ckpt_sect_t	*sect;
+	const xfs_ino_t		*inos;
+	__uint32_t		i;
+
+	sect = ckpt_sect_next(ck, XR_CKPT_BADDIRS);
+	inos = ckpt_read(ck, sect->cs_count * sizeof(xfs_ino_t));
+
+	/* saved head first, so add them back in reverse */
+	for (i = sect->cs_count; i > 0; i--)
+		dir2_add_badlist(inos[i - 1]);
+	ckpt_sect_done(ck);
+}
+
 /*
  * takes a name and length (name need not be null-terminated)
  * and returns 1 if the name contains a '/' or a \0, returns 0
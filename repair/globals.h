@@ -118,6 +118,7 @@ EXTERN char	*rt_name;		/* Name of realtime device */
 EXTERN int	rt_spec;		/* Realtime dev specified as option */
 EXTERN int	convert_lazy_count;	/* Convert lazy-count mode on/off */
 EXTERN int	lazy_count;		/* What to set if to if converting */
+EXTERN char	*checkpoint_name;	/* Checkpoint file to save/resume */
 
 /* misc status variables */
 
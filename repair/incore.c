@@ -25,6 +25,7 @@
 #include "protos.h"
 #include "err_protos.h"
 #include "threads.h"
+#include "checkpoint.h"
 
 /*
  * The following manages the in-core bitmap of the entire filesystem
@@ -319,3 +320,83 @@ free_bmaps(xfs_mount_t *mp)
 
 	free_rt_bmap(mp);
 }
+
+/*
+ * Checkpoint the block maps: for each ag the (start, state) pairs of the
+ * bmap btree in block order, then the realtime bitmap as it is.
+ */
+typedef struct bmap_ckpt_rec  {
+	__uint32_t		agbno;
+	__uint32_t		state;
+} bmap_ckpt_rec_t;
+
+void
+save_bmaps(
+	xfs_mount_t		*mp,
+	xr_ckpt_t		*ck)
+{
+	xfs_agnumber_t		agno;
+	bmap_ckpt_rec_t		rec;
+	unsigned long		key;
+	int			*statep;
+	__uint32_t		nrecs;
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		nrecs = 0;
+		statep = btree_find(ag_bmap[agno], 0, &key);
+		while (statep) {
+			nrecs++;
+			statep = btree_lookup_next(ag_bmap[agno], &key);
+		}
+
+		ckpt_sect_begin(ck, XR_CKPT_BMAP, nrecs,
+				nrecs * sizeof(bmap_ckpt_rec_t));
+		statep = btree_find(ag_bmap[agno], 0, &key);
+		while (statep) {
+			rec.agbno = key;
+			rec.state = statep - states;
+			ckpt_write(ck, &rec, sizeof(rec));
+			statep = btree_lookup_next(ag_bmap[agno], &key);
+		}
+		ckpt_sect_end(ck);
+	}
+
+	ckpt_sect_begin(ck, XR_CKPT_RTBMAP, 0, rt_bmap ? rt_bmap_size : 0);
+	if (rt_bmap)
+		ckpt_write(ck, rt_bmap, rt_bmap_size);
+	ckpt_sect_end(ck);
+}
+
+void
+restore_bmaps(
+	xfs_mount_t		*mp,
+	xr_ckpt_t		*ck)
+{
+	xfs_agnumber_t		agno;
+	const xr_ckpt_sect_t	*sect;
+	const bmap_ckpt_rec_t	*recs;
+	__uint32_t		i;
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		sect = ckpt_sect_next(ck, XR_CKPT_BMAP);
+		recs = ckpt_read(ck, sect->cs_count * sizeof(bmap_ckpt_rec_t));
+		ckpt_sect_done(ck);
+
+		btree_clear(ag_bmap[agno]);
+		for (i = 0; i < sect->cs_count; i++) {
+			if (recs[i].state >= sizeof(states) / sizeof(states[0]))
+				do_error(
+	_("bad state %u in checkpointed block map for ag %u\n"),
+					recs[i].state, agno);
+			btree_insert(ag_bmap[agno], recs[i].agbno,
+					&states[recs[i].state]);
+		}
+	}
+
+	sect = ckpt_sect_next(ck, XR_CKPT_RTBMAP);
+	if (sect->cs_len != (rt_bmap ? rt_bmap_size : 0))
+		do_error(_("checkpointed realtime block map has wrong size\n"));
+	if (rt_bmap)
+		memcpy(rt_bmap, ckpt_read(ck, rt_bmap_size), rt_bmap_size);
+	ckpt_sect_done(ck);
+}
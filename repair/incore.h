@@ -175,6 +175,18 @@ int		add_dup_extent(xfs_agnumber_t agno, xfs_agblock_t startblock,
 			xfs_extlen_t blockcount);
 int		search_dup_extent(xfs_agnumber_t agno,
 			xfs_agblock_t start_agbno, xfs_agblock_t end_agbno);
+
+/*
+ * one extent of a batch checked by search_dup_extents()
+ */
+typedef struct dup_query  {
+	xfs_agnumber_t		dq_agno;
+	xfs_agblock_t		dq_start;
+	xfs_agblock_t		dq_end;
+	int			dq_index;	/* caller's record number */
+} dup_query_t;
+
+int		search_dup_extents(dup_query_t *queries, int nqueries);
 void		add_rt_dup_extent(xfs_drtbno_t	startblock,
 				xfs_extlen_t	blockcount);
 
@@ -282,7 +294,8 @@ typedef struct ino_ex_data  {
 } ino_ex_data_t;
 
 typedef struct ino_tree_node  {
-	avlnode_t		avl_node;
+	struct ino_tree_node	*ino_next;	/* next record in agino order */
+	struct ino_tree_node	*ino_prev;	/* previous record */
 	xfs_agino_t		ino_startnum;	/* starting inode # */
 	xfs_inofree_t		ir_free;	/* inode free bit mask */
 	__uint64_t		ino_confirmed;	/* confirmed bitmask */
@@ -311,7 +324,51 @@ void		free_inode_rec(xfs_agnumber_t agno, ino_tree_node_t *ino_rec);
 void		get_inode_rec(struct xfs_mount *mp, xfs_agnumber_t agno,
 			      ino_tree_node_t *ino_rec);
 
-extern avltree_desc_t     **inode_tree_ptrs;
+/*
+ * Inode records are indexed per AG by a sparse two-level array keyed by
+ * agino >> ii_shift.  Every slot covered by a record points at it, so a
+ * lookup is two loads with no locking.  Records are also kept on a doubly
+ * linked list in agino order for the in-order walkers.
+ *
+ * ii_shift is log2 of the smallest possible spacing between chunk starts:
+ * 64 inodes, or one block's worth of inodes when a chunk spans several
+ * blocks and may start on any block boundary.
+ */
+#define INO_INDEX_LEAF_LOG	10
+#define INO_INDEX_LEAF_SLOTS	(1 << INO_INDEX_LEAF_LOG)
+
+typedef struct ino_index_leaf  {
+	struct ino_tree_node	*slots[INO_INDEX_LEAF_SLOTS];
+} ino_index_leaf_t;
+
+typedef struct ino_index  {
+	struct ino_tree_node	*ii_first;	/* lowest record */
+	struct ino_tree_node	*ii_last;	/* highest record */
+	ino_index_leaf_t	**ii_leaves;	/* allocated on first insert */
+	__uint32_t		ii_nleaves;
+	int			ii_shift;
+} ino_index_t;
+
+extern ino_index_t	*inode_tree_ptrs;
+
+static inline ino_tree_node_t *
+ino_index_lookup(ino_index_t *idx, xfs_agino_t ino)
+{
+	__uint32_t		slot = ino >> idx->ii_shift;
+	ino_index_leaf_t	*leaf;
+	ino_tree_node_t		*irec;
+
+	if (idx->ii_leaves == NULL ||
+	    (slot >> INO_INDEX_LEAF_LOG) >= idx->ii_nleaves)
+		return NULL;
+	leaf = idx->ii_leaves[slot >> INO_INDEX_LEAF_LOG];
+	if (leaf == NULL)
+		return NULL;
+	irec = leaf->slots[slot & (INO_INDEX_LEAF_SLOTS - 1)];
+	if (irec == NULL || ino - irec->ino_startnum >= XFS_INODES_PER_CHUNK)
+		return NULL;
+	return irec;
+}
 
 static inline int
 get_inode_offset(struct xfs_mount *mp, xfs_ino_t ino, ino_tree_node_t *irec)
@@ -321,7 +378,7 @@ get_inode_offset(struct xfs_mount *mp, xfs_ino_t ino, ino_tree_node_t *irec)
 static inline ino_tree_node_t *
 findfirst_inode_rec(xfs_agnumber_t agno)
 {
-	return((ino_tree_node_t *) inode_tree_ptrs[agno]->avl_firstino);
+	return inode_tree_ptrs[agno].ii_first;
 }
 static inline ino_tree_node_t *
 find_inode_rec(struct xfs_mount *mp, xfs_agnumber_t agno, xfs_agino_t ino)
@@ -331,8 +388,7 @@ find_inode_rec(struct xfs_mount *mp, xfs_agnumber_t agno, xfs_agino_t ino)
 	 */
 	if (agno >= mp->m_sb.sb_agcount)
 		return NULL;
-	return((ino_tree_node_t *)
-		avl_findrange(inode_tree_ptrs[agno], ino));
+	return ino_index_lookup(&inode_tree_ptrs[agno], ino);
 }
 void		find_inode_rec_range(struct xfs_mount *mp, xfs_agnumber_t agno,
 			xfs_agino_t start_ino, xfs_agino_t end_ino,
@@ -369,14 +425,7 @@ void			clear_uncertain_ino_cache(xfs_agnumber_t agno);
 /*
  * return next in-order inode tree node.  takes an "ino_tree_node_t *"
  */
-#define next_ino_rec(ino_node_ptr)	\
-		((ino_tree_node_t *) ((ino_node_ptr)->avl_node.avl_nextino))
-/*
- * return the next linked inode (forward avl tree link)-- meant to be used
- * by linked list routines (uncertain inode routines/records)
- */
-#define next_link_rec(ino_node_ptr)	\
-		((ino_tree_node_t *) ((ino_node_ptr)->avl_node.avl_forw))
+#define next_ino_rec(ino_node_ptr)	((ino_node_ptr)->ino_next)
 
 /*
  * Has an inode been processed for phase 6 (reference count checking)?
@@ -93,6 +93,25 @@ add_dup_extent(
 	return ret;
 }
 
+/*
+ * Look up an extent in a dup extent tree.  Leaves the tree cursor on the
+ * first duplicate starting at or after start_agbno, whose start is
+ * returned in *cur_agbno.
+ */
+static int
+__search_dup_extent(
+	struct btree_root	*tree,
+	xfs_agblock_t		start_agbno,
+	xfs_agblock_t		end_agbno,
+	unsigned long		*cur_agbno)
+{
+	if (!btree_find(tree, start_agbno, cur_agbno))
+		return 0;	/* this really shouldn't happen */
+	if (*cur_agbno < end_agbno)
+		return 1;
+	return (uintptr_t)btree_peek_prev(tree, NULL) > start_agbno;
+}
+
 int
 search_dup_extent(
 	xfs_agnumber_t		agno,
@@ -103,21 +122,90 @@ search_dup_extent(
 	int		ret;
 
 	pthread_mutex_lock(&dup_extent_tree_locks[agno]);
-	if (!btree_find(dup_extent_trees[agno], start_agbno, &bno)) {
-		ret = 0;
-		goto out;	/* this really shouldn't happen */
-	}
-	if (bno < end_agbno) {
-		ret = 1;
-		goto out;
-	}
-	ret = (uintptr_t)btree_peek_prev(dup_extent_trees[agno], NULL) >
-								start_agbno;
-out:
+	ret = __search_dup_extent(dup_extent_trees[agno], start_agbno,
+				end_agbno, &bno);
 	pthread_mutex_unlock(&dup_extent_tree_locks[agno]);
 	return ret;
 }
 
+static int
+dup_query_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const dup_query_t	*qa = a;
+	const dup_query_t	*qb = b;
+
+	if (qa->dq_agno != qb->dq_agno)
+		return qa->dq_agno < qb->dq_agno ? -1 : 1;
+	if (qa->dq_start != qb->dq_start)
+		return qa->dq_start < qb->dq_start ? -1 : 1;
+	return qa->dq_index - qb->dq_index;
+}
+
+/*
+ * Check a whole list of extents against the dup extent trees.  The list
+ * is sorted by AG and start block and swept in that order, so each AG
+ * lock is taken once and the tree cursor is stepped forward between
+ * neighbouring extents instead of searching down from the root for each
+ * one.  The list is reordered.
+ *
+ * Returns the lowest dq_index of an extent that overlaps a duplicate
+ * extent, or -1 if none do.
+ */
+int
+search_dup_extents(
+	dup_query_t		*queries,
+	int			nqueries)
+{
+	struct btree_root	*tree;
+	dup_query_t		*q;
+	xfs_agnumber_t		agno;
+	unsigned long		bno;
+	unsigned long		next_bno;
+	int			have_cursor;
+	int			first = -1;
+	int			i;
+	int			j;
+
+	for (i = 1; i < nqueries; i++)
+		if (dup_query_cmp(&queries[i - 1], &queries[i]) > 0)
+			break;
+	if (i < nqueries)
+		qsort(queries, nqueries, sizeof(dup_query_t), dup_query_cmp);
+
+	for (i = 0; i < nqueries; i = j)  {
+		agno = queries[i].dq_agno;
+		tree = dup_extent_trees[agno];
+		have_cursor = 0;
+		bno = 0;
+
+		pthread_mutex_lock(&dup_extent_tree_locks[agno]);
+		for (j = i; j < nqueries && queries[j].dq_agno == agno; j++)  {
+			q = &queries[j];
+			if (first >= 0 && q->dq_index > first)
+				continue;
+
+			/*
+			 * if this extent starts in the gap after the cursor,
+			 * step to the next duplicate so the lookup below is
+			 * answered from the cursor cache.
+			 */
+			if (have_cursor && q->dq_start > bno &&
+			    btree_peek_next(tree, &next_bno) &&
+			    q->dq_start <= next_bno)
+				btree_lookup_next(tree, &bno);
+
+			if (__search_dup_extent(tree, q->dq_start, q->dq_end,
+						&bno))
+				first = q->dq_index;
+			have_cursor = 1;
+		}
+		pthread_mutex_unlock(&dup_extent_tree_locks[agno]);
+	}
+	return first;
+}
+
 
 /*
  * extent tree stuff is avl trees of duplicate extents,
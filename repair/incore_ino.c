@@ -17,23 +17,23 @@
  */
 
 #include <libxfs.h>
-#include "avl.h"
 #include "globals.h"
 #include "incore.h"
 #include "agheader.h"
 #include "protos.h"
 #include "threads.h"
 #include "err_protos.h"
+#include "checkpoint.h"
 
 /*
- * array of inode tree ptrs, one per ag
+ * array of inode record indexes, one per ag
  */
-avltree_desc_t	**inode_tree_ptrs;
+ino_index_t	*inode_tree_ptrs;
 
 /*
  * ditto for uncertain inodes
  */
-static avltree_desc_t	**inode_uncertain_tree_ptrs;
+static ino_index_t	*inode_uncertain_tree_ptrs;
 
 /* memory optimised nlink counting for all inodes */
 
@@ -234,9 +234,8 @@ alloc_ino_node(
 	if (!irec)
 		do_error(_("inode map malloc failed\n"));
 
-	irec->avl_node.avl_nextino = NULL;
-	irec->avl_node.avl_forw = NULL;
-	irec->avl_node.avl_back = NULL;
+	irec->ino_next = NULL;
+	irec->ino_prev = NULL;
 
 	irec->ino_startnum = starting_ino;
 	irec->ino_confirmed = 0;
@@ -270,9 +269,8 @@ static void
 free_ino_tree_node(
 	struct ino_tree_node	*irec)
 {
-	irec->avl_node.avl_nextino = NULL;
-	irec->avl_node.avl_forw = NULL;
-	irec->avl_node.avl_back = NULL;
+	irec->ino_next = NULL;
+	irec->ino_prev = NULL;
 
 	free_nlink_array(irec->disk_nlinks, irec->nlink_size);
 	if (irec->ino_un.ex_data != NULL)  {
@@ -288,6 +286,152 @@ free_ino_tree_node(
 	free(irec);
 }
 
+/*
+ * Per-AG inode record index.  See the comment above ino_index_t.
+ */
+static void
+ino_index_init(ino_index_t *idx, struct xfs_mount *mp, int shift)
+{
+	__uint64_t	nslots;
+
+	nslots = ((__uint64_t)mp->m_sb.sb_agblocks << mp->m_sb.sb_inopblog) +
+			XFS_INODES_PER_CHUNK;
+	nslots = (nslots + (1ULL << shift) - 1) >> shift;
+
+	idx->ii_first = NULL;
+	idx->ii_last = NULL;
+	idx->ii_leaves = NULL;
+	idx->ii_nleaves = (nslots + INO_INDEX_LEAF_SLOTS - 1) >>
+				INO_INDEX_LEAF_LOG;
+	idx->ii_shift = shift;
+}
+
+static inline ino_tree_node_t **
+ino_index_slot(ino_index_t *idx, __uint32_t slot)
+{
+	ino_index_leaf_t	*leaf;
+
+	leaf = idx->ii_leaves[slot >> INO_INDEX_LEAF_LOG];
+	if (leaf == NULL)
+		return NULL;
+	return &leaf->slots[slot & (INO_INDEX_LEAF_SLOTS - 1)];
+}
+
+/*
+ * find the highest record that starts in a slot below the given one
+ */
+static ino_tree_node_t *
+ino_index_prev(ino_index_t *idx, __uint32_t slot)
+{
+	ino_tree_node_t		**slotp;
+
+	while (slot > 0)  {
+		slot--;
+		slotp = ino_index_slot(idx, slot);
+		if (slotp == NULL)  {
+			slot &= ~(INO_INDEX_LEAF_SLOTS - 1);
+			continue;
+		}
+		if (*slotp != NULL)
+			return *slotp;
+	}
+	return NULL;
+}
+
+/*
+ * Insert a record into the index.  Returns 0 if the record would overlap
+ * one already there or lies outside the AG, in which case the index is
+ * left untouched.
+ */
+static int
+ino_index_insert(ino_index_t *idx, ino_tree_node_t *irec)
+{
+	__uint32_t		first = irec->ino_startnum >> idx->ii_shift;
+	__uint32_t		last = (irec->ino_startnum +
+					XFS_INODES_PER_CHUNK - 1) >> idx->ii_shift;
+	__uint32_t		slot;
+	ino_tree_node_t		**slotp;
+	ino_tree_node_t		*prev;
+
+	if ((last >> INO_INDEX_LEAF_LOG) >= idx->ii_nleaves)
+		return 0;
+
+	if (idx->ii_leaves == NULL)  {
+		idx->ii_leaves = calloc(idx->ii_nleaves,
+					sizeof(ino_index_leaf_t *));
+		if (idx->ii_leaves == NULL)
+			do_error(_("couldn't malloc inode index\n"));
+	}
+
+	for (slot = first; slot <= last; slot++)  {
+		if (idx->ii_leaves[slot >> INO_INDEX_LEAF_LOG] == NULL)  {
+			idx->ii_leaves[slot >> INO_INDEX_LEAF_LOG] =
+					calloc(1, sizeof(ino_index_leaf_t));
+			if (idx->ii_leaves[slot >> INO_INDEX_LEAF_LOG] == NULL)
+				do_error(_("couldn't malloc inode index\n"));
+		}
+		if (*ino_index_slot(idx, slot) != NULL)
+			return 0;
+	}
+
+	/*
+	 * inodes are mostly added in ascending order, so try the tail
+	 * before searching backwards for the predecessor.
+	 */
+	if (idx->ii_last == NULL ||
+	    idx->ii_last->ino_startnum < irec->ino_startnum)
+		prev = idx->ii_last;
+	else
+		prev = ino_index_prev(idx, first);
+
+	irec->ino_prev = prev;
+	if (prev)  {
+		irec->ino_next = prev->ino_next;
+		prev->ino_next = irec;
+	} else  {
+		irec->ino_next = idx->ii_first;
+		idx->ii_first = irec;
+	}
+	if (irec->ino_next)
+		irec->ino_next->ino_prev = irec;
+	else
+		idx->ii_last = irec;
+
+	for (slot = first; slot <= last; slot++)  {
+		slotp = ino_index_slot(idx, slot);
+		*slotp = irec;
+	}
+	return 1;
+}
+
+static void
+ino_index_delete(ino_index_t *idx, ino_tree_node_t *irec)
+{
+	__uint32_t		first = irec->ino_startnum >> idx->ii_shift;
+	__uint32_t		last = (irec->ino_startnum +
+					XFS_INODES_PER_CHUNK - 1) >> idx->ii_shift;
+	__uint32_t		slot;
+	ino_tree_node_t		**slotp;
+
+	for (slot = first; slot <= last; slot++)  {
+		slotp = ino_index_slot(idx, slot);
+		ASSERT(slotp != NULL && *slotp == irec);
+		*slotp = NULL;
+	}
+
+	if (irec->ino_prev)
+		irec->ino_prev->ino_next = irec->ino_next;
+	else
+		idx->ii_first = irec->ino_next;
+	if (irec->ino_next)
+		irec->ino_next->ino_prev = irec->ino_prev;
+	else
+		idx->ii_last = irec->ino_prev;
+
+	irec->ino_next = NULL;
+	irec->ino_prev = NULL;
+}
+
 /*
  * last referenced cache for uncertain inodes
  */
@@ -331,13 +475,11 @@ add_aginode_uncertain(xfs_agnumber_t agno, xfs_agino_t ino, int free)
 	 * check to see if record containing inode is already in the tree.
 	 * if not, add it
 	 */
-	ino_rec = (ino_tree_node_t *)
-		avl_findrange(inode_uncertain_tree_ptrs[agno], s_ino);
+	ino_rec = ino_index_lookup(&inode_uncertain_tree_ptrs[agno], s_ino);
 	if (!ino_rec) {
 		ino_rec = alloc_ino_node(s_ino);
 
-		if (!avl_insert(inode_uncertain_tree_ptrs[agno],
-				&ino_rec->avl_node))
+		if (!ino_index_insert(&inode_uncertain_tree_ptrs[agno], ino_rec))
 			do_error(
 	_("add_aginode_uncertain - duplicate inode range\n"));
 	}
@@ -371,29 +513,23 @@ void
 get_uncertain_inode_rec(struct xfs_mount *mp, xfs_agnumber_t agno,
 			ino_tree_node_t *ino_rec)
 {
-	ASSERT(inode_tree_ptrs != NULL);
+	ASSERT(inode_uncertain_tree_ptrs != NULL);
 	ASSERT(agno < mp->m_sb.sb_agcount);
-	ASSERT(inode_tree_ptrs[agno] != NULL);
 
-	avl_delete(inode_uncertain_tree_ptrs[agno], &ino_rec->avl_node);
+	ino_index_delete(&inode_uncertain_tree_ptrs[agno], ino_rec);
 
-	ino_rec->avl_node.avl_nextino = NULL;
-	ino_rec->avl_node.avl_forw = NULL;
-	ino_rec->avl_node.avl_back = NULL;
 }
 
 ino_tree_node_t *
 findfirst_uncertain_inode_rec(xfs_agnumber_t agno)
 {
-	return((ino_tree_node_t *)
-		inode_uncertain_tree_ptrs[agno]->avl_firstino);
+	return inode_uncertain_tree_ptrs[agno].ii_first;
 }
 
 ino_tree_node_t *
 find_uncertain_inode_rec(xfs_agnumber_t agno, xfs_agino_t ino)
 {
-	return((ino_tree_node_t *)
-		avl_findrange(inode_uncertain_tree_ptrs[agno], ino));
+	return ino_index_lookup(&inode_uncertain_tree_ptrs[agno], ino);
 }
 
 void
@@ -404,7 +540,7 @@ clear_uncertain_ino_cache(xfs_agnumber_t agno)
 
 
 /*
- * Next comes the inode trees.  One per AG,  AVL trees of inode records, each
+ * Next comes the inode trees.  One index per AG of inode records, each
  * inode record tracking 64 inodes
  */
 
@@ -433,7 +569,7 @@ add_inode(
 	struct ino_tree_node	*irec;
 
 	irec = alloc_ino_node(agino);
-	if (!avl_insert(inode_tree_ptrs[agno],	&irec->avl_node))
+	if (!ino_index_insert(&inode_tree_ptrs[agno], irec))
 		do_warn(_("add_inode - duplicate inode range\n"));
 	return irec;
 }
@@ -446,13 +582,9 @@ get_inode_rec(struct xfs_mount *mp, xfs_agnumber_t agno, ino_tree_node_t *ino_re
 {
 	ASSERT(inode_tree_ptrs != NULL);
 	ASSERT(agno < mp->m_sb.sb_agcount);
-	ASSERT(inode_tree_ptrs[agno] != NULL);
 
-	avl_delete(inode_tree_ptrs[agno], &ino_rec->avl_node);
+	ino_index_delete(&inode_tree_ptrs[agno], ino_rec);
 
-	ino_rec->avl_node.avl_nextino = NULL;
-	ino_rec->avl_node.avl_forw = NULL;
-	ino_rec->avl_node.avl_back = NULL;
 }
 
 /*
@@ -470,14 +602,49 @@ find_inode_rec_range(struct xfs_mount *mp, xfs_agnumber_t agno,
 			xfs_agino_t start_ino, xfs_agino_t end_ino,
 			ino_tree_node_t **first, ino_tree_node_t **last)
 {
+	ino_index_t		*idx;
+	ino_tree_node_t		**slotp;
+	ino_tree_node_t		*irec = NULL;
+	__uint32_t		slot;
+	__uint32_t		end_slot;
+
 	*first = *last = NULL;
 
 	/*
 	 * Is the AG inside the file system ?
 	 */
-	if (agno < mp->m_sb.sb_agcount)
-		avl_findranges(inode_tree_ptrs[agno], start_ino,
-			end_ino, (avlnode_t **) first, (avlnode_t **) last);
+	if (agno >= mp->m_sb.sb_agcount || start_ino >= end_ino)
+		return;
+	idx = &inode_tree_ptrs[agno];
+	if (idx->ii_leaves == NULL)
+		return;
+
+	/*
+	 * find the first record overlapping the range, then walk the
+	 * ordered list for the last one starting before its end.
+	 */
+	end_slot = (end_ino - 1) >> idx->ii_shift;
+	if ((end_slot >> INO_INDEX_LEAF_LOG) >= idx->ii_nleaves)
+		end_slot = ((__uint64_t)idx->ii_nleaves << INO_INDEX_LEAF_LOG) - 1;
+	for (slot = start_ino >> idx->ii_shift; slot <= end_slot; slot++)  {
+		slotp = ino_index_slot(idx, slot);
+		if (slotp == NULL)  {
+			slot |= INO_INDEX_LEAF_SLOTS - 1;
+			continue;
+		}
+		irec = *slotp;
+		if (irec != NULL &&
+		    irec->ino_startnum + XFS_INODES_PER_CHUNK > start_ino)
+			break;
+		irec = NULL;
+	}
+	if (irec == NULL || irec->ino_startnum >= end_ino)
+		return;
+
+	*first = irec;
+	while (irec->ino_next && irec->ino_next->ino_startnum < end_ino)
+		irec = irec->ino_next;
+	*last = irec;
 }
 
 /*
@@ -749,51 +916,35 @@ add_ino_ex_data(xfs_mount_t *mp)
 	full_ino_ex_data = 1;
 }
 
-static __psunsigned_t
-avl_ino_start(avlnode_t *node)
-{
-	return((__psunsigned_t) ((ino_tree_node_t *) node)->ino_startnum);
-}
-
-static __psunsigned_t
-avl_ino_end(avlnode_t *node)
-{
-	return((__psunsigned_t) (
-		((ino_tree_node_t *) node)->ino_startnum +
-		XFS_INODES_PER_CHUNK));
-}
-
-avlops_t avl_ino_tree_ops = {
-	avl_ino_start,
-	avl_ino_end
-};
-
 void
 incore_ino_init(xfs_mount_t *mp)
 {
 	int i;
 	int agcount = mp->m_sb.sb_agcount;
+	int shift;
 
 	if ((inode_tree_ptrs = malloc(agcount *
-					sizeof(avltree_desc_t *))) == NULL)
+					sizeof(ino_index_t))) == NULL)
 		do_error(_("couldn't malloc inode tree descriptor table\n"));
 	if ((inode_uncertain_tree_ptrs = malloc(agcount *
-					sizeof(avltree_desc_t *))) == NULL)
+					sizeof(ino_index_t))) == NULL)
 		do_error(
 		_("couldn't malloc uncertain ino tree descriptor table\n"));
 
+	/*
+	 * chunks on filesystems with aligned inodes start on a 64-inode
+	 * boundary, otherwise multi-block chunks can start on any block
+	 * boundary.  uncertain records are always 64-inode aligned.
+	 */
+	if (xfs_sb_version_hasalign(&mp->m_sb) &&
+	    mp->m_sb.sb_inoalignmt >= XFS_IALLOC_BLOCKS(mp))
+		shift = XFS_INODES_PER_CHUNK_LOG;
+	else
+		shift = MIN(mp->m_sb.sb_inopblog, XFS_INODES_PER_CHUNK_LOG);
 	for (i = 0; i < agcount; i++)  {
-		if ((inode_tree_ptrs[i] =
-				malloc(sizeof(avltree_desc_t))) == NULL)
-			do_error(_("couldn't malloc inode tree descriptor\n"));
-		if ((inode_uncertain_tree_ptrs[i] =
-				malloc(sizeof(avltree_desc_t))) == NULL)
-			do_error(
-			_("couldn't malloc uncertain ino tree descriptor\n"));
-	}
-	for (i = 0; i < agcount; i++)  {
-		avl_init_tree(inode_tree_ptrs[i], &avl_ino_tree_ops);
-		avl_init_tree(inode_uncertain_tree_ptrs[i], &avl_ino_tree_ops);
+		ino_index_init(&inode_tree_ptrs[i], mp, shift);
+		ino_index_init(&inode_uncertain_tree_ptrs[i], mp,
+				XFS_INODES_PER_CHUNK_LOG);
 	}
 
 	if ((last_rec = malloc(sizeof(ino_tree_node_t *) * agcount)) == NULL)
@@ -803,3 +954,159 @@ incore_ino_init(xfs_mount_t *mp)
 
 	full_ino_ex_data = 0;
 }
+
+/*
+ * Checkpoint the inode trees, one section per ag.  Each record is the
+ * fixed part below followed by the on-disk nlink array and, if pmask is
+ * set, one parent inode number per bit.  The trees only carry parent
+ * lists (not ex_data) at the phases we checkpoint.
+ */
+typedef struct ino_ckpt_rec  {
+	__uint32_t		startnum;
+	__uint32_t		nlink_size;
+	__uint64_t		ir_free;
+	__uint64_t		confirmed;
+	__uint64_t		isa_dir;
+	__uint64_t		pmask;
+} ino_ckpt_rec_t;
+
+static int
+count_parents(
+	__uint64_t		pmask)
+{
+	int			cnt = 0;
+
+	for (; pmask; pmask &= pmask - 1)
+		cnt++;
+	return cnt;
+}
+
+static __uint64_t
+irec_ckpt_size(
+	ino_tree_node_t		*irec)
+{
+	__uint64_t		len;
+
+	len = sizeof(ino_ckpt_rec_t) + XFS_INODES_PER_CHUNK * irec->nlink_size;
+	if (irec->ino_un.plist)
+		len += count_parents(irec->ino_un.plist->pmask) *
+				sizeof(parent_entry_t);
+	return len;
+}
+
+void
+save_inode_trees(
+	xfs_mount_t		*mp,
+	xr_ckpt_t		*ck)
+{
+	xfs_agnumber_t		agno;
+	ino_tree_node_t		*irec;
+	ino_ckpt_rec_t		rec;
+	__uint64_t		len;
+	__uint32_t		nrecs;
+
+	ASSERT(!full_ino_ex_data);
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		nrecs = 0;
+		len = 0;
+		for (irec = findfirst_inode_rec(agno); irec;
+		     irec = next_ino_rec(irec)) {
+			nrecs++;
+			len += irec_ckpt_size(irec);
+		}
+
+		ckpt_sect_begin(ck, XR_CKPT_INODES, nrecs, len);
+		for (irec = findfirst_inode_rec(agno); irec;
+		     irec = next_ino_rec(irec)) {
+			memset(&rec, 0, sizeof(rec));
+			rec.startnum = irec->ino_startnum;
+			rec.nlink_size = irec->nlink_size;
+			rec.ir_free = irec->ir_free;
+			rec.confirmed = irec->ino_confirmed;
+			rec.isa_dir = irec->ino_isa_dir;
+			if (irec->ino_un.plist)
+				rec.pmask = irec->ino_un.plist->pmask;
+			ckpt_write(ck, &rec, sizeof(rec));
+			ckpt_write(ck, irec->disk_nlinks.un8,
+				XFS_INODES_PER_CHUNK * irec->nlink_size);
+			if (rec.pmask)
+				ckpt_write(ck, irec->ino_un.plist->pentries,
+					count_parents(rec.pmask) *
+						sizeof(parent_entry_t));
+		}
+		ckpt_sect_end(ck);
+	}
+}
+
+void
+restore_inode_trees(
+	xfs_mount_t		*mp,
+	xr_ckpt_t		*ck)
+{
+	xfs_agnumber_t		agno;
+	const xr_ckpt_sect_t	*sect;
+	const ino_ckpt_rec_t	*rec;
+	ino_tree_node_t		*irec;
+	parent_list_t		*ptbl;
+	__uint32_t		i;
+	int			cnt;
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		ASSERT(inode_tree_ptrs[agno].ii_first == NULL);
+
+		sect = ckpt_sect_next(ck, XR_CKPT_INODES);
+		for (i = 0; i < sect->cs_count; i++) {
+			rec = ckpt_read(ck, sizeof(*rec));
+			if (rec->nlink_size != sizeof(__uint8_t) &&
+			    rec->nlink_size != sizeof(__uint16_t) &&
+			    rec->nlink_size != sizeof(__uint32_t))
+				do_error(
+	_("bad nlink size %u in checkpointed inode record %u/%u\n"),
+					rec->nlink_size, agno, rec->startnum);
+
+			irec = alloc_ino_node(rec->startnum);
+			irec->ir_free = rec->ir_free;
+			irec->ino_confirmed = rec->confirmed;
+			irec->ino_isa_dir = rec->isa_dir;
+			if (rec->nlink_size != irec->nlink_size) {
+				free_nlink_array(irec->disk_nlinks,
+						irec->nlink_size);
+				irec->nlink_size = rec->nlink_size;
+				irec->disk_nlinks.un8 =
+					alloc_nlink_array(irec->nlink_size);
+			}
+			memcpy(irec->disk_nlinks.un8,
+				ckpt_read(ck, XFS_INODES_PER_CHUNK *
+						irec->nlink_size),
+				XFS_INODES_PER_CHUNK * irec->nlink_size);
+
+			if (rec->pmask) {
+				cnt = count_parents(rec->pmask);
+				ptbl = malloc(sizeof(parent_list_t));
+				if (!ptbl)
+					do_error(
+				_("couldn't malloc parent list table\n"));
+				ptbl->pmask = rec->pmask;
+				ptbl->pentries = memalign(sizeof(xfs_ino_t),
+						cnt * sizeof(parent_entry_t));
+				if (!ptbl->pentries)
+					do_error(
+				_("couldn't memalign pentries table\n"));
+				memcpy(ptbl->pentries,
+					ckpt_read(ck, cnt * sizeof(parent_entry_t)),
+					cnt * sizeof(parent_entry_t));
+#ifdef DEBUG
+				ptbl->cnt = cnt;
+#endif
+				irec->ino_un.plist = ptbl;
+			}
+
+			if (!ino_index_insert(&inode_tree_ptrs[agno], irec))
+				do_error(
+	_("overlapping checkpointed inode record %u/%u\n"),
+					agno, rec->startnum);
+		}
+		ckpt_sect_done(ck);
+	}
+}
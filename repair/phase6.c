@@ -76,31 +76,51 @@ add_dotdot_update(
  * Data structures and routines to keep track of directory entries
  * and whether their leaf entry has been seen. Also used for name
  * duplicate checking and rebuilding step if required.
+ *
+ * Entries live in a flat array in the order they were added, and are
+ * found by address and by name hash through two open-addressed tables
+ * of indices into that array.  A single table is reused for every
+ * directory: slots are only valid if they carry the current generation,
+ * so resetting it between directories is just a generation bump.
  */
 typedef struct dir_hash_ent {
-	struct dir_hash_ent	*nextbyaddr;	/* next in addr bucket */
-	struct dir_hash_ent	*nextbyhash;	/* next in name bucket */
-	struct dir_hash_ent	*nextbyorder;	/* next in order added */
-	xfs_dahash_t		hashval;	/* hash value of name */
-	__uint32_t		address;	/* offset of data entry */
 	xfs_ino_t 		inum;		/* inode num of entry */
-	short			junkit;		/* name starts with / */
-	short			seen;		/* have seen leaf entry */
+	__uint32_t		address;	/* offset of data entry */
+	xfs_dahash_t		hashval;	/* hash value of name */
 	struct xfs_name		name;
+	char			junkit;		/* name starts with / */
+	char			seen;		/* have seen leaf entry */
 } dir_hash_ent_t;
 
+typedef struct dir_hash_slot {
+	__uint32_t		gen;		/* slot used if == table gen */
+	__uint32_t		ent;		/* index of entry */
+} dir_hash_slot_t;
+
 typedef struct dir_hash_tab {
-	int			size;		/* size of hash tables */
-	int			names_duped;	/* 1 = ent names malloced */
-	dir_hash_ent_t		*first;		/* ptr to first added entry */
-	dir_hash_ent_t		*last;		/* ptr to last added entry */
-	dir_hash_ent_t		**byhash;	/* ptr to name hash buckets */
-	dir_hash_ent_t		**byaddr;	/* ptr to addr hash buckets */
+	__uint32_t		gen;		/* current generation */
+	__uint32_t		mask;		/* slots in each table - 1 */
+	int			nents;		/* entries added */
+	int			maxents;	/* size of entry arena */
+	int			names_duped;	/* 1 = ent names copied */
+	dir_hash_ent_t		*ents;		/* entries, in order added */
+	dir_hash_slot_t		*byhash;	/* name hash slots */
+	dir_hash_slot_t		*byaddr;	/* addr hash slots */
+	unsigned char		*names;		/* copied names */
+	size_t			namesize;	/* size of name arena */
+	int			nbatch;		/* names in current block */
+	int			maxbatch;	/* size of batch arrays */
+	const __uint8_t		**bnames;	/* names to hash together */
+	int			*blens;		/* their lengths */
+	xfs_dahash_t		*bhashes;	/* and their hash values */
 } dir_hash_tab_t;
 
-#define	DIR_HASH_TAB_SIZE(n)	\
-	(sizeof(dir_hash_tab_t) + (sizeof(dir_hash_ent_t *) * (n) * 2))
-#define	DIR_HASH_FUNC(t,a)	((a) % (t)->size)
+static dir_hash_tab_t	dir_hash_table;
+
+#define	DIR_HASH_MINSLOTS	64
+#define	DIR_HASH_SLOT(t,v)	\
+	((__uint32_t)(((__uint64_t)(v) * 0x9e3779b97f4a7c15ULL) >> 32) & (t)->mask)
+#define	DIR_HASH_USED(t,s)	((s)->gen == (t)->gen)
 
 /*
  * Track the contents of the freespace table in a directory.
@@ -124,8 +144,67 @@ typedef struct freetab {
 #define	DIR_HASH_CK_BADSTALE	5
 #define	DIR_HASH_CK_TOTAL	6
 
+static dir_hash_slot_t *
+dir_hash_slots(
+	size_t			nslots)
+{
+	dir_hash_slot_t		*slots;
+
+	if ((slots = calloc(nslots, sizeof(*slots))) == NULL)
+		do_error(_("calloc failed in dir_hash_slots (%zu bytes)\n"),
+			nslots * sizeof(*slots));
+	return slots;
+}
+
+static void
+dir_hash_insert(
+	dir_hash_tab_t		*hashtab,
+	dir_hash_slot_t		*table,
+	__uint32_t		key,
+	int			ent)
+{
+	__uint32_t		i;
+
+	for (i = DIR_HASH_SLOT(hashtab, key);
+	     DIR_HASH_USED(hashtab, &table[i]);
+	     i = (i + 1) & hashtab->mask)
+		;
+	table[i].gen = hashtab->gen;
+	table[i].ent = ent;
+}
+
 /*
- * Returns 0 if the name already exists (ie. a duplicate)
+ * Double the slot tables once they are three quarters full, so that
+ * probe sequences stay short even when the directory size was a poor
+ * guess at the number of entries.
+ */
+static void
+dir_hash_grow(
+	dir_hash_tab_t		*hashtab)
+{
+	dir_hash_ent_t		*p;
+	size_t			nslots;
+	int			i;
+
+	nslots = ((size_t)hashtab->mask + 1) * 2;
+	free(hashtab->byhash);
+	free(hashtab->byaddr);
+	hashtab->byhash = dir_hash_slots(nslots);
+	hashtab->byaddr = dir_hash_slots(nslots);
+	hashtab->mask = nslots - 1;
+	hashtab->gen = 1;
+
+	for (i = 0, p = hashtab->ents; i < hashtab->nents; i++, p++) {
+		dir_hash_insert(hashtab, hashtab->byaddr, p->address, i);
+		if (!p->junkit)
+			dir_hash_insert(hashtab, hashtab->byhash, p->hashval, i);
+	}
+}
+
+/*
+ * Returns 0 if the name already exists (ie. a duplicate).  The hash
+ * value of the name is looked up in the current batch if it is there,
+ * else computed here.
  */
 static int
 dir_hash_add(
@@ -134,15 +213,16 @@ dir_hash_add(
 	__uint32_t		addr,
 	xfs_ino_t		inum,
 	int			namelen,
-	unsigned char		*name)
+	unsigned char		*name,
+	int			batchidx)
 {
 	xfs_dahash_t		hash = 0;
-	int			byaddr;
-	int			byhash = 0;
 	dir_hash_ent_t		*p;
+	dir_hash_slot_t		*slot;
 	int			dup;
 	short			junk;
 	struct xfs_name		xname;
+	__uint32_t		i;
 
 	ASSERT(!hashtab->names_duped);
 
@@ -150,17 +230,34 @@ dir_hash_add(
 	xname.len = namelen;
 
 	junk = name[0] == '/';
-	byaddr = DIR_HASH_FUNC(hashtab, addr);
 	dup = 0;
 
+	if (hashtab->nents >= hashtab->maxents) {
+		hashtab->maxents *= 2;
+		hashtab->ents = realloc(hashtab->ents,
+				hashtab->maxents * sizeof(dir_hash_ent_t));
+		if (!hashtab->ents)
+			do_error(
+		_("realloc failed in dir_hash_add (%zu bytes)\n"),
+				hashtab->maxents * sizeof(dir_hash_ent_t));
+	}
+	if (hashtab->nents + 1 > (hashtab->mask + 1) / 4 * 3)
+		dir_hash_grow(hashtab);
+
 	if (!junk) {
-		hash = mp->m_dirnameops->hashname(&xname);
-		byhash = DIR_HASH_FUNC(hashtab, hash);
+		if (batchidx >= 0 && batchidx < hashtab->nbatch &&
+		    hashtab->bnames[batchidx] == name)
+			hash = hashtab->bhashes[batchidx];
+		else
+			hash = mp->m_dirnameops->hashname(&xname);
 
 		/*
-		 * search hash bucket for existing name.
+		 * search hash slots for existing name.
 		 */
-		for (p = hashtab->byhash[byhash]; p; p = p->nextbyhash) {
+		for (i = DIR_HASH_SLOT(hashtab, hash);
+		     DIR_HASH_USED(hashtab, &hashtab->byhash[i]);
+		     i = (i + 1) & hashtab->mask) {
+			p = &hashtab->ents[hashtab->byhash[i].ent];
 			if (p->hashval == hash && p->name.len == namelen) {
 				if (memcmp(p->name.name, name, namelen) == 0) {
 					dup = 1;
@@ -169,26 +266,19 @@ dir_hash_add(
 				}
 			}
 		}
+		if (!dup) {
+			slot = &hashtab->byhash[i];
+			slot->gen = hashtab->gen;
+			slot->ent = hashtab->nents;
+		}
 	}
 
-	if ((p = malloc(sizeof(*p))) == NULL)
-		do_error(_("malloc failed in dir_hash_add (%zu bytes)\n"),
-			sizeof(*p));
-
-	p->nextbyaddr = hashtab->byaddr[byaddr];
-	hashtab->byaddr[byaddr] = p;
-	if (hashtab->last)
-		hashtab->last->nextbyorder = p;
-	else
-		hashtab->first = p;
-	p->nextbyorder = NULL;
-	hashtab->last = p;
+	p = &hashtab->ents[hashtab->nents];
+	dir_hash_insert(hashtab, hashtab->byaddr, addr, hashtab->nents);
+	hashtab->nents++;
 
-	if (!(p->junkit = junk)) {
-		p->hashval = hash;
-		p->nextbyhash = hashtab->byhash[byhash];
-		hashtab->byhash[byhash] = p;
-	}
+	p->junkit = junk;
+	p->hashval = hash;
 	p->address = addr;
 	p->inum = inum;
 	p->seen = 0;
@@ -197,6 +287,93 @@ dir_hash_add(
 	return !dup;
 }
 
+/*
+ * Start collecting the names of a directory block so that they can be
+ * hashed together by dir_hash_batch_hash.  Only the default name hash
+ * can be batched; with any other the batch stays empty.
+ */
+static void
+dir_hash_batch_start(
+	xfs_mount_t		*mp,
+	dir_hash_tab_t		*hashtab)
+{
+	int			n;
+
+	hashtab->nbatch = 0;
+	n = mp->m_dirblksize / XFS_DIR2_DATA_ALIGN;
+	if (n <= hashtab->maxbatch)
+		return;
+
+	free(hashtab->bnames);
+	free(hashtab->blens);
+	free(hashtab->bhashes);
+	hashtab->bnames = malloc(n * sizeof(*hashtab->bnames));
+	hashtab->blens = malloc(n * sizeof(*hashtab->blens));
+	hashtab->bhashes = malloc(n * sizeof(*hashtab->bhashes));
+	if (!hashtab->bnames || !hashtab->blens || !hashtab->bhashes)
+		do_error(_("malloc failed in dir_hash_batch_start\n"));
+	hashtab->maxbatch = n;
+}
+
+static void
+dir_hash_batch_add(
+	dir_hash_tab_t		*hashtab,
+	int			namelen,
+	unsigned char		*name)
+{
+	if (hashtab->nbatch >= hashtab->maxbatch)
+		return;
+	hashtab->bnames[hashtab->nbatch] = name;
+	hashtab->blens[hashtab->nbatch] = namelen;
+	hashtab->nbatch++;
+}
+
+static void
+dir_hash_batch_hash(
+	xfs_mount_t		*mp,
+	dir_hash_tab_t		*hashtab)
+{
+	if (mp->m_dirnameops != &xfs_default_nameops) {
+		hashtab->nbatch = 0;
+		return;
+	}
+	libxfs_da_hashname_batch(hashtab->bnames, hashtab->blens,
+				 hashtab->bhashes, hashtab->nbatch);
+}
+
+#ifdef DEBUG
+/*
+ * Check the batch hash against xfs_da_hashname on random names of every
+ * length, so every tail length after the eight and four byte steps, and
+ * at every alignment within an eight byte word.
+ */
+static void
+dir_hash_batch_check(void)
+{
+	__uint8_t		buf[MAXNAMELEN + 8];
+	const __uint8_t		*names[8];
+	int			lens[8];
+	xfs_dahash_t		hashes[8];
+	int			len;
+	int			i;
+
+	for (len = 1; len <= MAXNAMELEN; len++) {
+		for (i = 0; i < sizeof(buf); i++)
+			buf[i] = random();
+		for (i = 0; i < 8; i++) {
+			names[i] = buf + i;
+			lens[i] = len;
+		}
+		libxfs_da_hashname_batch(names, lens, hashes, 8);
+		for (i = 0; i < 8; i++) {
+			if (hashes[i] != libxfs_da_hashname(names[i], len))
+				do_error(
+	_("batch name hash mismatch, length %d offset %d\n"), len, i);
+		}
+	}
+}
+#endif
+
 /*
  * checks to see if any data entries are not in the leaf blocks
  */
@@ -205,13 +382,10 @@ dir_hash_unseen(
 	dir_hash_tab_t	*hashtab)
 {
 	int		i;
-	dir_hash_ent_t	*p;
 
-	for (i = 0; i < hashtab->size; i++) {
-		for (p = hashtab->byaddr[i]; p; p = p->nextbyaddr) {
-			if (p->seen == 0)
-				return 1;
-		}
+	for (i = 0; i < hashtab->nents; i++) {
+		if (hashtab->ents[i].seen == 0)
+			return 1;
 	}
 	return 0;
 }
@@ -248,58 +422,100 @@ dir_hash_check(
 	return 1;
 }
 
+/*
+ * Forget all the entries of the current directory.  Nothing is freed,
+ * the arenas and slot tables are kept for the next directory.
+ */
 static void
 dir_hash_done(
 	dir_hash_tab_t	*hashtab)
 {
-	int		i;
-	dir_hash_ent_t	*n;
-	dir_hash_ent_t	*p;
-
-	for (i = 0; i < hashtab->size; i++) {
-		for (p = hashtab->byaddr[i]; p; p = n) {
-			n = p->nextbyaddr;
-			if (hashtab->names_duped)
-				free((void *)p->name.name);
-			free(p);
-		}
+	hashtab->nents = 0;
+	hashtab->names_duped = 0;
+	hashtab->nbatch = 0;
+	if (++hashtab->gen == 0) {
+		memset(hashtab->byhash, 0,
+			((size_t)hashtab->mask + 1) * sizeof(dir_hash_slot_t));
+		memset(hashtab->byaddr, 0,
+			((size_t)hashtab->mask + 1) * sizeof(dir_hash_slot_t));
+		hashtab->gen = 1;
 	}
-	free(hashtab);
 }
 
+/*
+ * Set up the hash table for a directory of the given size.  Data
+ * entries take at least 16 bytes, but most are over twice that, so
+ * size the arena for size / 32 entries and keep the slot tables at
+ * most half full; both grow if that turns out to be too small.
+ */
 static dir_hash_tab_t *
 dir_hash_init(
 	xfs_fsize_t	size)
 {
-	dir_hash_tab_t	*hashtab;
-	int		hsize;
-
-	hsize = size / (16 * 4);
-	if (hsize > 65536)
-		hsize = 63336;
-	else if (hsize < 16)
-		hsize = 16;
-	if ((hashtab = calloc(DIR_HASH_TAB_SIZE(hsize), 1)) == NULL)
-		do_error(_("calloc failed in dir_hash_init\n"));
-	hashtab->size = hsize;
-	hashtab->byhash = (dir_hash_ent_t**)((char *)hashtab +
-		sizeof(dir_hash_tab_t));
-	hashtab->byaddr = (dir_hash_ent_t**)((char *)hashtab +
-		sizeof(dir_hash_tab_t) + sizeof(dir_hash_ent_t*) * hsize);
+	dir_hash_tab_t	*hashtab = &dir_hash_table;
+	size_t		nents;
+	size_t		nslots;
+
+	ASSERT(hashtab->nents == 0);
+
+	nents = size / 32;
+	if (nents < DIR_HASH_MINSLOTS / 2)
+		nents = DIR_HASH_MINSLOTS / 2;
+	else if (nents > (1 << 24))
+		nents = 1 << 24;
+
+	if (nents > hashtab->maxents) {
+		free(hashtab->ents);
+		hashtab->ents = malloc(nents * sizeof(dir_hash_ent_t));
+		if (!hashtab->ents)
+			do_error(_("malloc failed in dir_hash_init\n"));
+		hashtab->maxents = nents;
+	}
+
+	for (nslots = DIR_HASH_MINSLOTS; nslots < nents * 2; nslots *= 2)
+		;
+	if (!hashtab->byhash || nslots > (size_t)hashtab->mask + 1) {
+		free(hashtab->byhash);
+		free(hashtab->byaddr);
+		hashtab->byhash = dir_hash_slots(nslots);
+		hashtab->byaddr = dir_hash_slots(nslots);
+		hashtab->mask = nslots - 1;
+		hashtab->gen = 1;
+	}
 	return hashtab;
 }
 
+/*
+ * Release the memory held by the table once all directories are done.
+ */
+static void
+dir_hash_release(void)
+{
+	dir_hash_tab_t	*hashtab = &dir_hash_table;
+
+	free(hashtab->ents);
+	free(hashtab->byhash);
+	free(hashtab->byaddr);
+	free(hashtab->names);
+	free(hashtab->bnames);
+	free(hashtab->blens);
+	free(hashtab->bhashes);
+	memset(hashtab, 0, sizeof(*hashtab));
+}
+
 static int
 dir_hash_see(
 	dir_hash_tab_t		*hashtab,
 	xfs_dahash_t		hash,
 	xfs_dir2_dataptr_t	addr)
 {
-	int			i;
+	__uint32_t		i;
 	dir_hash_ent_t		*p;
 
-	i = DIR_HASH_FUNC(hashtab, addr);
-	for (p = hashtab->byaddr[i]; p; p = p->nextbyaddr) {
+	for (i = DIR_HASH_SLOT(hashtab, addr);
+	     DIR_HASH_USED(hashtab, &hashtab->byaddr[i]);
+	     i = (i + 1) & hashtab->mask) {
+		p = &hashtab->ents[hashtab->byaddr[i].ent];
 		if (p->address != addr)
 			continue;
 		if (p->seen)
@@ -341,7 +557,7 @@ dir_hash_see_all(
 }
 
 /*
- * Convert name pointers into locally allocated memory.
+ * Copy the names out of the directory buffers into the name arena.
  * This must only be done after all the entries have been added.
  */
 static void
@@ -349,14 +565,27 @@ dir_hash_dup_names(dir_hash_tab_t *hashtab)
 {
 	unsigned char		*name;
 	dir_hash_ent_t		*p;
+	size_t			len;
+	int			i;
 
 	if (hashtab->names_duped)
 		return;
 
-	for (p = hashtab->first; p; p = p->nextbyorder) {
-		name = malloc(p->name.len);
+	for (i = 0, len = 0; i < hashtab->nents; i++)
+		len += hashtab->ents[i].name.len;
+	if (len > hashtab->namesize) {
+		free(hashtab->names);
+		if ((hashtab->names = malloc(len)) == NULL)
+			do_error(
+		_("malloc failed in dir_hash_dup_names (%zu bytes)\n"), len);
+		hashtab->namesize = len;
+	}
+
+	name = hashtab->names;
+	for (i = 0, p = hashtab->ents; i < hashtab->nents; i++, p++) {
 		memcpy(name, p->name.name, p->name.len);
 		p->name.name = name;
+		name += p->name.len;
 	}
 	hashtab->names_duped = 1;
 }
@@ -1246,6 +1475,7 @@ longform_dir2_rebuild(
 	dir_hash_ent_t		*p;
 	int			committed;
 	int			done;
+	int			i;
 
 	/*
 	 * trash directory completely and rebuild from scratch using the
@@ -1297,7 +1527,7 @@ longform_dir2_rebuild(
 
 	/* go through the hash list and re-add the inodes */
 
-	for (p = hashtab->first; p; p = p->nextbyorder) {
+	for (i = 0, p = hashtab->ents; i < hashtab->nents; i++, p++) {
 
 		if (p->name.name[0] == '/' || (p->name.name[0] == '.' &&
 				(p->name.len == 1 || (p->name.len == 2 &&
@@ -1433,6 +1663,7 @@ longform_dir2_entry_check_data(
 	int			lastfree;
 	int			len;
 	int			nbad;
+	int			nent;
 	int			needlog;
 	int			needscan;
 	xfs_ino_t		parent;
@@ -1484,6 +1715,7 @@ longform_dir2_entry_check_data(
 	}
 
 	/* check the data block */
+	dir_hash_batch_start(mp, hashtab);
 	while (ptr < endptr) {
 
 		/* check for freespace */
@@ -1523,6 +1755,7 @@ longform_dir2_entry_check_data(
 		if (be16_to_cpu(*xfs_dir3_data_entry_tag_p(mp, dep)) !=
 						(char *)dep - (char *)d)
 			break;
+		dir_hash_batch_add(hashtab, dep->namelen, dep->name);
 		ptr += xfs_dir3_data_entsize(mp, dep->namelen);
 	}
 
@@ -1549,6 +1782,10 @@ longform_dir2_entry_check_data(
 		return;
 	}
 
+	/* hash all the names in the block up front */
+	dir_hash_batch_hash(mp, hashtab);
+	nent = 0;
+
 	/* update number of data blocks processed */
 	if (freetab->nents < db + 1)
 		freetab->nents = db + 1;
@@ -1615,6 +1852,7 @@ longform_dir2_entry_check_data(
 		ptr += xfs_dir3_data_entsize(mp, dep->namelen);
 		inum = be64_to_cpu(dep->inumber);
 		lastfree = 0;
+		nent++;
 		/*
 		 * skip bogus entries (leading '/').  they'll be deleted
 		 * later.  must still log it, else we leak references to
@@ -1689,7 +1927,7 @@ longform_dir2_entry_check_data(
 		 * check for duplicate names in directory.
 		 */
 		if (!dir_hash_add(mp, hashtab, addr, inum, dep->namelen,
-							dep->name)) {
+							dep->name, nent - 1)) {
 			nbad++;
 			if (entry_junked(
 	_("entry \"%s\" (ino %" PRIu64 ") in dir %" PRIu64 " is a duplicate name"),
@@ -2381,7 +2619,7 @@ shortform_dir2_entry_check(xfs_mount_t	*mp,
 		 */
 		if (!dir_hash_add(mp, hashtab, (xfs_dir2_dataptr_t)
 				(sfep - xfs_dir2_sf_firstentry(sfp)),
-				lino, sfep->namelen, sfep->name)) {
+				lino, sfep->namelen, sfep->name, -1)) {
 			do_warn(
 _("entry \"%s\" (ino %" PRIu64 ") in dir %" PRIu64 " is a duplicate name"),
 				fname, lino, ino);
@@ -2960,6 +3198,10 @@ phase6(xfs_mount_t *mp)
 
 	do_log(_("Phase 6 - check inode connectivity...\n"));
 
+#ifdef DEBUG
+	dir_hash_batch_check();
+#endif
+
 	incore_ext_teardown(mp);
 
 	add_ino_ex_data(mp);
@@ -3039,6 +3281,7 @@ _("        - resetting contents of realtime bitmap and summary inodes\n"));
 	 * any directories that had updated ".." entries, rebuild them now
 	 */
 	update_missing_dotdot_entries(mp);
+	dir_hash_release();
 
 	do_log(_("        - traversal finished ...\n"));
 	do_log(_("        - moving disconnected inodes to %s ...\n"),
@@ -384,8 +384,10 @@ timestamp(int end, int phase, char *buf)
 	time_t    now;
 	struct tm *tmp;
 
-	if (verbose > 1)
+	if (verbose > 1) {
 		cache_report(stderr, "libxfs_bcache", libxfs_bcache);
+		kmem_zone_report(stderr);
+	}
 
 	now = time(NULL);
 
@@ -70,4 +70,8 @@ scan_ags(
 	struct xfs_mount	*mp,
 	int			scan_threads);
 
+void
+set_mp(
+	struct xfs_mount	*mpp);
+
 #endif /* _XR_SCAN_H */
@@ -29,6 +29,8 @@
 #include "prefetch.h"
 #include "threads.h"
 #include "progress.h"
+#include "scan.h"
+#include "checkpoint.h"
 
 #define	rounddown(x, y)	(((x)/(y))*(y))
 
@@ -56,6 +58,8 @@ static char *o_opts[] = {
 	"force_geometry",
 #define PHASE2_THREADS	6
 	"phase2_threads",
+#define CHECKPOINT	7
+	"checkpoint",
 	NULL
 };
 
@@ -261,6 +265,14 @@ process_args(int argc, char **argv)
 				case PHASE2_THREADS:
 					phase2_threads = (int)strtol(val, NULL, 0);
 					break;
+				case CHECKPOINT:
+					if (!val)
+						do_abort(
+		_("-o checkpoint requires a file name\n"));
+					if (checkpoint_name)
+						respec('o', o_opts, CHECKPOINT);
+					checkpoint_name = val;
+					break;
 				default:
 					unknown('o', val);
 					break;
@@ -528,6 +540,7 @@ main(int argc, char **argv)
 	xfs_buf_t	*sbp;
 	xfs_mount_t	xfs_m;
 	char		*msgbuf;
+	int		resume_phase;
 
 	progname = basename(argv[0]);
 	setlocale(LC_ALL, "");
@@ -750,23 +763,45 @@ main(int argc, char **argv)
 		return(1);
 	}
 
+	/*
+	 * pick up the in-core state of an interrupted run, if we were given
+	 * a checkpoint that still matches the filesystem
+	 */
+	resume_phase = checkpoint_load(mp);
+
 	/* make sure the per-ag freespace maps are ok so we can mount the fs */
-	phase2(mp, phase2_threads);
-	timestamp(PHASE_END, 2, NULL);
+	if (!resume_phase) {
+		phase2(mp, phase2_threads);
+		timestamp(PHASE_END, 2, NULL);
+	} else
+		set_mp(mp);	/* normally done by phase 2 */
 
 	if (do_prefetch)
 		init_prefetch(mp);
 
-	phase3(mp);
-	timestamp(PHASE_END, 3, NULL);
+	if (resume_phase < 3) {
+		phase3(mp);
+		timestamp(PHASE_END, 3, NULL);
+		checkpoint_save(mp, 3);
+	}
 
-	phase4(mp);
-	timestamp(PHASE_END, 4, NULL);
+	if (resume_phase < 4) {
+		phase4(mp);
+		timestamp(PHASE_END, 4, NULL);
+		checkpoint_save(mp, 4);
+	}
 
 	if (no_modify)
 		printf(_("No modify flag set, skipping phase 5\n"));
 	else {
 		phase5(mp);
+
+		/*
+		 * phase 5 only rebuilds the ag headers from the in-core
+		 * maps and can be rerun, but phases 6 and 7 rewrite inodes
+		 * the checkpoint describes.
+		 */
+		checkpoint_remove();
 	}
 	timestamp(PHASE_END, 5, NULL);
 
@@ -843,6 +878,8 @@ _("Warning:  project quota information would be cleared.\n"
 	if (ag_stride && report_interval)
 		stop_progress_rpt();
 
+	checkpoint_remove();
+
 	if (no_modify)  {
 		do_log(
 	_("No modify flag set, skipping filesystem flush and exiting.\n"));